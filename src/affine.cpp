@@ -0,0 +1,90 @@
+#include "affine.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DRAWSVG_AFFINE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace CMU462 {
+
+bool Affine2D::fromMatrix( const Matrix3x3& m, Affine2D& affine ) {
+
+  if ( m(2,0) != 0 || m(2,1) != 0 || m(2,2) == 0 ) return false;
+
+  double w = 1.0 / m(2,2);
+  affine = Affine2D( m(0,0) * w, m(1,0) * w,
+                     m(0,1) * w, m(1,1) * w,
+                     m(0,2) * w, m(1,2) * w );
+  return true;
+}
+
+Matrix3x3 Affine2D::toMatrix( void ) const {
+
+  Matrix3x3 m;
+  m(0,0) = a; m(0,1) = c; m(0,2) = e;
+  m(1,0) = b; m(1,1) = d; m(1,2) = f;
+  m(2,0) = 0; m(2,1) = 0; m(2,2) = 1;
+  return m;
+}
+
+void transform_points( const Affine2D& m, const float* in, float* out,
+                       size_t n ) {
+
+  size_t i = 0;
+
+#ifdef DRAWSVG_AFFINE_SSE2
+
+  // two points per register: (x0, y0, x1, y1)
+  const __m128 col0 = _mm_setr_ps( m.a, m.b, m.a, m.b );
+  const __m128 col1 = _mm_setr_ps( m.c, m.d, m.c, m.d );
+  const __m128 trans = _mm_setr_ps( m.e, m.f, m.e, m.f );
+
+  for ( ; i + 2 <= n; i += 2 ) {
+    __m128 p  = _mm_loadu_ps( in + 2 * i );
+    __m128 xx = _mm_shuffle_ps( p, p, _MM_SHUFFLE( 2, 2, 0, 0 ) );
+    __m128 yy = _mm_shuffle_ps( p, p, _MM_SHUFFLE( 3, 3, 1, 1 ) );
+    __m128 r  = _mm_add_ps( _mm_add_ps( _mm_mul_ps( col0, xx ),
+                                        _mm_mul_ps( col1, yy ) ), trans );
+    _mm_storeu_ps( out + 2 * i, r );
+  }
+
+#endif
+
+  for ( ; i < n; ++i ) {
+    float x = in[2 * i], y = in[2 * i + 1];
+    out[2 * i    ] = (float) ( m.a * x + m.c * y + m.e );
+    out[2 * i + 1] = (float) ( m.b * x + m.d * y + m.f );
+  }
+}
+
+void transform_points( const Affine2D& m, const Vector2D* in, float* out,
+                       size_t n ) {
+
+  size_t i = 0;
+
+#ifdef DRAWSVG_AFFINE_SSE2
+
+  // one point per register: (x, y), computed in double, stored as float
+  const __m128d col0 = _mm_setr_pd( m.a, m.b );
+  const __m128d col1 = _mm_setr_pd( m.c, m.d );
+  const __m128d trans = _mm_setr_pd( m.e, m.f );
+
+  for ( ; i < n; ++i ) {
+    __m128d p  = _mm_loadu_pd( &in[i].x );
+    __m128d xx = _mm_unpacklo_pd( p, p );
+    __m128d yy = _mm_unpackhi_pd( p, p );
+    __m128d r  = _mm_add_pd( _mm_add_pd( _mm_mul_pd( col0, xx ),
+                                         _mm_mul_pd( col1, yy ) ), trans );
+    _mm_storel_pi( (__m64*) ( out + 2 * i ), _mm_cvtpd_ps( r ) );
+  }
+
+#endif
+
+  for ( ; i < n; ++i ) {
+    out[2 * i    ] = (float) ( m.a * in[i].x + m.c * in[i].y + m.e );
+    out[2 * i + 1] = (float) ( m.b * in[i].x + m.d * in[i].y + m.f );
+  }
+}
+
+} // namespace CMU462
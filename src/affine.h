@@ -0,0 +1,87 @@
+#ifndef CMU462_AFFINE_H
+#define CMU462_AFFINE_H
+
+#include <stddef.h>
+
+#include "CMU462.h"
+#include "vector2D.h"
+#include "matrix3x3.h"
+
+namespace CMU462 {
+
+/**
+ * Defines a 2D affine transformation, stored as the top two rows of a
+ * 3x3 matrix. The coefficients follow the SVG matrix(a b c d e f) order:
+ *
+ *   | a c e |
+ *   | b d f |
+ *
+ * Every transformation an SVG document can express is affine, so this is
+ * a cheaper alternative to a full projective Matrix3x3.
+ */
+class Affine2D {
+ public:
+
+  // Components.
+  double a, b, c, d, e, f;
+
+  /**
+   * Constructor.
+   * Initializes to the identity transformation.
+   */
+  Affine2D() : a( 1 ), b( 0 ), c( 0 ), d( 1 ), e( 0 ), f( 0 ) { }
+
+  /**
+   * Constructor.
+   * Initializes from components in SVG matrix(a b c d e f) order.
+   */
+  Affine2D( double a, double b, double c, double d, double e, double f )
+    : a( a ), b( b ), c( c ), d( d ), e( e ), f( f ) { }
+
+  /**
+   * Converts a projective matrix to an equivalent affine transformation.
+   * Matrices with a bottom row of (0, 0, w) are affine after dividing by w,
+   * which also covers the uniform scale ViewportImp stores in (2,2).
+   * \return false if the matrix is truly projective.
+   */
+  static bool fromMatrix( const Matrix3x3& m, Affine2D& affine );
+
+  /**
+   * Returns the equivalent projective matrix.
+   */
+  Matrix3x3 toMatrix( void ) const;
+
+  // composition, applies rhs first
+  inline Affine2D operator*( const Affine2D& rhs ) const {
+    return Affine2D( a * rhs.a + c * rhs.b,
+                     b * rhs.a + d * rhs.b,
+                     a * rhs.c + c * rhs.d,
+                     b * rhs.c + d * rhs.d,
+                     a * rhs.e + c * rhs.f + e,
+                     b * rhs.e + d * rhs.f + f );
+  }
+
+  // point transformation
+  inline Vector2D operator*( const Vector2D& p ) const {
+    return Vector2D( a * p.x + c * p.y + e, b * p.x + d * p.y + f );
+  }
+
+}; // class Affine2D
+
+/**
+ * Transforms n points stored as interleaved x,y floats. in and out may
+ * alias. Uses SSE when available.
+ */
+void transform_points( const Affine2D& m, const float* in, float* out,
+                       size_t n );
+
+/**
+ * Transforms n points and writes them as interleaved x,y floats.
+ * Uses SSE2 when available.
+ */
+void transform_points( const Affine2D& m, const Vector2D* in, float* out,
+                       size_t n );
+
+} // namespace CMU462
+
+#endif // CMU462_AFFINE_H
@@ -0,0 +1,171 @@
+#include "base64_decoder.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DRAWSVG_BASE64_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CMU462 {
+
+// character classes below the 6 bit values
+static const signed char kSpace   = -1;
+static const signed char kPadding = -2;
+static const signed char kInvalid = -3;
+
+struct DecodeTable {
+
+  signed char values[256];
+
+  DecodeTable() {
+    for ( int i = 0; i < 256; ++i ) values[i] = kInvalid;
+    for ( int i = 0; i < 26; ++i ) {
+      values['A' + i] = i;
+      values['a' + i] = 26 + i;
+    }
+    for ( int i = 0; i < 10; ++i ) values['0' + i] = 52 + i;
+    values['+'] = 62;
+    values['/'] = 63;
+    values['='] = kPadding;
+    values[' '] = values['\t'] = values['\n'] = values['\r'] = kSpace;
+    values['\f'] = values['\v'] = kSpace;
+  }
+
+};
+
+static const DecodeTable kTable;
+
+#ifdef DRAWSVG_BASE64_SSE2
+
+// decode 16 characters into 12 bytes. False (and nothing written) if any
+// of them is not a base64 digit, those are left to the scalar path
+static inline bool decode_block( const char* p, unsigned char* out ) {
+
+  __m128i c = _mm_loadu_si128( (const __m128i*) p );
+
+  // bytes above 127 compare as negative and fall in no range
+  __m128i upper = _mm_and_si128( _mm_cmpgt_epi8( c, _mm_set1_epi8( 'A' - 1 ) ),
+                                 _mm_cmplt_epi8( c, _mm_set1_epi8( 'Z' + 1 ) ) );
+  __m128i lower = _mm_and_si128( _mm_cmpgt_epi8( c, _mm_set1_epi8( 'a' - 1 ) ),
+                                 _mm_cmplt_epi8( c, _mm_set1_epi8( 'z' + 1 ) ) );
+  __m128i digit = _mm_and_si128( _mm_cmpgt_epi8( c, _mm_set1_epi8( '0' - 1 ) ),
+                                 _mm_cmplt_epi8( c, _mm_set1_epi8( '9' + 1 ) ) );
+  __m128i plus  = _mm_cmpeq_epi8( c, _mm_set1_epi8( '+' ) );
+  __m128i slash = _mm_cmpeq_epi8( c, _mm_set1_epi8( '/' ) );
+
+  __m128i valid = _mm_or_si128( _mm_or_si128( upper, lower ),
+                                _mm_or_si128( digit, _mm_or_si128( plus, slash ) ) );
+  if ( _mm_movemask_epi8( valid ) != 0xffff ) return false;
+
+  // offset from each character to its 6 bit value
+  __m128i shift = _mm_or_si128(
+    _mm_or_si128( _mm_and_si128( upper, _mm_set1_epi8( -'A' ) ),
+                  _mm_and_si128( lower, _mm_set1_epi8( 26 - 'a' ) ) ),
+    _mm_or_si128( _mm_and_si128( digit, _mm_set1_epi8( 52 - '0' ) ),
+      _mm_or_si128( _mm_and_si128( plus,  _mm_set1_epi8( 62 - '+' ) ),
+                    _mm_and_si128( slash, _mm_set1_epi8( 63 - '/' ) ) ) ) );
+  __m128i v = _mm_add_epi8( c, shift );
+
+  // pairs of values into 12 bits, then pairs of those into 24 bits
+  __m128i pairs = _mm_or_si128(
+    _mm_slli_epi16( _mm_and_si128( v, _mm_set1_epi16( 0x00ff ) ), 6 ),
+    _mm_srli_epi16( v, 8 ) );
+  __m128i groups = _mm_madd_epi16( pairs, _mm_set1_epi32( 0x00011000 ) );
+
+  uint32_t g[4];
+  _mm_storeu_si128( (__m128i*) g, groups );
+  for ( int i = 0; i < 4; ++i ) {
+    out[0] = (unsigned char) ( g[i] >> 16 );
+    out[1] = (unsigned char) ( g[i] >>  8 );
+    out[2] = (unsigned char) ( g[i] );
+    out += 3;
+  }
+  return true;
+}
+
+#endif
+
+const char* Base64Decoder::scalar( const char* p, const char* end,
+                                   unsigned char*& out ) {
+
+  // at least one block, so the vector path skips what it stopped at
+  const char* stop = p + 16;
+
+  for ( ; p < end && ( p < stop || count ); ++p ) {
+
+    signed char value = kTable.values[(unsigned char) *p];
+
+    if ( value >= 0 ) {
+      bits = ( bits << 6 ) | value;
+      if ( ++count == 4 ) {
+        out[0] = (unsigned char) ( bits >> 16 );
+        out[1] = (unsigned char) ( bits >>  8 );
+        out[2] = (unsigned char) ( bits );
+        out += 3;
+        bits = 0; count = 0;
+      }
+    } else if ( value == kPadding ) {
+      padded = true;
+      return end;
+    } else if ( value == kInvalid ) {
+      error = true;
+      return end;
+    }
+  }
+
+  return p;
+}
+
+bool Base64Decoder::feed( const char* begin, const char* end,
+                          vector<unsigned char>& out ) {
+
+  if ( error || padded || begin >= end ) return !error;
+
+  // every 4 characters make at most 3 bytes, plus pending values
+  size_t start = out.size();
+  out.resize( start + ( end - begin ) / 4 * 3 + 3 );
+  unsigned char* o = &out[start];
+
+  const char* p = begin;
+  while ( p < end ) {
+
+#ifdef DRAWSVG_BASE64_SSE2
+    if ( count == 0 ) {
+      while ( end - p >= 16 && decode_block( p, o ) ) {
+        p += 16; o += 12;
+      }
+    }
+#endif
+
+    p = scalar( p, end, o );
+  }
+
+  out.resize( o - &out[0] );
+  return !error;
+}
+
+bool Base64Decoder::finish( vector<unsigned char>& out ) {
+
+  // 2 or 3 trailing values hold 1 or 2 bytes, a single one is malformed
+  if ( count == 1 ) error = true;
+  if ( count >= 2 ) {
+    bits <<= 6 * ( 4 - count );
+    out.push_back( (unsigned char) ( bits >> 16 ) );
+    if ( count == 3 ) out.push_back( (unsigned char) ( bits >> 8 ) );
+  }
+
+  bits = 0; count = 0;
+  return !error;
+}
+
+bool base64_decode( const char* begin, const char* end,
+                    vector<unsigned char>& out ) {
+
+  Base64Decoder decoder;
+  bool ok = decoder.feed( begin, end, out );
+  return decoder.finish( out ) && ok;
+}
+
+} // namespace CMU462
@@ -0,0 +1,50 @@
+#ifndef CMU462_BASE64_DECODER_H
+#define CMU462_BASE64_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace CMU462 {
+
+/**
+ * Incremental base64 decoder. Input can be fed in chunks of any size,
+ * whitespace anywhere in the input is skipped as it is read, and decoded
+ * bytes are appended to the output in place, so data URIs are decoded in
+ * a single pass without first stripping or copying them.
+ *
+ * Decoding stops at the first padding character. Any other character
+ * that is neither base64 nor whitespace is an error, the bytes decoded
+ * up to it are kept.
+ */
+class Base64Decoder {
+ public:
+
+  Base64Decoder() : bits( 0 ), count( 0 ), padded( false ), error( false ) { }
+
+  // decode a chunk, appending to out. False once an error was seen
+  bool feed( const char* begin, const char* end,
+             std::vector<unsigned char>& out );
+
+  // flush a trailing partial group. False if the input was malformed
+  bool finish( std::vector<unsigned char>& out );
+
+ private:
+
+  // decode one character at a time until a group boundary
+  const char* scalar( const char* p, const char* end, unsigned char*& out );
+
+  uint32_t bits;    // pending 6 bit values
+  int count;        // number of pending values
+  bool padded;      // reached the padding, the rest is ignored
+  bool error;
+
+}; // class Base64Decoder
+
+// decode a whole base64 string, appending to out
+bool base64_decode( const char* begin, const char* end,
+                    std::vector<unsigned char>& out );
+
+} // namespace CMU462
+
+#endif // CMU462_BASE64_DECODER_H
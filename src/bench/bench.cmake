@@ -0,0 +1,59 @@
+if(DRAWSVG_BUILD_BENCHMARKS)
+
+  # Benchmarks run headless, they only need the scene and rendering code
+  include_directories(${CMAKE_CURRENT_SOURCE_DIR})
+
+  # scene loading throughput and peak memory, from source and precompiled
+  add_executable( load_bench
+      bench/load_bench.cpp
+      ${CMU462_DRAWSVG_CORE_SOURCE}
+  )
+  target_link_libraries( load_bench CMU462 )
+
+  # points attribute parsing throughput
+  add_executable( parse_bench
+      bench/parse_bench.cpp
+      ${CMU462_DRAWSVG_CORE_SOURCE}
+  )
+  target_link_libraries( parse_bench CMU462 )
+
+  # transform attribute parsing throughput against the old parser
+  add_executable( transform_bench
+      bench/transform_bench.cpp
+      ${CMU462_DRAWSVG_CORE_SOURCE}
+  )
+  target_link_libraries( transform_bench CMU462 )
+
+  # optimized export against the original: size, load and frame time
+  add_executable( export_bench
+      bench/export_bench.cpp
+      ${CMU462_DRAWSVG_CORE_SOURCE}
+  )
+  target_link_libraries( export_bench CMU462 )
+
+  # PNG decoding and inflate throughput against LodePNG
+  add_executable( png_bench
+      bench/png_bench.cpp
+      ${CMU462_DRAWSVG_CORE_SOURCE}
+  )
+  target_link_libraries( png_bench CMU462 )
+
+  # frame time of the corpus, implementation against reference
+  add_executable( frame_bench
+      bench/frame_bench.cpp
+      ${CMU462_DRAWSVG_CORE_SOURCE}
+  )
+  target_link_libraries( frame_bench drawsvg_ref CMU462 )
+
+  # rasterization, sampling and loading kernels on synthetic inputs
+  add_executable( kernel_bench
+      bench/kernel_bench.cpp
+      ${CMU462_DRAWSVG_CORE_SOURCE}
+  )
+  target_link_libraries( kernel_bench CMU462 )
+
+  set_target_properties( load_bench parse_bench transform_bench
+      export_bench png_bench frame_bench kernel_bench PROPERTIES
+      RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/bench )
+
+endif(DRAWSVG_BUILD_BENCHMARKS)
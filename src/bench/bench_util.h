@@ -0,0 +1,96 @@
+#ifndef CMU462_BENCH_UTIL_H
+#define CMU462_BENCH_UTIL_H
+
+/*
+ * Helpers shared by the benchmarks and the batch tools (drawsvg_render,
+ * drawsvg_diff): the clock they time with, the files they run on and the
+ * percentiles they report.
+ */
+
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace CMU462 {
+
+/**
+ * Seconds on a monotonic clock, only meaningful as a difference: unlike
+ * the time of day it does not jump when the system clock is set.
+ */
+inline double now() {
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+inline bool has_extension( const std::string& path, const char* extension ) {
+  size_t dot = path.find_last_of( "./" );
+  return dot != std::string::npos && path[dot] == '.' &&
+         path.compare( dot + 1, std::string::npos, extension ) == 0;
+}
+
+inline bool is_svg( const std::string& path ) {
+  return has_extension( path, "svg" ) || has_extension( path, "svgz" );
+}
+
+/**
+ * Appends the files of path accepted by filter: path itself if it is not
+ * a directory, whatever its name, or the files of the directory and of
+ * its subdirectories, in name order. Hidden files are skipped.
+ * \return false if path does not exist or a directory cannot be read.
+ */
+inline bool collect( const std::string& path,
+                     std::vector<std::string>& files,
+                     bool (*filter)( const std::string& ) = is_svg ) {
+
+  struct stat st;
+  if ( stat( path.c_str(), &st ) ) return false;
+
+  if ( !S_ISDIR( st.st_mode ) ) {
+    files.push_back( path );
+    return true;
+  }
+
+  DIR* dir = opendir( path.c_str() );
+  if ( !dir ) return false;
+
+  std::string pathname = path;
+  if ( pathname[pathname.size() - 1] != '/' ) pathname.push_back( '/' );
+
+  std::vector<std::string> names;
+  struct dirent* ent;
+  while ( ( ent = readdir( dir ) ) != NULL ) {
+    if ( ent->d_name[0] != '.' ) names.push_back( ent->d_name );
+  }
+  closedir( dir );
+
+  std::sort( names.begin(), names.end() );
+
+  bool readable = true;
+  for ( size_t i = 0; i < names.size(); i++ ) {
+    std::string child = pathname + names[i];
+    if ( !stat( child.c_str(), &st ) && S_ISDIR( st.st_mode ) ) {
+      readable = collect( child, files, filter ) && readable;
+    } else if ( filter( names[i] ) ) {
+      files.push_back( child );
+    }
+  }
+  return readable;
+}
+
+/**
+ * Nearest rank percentile p (0 to 100) of sorted values, of which there
+ * is at least one.
+ */
+inline double percentile( const std::vector<double>& sorted, double p ) {
+  size_t rank = (size_t) std::ceil( p / 100 * sorted.size() );
+  return sorted[std::min( std::max( rank, (size_t) 1 ), sorted.size() ) - 1];
+}
+
+} // namespace CMU462
+
+#endif // CMU462_BENCH_UTIL_H
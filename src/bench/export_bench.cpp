@@ -0,0 +1,170 @@
+/*
+ * Optimized export benchmark.
+ *
+ * Loads every file, writes it with SVGParser::saveOptimized and compares
+ * the original with the optimized document: file size, number of
+ * elements, load time and the time to draw a frame of the whole canvas
+ * with the software renderer, along with the pixels of that frame that
+ * differ between the two.
+ *
+ * usage: export_bench [-n runs] [-d digits] [-s width height]
+ *                     <file or directory>...
+ */
+
+#include "svg.h"
+#include "texture.h"
+#include "viewport.h"
+#include "software_renderer.h"
+#include "bench_util.h"
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace CMU462;
+
+struct Measure {
+  double size_kb;
+  size_t nodes;
+  double load_ms;
+  double frame_ms;
+  vector<unsigned char> frame;
+};
+
+static double file_kb( const string& path ) {
+  struct stat st;
+  return stat( path.c_str(), &st ) ? 0 : st.st_size / 1024.0;
+}
+
+// draw the whole canvas into frame, best time of runs
+static double draw( SVG& svg, size_t width, size_t height, int runs,
+                    vector<unsigned char>& frame ) {
+
+  frame.assign( 4 * width * height, 255 );
+
+  SoftwareRendererImp renderer;
+  Sampler2DImp sampler;
+  renderer.set_tex_sampler( &sampler );
+  renderer.set_render_target( &frame[0], width, height );
+  renderer.set_sample_rate( 1 );
+
+  ViewportImp viewport;
+  float span = max( svg.width, svg.height ) * 1.2f / 2;
+  viewport.set_viewbox( svg.width / 2, svg.height / 2, span );
+
+  // normalized to screen, centered square
+  Matrix3x3 norm_2_screen = Matrix3x3::identity();
+  float side = min( width, height );
+  norm_2_screen(0,0) = side; norm_2_screen(0,2) = ( width  - side ) / 2;
+  norm_2_screen(1,1) = side; norm_2_screen(1,2) = ( height - side ) / 2;
+  renderer.set_svg_2_screen( norm_2_screen * viewport.get_svg_2_norm() );
+
+  svg.images.wait();
+
+  double best = 1e30;
+  for ( int i = 0; i < runs; ++i ) {
+    double t0 = now();
+    renderer.draw_svg( svg );
+    best = min( best, now() - t0 );
+  }
+  return best * 1e3;
+}
+
+static bool measure( const string& path, size_t width, size_t height,
+                     int runs, Measure& m ) {
+
+  m.size_kb = file_kb( path );
+  m.load_ms = 1e30;
+  for ( int i = 0; i < runs; ++i ) {
+    SVG svg;
+    double t0 = now();
+    if ( SVGParser::load( path.c_str(), &svg ) ) return false;
+    m.load_ms = min( m.load_ms, ( now() - t0 ) * 1e3 );
+  }
+
+  SVG svg;
+  SVGParser::load( path.c_str(), &svg );
+  m.nodes = svg.nodes.size();
+  m.frame_ms = draw( svg, width, height, runs, m.frame );
+  return true;
+}
+
+int main( int argc, char** argv ) {
+
+  int runs = 5, digits = 5;
+  size_t width = 800, height = 600;
+  vector<string> files;
+  for ( int i = 1; i < argc; i++ ) {
+    string arg = argv[i];
+    if ( arg == "-n" && i + 1 < argc ) {
+      runs = max( 1, atoi( argv[++i] ) );
+    } else if ( arg == "-d" && i + 1 < argc ) {
+      digits = atoi( argv[++i] );
+    } else if ( arg == "-s" && i + 2 < argc ) {
+      width  = max( 1, atoi( argv[++i] ) );
+      height = max( 1, atoi( argv[++i] ) );
+    } else if ( !collect( arg, files ) ) {
+      cerr << "cannot read " << arg << endl;
+      return 1;
+    }
+  }
+
+  if ( files.empty() ) {
+    cerr << "usage: " << argv[0] << " [-n runs] [-d digits] "
+         << "[-s width height] <file or directory>..." << endl;
+    return 1;
+  }
+
+  printf( "%-28s %19s %17s %19s %19s %9s\n", "", "size(KB)", "elements",
+          "load(ms)", "frame(ms)", "" );
+  printf( "%-28s %9s %9s %8s %8s %9s %9s %9s %9s %9s\n", "file",
+          "original", "optimized", "original", "optim.", "original",
+          "optimized", "original", "optimized", "diff(px)" );
+
+  string output = "/tmp/export_bench.svg";
+  for ( size_t i = 0; i < files.size(); i++ ) {
+
+    const string& path = files[i];
+    string name = path.substr( path.find_last_of( "/" ) + 1 );
+
+    Measure original, optimized;
+    if ( !measure( path, width, height, runs, original ) ) {
+      cerr << "cannot load " << path << endl;
+      continue;
+    }
+
+    {
+      SVG svg;
+      SVGParser::load( path.c_str(), &svg );
+      svg.images.wait();
+      if ( SVGParser::saveOptimized( output.c_str(), &svg, digits ) ) {
+        continue;
+      }
+    }
+    if ( !measure( output, width, height, runs, optimized ) ) {
+      cerr << "cannot load the optimized " << path << endl;
+      continue;
+    }
+
+    size_t differ = 0;
+    for ( size_t p = 0; p < original.frame.size(); p += 4 ) {
+      if ( memcmp( &original.frame[p], &optimized.frame[p], 4 ) ) differ++;
+    }
+
+    printf( "%-28s %9.1f %9.1f %8zu %8zu %9.2f %9.2f %9.2f %9.2f %9zu\n",
+            name.c_str(), original.size_kb, optimized.size_kb,
+            original.nodes, optimized.nodes, original.load_ms,
+            optimized.load_ms, original.frame_ms, optimized.frame_ms,
+            differ );
+  }
+
+  remove( output.c_str() );
+  return 0;
+}
@@ -0,0 +1,321 @@
+/*
+ * End-to-end frame benchmark.
+ *
+ * Loads every file and draws it with SoftwareRendererImp and
+ * SoftwareRendererRef at each frame size, sample rate and zoom level
+ * asked for, headless, into memory. Reports the load time, frame time
+ * percentiles and throughput in Mpixels and Msamples per second of both
+ * renderers, the speedup of the implementation over the reference and
+ * the pixels where their last frames differ, as a table and, if asked
+ * for, as JSON.
+ *
+ * Zoom levels magnify the center of the canvas, 1 being the view the
+ * viewer opens with (the whole canvas).
+ *
+ * usage: frame_bench [-n frames] [-w warmup] [-s width height]...
+ *                    [-r rates] [-z zooms] [-i] [-o json]
+ *                    <file or directory>...
+ *   -s    frame size, repeat for several (default: 800 600, 1920 1080)
+ *   -r    comma separated sample rates (default: 1,2,4)
+ *   -z    comma separated zoom levels (default: 1,4)
+ *   -i    implementation only, skip the reference renderer
+ *   -o    write the results as JSON to a file, - for stdout
+ *
+ * Directories are searched recursively, svg/ runs the whole corpus.
+ */
+
+#include "svg.h"
+#include "texture.h"
+#include "viewport.h"
+#include "software_renderer.h"
+#include "bench_util.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace CMU462;
+
+struct Size {
+  size_t width, height;
+};
+
+struct Frames {
+  double p50, p90, p99, mean;   // frame time, ms
+  double mpixels, msamples;     // per second, at the median frame time
+};
+
+struct Result {
+  string file;
+  double load_ms;
+  Size size;
+  size_t sample_rate;
+  float zoom;
+  Frames imp, ref;
+  bool has_ref;
+  size_t differ;                // pixels of the last frames
+};
+
+// draw svg warmup + frames times into frame, timing the frames
+static Frames draw( SoftwareRenderer& renderer, Sampler2D& sampler,
+                    SVG& svg, const Size& size, size_t sample_rate,
+                    float zoom, int warmup, int frames,
+                    vector<unsigned char>& frame ) {
+
+  frame.assign( 4 * size.width * size.height, 255 );
+
+  renderer.set_tex_sampler( &sampler );
+  renderer.set_render_target( &frame[0], size.width, size.height );
+  renderer.set_sample_rate( sample_rate );
+
+  ViewportImp viewport;
+  float span = 1.2 * max( svg.width, svg.height ) / 2 / zoom;
+  viewport.set_viewbox( svg.width / 2, svg.height / 2, span );
+
+  // the largest centered square of the frame shows the view
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( size.width, size.height );
+  norm_to_screen(0,0) = scale;
+  norm_to_screen(0,2) = ( size.width  - scale ) / 2;
+  norm_to_screen(1,1) = scale;
+  norm_to_screen(1,2) = ( size.height - scale ) / 2;
+  renderer.set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+
+  for ( int i = 0; i < warmup; i++ ) renderer.draw_svg( svg );
+
+  vector<double> times;
+  for ( int i = 0; i < frames; i++ ) {
+    double t0 = now();
+    renderer.draw_svg( svg );
+    times.push_back( ( now() - t0 ) * 1e3 );
+  }
+  sort( times.begin(), times.end() );
+
+  Frames f;
+  f.p50 = percentile( times, 50 );
+  f.p90 = percentile( times, 90 );
+  f.p99 = percentile( times, 99 );
+  f.mean = 0;
+  for ( size_t i = 0; i < times.size(); i++ ) f.mean += times[i];
+  f.mean /= times.size();
+
+  double pixels = (double) size.width * size.height;
+  f.mpixels  = pixels / ( f.p50 * 1e3 );
+  f.msamples = pixels * sample_rate * sample_rate / ( f.p50 * 1e3 );
+  return f;
+}
+
+// file name with its directory, as in illustration/05_lion.svg
+static string short_name( const string& path ) {
+  size_t slash = path.find_last_of( "/" );
+  if ( slash == string::npos || slash == 0 ) return path;
+  size_t parent = path.find_last_of( "/", slash - 1 );
+  return path.substr( parent == string::npos ? 0 : parent + 1 );
+}
+
+template <class T>
+static vector<T> parse_list( const char* list ) {
+  vector<T> values;
+  for ( const char* p = list; *p; ) {
+    char* end;
+    double value = strtod( p, &end );
+    if ( end == p ) break;
+    if ( value > 0 ) values.push_back( (T) value );
+    p = *end == ',' ? end + 1 : end;
+  }
+  return values;
+}
+
+static void write_frames( FILE* out, const char* name, const Frames& f ) {
+  fprintf( out, "\"%s\": { \"p50_ms\": %.4f, \"p90_ms\": %.4f, "
+           "\"p99_ms\": %.4f, \"mean_ms\": %.4f, \"mpixels_per_s\": %.3f, "
+           "\"msamples_per_s\": %.3f }", name, f.p50, f.p90, f.p99, f.mean,
+           f.mpixels, f.msamples );
+}
+
+static void write_json( FILE* out, const vector<Result>& results,
+                        int warmup, int frames ) {
+
+  fprintf( out, "{\n  \"warmup\": %d,\n  \"frames\": %d,\n"
+           "  \"results\": [\n", warmup, frames );
+
+  for ( size_t i = 0; i < results.size(); i++ ) {
+    const Result& r = results[i];
+    fprintf( out, "    { \"file\": \"%s\", \"load_ms\": %.4f, "
+             "\"width\": %zu, \"height\": %zu, \"sample_rate\": %zu, "
+             "\"zoom\": %g,\n      ", r.file.c_str(), r.load_ms,
+             r.size.width, r.size.height, r.sample_rate, r.zoom );
+    write_frames( out, "imp", r.imp );
+    if ( r.has_ref ) {
+      fprintf( out, ",\n      " );
+      write_frames( out, "ref", r.ref );
+      fprintf( out, ",\n      \"speedup\": %.3f, \"differ_px\": %zu",
+               r.ref.p50 / r.imp.p50, r.differ );
+    }
+    fprintf( out, " }%s\n", i + 1 < results.size() ? "," : "" );
+  }
+
+  fprintf( out, "  ]\n}\n" );
+}
+
+static void usage( const char* program ) {
+  cerr << "usage: " << program << " [-n frames] [-w warmup] "
+       << "[-s width height]... [-r rates] [-z zooms] [-i] [-o json] "
+       << "<file or directory>..." << endl;
+}
+
+int main( int argc, char** argv ) {
+
+  int frames = 5, warmup = 1;
+  bool reference = true;
+  string json;
+  vector<Size> sizes;
+  vector<size_t> rates( 1, 1 );
+  rates.push_back( 2 ); rates.push_back( 4 );
+  vector<float> zooms( 1, 1 );
+  zooms.push_back( 4 );
+
+  vector<string> files;
+  for ( int i = 1; i < argc; i++ ) {
+    string arg = argv[i];
+    if ( arg == "-n" && i + 1 < argc ) {
+      frames = max( 1, atoi( argv[++i] ) );
+    } else if ( arg == "-w" && i + 1 < argc ) {
+      warmup = max( 0, atoi( argv[++i] ) );
+    } else if ( arg == "-s" && i + 2 < argc ) {
+      Size size;
+      size.width  = max( 1, atoi( argv[++i] ) );
+      size.height = max( 1, atoi( argv[++i] ) );
+      sizes.push_back( size );
+    } else if ( arg == "-r" && i + 1 < argc ) {
+      rates = parse_list<size_t>( argv[++i] );
+    } else if ( arg == "-z" && i + 1 < argc ) {
+      zooms = parse_list<float>( argv[++i] );
+    } else if ( arg == "-i" ) {
+      reference = false;
+    } else if ( arg == "-o" && i + 1 < argc ) {
+      json = argv[++i];
+    } else if ( arg[0] == '-' ) {
+      usage( argv[0] );
+      return 1;
+    } else if ( !collect( arg, files ) ) {
+      cerr << "cannot read " << arg << endl;
+      return 1;
+    }
+  }
+
+  if ( sizes.empty() ) {
+    Size small = { 800, 600 }, large = { 1920, 1080 };
+    sizes.push_back( small );
+    sizes.push_back( large );
+  }
+
+  if ( files.empty() || rates.empty() || zooms.empty() ) {
+    usage( argv[0] );
+    return 1;
+  }
+
+  // the table goes to stderr when the JSON goes to stdout
+  FILE* table = json == "-" ? stderr : stdout;
+
+  fprintf( table, "%-34s %9s %4s %4s %8s %9s %9s %9s %8s %9s %9s %7s %8s\n",
+           "file", "size", "rate", "zoom", "load(ms)", "p50(ms)", "p90(ms)",
+           "p99(ms)", "Mpix/s", "Msmp/s", "ref(ms)", "speedup",
+           "diff(px)" );
+
+  vector<Result> results;
+  for ( size_t i = 0; i < files.size(); i++ ) {
+
+    SVG svg;
+    double t0 = now();
+    if ( SVGParser::load( files[i].c_str(), &svg ) < 0 ) {
+      cerr << "cannot load " << files[i] << endl;
+      continue;
+    }
+    double load_ms = ( now() - t0 ) * 1e3;
+
+    for ( size_t s = 0; s < sizes.size(); s++ )
+    for ( size_t r = 0; r < rates.size(); r++ )
+    for ( size_t z = 0; z < zooms.size(); z++ ) {
+
+      Result result;
+      result.file = short_name( files[i] );
+      result.load_ms = load_ms;
+      result.size = sizes[s];
+      result.sample_rate = rates[r];
+      result.zoom = zooms[z];
+      result.ref = Frames();
+      result.has_ref = reference;
+      result.differ = 0;
+
+      vector<unsigned char> imp_frame, ref_frame;
+      {
+        SoftwareRendererImp renderer;
+        Sampler2DImp sampler;
+        result.imp = draw( renderer, sampler, svg, sizes[s], rates[r],
+                           zooms[z], warmup, frames, imp_frame );
+      }
+
+      if ( reference ) {
+        SoftwareRendererRef renderer;
+        Sampler2DRef sampler;
+        result.ref = draw( renderer, sampler, svg, sizes[s], rates[r],
+                           zooms[z], warmup, frames, ref_frame );
+        for ( size_t p = 0; p < imp_frame.size(); p += 4 ) {
+          if ( memcmp( &imp_frame[p], &ref_frame[p], 4 ) ) result.differ++;
+        }
+      }
+
+      char size[32];
+      snprintf( size, sizeof( size ), "%zux%zu", result.size.width,
+                result.size.height );
+      fprintf( table, "%-34s %9s %4zu %4g %8.2f %9.2f %9.2f %9.2f %8.1f "
+               "%9.1f", result.file.c_str(), size, result.sample_rate,
+               result.zoom, result.load_ms, result.imp.p50, result.imp.p90,
+               result.imp.p99, result.imp.mpixels, result.imp.msamples );
+      if ( reference ) {
+        fprintf( table, " %9.2f %6.2fx %8zu\n", result.ref.p50,
+                 result.ref.p50 / result.imp.p50, result.differ );
+      } else {
+        fprintf( table, "\n" );
+      }
+      fflush( table );
+
+      results.push_back( result );
+    }
+  }
+
+  // totals of the median frame times, if anything was drawn
+  double imp_total = 0, ref_total = 0;
+  for ( size_t i = 0; i < results.size(); i++ ) {
+    imp_total += results[i].imp.p50;
+    ref_total += results[i].ref.p50;
+  }
+  if ( !results.empty() ) {
+    fprintf( table, "%-34s %9s %4s %4s %8s %9.2f %9s %9s %8s %9s",
+             "total", "", "", "", "", imp_total, "", "", "", "" );
+    if ( reference ) {
+      fprintf( table, " %9.2f %6.2fx\n", ref_total, ref_total / imp_total );
+    } else {
+      fprintf( table, "\n" );
+    }
+  }
+
+  if ( !json.empty() ) {
+    FILE* out = json == "-" ? stdout : fopen( json.c_str(), "w" );
+    if ( !out ) {
+      cerr << "cannot write " << json << endl;
+      return 1;
+    }
+    write_json( out, results, warmup, frames );
+    if ( out != stdout ) fclose( out );
+  }
+
+  return 0;
+}
@@ -0,0 +1,455 @@
+/*
+ * Kernel microbenchmarks.
+ *
+ * Times the hot functions of the software renderer and the loader one at
+ * a time on synthetic inputs generated from a fixed seed: triangle and
+ * line rasterization, sample and pixel fills, resolve, texture sampling,
+ * mipmap generation, triangulation, points attribute parsing and PNG
+ * decoding. Each kernel runs a fixed batch of work per iteration, after
+ * warmup iterations, and reports the percentiles of the iteration times
+ * and its throughput at the median.
+ *
+ * usage: kernel_bench [-w warmup] [-n iterations] [-o json] [name]...
+ *
+ * Names select the kernels whose name contains one of them.
+ */
+
+#include "svg.h"
+#include "png.h"
+#include "number.h"
+#include "texture.h"
+#include "triangulation.h"
+#include "software_renderer.h"
+#include "bench_util.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+using namespace CMU462;
+
+// frame the rasterization kernels draw into
+static const size_t kTargetSize = 512;
+
+// keeps results alive so nothing is optimized away
+static volatile float sink;
+
+namespace CMU462 {
+
+// calls into the private kernels of the renderer
+struct RendererKernels {
+
+  static void triangle( SoftwareRendererImp& r, const float* v,
+                        const Color& c ) {
+    r.rasterize_triangle( v[0], v[1], v[2], v[3], v[4], v[5], c );
+  }
+
+  static void line( SoftwareRendererImp& r, const float* v,
+                    const Color& c ) {
+    r.rasterize_line( v[0], v[1], v[2], v[3], c );
+  }
+
+  static void sample( SoftwareRendererImp& r, int x, int y,
+                      const Color& c ) {
+    r.fill_sample( x, y, c );
+  }
+
+  static void pixel( SoftwareRendererImp& r, int x, int y,
+                     const Color& c ) {
+    r.fill_pixel( x, y, c );
+  }
+
+  static void resolve( SoftwareRendererImp& r ) { r.resolve(); }
+
+  static size_t samples( SoftwareRendererImp& r ) { return r.w * r.h; }
+};
+
+} // namespace CMU462
+
+struct Kernel {
+  string name;
+  const char* unit;              // what items counts
+  double items;                  // per iteration
+  std::function<void()> run;     // one iteration
+};
+
+struct Timing {
+  double min, p50, p90, p99;     // iteration time, us
+};
+
+static Timing measure( const Kernel& kernel, int warmup, int iterations ) {
+
+  for ( int i = 0; i < warmup; i++ ) kernel.run();
+
+  vector<double> times;
+  for ( int i = 0; i < iterations; i++ ) {
+    double t0 = now();
+    kernel.run();
+    times.push_back( ( now() - t0 ) * 1e6 );
+  }
+  sort( times.begin(), times.end() );
+
+  Timing t;
+  t.min = times[0];
+  t.p50 = percentile( times, 50 );
+  t.p90 = percentile( times, 90 );
+  t.p99 = percentile( times, 99 );
+  return t;
+}
+
+// deterministic inputs, the same on every run and platform
+static unsigned int seed = 1;
+static float uniform( float lo, float hi ) {
+  seed = seed * 1664525u + 1013904223u;
+  return lo + ( hi - lo ) * ( ( seed >> 8 ) / 16777216.0f );
+}
+
+// count triangles of about size pixels across, anywhere on the target
+static vector<float> make_triangles( size_t count, float size ) {
+  vector<float> v;
+  for ( size_t i = 0; i < count; i++ ) {
+    float x = uniform( 0, kTargetSize - size );
+    float y = uniform( 0, kTargetSize - size );
+    for ( int k = 0; k < 3; k++ ) {
+      v.push_back( x + uniform( 0, size ) );
+      v.push_back( y + uniform( 0, size ) );
+    }
+  }
+  return v;
+}
+
+// texture with a random base level and its mip chain
+static void make_texture( Texture& tex, size_t size, Sampler2DImp& sampler ) {
+  tex.width = tex.height = size;
+  tex.mipmap.assign( 1, MipLevel() );
+  tex.mipmap[0].width = tex.mipmap[0].height = size;
+  tex.mipmap[0].texels.resize( 4 * size * size );
+  for ( size_t i = 0; i < tex.mipmap[0].texels.size(); i++ ) {
+    tex.mipmap[0].texels[i] = (unsigned char) uniform( 0, 256 );
+  }
+  sampler.generate_mips( tex, 0 );
+}
+
+// star shaped contour, concave, with n points
+static vector<Vector2D> make_contour( size_t n ) {
+  vector<Vector2D> contour;
+  for ( size_t i = 0; i < n; i++ ) {
+    double a = 2 * PI * i / n, r = i % 2 ? 40 : uniform( 60, 100 );
+    contour.push_back( Vector2D( 100 + r * cos( a ), 100 + r * sin( a ) ) );
+  }
+  return contour;
+}
+
+// points attribute as drawing programs write it
+static string make_points( size_t n ) {
+  string points;
+  char buffer[64];
+  for ( size_t i = 0; i < n; i++ ) {
+    snprintf( buffer, sizeof( buffer ), "%s%.3f,%.3f", i ? " " : "",
+              uniform( -1000, 1000 ), uniform( -1000, 1000 ) );
+    points += buffer;
+  }
+  return points;
+}
+
+// smooth gradient with noise, compresses like a photograph would
+static vector<unsigned char> make_png( size_t size ) {
+  PNG png;
+  png.width = png.height = size;
+  png.pixels.resize( 4 * size * size );
+  for ( size_t y = 0; y < size; y++ ) {
+    for ( size_t x = 0; x < size; x++ ) {
+      unsigned char* p = &png.pixels[4 * ( y * size + x )];
+      p[0] = (unsigned char) ( x * 255 / size + uniform( 0, 8 ) );
+      p[1] = (unsigned char) ( y * 255 / size + uniform( 0, 8 ) );
+      p[2] = (unsigned char) ( ( x + y ) * 127 / size );
+      p[3] = 255;
+    }
+  }
+  vector<unsigned char> encoded;
+  PNGParser::save( encoded, png );
+  return encoded;
+}
+
+static void write_json( FILE* out, const vector<Kernel>& kernels,
+                        const vector<Timing>& timings,
+                        int warmup, int iterations ) {
+  fprintf( out, "{\n  \"warmup\": %d,\n  \"iterations\": %d,\n"
+           "  \"kernels\": [\n", warmup, iterations );
+  for ( size_t i = 0; i < kernels.size(); i++ ) {
+    const Timing& t = timings[i];
+    fprintf( out, "    { \"name\": \"%s\", \"unit\": \"%s\", "
+             "\"items\": %.0f, \"min_us\": %.3f, \"p50_us\": %.3f, "
+             "\"p90_us\": %.3f, \"p99_us\": %.3f, "
+             "\"mitems_per_s\": %.3f }%s\n", kernels[i].name.c_str(),
+             kernels[i].unit, kernels[i].items, t.min, t.p50, t.p90, t.p99,
+             kernels[i].items / t.p50, i + 1 < kernels.size() ? "," : "" );
+  }
+  fprintf( out, "  ]\n}\n" );
+}
+
+int main( int argc, char** argv ) {
+
+  int warmup = 3, iterations = 30;
+  string json;
+  vector<string> names;
+  for ( int i = 1; i < argc; i++ ) {
+    string arg = argv[i];
+    if ( arg == "-w" && i + 1 < argc ) {
+      warmup = max( 0, atoi( argv[++i] ) );
+    } else if ( arg == "-n" && i + 1 < argc ) {
+      iterations = max( 1, atoi( argv[++i] ) );
+    } else if ( arg == "-o" && i + 1 < argc ) {
+      json = argv[++i];
+    } else if ( !arg.empty() && arg[0] == '-' ) {
+      cerr << "usage: " << argv[0]
+           << " [-w warmup] [-n iterations] [-o json] [name]..." << endl;
+      return 1;
+    } else {
+      names.push_back( arg );
+    }
+  }
+
+  // Inputs //
+
+  const Color opaque( 0.2f, 0.4f, 0.6f, 1.0f );
+  const Color translucent( 0.8f, 0.3f, 0.1f, 0.5f );
+
+  vector<unsigned char> target( 4 * kTargetSize * kTargetSize );
+
+  // one renderer per sample rate, drawing into the same target
+  SoftwareRendererImp renderer, supersampled;
+  Sampler2DImp sampler;
+  renderer.set_tex_sampler( &sampler );
+  renderer.set_render_target( &target[0], kTargetSize, kTargetSize );
+  renderer.set_sample_rate( 1 );
+  supersampled.set_tex_sampler( &sampler );
+  supersampled.set_render_target( &target[0], kTargetSize, kTargetSize );
+  supersampled.set_sample_rate( 4 );
+
+  vector<float> small_triangles = make_triangles( 4096, 8 );
+  vector<float> large_triangles = make_triangles( 64, 256 );
+  vector<float> lines;
+  for ( size_t i = 0; i < 4096; i++ ) {
+    float x = uniform( 64, kTargetSize - 64 );
+    float y = uniform( 64, kTargetSize - 64 );
+    float a = uniform( 0, 2 * PI );
+    lines.push_back( x ); lines.push_back( y );
+    lines.push_back( x + 48 * cos( a ) ); lines.push_back( y + 48 * sin( a ) );
+  }
+
+  Texture texture, mip_source;
+  make_texture( texture, 256, sampler );
+  make_texture( mip_source, 1024, sampler );
+  vector<float> uvs;
+  for ( size_t i = 0; i < 2 * 65536; i++ ) uvs.push_back( uniform( 0, 1 ) );
+
+  vector<Vector2D> contour = make_contour( 256 );
+  string points = make_points( 10000 );
+  vector<unsigned char> encoded = make_png( 512 );
+
+  // Kernels //
+
+  vector<Kernel> kernels;
+
+  Kernel k;
+
+  k.name = "rasterize_triangle/8px"; k.unit = "tri";
+  k.items = small_triangles.size() / 6;
+  k.run = [&] {
+    for ( size_t i = 0; i < small_triangles.size(); i += 6 ) {
+      RendererKernels::triangle( renderer, &small_triangles[i], opaque );
+    }
+  };
+  kernels.push_back( k );
+
+  k.name = "rasterize_triangle/8px/alpha"; k.unit = "tri";
+  k.run = [&] {
+    for ( size_t i = 0; i < small_triangles.size(); i += 6 ) {
+      RendererKernels::triangle( renderer, &small_triangles[i],
+                                 translucent );
+    }
+  };
+  kernels.push_back( k );
+
+  k.name = "rasterize_triangle/256px"; k.unit = "tri";
+  k.items = large_triangles.size() / 6;
+  k.run = [&] {
+    for ( size_t i = 0; i < large_triangles.size(); i += 6 ) {
+      RendererKernels::triangle( renderer, &large_triangles[i], opaque );
+    }
+  };
+  kernels.push_back( k );
+
+  // a quarter of them, at 16 samples per pixel
+  k.name = "rasterize_triangle/256px/x16"; k.unit = "tri";
+  k.items = large_triangles.size() / 24;
+  k.run = [&] {
+    for ( size_t i = 0; i < large_triangles.size() / 4; i += 6 ) {
+      RendererKernels::triangle( supersampled, &large_triangles[i], opaque );
+    }
+  };
+  kernels.push_back( k );
+
+  k.name = "rasterize_line/48px"; k.unit = "line";
+  k.items = lines.size() / 4;
+  k.run = [&] {
+    for ( size_t i = 0; i < lines.size(); i += 4 ) {
+      RendererKernels::line( renderer, &lines[i], opaque );
+    }
+  };
+  kernels.push_back( k );
+
+  k.name = "fill_sample/opaque"; k.unit = "sample";
+  k.items = kTargetSize * kTargetSize;
+  k.run = [&] {
+    for ( size_t y = 0; y < kTargetSize; y++ )
+    for ( size_t x = 0; x < kTargetSize; x++ ) {
+      RendererKernels::sample( renderer, x, y, opaque );
+    }
+  };
+  kernels.push_back( k );
+
+  k.name = "fill_sample/alpha"; k.unit = "sample";
+  k.run = [&] {
+    for ( size_t y = 0; y < kTargetSize; y++ )
+    for ( size_t x = 0; x < kTargetSize; x++ ) {
+      RendererKernels::sample( renderer, x, y, translucent );
+    }
+  };
+  kernels.push_back( k );
+
+  k.name = "fill_pixel/x16"; k.unit = "pixel";
+  k.items = kTargetSize * kTargetSize / 16;
+  k.run = [&] {
+    for ( size_t y = 0; y < kTargetSize; y += 4 )
+    for ( size_t x = 0; x < kTargetSize; x += 4 ) {
+      RendererKernels::pixel( supersampled, x, y, translucent );
+    }
+  };
+  kernels.push_back( k );
+
+  k.name = "resolve/x1"; k.unit = "sample";
+  k.items = RendererKernels::samples( renderer );
+  k.run = [&] { RendererKernels::resolve( renderer ); };
+  kernels.push_back( k );
+
+  k.name = "resolve/x16"; k.unit = "sample";
+  k.items = RendererKernels::samples( supersampled );
+  k.run = [&] { RendererKernels::resolve( supersampled ); };
+  kernels.push_back( k );
+
+  k.name = "sample_nearest"; k.unit = "lookup";
+  k.items = uvs.size() / 2;
+  k.run = [&] {
+    float sum = 0;
+    for ( size_t i = 0; i < uvs.size(); i += 2 ) {
+      sum += sampler.sample_nearest( texture, uvs[i], uvs[i + 1] ).r;
+    }
+    sink = sum;
+  };
+  kernels.push_back( k );
+
+  k.name = "sample_bilinear"; k.unit = "lookup";
+  k.run = [&] {
+    float sum = 0;
+    for ( size_t i = 0; i < uvs.size(); i += 2 ) {
+      sum += sampler.sample_bilinear( texture, uvs[i], uvs[i + 1] ).r;
+    }
+    sink = sum;
+  };
+  kernels.push_back( k );
+
+  // the texture drawn 45 pixels wide, between mip levels 2 and 3
+  k.name = "sample_trilinear"; k.unit = "lookup";
+  k.run = [&] {
+    float sum = 0;
+    for ( size_t i = 0; i < uvs.size(); i += 2 ) {
+      sum += sampler.sample_trilinear( texture, uvs[i], uvs[i + 1],
+                                       45.0f, 45.0f ).r;
+    }
+    sink = sum;
+  };
+  kernels.push_back( k );
+
+  k.name = "generate_mips/1024"; k.unit = "texel";
+  k.items = 1024 * 1024;
+  k.run = [&] { sampler.generate_mips( mip_source, 0 ); };
+  kernels.push_back( k );
+
+  k.name = "triangulate/256"; k.unit = "vertex";
+  k.items = contour.size();
+  k.run = [&] {
+    vector<int> indices;
+    triangulate( contour, indices );
+    sink = indices.size();
+  };
+  kernels.push_back( k );
+
+  k.name = "parse_points/10k"; k.unit = "point";
+  k.items = 10000;
+  k.run = [&] {
+    vector<Vector2D> parsed;
+    parsed.reserve( 10000 );
+    parse_points( points.data(), points.data() + points.size(), parsed );
+    sink = parsed.size();
+  };
+  kernels.push_back( k );
+
+  k.name = "png_load/512"; k.unit = "pixel";
+  k.items = 512 * 512;
+  k.run = [&] {
+    PNG png;
+    PNGParser::load( &encoded[0], encoded.size(), png );
+    sink = png.width;
+  };
+  kernels.push_back( k );
+
+  // keep the selected ones
+  if ( !names.empty() ) {
+    vector<Kernel> selected;
+    for ( size_t i = 0; i < kernels.size(); i++ ) {
+      for ( size_t j = 0; j < names.size(); j++ ) {
+        if ( kernels[i].name.find( names[j] ) != string::npos ) {
+          selected.push_back( kernels[i] );
+          break;
+        }
+      }
+    }
+    kernels.swap( selected );
+  }
+
+  // Report //
+
+  FILE* table = json == "-" ? stderr : stdout;
+  fprintf( table, "%-30s %10s %10s %10s %10s %17s\n", "kernel", "min(us)",
+           "p50(us)", "p90(us)", "p99(us)", "items/s" );
+
+  vector<Timing> timings;
+  for ( size_t i = 0; i < kernels.size(); i++ ) {
+    Timing t = measure( kernels[i], warmup, iterations );
+    timings.push_back( t );
+    fprintf( table, "%-30s %10.1f %10.1f %10.1f %10.1f %8.3fM %-6s\n",
+             kernels[i].name.c_str(), t.min, t.p50, t.p90, t.p99,
+             kernels[i].items / t.p50, kernels[i].unit );
+    fflush( table );
+  }
+
+  if ( !json.empty() ) {
+    FILE* out = json == "-" ? stdout : fopen( json.c_str(), "w" );
+    if ( !out ) {
+      cerr << "cannot write " << json << endl;
+      return 1;
+    }
+    write_json( out, kernels, timings, warmup, iterations );
+    if ( out != stdout ) fclose( out );
+  }
+
+  return 0;
+}
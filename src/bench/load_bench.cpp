@@ -0,0 +1,255 @@
+/*
+ * Scene loading benchmark.
+ *
+ * Loads every file with the DOM, the chunked streaming and the mapped
+ * loader, and from a precompiled scene written beforehand, and reports
+ * throughput (in MB of source per second), peak resident memory and page
+ * faults. Each load runs in a process of its own, so the peak of one
+ * loader is not hidden by another.
+ *
+ * Compressed files (.svgz) are not loaded with the DOM. Their size and
+ * throughput are in decompressed MB, and decompression alone is timed
+ * too ("inflate") along with what the mapped load spends on the rest
+ * ("parse", the difference of the two).
+ *
+ * usage: load_bench [-n runs] <file or directory>...
+ */
+
+#include "svg.h"
+#include "inflate.h"
+#include "xml_stream.h"
+#include "bench_util.h"
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+using namespace CMU462;
+
+struct Result {
+  int status;
+  double seconds;       // best of all runs
+  double baseline_mb;   // resident memory before loading
+  double peak_mb;       // peak resident memory
+  long faults;          // page faults of the first run
+};
+
+static double peak_rss_mb() {
+  struct rusage usage;
+  getrusage( RUSAGE_SELF, &usage );
+#ifdef __APPLE__
+  return usage.ru_maxrss / ( 1024.0 * 1024.0 );  // bytes
+#else
+  return usage.ru_maxrss / 1024.0;               // kilobytes
+#endif
+}
+
+static long page_faults() {
+  struct rusage usage;
+  getrusage( RUSAGE_SELF, &usage );
+  return usage.ru_minflt + usage.ru_majflt;
+}
+
+static const int kLoaders = 5;
+static const char* kLoaderNames[kLoaders] = {
+  "dom", "stream", "mmap", "binary", "inflate"
+};
+
+static bool is_compressed( const string& path ) {
+  size_t dot = path.find_last_of( "." );
+  return dot != string::npos && path.substr( dot + 1 ) == "svgz";
+}
+
+// decompress a compressed file without parsing it, storing the
+// decompressed size if size is not NULL. Stands in for a loader
+static int inflate_only( const char* path, size_t* size ) {
+
+  ifstream file( path, ios::binary );
+  vector<unsigned char> data( ( istreambuf_iterator<char>( file ) ),
+                              istreambuf_iterator<char>() );
+  if ( data.empty() ) return -1;
+
+  InflateStream stream;
+  if ( stream.open( &data[0], data.size(), kInflateGzip ) ) return -1;
+
+  vector<unsigned char> chunk( kXMLChunkSize );
+  size_t total = 0, n;
+  while ( ( n = stream.read( &chunk[0], chunk.size() ) ) ) total += n;
+
+  if ( size ) *size = total;
+  return stream.error() ? -1 : 0;
+}
+
+// precompiled scene of the file being measured
+static string scene_path;
+
+static int load( const char* path, int loader, SVG* svg ) {
+  switch ( loader ) {
+    case 0:  return SVGParser::loadDOM( path, svg );
+    case 1:  return SVGParser::loadStream( path, svg );
+    case 2:  return SVGParser::load( path, svg );
+    case 3:  return SVGParser::loadBinary( scene_path.c_str(), svg );
+    default: return inflate_only( path, NULL );
+  }
+}
+
+// whether a loader applies to a file
+static bool applies( int loader, bool compressed ) {
+  if ( loader == 0 ) return !compressed;   // tinyxml2 reads plain files
+  if ( loader == 4 ) return compressed;
+  return true;
+}
+
+// write the precompiled scene of path, in a process of its own so that
+// its memory is not counted
+static bool prepare( const char* path ) {
+
+  pid_t pid = fork();
+  if ( pid < 0 ) return false;
+
+  if ( pid == 0 ) {
+    SVG* svg = new SVG();
+    int status = SVGParser::load( path, svg );
+    if ( !status ) status = SVGParser::saveBinary( scene_path.c_str(), svg );
+    _exit( status ? 1 : 0 );
+  }
+
+  int status;
+  return waitpid( pid, &status, 0 ) == pid &&
+         WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+}
+
+// load path in a child process and report timings through a pipe
+static Result run( const char* path, int loader, int runs ) {
+
+  Result result = { -1, 0, 0, 0, 0 };
+
+  int fd[2];
+  if ( pipe( fd ) ) return result;
+
+  pid_t pid = fork();
+  if ( pid < 0 ) return result;
+
+  if ( pid == 0 ) {
+    close( fd[0] );
+
+    Result r = { 0, 1e30, peak_rss_mb(), 0, 0 };
+    for ( int i = 0; i < runs && r.status == 0; i++ ) {
+      SVG* svg = new SVG();
+      long faults = page_faults();
+      double t0 = now();
+      r.status = load( path, loader, svg );
+      double t1 = now();
+      if ( t1 - t0 < r.seconds ) r.seconds = t1 - t0;
+      if ( i == 0 ) {
+        r.peak_mb = peak_rss_mb();
+        r.faults = page_faults() - faults;
+      }
+      delete svg;
+    }
+
+    ssize_t n = write( fd[1], &r, sizeof( r ) );
+    close( fd[1] );
+    _exit( n == sizeof( r ) ? 0 : 1 );
+  }
+
+  close( fd[1] );
+  if ( read( fd[0], &result, sizeof( result ) ) != sizeof( result ) ) {
+    result.status = -1;
+  }
+  close( fd[0] );
+  waitpid( pid, NULL, 0 );
+
+  return result;
+}
+
+int main( int argc, char** argv ) {
+
+  int runs = 3;
+  vector<string> files;
+  for ( int i = 1; i < argc; i++ ) {
+    string arg = argv[i];
+    if ( arg == "-n" && i + 1 < argc ) {
+      runs = atoi( argv[++i] );
+      if ( runs < 1 ) runs = 1;
+    } else if ( !collect( arg, files ) ) {
+      cerr << "cannot read " << arg << endl;
+      return 1;
+    }
+  }
+
+  if ( files.empty() ) {
+    cerr << "usage: " << argv[0] << " [-n runs] <file or directory>..." << endl;
+    return 1;
+  }
+
+  printf( "%-32s %10s %-7s %10s %10s %12s %10s\n", "file", "size(MB)",
+          "loader", "time(ms)", "MB/s", "peak(MB)", "faults" );
+
+  char scene[64];
+  snprintf( scene, sizeof( scene ), "/tmp/load_bench_%d.bin", (int) getpid() );
+  scene_path = scene;
+
+  double total_mb = 0, total_s[kLoaders] = { 0, 0, 0, 0, 0 };
+  for ( size_t i = 0; i < files.size(); i++ ) {
+
+    struct stat st;
+    if ( stat( files[i].c_str(), &st ) ) {
+      cerr << "cannot stat " << files[i] << endl;
+      continue;
+    }
+    bool compressed = is_compressed( files[i] );
+    size_t bytes = st.st_size;
+    if ( compressed && inflate_only( files[i].c_str(), &bytes ) ) {
+      cerr << "cannot inflate " << files[i] << endl;
+      continue;
+    }
+    double mb = bytes / ( 1024.0 * 1024.0 );
+    total_mb += mb;
+
+    string name = files[i].substr( files[i].find_last_of( "/" ) + 1 );
+    bool prepared = prepare( files[i].c_str() );
+    double seconds[kLoaders] = { 0, 0, 0, 0, 0 };
+    for ( int loader = 0; loader < kLoaders; loader++ ) {
+      if ( !applies( loader, compressed ) ) continue;
+      Result r = { -1, 0, 0, 0, 0 };
+      if ( loader != 3 || prepared ) r = run( files[i].c_str(), loader, runs );
+      if ( r.status ) {
+        printf( "%-32s %10.3f %-7s %10s\n", name.c_str(), mb,
+                kLoaderNames[loader], "failed" );
+        continue;
+      }
+      total_s[loader] += r.seconds;
+      seconds[loader] = r.seconds;
+      printf( "%-32s %10.3f %-7s %10.3f %10.1f %12.1f %10ld\n",
+              name.c_str(), mb, kLoaderNames[loader], r.seconds * 1e3,
+              mb / r.seconds, r.peak_mb - r.baseline_mb, r.faults );
+    }
+    remove( scene_path.c_str() );
+
+    if ( seconds[2] > seconds[4] && seconds[4] > 0 ) {
+      double parse = seconds[2] - seconds[4];
+      printf( "%-32s %10.3f %-7s %10.3f %10.1f\n", name.c_str(), mb,
+              "parse", parse * 1e3, mb / parse );
+    }
+  }
+
+  for ( int loader = 0; loader < kLoaders; loader++ ) {
+    if ( total_s[loader] > 0 ) {
+      printf( "%-32s %10.3f %-7s %10.3f %10.1f\n", "total", total_mb,
+              kLoaderNames[loader], total_s[loader] * 1e3,
+              total_mb / total_s[loader] );
+    }
+  }
+
+  return 0;
+}
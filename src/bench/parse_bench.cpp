@@ -0,0 +1,151 @@
+/*
+ * Point list parsing benchmark.
+ *
+ * Collects the points attributes of every file and parses them with
+ * stream extraction, as the loader used to, and with parse_points.
+ * Reports throughput in MB of attribute text per second.
+ *
+ * usage: parse_bench [-t seconds] <file or directory>...
+ */
+
+#include "number.h"
+#include "xml_stream.h"
+#include "bench_util.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+
+using namespace std;
+using namespace CMU462;
+
+static bool collect_points( const char* path, vector<string>& lists ) {
+
+  XMLStream xml;
+  if ( !xml.map( path ) ) return false;
+
+  XMLToken token;
+  while ( ( token = xml.next() ) != XML_DONE ) {
+    if ( token == XML_ERROR ) return false;
+    if ( token != XML_START ) continue;
+    StringView points = xml.attribute( "points" );
+    if ( points.valid() ) lists.push_back( points.str() );
+  }
+  return true;
+}
+
+static size_t parse_stream( const vector<string>& lists, double& sum ) {
+
+  size_t count = 0;
+  for ( size_t i = 0; i < lists.size(); i++ ) {
+    stringstream points ( lists[i] );
+    float x, y; char c;
+    while ( points >> x >> c >> y ) {
+      sum += x + y;
+      count++;
+    }
+  }
+  return count;
+}
+
+static size_t parse_number( const vector<string>& lists, double& sum ) {
+
+  size_t count = 0;
+  vector<Vector2D> points;
+  for ( size_t i = 0; i < lists.size(); i++ ) {
+    points.clear();
+    const char* s = lists[i].c_str();
+    parse_points( s, s + lists[i].size(), points );
+    for ( size_t j = 0; j < points.size(); j++ ) {
+      sum += points[j].x + points[j].y;
+    }
+    count += points.size();
+  }
+  return count;
+}
+
+// best seconds per pass over lists, running for at least min_seconds
+static double time_parser( size_t (*parse)( const vector<string>&, double& ),
+                           const vector<string>& lists, double min_seconds,
+                           size_t& count ) {
+
+  double best = 1e30, sum = 0, start = now();
+  do {
+    double t0 = now();
+    count = parse( lists, sum );
+    double t1 = now();
+    if ( t1 - t0 < best ) best = t1 - t0;
+  } while ( now() - start < min_seconds );
+
+  // keep the results alive
+  if ( sum == 1e300 ) printf( "%f\n", sum );
+  return best;
+}
+
+int main( int argc, char** argv ) {
+
+  double min_seconds = 0.2;
+  vector<string> files;
+  for ( int i = 1; i < argc; i++ ) {
+    string arg = argv[i];
+    if ( arg == "-t" && i + 1 < argc ) {
+      min_seconds = atof( argv[++i] );
+    } else if ( !collect( arg, files ) ) {
+      cerr << "cannot read " << arg << endl;
+      return 1;
+    }
+  }
+
+  if ( files.empty() ) {
+    cerr << "usage: " << argv[0] << " [-t seconds] <file or directory>..."
+         << endl;
+    return 1;
+  }
+
+  printf( "%-32s %10s %10s %12s %12s %8s\n",
+          "file", "size(KB)", "points", "stream MB/s", "number MB/s",
+          "speedup" );
+
+  double total_mb = 0, total_s[2] = { 0, 0 };
+  for ( size_t i = 0; i < files.size(); i++ ) {
+
+    vector<string> lists;
+    if ( !collect_points( files[i].c_str(), lists ) ) {
+      cerr << "cannot read " << files[i] << endl;
+      continue;
+    }
+
+    size_t bytes = 0;
+    for ( size_t j = 0; j < lists.size(); j++ ) bytes += lists[j].size();
+    if ( bytes == 0 ) continue;
+    double mb = bytes / ( 1024.0 * 1024.0 );
+
+    size_t count_stream, count_number;
+    double s0 = time_parser( parse_stream, lists, min_seconds, count_stream );
+    double s1 = time_parser( parse_number, lists, min_seconds, count_number );
+
+    // stream extraction stops early on lists without commas
+    if ( count_stream != count_number ) {
+      cerr << files[i] << ": stream parsed " << count_stream
+           << " points, number parsed " << count_number << endl;
+    }
+
+    total_mb += mb; total_s[0] += s0; total_s[1] += s1;
+
+    string name = files[i].substr( files[i].find_last_of( "/" ) + 1 );
+    printf( "%-32s %10.1f %10zu %12.1f %12.1f %7.1fx\n",
+            name.c_str(), bytes / 1024.0, count_number,
+            mb / s0, mb / s1, s0 / s1 );
+  }
+
+  if ( total_s[0] > 0 && total_s[1] > 0 ) {
+    printf( "%-32s %10.1f %10s %12.1f %12.1f %7.1fx\n", "total",
+            total_mb * 1024.0, "", total_mb / total_s[0],
+            total_mb / total_s[1], total_s[0] / total_s[1] );
+  }
+
+  return 0;
+}
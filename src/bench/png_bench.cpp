@@ -0,0 +1,298 @@
+/*
+ * PNG decoding benchmark.
+ *
+ * Collects every PNG file, and every PNG embedded in an SVG file, and
+ * decodes them with PNGParser and with the LodePNG decoder of the CMU462
+ * library, checking that both give the same pixels. Reports full decode
+ * throughput in megapixels per second and inflate throughput in MB of
+ * decompressed data per second.
+ *
+ * With -e, also encodes a generated frame of the given size with
+ * PNGParser::save, on the calling thread and in bands on a pool, checking
+ * that the file decodes back to the frame.
+ *
+ * usage: png_bench [-t seconds] [-e width height] [-j threads]
+ *                  [file or directory]...
+ */
+
+#include "png.h"
+#include "task_pool.h"
+#include "inflate.h"
+#include "base64_decoder.h"
+#include "xml_stream.h"
+#include "bench_util.h"
+
+#include "lodepng.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+using namespace CMU462;
+
+typedef vector<unsigned char> Bytes;
+
+// files images are read from
+static bool is_image( const string& path ) {
+  return has_extension( path, "png" ) || has_extension( path, "svg" );
+}
+
+// the PNG files of a path, embedded ones for SVG files
+static bool collect_images( const string& path, vector<Bytes>& images ) {
+
+  if ( has_extension( path, "png" ) ) {
+    ifstream file( path.c_str(), ios::binary );
+    if ( !file ) return false;
+    images.push_back( Bytes( ( istreambuf_iterator<char>( file ) ),
+                             istreambuf_iterator<char>() ) );
+    return true;
+  }
+
+  XMLStream xml;
+  if ( !xml.map( path.c_str() ) ) return false;
+
+  XMLToken token;
+  while ( ( token = xml.next() ) != XML_DONE ) {
+    if ( token == XML_ERROR ) return false;
+    if ( token != XML_START ) continue;
+    StringView href = xml.attribute( "xlink:href" );
+    if ( !href.valid() ) continue;
+    const char* data = find( href.begin(), href.end(), ',' );
+    if ( data == href.end() ) continue;
+    Bytes image;
+    if ( base64_decode( data + 1, href.end(), image ) ) {
+      images.push_back( image );
+    }
+  }
+  return true;
+}
+
+// concatenated IDAT chunks of a PNG file, the zlib stream
+static Bytes idat( const Bytes& png ) {
+
+  Bytes stream;
+  for ( size_t pos = 8; pos + 12 <= png.size(); ) {
+    size_t length = ( png[pos] << 24 ) | ( png[pos + 1] << 16 ) |
+                    ( png[pos + 2] << 8 ) | png[pos + 3];
+    if ( pos + 12 + length > png.size() ) break;
+    if ( !memcmp( &png[pos + 4], "IDAT", 4 ) ) {
+      stream.insert( stream.end(), &png[pos + 8], &png[pos + 8 + length] );
+    }
+    pos += 12 + length;
+  }
+  return stream;
+}
+
+// decoders, returning the pixels as premultiplied by PNGParser
+
+static bool decode_png( const Bytes& file, Bytes& pixels ) {
+  PNG png;
+  if ( PNGParser::load( &file[0], file.size(), png ) ) return false;
+  pixels.swap( png.pixels );
+  return true;
+}
+
+static bool decode_lodepng( const Bytes& file, Bytes& pixels ) {
+  unsigned w, h;
+  pixels.clear();  // appended to
+  if ( lodepng::decode( pixels, w, h, &file[0], file.size() ) ) return false;
+  for ( size_t i = 0; i < pixels.size(); i += 4 ) {
+    if ( !pixels[i + 3] ) pixels[i] = pixels[i + 1] = pixels[i + 2] = 0;
+  }
+  return true;
+}
+
+static bool inflate_zlib( const Bytes& stream, Bytes& data ) {
+  data.clear();
+  return stream.size() && !zlib_decompress( &stream[0], stream.size(), data );
+}
+
+static bool inflate_lodepng( const Bytes& stream, Bytes& data ) {
+  data.clear();
+  return stream.size() && !lodepng::decompress( data, &stream[0],
+                                                stream.size() );
+}
+
+typedef bool (*Decoder)( const Bytes&, Bytes& );
+
+// best seconds per pass over inputs, running for at least min_seconds.
+// outputs holds the results of the last pass
+static double time_decoder( Decoder decode, const vector<Bytes>& inputs,
+                            double min_seconds, vector<Bytes>& outputs ) {
+
+  outputs.assign( inputs.size(), Bytes() );
+
+  double best = 1e30, start = now();
+  do {
+    double t0 = now();
+    for ( size_t i = 0; i < inputs.size(); i++ ) {
+      if ( !decode( inputs[i], outputs[i] ) ) outputs[i].clear();
+    }
+    double t1 = now();
+    if ( t1 - t0 < best ) best = t1 - t0;
+  } while ( now() - start < min_seconds );
+
+  return best;
+}
+
+// a frame like the renderer writes: flat shapes with antialiased edges over
+// a gradient
+static void generate_frame( PNG& png, size_t width, size_t height ) {
+
+  png.width = width;
+  png.height = height;
+  png.pixels.resize( 4 * width * height );
+  for ( size_t y = 0; y < height; y++ ) {
+    unsigned char* row = &png.pixels[4 * width * y];
+    for ( size_t x = 0; x < width; x++ ) {
+      size_t cell = ( x / 97 ) ^ ( y / 61 );
+      bool edge = x % 97 == 0 || y % 61 == 0;
+      row[4 * x + 0] = cell & 1 ? 255 : x * 255 / width;
+      row[4 * x + 1] = cell & 2 ? 128 : y * 255 / height;
+      row[4 * x + 2] = edge ? 96 : cell * 37;
+      row[4 * x + 3] = 255;
+    }
+  }
+}
+
+// best seconds to encode png, running for at least min_seconds. file holds
+// the result of the last pass
+static double time_encoder( const PNG& png, TaskPool* pool,
+                            double min_seconds, Bytes& file ) {
+
+  double best = 1e30, start = now();
+  do {
+    file.clear();
+    double t0 = now();
+    PNGParser::save( file, png, kDeflateDefault, pool );
+    double t1 = now();
+    if ( t1 - t0 < best ) best = t1 - t0;
+  } while ( now() - start < min_seconds );
+
+  return best;
+}
+
+static void encode( size_t width, size_t height, size_t threads,
+                    double min_seconds ) {
+
+  PNG png;
+  generate_frame( png, width, height );
+
+  TaskPool pool( threads );
+  Bytes serial, pooled;
+  double s0 = time_encoder( png, NULL,  min_seconds, serial );
+  double s1 = time_encoder( png, &pool, min_seconds, pooled );
+
+  PNG decoded;
+  if ( serial != pooled ) {
+    cerr << "encoding on the pool gives a different file" << endl;
+  } else if ( PNGParser::load( &pooled[0], pooled.size(), decoded ) ||
+              decoded.pixels != png.pixels ) {
+    cerr << "encoded frame does not decode back to the frame" << endl;
+  }
+
+  double mp = width * height / 1e6;
+  printf( "%-32s %8s %10s %10s %10s %10s %8s\n", "encode", "Mpixels",
+          "ratio", "serial s", "pool s", "pool MP/s", "speedup" );
+  char name[32];
+  snprintf( name, sizeof( name ), "%zux%zu", width, height );
+  printf( "%-32s %8.2f %9.1fx %10.3f %10.3f %10.1f %7.1fx\n", name, mp,
+          png.pixels.size() / (double) pooled.size(), s0, s1, mp / s1,
+          s0 / s1 );
+}
+
+int main( int argc, char** argv ) {
+
+  double min_seconds = 0.2;
+  size_t encode_width = 0, encode_height = 0, threads = 0;
+  vector<string> files;
+  for ( int i = 1; i < argc; i++ ) {
+    string arg = argv[i];
+    if ( arg == "-t" && i + 1 < argc ) {
+      min_seconds = atof( argv[++i] );
+    } else if ( arg == "-e" && i + 2 < argc ) {
+      encode_width  = max( 1, atoi( argv[++i] ) );
+      encode_height = max( 1, atoi( argv[++i] ) );
+    } else if ( arg == "-j" && i + 1 < argc ) {
+      threads = max( 1, atoi( argv[++i] ) );
+    } else if ( !collect( arg, files, is_image ) ) {
+      cerr << "cannot read " << arg << endl;
+      return 1;
+    }
+  }
+
+  if ( files.empty() && !encode_width ) {
+    cerr << "usage: " << argv[0] << " [-t seconds] [-e width height] "
+         << "[-j threads] [file or directory]..." << endl;
+    return 1;
+  }
+
+  if ( encode_width ) {
+    encode( encode_width, encode_height, threads, min_seconds );
+    if ( files.empty() ) return 0;
+    printf( "\n" );
+  }
+
+  printf( "%-32s %6s %8s %10s %10s %10s %10s %8s\n",
+          "file", "images", "Mpixels", "lode MP/s", "png MP/s",
+          "lode MB/s", "infl MB/s", "speedup" );
+
+  double total_mp = 0, total_mb = 0, total_s[4] = { 0, 0, 0, 0 };
+  for ( size_t i = 0; i < files.size(); i++ ) {
+
+    vector<Bytes> images;
+    if ( !collect_images( files[i], images ) ) {
+      cerr << "cannot read " << files[i] << endl;
+      continue;
+    }
+    if ( images.empty() ) continue;
+
+    vector<Bytes> streams;
+    for ( size_t j = 0; j < images.size(); j++ ) {
+      streams.push_back( idat( images[j] ) );
+    }
+
+    vector<Bytes> reference, pixels, inflated;
+    double s0 = time_decoder( decode_lodepng,  images,  min_seconds, reference );
+    double s1 = time_decoder( decode_png,      images,  min_seconds, pixels );
+    double s2 = time_decoder( inflate_lodepng, streams, min_seconds, inflated );
+    double s3 = time_decoder( inflate_zlib,    streams, min_seconds, inflated );
+
+    size_t bytes = 0, mismatches = 0;
+    for ( size_t j = 0; j < images.size(); j++ ) {
+      if ( pixels[j] != reference[j] ) mismatches++;
+      bytes += inflated[j].size();
+    }
+    if ( mismatches ) {
+      cerr << files[i] << ": " << mismatches << " of " << images.size()
+           << " images decode differently from LodePNG" << endl;
+    }
+
+    size_t texels = 0;
+    for ( size_t j = 0; j < pixels.size(); j++ ) texels += pixels[j].size() / 4;
+    double mp = texels / 1e6, mb = bytes / ( 1024.0 * 1024.0 );
+
+    total_mp += mp; total_mb += mb;
+    total_s[0] += s0; total_s[1] += s1; total_s[2] += s2; total_s[3] += s3;
+
+    string name = files[i].substr( files[i].find_last_of( "/" ) + 1 );
+    printf( "%-32s %6zu %8.2f %10.1f %10.1f %10.1f %10.1f %7.1fx\n",
+            name.c_str(), images.size(), mp, mp / s0, mp / s1,
+            mb / s2, mb / s3, s0 / s1 );
+  }
+
+  if ( total_s[1] > 0 && total_s[3] > 0 ) {
+    printf( "%-32s %6s %8.2f %10.1f %10.1f %10.1f %10.1f %7.1fx\n", "total",
+            "", total_mp, total_mp / total_s[0], total_mp / total_s[1],
+            total_mb / total_s[2], total_mb / total_s[3],
+            total_s[0] / total_s[1] );
+  }
+
+  return 0;
+}
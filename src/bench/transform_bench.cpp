@@ -0,0 +1,285 @@
+/*
+ * Transform attribute parsing benchmark.
+ *
+ * Collects the transform attributes of every file, plus generated lists
+ * of every transform type if asked for, and parses them with string
+ * splitting and 3x3 matrix products, as the loader used to, and with
+ * parse_transform. Checks that both give the same transforms and reports
+ * throughput in MB of attribute text and millions of attributes per
+ * second. Before timing, checks which lists parse_transform accepts.
+ *
+ * usage: transform_bench [-t seconds] [-g count] [file or directory]...
+ */
+
+#include "number.h"
+#include "xml_stream.h"
+#include "bench_util.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+using namespace CMU462;
+
+static bool collect_transforms( const char* path, vector<string>& lists ) {
+
+  XMLStream xml;
+  if ( !xml.map( path ) ) return false;
+
+  XMLToken token;
+  while ( ( token = xml.next() ) != XML_DONE ) {
+    if ( token == XML_ERROR ) return false;
+    if ( token != XML_START ) continue;
+    StringView transform = xml.attribute( "transform" );
+    if ( transform.valid() ) lists.push_back( transform.str() );
+  }
+  return true;
+}
+
+// lists of one to four transforms, as written by drawing programs
+static void generate_transforms( size_t count, vector<string>& lists ) {
+
+  static const char* kFormats[] = {
+    "translate(%.2f %.2f)", "scale(%.3f %.3f)", "rotate(%.1f %.1f %.1f)",
+    "matrix(%.4f %.4f %.4f %.4f %.2f %.2f)", "skewX(%.1f)", "skewY(%.1f)"
+  };
+
+  srand( 1 );
+  for ( size_t i = 0; i < count; i++ ) {
+    string list;
+    int n = 1 + rand() % 4;
+    for ( int j = 0; j < n; j++ ) {
+      double v[6];
+      for ( int k = 0; k < 6; k++ ) v[k] = ( rand() % 20000 ) / 100.0 - 100;
+      char buffer[128];
+      snprintf( buffer, sizeof( buffer ), kFormats[rand() % 6],
+                v[0], v[1], v[2], v[3], v[4], v[5] );
+      if ( j ) list += " ";
+      list += buffer;
+    }
+    lists.push_back( list );
+  }
+}
+
+// the loader before parse_transform
+static Matrix3x3 legacy_transform( const string& list ) {
+
+  Matrix3x3 transform = Matrix3x3::identity();
+
+  string trans_str = list; size_t paren_l, paren_r;
+  while ( trans_str.find_first_of('(') != string::npos ) {
+
+    paren_l = trans_str.find_first_of('(');
+    paren_r = trans_str.find_first_of(')');
+    if ( paren_r == string::npos ) paren_r = trans_str.size();
+
+    string type = trans_str.substr(0, paren_l);
+
+    float values[6] = { 0, 0, 0, 0, 0, 0 };
+    const char* args = trans_str.c_str() + paren_l + 1;
+    size_t count = parse_numbers( args, trans_str.c_str() + paren_r,
+                                  values, 6 );
+
+    Matrix3x3 m = Matrix3x3::identity();
+    if ( type == "matrix" ) {
+      m(0,0) = values[0]; m(0,1) = values[2]; m(0,2) = values[4];
+      m(1,0) = values[1]; m(1,1) = values[3]; m(1,2) = values[5];
+    } else if ( type == "translate" ) {
+      m(0,2) = count > 0 ? values[0] : 0;
+      m(1,2) = count > 1 ? values[1] : 0;
+    } else if ( type == "scale" ) {
+      m(0,0) = count > 0 ? values[0] : 1;
+      m(1,1) = count > 1 ? values[1] : 1;
+    } else if ( type == "rotate" ) {
+      float a = values[0], x = values[1], y = values[2];
+      m(0,0) = cos(a*PI/180.0f); m(0,1) = -sin(a*PI/180.0f);
+      m(1,0) = sin(a*PI/180.0f); m(1,1) =  cos(a*PI/180.0f);
+      if ( x != 0 || y != 0 ) {
+        m(0,2) = -x * cos(a*PI/180.0f) + y * sin(a*PI/180.0f) + x;
+        m(1,2) = -x * sin(a*PI/180.0f) - y * cos(a*PI/180.0f) + y;
+      }
+    } else if ( type == "skewX" ) {
+      m(0,1) = tan(values[0]*PI/180.0f);
+    } else if ( type == "skewY" ) {
+      m(1,0) = tan(values[0]*PI/180.0f);
+    }
+    transform = transform * m;
+
+    size_t end = paren_r + 2;
+    trans_str.erase(0, end);
+  }
+
+  return transform;
+}
+
+static double parse_legacy( const vector<string>& lists,
+                            vector<Affine2D>& results ) {
+  double t0 = now();
+  for ( size_t i = 0; i < lists.size(); i++ ) {
+    Affine2D::fromMatrix( legacy_transform( lists[i] ), results[i] );
+  }
+  return now() - t0;
+}
+
+static double parse_folded( const vector<string>& lists,
+                            vector<Affine2D>& results ) {
+  double t0 = now();
+  for ( size_t i = 0; i < lists.size(); i++ ) {
+    const char* s = lists[i].c_str();
+    results[i] = Affine2D();
+    parse_transform( s, s + lists[i].size(), results[i] );
+  }
+  return now() - t0;
+}
+
+// lists parse_transform must accept or reject, as SVG allows 6 arguments
+// for matrix, 1 or 2 for translate and scale, 1 or 3 for rotate and 1 for
+// skewX and skewY
+static const struct { const char* list; bool valid; } kChecks[] = {
+  { "matrix(1 0 0 1 5 5)", true },
+  { "translate(10)", true },     { "translate(10, 20)", true },
+  { "scale(2)", true },          { "scale(2 3)", true },
+  { "rotate(45)", true },        { "rotate(45 5 5)", true },
+  { "skewX(10)", true },         { "skewY(10)", true },
+  { "translate(1) , scale(2)", true },
+  { "matrix(1 0 0 1 5)", false }, { "matrix(1 0 0 1 5 5 5)", false },
+  { "translate()", false },      { "translate(1 2 3)", false },
+  { "scale()", false },          { "scale(1 2 3)", false },
+  { "rotate()", false },         { "rotate(1 2)", false },
+  { "rotate(1 2 3 4)", false },
+  { "skewX()", false },          { "skewX(1 2)", false },
+  { "skewY()", false },          { "skewY(1 2)", false },
+  { "translate(1) rotate(1 2)", false },
+  { "translate(1", false },      { "shear(1)", false },
+};
+
+// number of lists in kChecks parse_transform gets wrong
+static size_t check_transforms() {
+  size_t failures = 0;
+  for ( size_t i = 0; i < sizeof( kChecks ) / sizeof( kChecks[0] ); i++ ) {
+    const char* s = kChecks[i].list;
+    Affine2D m;
+    if ( parse_transform( s, s + strlen( s ), m ) != kChecks[i].valid ) {
+      cerr << "parse_transform " << ( kChecks[i].valid ? "rejects" : "accepts" )
+           << " \"" << s << "\"" << endl;
+      failures++;
+    }
+  }
+  return failures;
+}
+
+typedef double (*Parser)( const vector<string>&, vector<Affine2D>& );
+
+// best seconds per pass over lists, running for at least min_seconds
+static double time_parser( Parser parse, const vector<string>& lists,
+                           double min_seconds, vector<Affine2D>& results ) {
+
+  results.assign( lists.size(), Affine2D() );
+
+  double best = 1e30, start = now();
+  do {
+    double seconds = parse( lists, results );
+    if ( seconds < best ) best = seconds;
+  } while ( now() - start < min_seconds );
+
+  return best;
+}
+
+static bool same( const Affine2D& x, const Affine2D& y ) {
+  double scale = fabs( x.a ) + fabs( x.b ) + fabs( x.c ) + fabs( x.d ) +
+                 fabs( x.e ) + fabs( x.f ) + 1;
+  double error = fabs( x.a - y.a ) + fabs( x.b - y.b ) + fabs( x.c - y.c ) +
+                 fabs( x.d - y.d ) + fabs( x.e - y.e ) + fabs( x.f - y.f );
+  return error <= scale * 1e-9;
+}
+
+int main( int argc, char** argv ) {
+
+  double min_seconds = 0.2;
+  size_t generated = 0;
+  vector<string> files;
+  for ( int i = 1; i < argc; i++ ) {
+    string arg = argv[i];
+    if ( arg == "-t" && i + 1 < argc ) {
+      min_seconds = atof( argv[++i] );
+    } else if ( arg == "-g" && i + 1 < argc ) {
+      generated = atol( argv[++i] );
+    } else if ( !collect( arg, files ) ) {
+      cerr << "cannot read " << arg << endl;
+      return 1;
+    }
+  }
+
+  if ( files.empty() && !generated ) {
+    cerr << "usage: " << argv[0]
+         << " [-t seconds] [-g count] [file or directory]..." << endl;
+    return 1;
+  }
+
+  if ( check_transforms() ) return 1;
+
+  printf( "%-32s %10s %10s %12s %12s %12s %8s\n", "file", "size(KB)",
+          "lists", "legacy MB/s", "folded MB/s", "folded M/s", "speedup" );
+
+  // generated lists go first, under their own name
+  vector< vector<string> > inputs;
+  vector<string> names;
+  if ( generated ) {
+    inputs.push_back( vector<string>() );
+    generate_transforms( generated, inputs.back() );
+    names.push_back( "(generated)" );
+  }
+  for ( size_t i = 0; i < files.size(); i++ ) {
+    vector<string> lists;
+    if ( !collect_transforms( files[i].c_str(), lists ) ) {
+      cerr << "cannot read " << files[i] << endl;
+      continue;
+    }
+    if ( lists.empty() ) continue;
+    inputs.push_back( lists );
+    names.push_back( files[i].substr( files[i].find_last_of( "/" ) + 1 ) );
+  }
+
+  double total_mb = 0, total_s[2] = { 0, 0 };
+  for ( size_t i = 0; i < inputs.size(); i++ ) {
+
+    const vector<string>& lists = inputs[i];
+    size_t bytes = 0;
+    for ( size_t j = 0; j < lists.size(); j++ ) bytes += lists[j].size();
+    double mb = bytes / ( 1024.0 * 1024.0 );
+
+    vector<Affine2D> legacy, folded;
+    double s0 = time_parser( parse_legacy, lists, min_seconds, legacy );
+    double s1 = time_parser( parse_folded, lists, min_seconds, folded );
+
+    // the legacy parser ignores a transform written right after another
+    // one's ')', and scales y by 1 for scale(s)
+    size_t mismatches = 0;
+    for ( size_t j = 0; j < lists.size(); j++ ) {
+      if ( !same( legacy[j], folded[j] ) ) mismatches++;
+    }
+    if ( mismatches ) {
+      cerr << names[i] << ": " << mismatches << " of " << lists.size()
+           << " transforms differ from the legacy parser" << endl;
+    }
+
+    total_mb += mb; total_s[0] += s0; total_s[1] += s1;
+
+    printf( "%-32s %10.1f %10zu %12.1f %12.1f %12.2f %7.1fx\n",
+            names[i].c_str(), bytes / 1024.0, lists.size(), mb / s0,
+            mb / s1, lists.size() / s1 * 1e-6, s0 / s1 );
+  }
+
+  if ( total_s[0] > 0 && total_s[1] > 0 ) {
+    printf( "%-32s %10.1f %10s %12.1f %12.1f %12s %7.1fx\n", "total",
+            total_mb * 1024.0, "", total_mb / total_s[0],
+            total_mb / total_s[1], "", total_s[0] / total_s[1] );
+  }
+
+  return 0;
+}
@@ -0,0 +1,567 @@
+#include "deflate.h"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+static const size_t kWindow = 32768;
+static const size_t kMinMatch = 4;      // hashed prefix length
+static const size_t kMaxMatch = 258;
+static const size_t kMaxStored = 65535;
+
+// symbols per block, each block gets its own Huffman codes
+static const size_t kBlockSymbols = 1 << 15;
+
+// hash chain probes per position, by level
+static const int kProbes[3] = { 0, 1, 16 };
+
+static const int kHashBits = 15;
+
+static const int kMaxCodeLength = 15;
+static const int kMaxCodeLengthCodeLength = 7;
+
+static const uint8_t kCodeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Code tables //
+
+// length and distance symbols and extra bits
+struct CodeTables {
+
+  uint8_t length_code[kMaxMatch + 1];     // length -> code - 257
+  uint16_t length_base[29];
+  uint8_t length_extra[29];
+
+  uint8_t distance_code[512];             // see distance_symbol
+  uint16_t distance_base[30];
+  uint8_t distance_extra[30];
+
+  CodeTables() {
+
+    int length = 3;
+    for ( int code = 0; code < 28; ++code ) {
+      length_extra[code] = code < 8 ? 0 : ( code - 4 ) / 4;
+      length_base[code] = length;
+      for ( int i = 0; i < ( 1 << length_extra[code] ); ++i ) {
+        length_code[length++] = code;
+      }
+    }
+    length_code[258] = 28;
+    length_base[28] = 258; length_extra[28] = 0;
+
+    int distance = 1;
+    for ( int code = 0; code < 30; ++code ) {
+      distance_extra[code] = code < 4 ? 0 : ( code - 2 ) / 2;
+      distance_base[code] = distance;
+      distance += 1 << distance_extra[code];
+    }
+
+    // distances up to 256 directly, longer ones by their top bits
+    for ( int d = 1; d <= 256; ++d ) {
+      distance_code[d - 1] = code_of( d );
+    }
+    for ( int d = 257; d <= 32768; d += 128 ) {
+      distance_code[256 + ( ( d - 1 ) >> 7 )] = code_of( d );
+    }
+  }
+
+  int code_of( int distance ) const {
+    int code = 0;
+    while ( code < 29 && distance_base[code + 1] <= distance ) code++;
+    return code;
+  }
+
+  inline int distance_symbol( unsigned distance ) const {
+    return distance <= 256 ? distance_code[distance - 1]
+                           : distance_code[256 + ( ( distance - 1 ) >> 7 )];
+  }
+
+};
+
+static const CodeTables kCodes;
+
+// Checksums //
+
+uint32_t adler32( uint32_t adler, const unsigned char* data, size_t size ) {
+
+  static const uint32_t kBase = 65521;
+  static const size_t kMaxRun = 5552;  // sums cannot overflow 32 bits
+
+  uint32_t a = adler & 0xffff, b = adler >> 16;
+  while ( size ) {
+    size_t n = min( size, kMaxRun );
+    size -= n;
+    for ( ; n; --n ) {
+      a += *data++;
+      b += a;
+    }
+    a %= kBase;
+    b %= kBase;
+  }
+  return ( b << 16 ) | a;
+}
+
+uint32_t adler32_combine( uint32_t first, uint32_t second, size_t size ) {
+
+  static const uint32_t kBase = 65521;
+
+  uint32_t remainder = (uint32_t) ( size % kBase );
+  uint32_t a = first & 0xffff;
+  uint32_t b = (uint32_t) ( ( (uint64_t) remainder * a ) % kBase );
+  a += ( second & 0xffff ) + kBase - 1;
+  b += ( first >> 16 ) + ( second >> 16 ) + kBase - remainder;
+  if ( a >= kBase ) a -= kBase;
+  if ( a >= kBase ) a -= kBase;
+  if ( b >= kBase * 2 ) b -= kBase * 2;
+  if ( b >= kBase ) b -= kBase;
+  return ( b << 16 ) | a;
+}
+
+// four tables, to process four bytes per step
+struct CRCTables {
+
+  uint32_t table[4][256];
+
+  CRCTables() {
+    for ( uint32_t n = 0; n < 256; ++n ) {
+      uint32_t c = n;
+      for ( int k = 0; k < 8; ++k ) c = c & 1 ? 0xedb88320u ^ ( c >> 1 ) : c >> 1;
+      table[0][n] = c;
+    }
+    for ( uint32_t n = 0; n < 256; ++n ) {
+      for ( int k = 1; k < 4; ++k ) {
+        uint32_t c = table[k - 1][n];
+        table[k][n] = table[0][c & 0xff] ^ ( c >> 8 );
+      }
+    }
+  }
+
+};
+
+static const CRCTables kCRC;
+
+uint32_t crc32( uint32_t crc, const unsigned char* data, size_t size ) {
+
+  uint32_t c = ~crc;
+  for ( ; size >= 4; size -= 4, data += 4 ) {
+    c ^= data[0] | ( data[1] << 8 ) | ( data[2] << 16 ) |
+         ( (uint32_t) data[3] << 24 );
+    c = kCRC.table[3][c & 0xff] ^ kCRC.table[2][( c >> 8 ) & 0xff] ^
+        kCRC.table[1][( c >> 16 ) & 0xff] ^ kCRC.table[0][c >> 24];
+  }
+  for ( ; size; --size ) {
+    c = kCRC.table[0][( c ^ *data++ ) & 0xff] ^ ( c >> 8 );
+  }
+  return ~c;
+}
+
+// Bit output //
+
+class BitWriter {
+ public:
+
+  BitWriter( vector<unsigned char>& out ) : out( out ), bits( 0 ), count( 0 ) { }
+
+  // write the low n bits of value, least significant first (n <= 32)
+  inline void put( uint32_t value, unsigned n ) {
+    bits |= (uint64_t) value << count;
+    count += n;
+    if ( count >= 32 ) {
+      unsigned char word[4] = { (unsigned char) bits,
+                                (unsigned char) ( bits >> 8 ),
+                                (unsigned char) ( bits >> 16 ),
+                                (unsigned char) ( bits >> 24 ) };
+      out.insert( out.end(), word, word + 4 );
+      bits >>= 32;
+      count -= 32;
+    }
+  }
+
+  // pad with zero bits to a byte boundary and flush
+  void align( void ) {
+    while ( count > 0 ) {
+      out.push_back( (unsigned char) bits );
+      bits >>= 8;
+      count = count > 8 ? count - 8 : 0;
+    }
+    bits = 0;
+  }
+
+  vector<unsigned char>& out;
+
+ private:
+
+  uint64_t bits;
+  unsigned count;
+
+}; // class BitWriter
+
+// Huffman codes //
+
+// code lengths of an optimal prefix code for freq, no longer than limit.
+// Over long codes are fixed by flattening the frequencies and retrying
+static void build_lengths( const uint32_t* freq, int n, int limit,
+                           uint8_t* lengths ) {
+
+  memset( lengths, 0, n );
+
+  vector<uint32_t> weights( freq, freq + n );
+  while ( true ) {
+
+    // leaves by increasing weight
+    vector<pair<uint32_t, int> > leaves;
+    for ( int i = 0; i < n; ++i ) {
+      if ( weights[i] ) leaves.push_back( make_pair( weights[i], i ) );
+    }
+    if ( leaves.empty() ) return;
+    if ( leaves.size() == 1 ) {
+      lengths[leaves[0].second] = 1;
+      return;
+    }
+    sort( leaves.begin(), leaves.end() );
+
+    // two queue construction: internal nodes are made in increasing
+    // weight order, nodes are leaves first then internal ones
+    size_t m = leaves.size();
+    vector<uint64_t> weight( 2 * m - 1 );
+    vector<int> parent( 2 * m - 1 );
+    for ( size_t i = 0; i < m; ++i ) weight[i] = leaves[i].first;
+
+    size_t leaf = 0, node = m;
+    for ( size_t next = m; next < 2 * m - 1; ++next ) {
+      size_t pick[2];
+      for ( int k = 0; k < 2; ++k ) {
+        if ( leaf < m && ( node >= next || weight[leaf] <= weight[node] ) ) {
+          pick[k] = leaf++;
+        } else {
+          pick[k] = node++;
+        }
+      }
+      weight[next] = weight[pick[0]] + weight[pick[1]];
+      parent[pick[0]] = parent[pick[1]] = (int) next;
+    }
+
+    // depths from the root down
+    vector<int> depth( 2 * m - 1, 0 );
+    int longest = 0;
+    for ( int i = (int) ( 2 * m ) - 3; i >= 0; --i ) {
+      depth[i] = depth[parent[i]] + 1;
+      if ( i < (int) m && depth[i] > longest ) longest = depth[i];
+    }
+
+    if ( longest <= limit ) {
+      for ( size_t i = 0; i < m; ++i ) {
+        lengths[leaves[i].second] = depth[i];
+      }
+      return;
+    }
+
+    for ( int i = 0; i < n; ++i ) {
+      if ( weights[i] ) weights[i] = ( weights[i] >> 1 ) | 1;
+    }
+  }
+}
+
+// canonical codes for lengths, bit reversed for the LSB first output
+static void build_codes( const uint8_t* lengths, int n, uint16_t* codes ) {
+
+  int count[kMaxCodeLength + 1] = { 0 };
+  for ( int i = 0; i < n; ++i ) count[lengths[i]]++;
+  count[0] = 0;
+
+  unsigned next[kMaxCodeLength + 2] = { 0 };
+  for ( int length = 1; length <= kMaxCodeLength; ++length ) {
+    next[length + 1] = ( next[length] + count[length] ) << 1;
+  }
+
+  for ( int i = 0; i < n; ++i ) {
+    int length = lengths[i];
+    if ( !length ) continue;
+    unsigned code = next[length]++, reversed = 0;
+    for ( int k = 0; k < length; ++k ) {
+      reversed = ( reversed << 1 ) | ( code & 1 );
+      code >>= 1;
+    }
+    codes[i] = reversed;
+  }
+}
+
+// Blocks //
+
+// a literal (distance 0) or a match
+struct Symbol {
+  uint16_t length;    // literal byte or match length
+  uint16_t distance;
+};
+
+static void write_stored( BitWriter& writer, const unsigned char* data,
+                          size_t size, bool final ) {
+
+  do {
+    size_t n = min( size, kMaxStored );
+    size -= n;
+
+    writer.put( final && size == 0, 1 );
+    writer.put( 0, 2 );
+    writer.align();
+
+    unsigned char header[4] = { (unsigned char) n, (unsigned char) ( n >> 8 ),
+                                (unsigned char) ~n,
+                                (unsigned char) ( ~n >> 8 ) };
+    writer.out.insert( writer.out.end(), header, header + 4 );
+    writer.out.insert( writer.out.end(), data, data + n );
+    data += n;
+  } while ( size );
+}
+
+// write symbols as a dynamic Huffman block, or the raw bytes they cover
+// as stored blocks if that is smaller
+static void write_block( BitWriter& writer, const Symbol* symbols,
+                         size_t count, const unsigned char* raw,
+                         size_t raw_size, bool final ) {
+
+  uint32_t freq[286] = { 0 }, dfreq[30] = { 0 };
+  for ( size_t i = 0; i < count; ++i ) {
+    if ( symbols[i].distance ) {
+      freq[257 + kCodes.length_code[symbols[i].length]]++;
+      dfreq[kCodes.distance_symbol( symbols[i].distance )]++;
+    } else {
+      freq[symbols[i].length]++;
+    }
+  }
+  freq[256] = 1;
+
+  uint8_t lengths[286 + 30];
+  uint8_t* dlengths = lengths + 286;
+  build_lengths( freq, 286, kMaxCodeLength, lengths );
+  build_lengths( dfreq, 30, kMaxCodeLength, dlengths );
+
+  // at least one distance code, even if unused
+  bool any = false;
+  for ( int i = 0; i < 30; ++i ) any |= dlengths[i] != 0;
+  if ( !any ) dlengths[0] = 1;
+
+  int nlit = 286, ndist = 30;
+  while ( nlit > 257 && !lengths[nlit - 1] ) nlit--;
+  while ( ndist > 1 && !dlengths[ndist - 1] ) ndist--;
+
+  // code lengths of both codes as one run length coded sequence
+  uint8_t all[286 + 30];
+  memcpy( all, lengths, nlit );
+  memcpy( all + nlit, dlengths, ndist );
+  int total = nlit + ndist;
+
+  uint8_t rle[286 + 30], rle_extra[286 + 30];
+  int nrle = 0;
+  uint32_t cfreq[19] = { 0 };
+  for ( int i = 0; i < total; ) {
+    int value = all[i], run = 1;
+    while ( i + run < total && all[i + run] == value ) run++;
+
+    if ( value == 0 && run >= 3 ) {
+      run = min( run, 138 );
+      rle[nrle] = run >= 11 ? 18 : 17;
+      rle_extra[nrle++] = run >= 11 ? run - 11 : run - 3;
+    } else if ( value != 0 && run >= 4 ) {
+      run = min( run, 7 );  // the value itself, then 3 to 6 repeats
+      rle[nrle] = value; rle_extra[nrle++] = 0;
+      rle[nrle] = 16;    rle_extra[nrle++] = run - 4;
+      cfreq[value]++;
+    } else {
+      run = 1;
+      rle[nrle] = value; rle_extra[nrle++] = 0;
+    }
+    cfreq[rle[nrle - 1]]++;
+    i += run;
+  }
+
+  uint8_t clengths[19];
+  build_lengths( cfreq, 19, kMaxCodeLengthCodeLength, clengths );
+  int nclen = 19;
+  while ( nclen > 4 && !clengths[kCodeLengthOrder[nclen - 1]] ) nclen--;
+
+  // compare sizes
+  static const uint8_t kRLEExtraBits[19] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7
+  };
+  uint64_t bits = 3 + 5 + 5 + 4 + 3 * nclen;
+  for ( int i = 0; i < 19; ++i ) {
+    bits += (uint64_t) cfreq[i] * ( clengths[i] + kRLEExtraBits[i] );
+  }
+  for ( int i = 0; i < 286; ++i ) {
+    bits += (uint64_t) freq[i] * lengths[i];
+    if ( i > 256 ) bits += (uint64_t) freq[i] * kCodes.length_extra[i - 257];
+  }
+  for ( int i = 0; i < 30; ++i ) {
+    bits += (uint64_t) dfreq[i] * ( dlengths[i] + kCodes.distance_extra[i] );
+  }
+  uint64_t stored_bits = ( raw_size + 5 * ( raw_size / kMaxStored + 1 ) ) * 8;
+  if ( stored_bits < bits ) {
+    write_stored( writer, raw, raw_size, final );
+    return;
+  }
+
+  uint16_t codes[286], dcodes[30], ccodes[19];
+  build_codes( lengths, 286, codes );
+  build_codes( dlengths, 30, dcodes );
+  build_codes( clengths, 19, ccodes );
+
+  writer.put( final, 1 );
+  writer.put( 2, 2 );
+  writer.put( nlit - 257, 5 );
+  writer.put( ndist - 1, 5 );
+  writer.put( nclen - 4, 4 );
+  for ( int i = 0; i < nclen; ++i ) {
+    writer.put( clengths[kCodeLengthOrder[i]], 3 );
+  }
+  for ( int i = 0; i < nrle; ++i ) {
+    writer.put( ccodes[rle[i]], clengths[rle[i]] );
+    if ( rle[i] >= 16 ) writer.put( rle_extra[i], kRLEExtraBits[rle[i]] );
+  }
+
+  for ( size_t i = 0; i < count; ++i ) {
+    const Symbol& s = symbols[i];
+    if ( !s.distance ) {
+      writer.put( codes[s.length], lengths[s.length] );
+      continue;
+    }
+    int lcode = kCodes.length_code[s.length];
+    writer.put( codes[257 + lcode], lengths[257 + lcode] );
+    writer.put( s.length - kCodes.length_base[lcode],
+                kCodes.length_extra[lcode] );
+    int dcode = kCodes.distance_symbol( s.distance );
+    writer.put( dcodes[dcode], dlengths[dcode] );
+    writer.put( s.distance - kCodes.distance_base[dcode],
+                kCodes.distance_extra[dcode] );
+  }
+  writer.put( codes[256], lengths[256] );
+}
+
+// Matching //
+
+static inline uint32_t load32( const unsigned char* p ) {
+  uint32_t word;
+  memcpy( &word, p, sizeof( word ) );
+  return word;
+}
+
+static inline uint32_t hash4( const unsigned char* p ) {
+  return ( load32( p ) * 2654435761u ) >> ( 32 - kHashBits );
+}
+
+// length of the common prefix of a and b, up to limit
+static inline size_t match_length( const unsigned char* a,
+                                   const unsigned char* b, size_t limit ) {
+  size_t n = 0;
+#if defined(__GNUC__) && \
+    defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while ( n + 8 <= limit ) {
+    uint64_t x, y;
+    memcpy( &x, a + n, 8 );
+    memcpy( &y, b + n, 8 );
+    if ( x != y ) return n + ( __builtin_ctzll( x ^ y ) >> 3 );
+    n += 8;
+  }
+#endif
+  while ( n < limit && a[n] == b[n] ) n++;
+  return n;
+}
+
+void deflate( const unsigned char* data, size_t size, size_t window,
+              int level, bool final, vector<unsigned char>& out ) {
+
+  BitWriter writer( out );
+
+  if ( level <= kDeflateStore || size == 0 ) {
+    if ( size || final ) write_stored( writer, data, size, final );
+  } else {
+
+    int probes = kProbes[min( level, kDeflateDefault )];
+
+    // positions are relative to the start of the window
+    window = min( window, kWindow );
+    const unsigned char* base = data - window;
+    size_t end = window + size;
+
+    vector<int32_t> head( 1 << kHashBits, -1 );
+    vector<int32_t> chain( probes > 1 ? end : 0 );
+
+    for ( size_t pos = 0; pos + kMinMatch <= window; ++pos ) {
+      uint32_t h = hash4( base + pos );
+      if ( probes > 1 ) chain[pos] = head[h];
+      head[h] = (int32_t) pos;
+    }
+
+    vector<Symbol> symbols;
+    symbols.reserve( kBlockSymbols );
+    size_t block = window;   // start of the current block
+
+    for ( size_t pos = window; pos < end; ) {
+
+      size_t best = 0, distance = 0;
+      if ( pos + kMinMatch <= end ) {
+
+        size_t limit = min( kMaxMatch, end - pos );
+        uint32_t h = hash4( base + pos );
+        int32_t candidate = head[h];
+        for ( int probe = 0; probe < probes && candidate >= 0; ++probe ) {
+          if ( pos - candidate > kWindow ) break;
+          size_t length = match_length( base + candidate, base + pos, limit );
+          if ( length > best ) {
+            best = length;
+            distance = pos - candidate;
+            if ( length == limit ) break;
+          }
+          if ( probes == 1 ) break;
+          candidate = chain[candidate];
+        }
+
+        if ( probes > 1 ) chain[pos] = head[h];
+        head[h] = (int32_t) pos;
+      }
+
+      Symbol symbol;
+      if ( best >= kMinMatch ) {
+        symbol.length = (uint16_t) best;
+        symbol.distance = (uint16_t) distance;
+
+        // the fast level does not index positions inside matches
+        if ( probes > 1 ) {
+          for ( size_t i = pos + 1; i < pos + best && i + kMinMatch <= end; ++i ) {
+            uint32_t h = hash4( base + i );
+            chain[i] = head[h];
+            head[h] = (int32_t) i;
+          }
+        }
+        pos += best;
+      } else {
+        symbol.length = base[pos];
+        symbol.distance = 0;
+        pos++;
+      }
+      symbols.push_back( symbol );
+
+      if ( symbols.size() == kBlockSymbols || pos == end ) {
+        write_block( writer, &symbols[0], symbols.size(), base + block,
+                     pos - block, final && pos == end );
+        symbols.clear();
+        block = pos;
+      }
+    }
+  }
+
+  // byte align, the sync flush marker lets pieces be concatenated
+  if ( !final ) {
+    writer.put( 0, 3 );
+    writer.align();
+    unsigned char marker[4] = { 0, 0, 0xff, 0xff };
+    out.insert( out.end(), marker, marker + 4 );
+  }
+  writer.align();
+}
+
+} // namespace CMU462
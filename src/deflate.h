@@ -0,0 +1,39 @@
+#ifndef CMU462_DEFLATE_H
+#define CMU462_DEFLATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace CMU462 {
+
+// compression levels
+static const int kDeflateStore   = 0;  // stored blocks, no compression
+static const int kDeflateFast    = 1;  // one match candidate per position
+static const int kDeflateDefault = 2;  // short hash chains
+
+/**
+ * Compress size bytes at data into deflate blocks (RFC 1951), appending
+ * them to out. The window bytes just before data (up to 32k are used) are
+ * history that matches may refer to without being compressed, so that
+ * independent pieces of one stream can be compressed in parallel, each
+ * with the end of the previous piece as its window.
+ *
+ * The output always ends on a byte boundary, so pieces can be
+ * concatenated. With final the last block is marked as the end of the
+ * stream, otherwise an empty stored block follows it (a sync flush).
+ */
+void deflate( const unsigned char* data, size_t size, size_t window,
+              int level, bool final, std::vector<unsigned char>& out );
+
+// running checksums, start from adler32( 1, ... ) and crc32( 0, ... )
+uint32_t adler32( uint32_t adler, const unsigned char* data, size_t size );
+uint32_t crc32( uint32_t crc, const unsigned char* data, size_t size );
+
+// adler32 of two concatenated pieces, from their checksums and the size
+// of the second
+uint32_t adler32_combine( uint32_t first, uint32_t second, size_t size );
+
+} // namespace CMU462
+
+#endif // CMU462_DEFLATE_H
@@ -0,0 +1,270 @@
+/*
+ * Headless image comparison.
+ *
+ * Renders every file with SoftwareRendererImp and compares the frame with
+ * the one SoftwareRendererRef renders, or with a golden PNG stored
+ * earlier, reporting the differing pixels, the largest channel error,
+ * PSNR and SSIM. Heatmaps of the differences can be written as PNG.
+ *
+ * usage: drawsvg_diff [options] <file or directory>...
+ *   -s <width> <height> frame size in pixels (default: 800 600)
+ *   -r <rate>           sample rate, samples per pixel side (default: 1)
+ *   -g <dir>            compare with <dir>/<name>.png instead of the
+ *                       reference renderer
+ *   -u <dir>            write the frames as goldens to <dir>/<name>.png,
+ *                       nothing is compared
+ *   -o <dir>            write heatmaps to <dir>/<name>.png
+ *   -p <dB>             fail files with a lower PSNR
+ *   -m <ssim>           fail files with a lower SSIM
+ *   -j <threads>        workers for comparing and encoding (default:
+ *                       hardware threads)
+ *
+ * <name> is the path of the file relative to the directory argument it was
+ * found under, without its extension (basic/test1 for basic/test1.svg
+ * under svg/), or the file name of a file argument. Directories are
+ * searched recursively.
+ *
+ * Exits with 1 if any file cannot be compared or fails a threshold.
+ */
+
+#include "svg.h"
+#include "png.h"
+#include "texture.h"
+#include "viewport.h"
+#include "task_pool.h"
+#include "image_diff.h"
+#include "software_renderer.h"
+#include "bench/bench_util.h"
+
+#include <sys/stat.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <map>
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[DrawSVG] " << s << endl;
+
+struct Options {
+  size_t width, height;
+  size_t sample_rate;
+  string golden, update, heatmaps;
+  double min_psnr, min_ssim;
+};
+
+// draw the document with renderer into frame, as the viewer opens it
+static void render( SoftwareRenderer& renderer, Sampler2D& sampler,
+                    SVG& svg, const Options& options,
+                    vector<unsigned char>& frame ) {
+
+  size_t width = options.width, height = options.height;
+  frame.assign( 4 * width * height, 255 );
+
+  renderer.set_tex_sampler( &sampler );
+  renderer.set_render_target( &frame[0], width, height );
+  renderer.set_sample_rate( options.sample_rate );
+
+  ViewportImp viewport;
+  float span = 1.2 * max( svg.width, svg.height ) / 2;
+  viewport.set_viewbox( svg.width / 2, svg.height / 2, span );
+
+  // the largest centered square of the frame shows the view
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = ( width  - scale ) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = ( height - scale ) / 2;
+  renderer.set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+
+  renderer.draw_svg( svg );
+}
+
+static int save( const string& filename, const Options& options,
+                 vector<unsigned char>& pixels, TaskPool* pool ) {
+  PNG png;
+  png.width = options.width;
+  png.height = options.height;
+  png.pixels.swap( pixels );
+  int status = PNGParser::save( filename.c_str(), png, kDeflateFast, pool );
+  png.pixels.swap( pixels );
+  return status;
+}
+
+static string directory( const string& path ) {
+  return path[path.size() - 1] == '/' ? path : path + "/";
+}
+
+// name of file found under path, see above
+static string relative_name( const string& path, const string& file ) {
+  string name = file == path ? file.substr( file.find_last_of( "/" ) + 1 )
+                             : file.substr( directory( path ).size() );
+  return name.substr( 0, name.find_last_of( "." ) );
+}
+
+// creates the missing directories of filename's path
+static void make_parents( const string& filename ) {
+  for ( size_t slash = filename.find( '/', 1 ); slash != string::npos;
+        slash = filename.find( '/', slash + 1 ) ) {
+    mkdir( filename.substr( 0, slash ).c_str(), 0777 );
+  }
+}
+
+static void usage( const char* program ) {
+  msg( "Usage: " << program << " [-s width height] [-r rate] [-g dir] "
+       << "[-u dir] [-o dir] [-p dB] [-m ssim] [-j threads] "
+       << "<file or directory>..." );
+}
+
+int main( int argc, char** argv ) {
+
+  Options options;
+  options.width = 800; options.height = 600;
+  options.sample_rate = 1;
+  options.min_psnr = options.min_ssim = -1;
+  size_t threads = 0;
+
+  vector<string> files, names;
+  map<string, string> named;  // file of each name
+  for ( int i = 1; i < argc; i++ ) {
+    string arg = argv[i];
+    if ( arg == "-s" && i + 2 < argc ) {
+      options.width  = max( 1, atoi( argv[++i] ) );
+      options.height = max( 1, atoi( argv[++i] ) );
+    } else if ( arg == "-r" && i + 1 < argc ) {
+      options.sample_rate = max( 1, atoi( argv[++i] ) );
+    } else if ( arg == "-g" && i + 1 < argc ) {
+      options.golden = directory( argv[++i] );
+    } else if ( arg == "-u" && i + 1 < argc ) {
+      options.update = directory( argv[++i] );
+    } else if ( arg == "-o" && i + 1 < argc ) {
+      options.heatmaps = directory( argv[++i] );
+    } else if ( arg == "-p" && i + 1 < argc ) {
+      options.min_psnr = atof( argv[++i] );
+    } else if ( arg == "-m" && i + 1 < argc ) {
+      options.min_ssim = atof( argv[++i] );
+    } else if ( arg == "-j" && i + 1 < argc ) {
+      threads = max( 1, atoi( argv[++i] ) );
+    } else if ( !arg.empty() && arg[0] == '-' ) {
+      usage( argv[0] );
+      return 1;
+    } else if ( !collect( arg, files ) ) {
+      msg( "Cannot read " << arg );
+      return 1;
+    } else {
+      for ( size_t j = names.size(); j < files.size(); j++ ) {
+        names.push_back( relative_name( arg, files[j] ) );
+        pair<map<string, string>::iterator, bool> added =
+          named.insert( make_pair( names[j], files[j] ) );
+        if ( !added.second ) {
+          msg( files[j] << " and " << added.first->second
+               << " would both be named " << names[j] );
+          return 1;
+        }
+      }
+    }
+  }
+
+  if ( files.empty() ) {
+    usage( argv[0] );
+    return 1;
+  }
+
+  TaskPool pool( threads );
+
+  if ( options.update.empty() ) {
+    printf( "%-32s %10s %6s %9s %8s %9s\n", "file", "errors", "max",
+            "PSNR(dB)", "SSIM", "diff(ms)" );
+  }
+
+  int failed = 0;
+  for ( size_t i = 0; i < files.size(); i++ ) {
+
+    const string& name = names[i];
+
+    SVG svg;
+    if ( SVGParser::load( files[i].c_str(), &svg, &pool ) < 0 ) {
+      printf( "%-32s cannot load\n", name.c_str() );
+      failed++;
+      continue;
+    }
+    svg.images.wait();
+
+    vector<unsigned char> frame;
+    {
+      SoftwareRendererImp renderer;
+      Sampler2DImp sampler;
+      render( renderer, sampler, svg, options, frame );
+    }
+
+    // store goldens
+    if ( !options.update.empty() ) {
+      string golden = options.update + name + ".png";
+      make_parents( golden );
+      if ( save( golden, options, frame, &pool ) ) {
+        msg( "Cannot write " << golden );
+        failed++;
+      } else {
+        printf( "%s\n", golden.c_str() );
+      }
+      continue;
+    }
+
+    // what the frame is compared with
+    vector<unsigned char> expected;
+    if ( !options.golden.empty() ) {
+      string golden = options.golden + name + ".png";
+      PNG png;
+      if ( PNGParser::load( golden.c_str(), png ) ) {
+        printf( "%-32s cannot load %s\n", name.c_str(), golden.c_str() );
+        failed++;
+        continue;
+      }
+      if ( (size_t) png.width != options.width ||
+           (size_t) png.height != options.height ) {
+        printf( "%-32s golden is %dx%d\n", name.c_str(), png.width,
+                png.height );
+        failed++;
+        continue;
+      }
+      expected.swap( png.pixels );
+    } else {
+      SoftwareRendererRef renderer;
+      Sampler2DRef sampler;
+      render( renderer, sampler, svg, options, expected );
+    }
+
+    vector<unsigned char> heatmap;
+    if ( !options.heatmaps.empty() ) heatmap.resize( frame.size() );
+
+    DiffStats stats;
+    double t0 = now();
+    diff_images( &expected[0], &frame[0], options.width, options.height,
+                 stats, heatmap.empty() ? NULL : &heatmap[0], &pool );
+    double diff_ms = ( now() - t0 ) * 1e3;
+
+    if ( !heatmap.empty() ) {
+      string output = options.heatmaps + name + ".png";
+      make_parents( output );
+      if ( save( output, options, heatmap, &pool ) ) {
+        msg( "Cannot write " << output );
+      }
+    }
+
+    bool fails = stats.psnr < options.min_psnr ||
+                 stats.ssim < options.min_ssim;
+    if ( fails ) failed++;
+
+    printf( "%-32s %10zu %6d %9.2f %8.5f %9.2f%s\n", name.c_str(),
+            stats.errors, stats.max_error, stats.psnr, stats.ssim, diff_ms,
+            fails ? "  FAIL" : "" );
+  }
+
+  printf( "%zu files, %d failed\n", files.size(), failed );
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+#include "document_cache.h"
+
+#include <iostream>
+
+using namespace std;
+
+namespace CMU462 {
+
+// Footprint //
+
+static size_t points_bytes( const vector<Vector2D>& points ) {
+  return points.capacity() * sizeof( Vector2D );
+}
+
+static size_t lod_bytes( const LODChain& lod ) {
+  size_t bytes = lod.levels.capacity() * sizeof( LODLevel );
+  for ( size_t i = 0; i < lod.levels.size(); ++i ) {
+    bytes += points_bytes( lod.levels[i].points );
+  }
+  return bytes;
+}
+
+// textures are only counted once decoding is done, until then they are
+// written by background tasks
+static size_t element_bytes( const SVGElement* element, bool textures ) {
+
+  switch ( element->type ) {
+    case POLYLINE: {
+      const Polyline* polyline = static_cast<const Polyline*>( element );
+      return sizeof( Polyline ) + points_bytes( polyline->points ) +
+             lod_bytes( polyline->lod );
+    }
+    case POLYGON: {
+      const Polygon* polygon = static_cast<const Polygon*>( element );
+      return sizeof( Polygon ) + points_bytes( polygon->points ) +
+             lod_bytes( polygon->lod );
+    }
+    case PATH: {
+      const Path* path = static_cast<const Path*>( element );
+      return sizeof( Path ) + path->data.ops.capacity() * sizeof( PathOp ) +
+             points_bytes( path->data.coords );
+    }
+    case IMAGE: {
+      const Image* image = static_cast<const Image*>( element );
+      size_t bytes = sizeof( Image );
+      if ( textures ) {
+        for ( size_t i = 0; i < image->tex.mipmap.size(); ++i ) {
+          bytes += image->tex.mipmap[i].texels.capacity();
+        }
+      }
+      return bytes;
+    }
+    case GROUP: {
+      const Group* group = static_cast<const Group*>( element );
+      size_t bytes = sizeof( Group );
+      for ( size_t i = 0; i < group->elements.size(); ++i ) {
+        bytes += element_bytes( group->elements[i], textures );
+      }
+      return bytes;
+    }
+    case USE:
+      return sizeof( Use ) + static_cast<const Use*>( element )->href.size();
+    default:
+      return sizeof( Ellipse );   // largest of the remaining shapes
+  }
+}
+
+size_t DocumentCache::footprint( Document& document ) {
+
+  if ( document.bytes ) return document.bytes;
+
+  SVG* svg = document.svg;
+  bool textures = !svg->images.busy();
+
+  // scene tables
+  size_t bytes = sizeof( SVG ) + svg->nodes.size() *
+    ( sizeof( SVGElement* ) + sizeof( int ) + sizeof( Matrix3x3 ) +
+      sizeof( unsigned long ) );
+
+  for ( size_t i = 0; i < svg->elements.size(); ++i ) {
+    bytes += element_bytes( svg->elements[i], textures );
+  }
+  for ( size_t i = 0; i < svg->defs.size(); ++i ) {
+    bytes += element_bytes( svg->defs[i], textures );
+  }
+
+  // exact once nothing changes any more
+  if ( textures ) document.bytes = bytes;
+  return bytes;
+}
+
+// Documents //
+
+DocumentCache::~DocumentCache() {
+
+  // wait for background loads, they write into documents
+  unique_lock<mutex> guard( lock );
+  for ( size_t i = 0; i < documents.size(); ++i ) {
+    while ( documents[i].loading ) loaded.wait( guard );
+    delete documents[i].svg;
+  }
+}
+
+size_t DocumentCache::add( const string& path, SVG* svg ) {
+
+  Document document = { path, svg, false, false, false, 0, 0 };
+
+  lock_guard<mutex> guard( lock );
+  documents.push_back( document );
+  return documents.size() - 1;
+}
+
+size_t DocumentCache::add( SVG* svg ) {
+
+  Document document = { string(), svg, false, false, true, 0, 0 };
+
+  lock_guard<mutex> guard( lock );
+  documents.push_back( document );
+  return documents.size() - 1;
+}
+
+void DocumentCache::remove( size_t index ) {
+
+  // background loads refer to their document by index
+  unique_lock<mutex> guard( lock );
+  for ( size_t i = 0; i < documents.size(); ++i ) {
+    while ( documents[i].loading ) loaded.wait( guard );
+  }
+
+  if ( index >= documents.size() ) return;
+  delete documents[index].svg;
+  documents.erase( documents.begin() + index );
+}
+
+void DocumentCache::load( size_t index ) {
+
+  string path;
+  {
+    lock_guard<mutex> guard( lock );
+    path = documents[index].path;
+  }
+
+  SVG* svg = new SVG();
+  if ( SVGParser::loadCached( path.c_str(), svg, pool ) < 0 ) {
+    cerr << "[DrawSVG] Failed to load " << path << " (Invalid SVG file)"
+         << endl;
+    delete svg;
+    svg = NULL;
+  }
+
+  // notified under the lock, a waiting destructor may free the cache as
+  // soon as it is released
+  lock_guard<mutex> guard( lock );
+  Document& document = documents[index];
+  document.svg = svg;
+  document.failed = ( svg == NULL );
+  document.loading = false;
+  document.bytes = 0;
+  loaded.notify_all();
+}
+
+SVG* DocumentCache::acquire( size_t index ) {
+
+  if ( index >= documents.size() ) return NULL;
+
+  {
+    unique_lock<mutex> guard( lock );
+    Document& document = documents[index];
+    document.used = ++clock;
+
+    while ( document.loading ) loaded.wait( guard );
+    if ( document.svg || document.failed ) return document.svg;
+
+    document.loading = true;
+  }
+
+  // not resident and nobody is loading it
+  load( index );
+
+  lock_guard<mutex> guard( lock );
+  return documents[index].svg;
+}
+
+void DocumentCache::prefetch( size_t index ) {
+
+  if ( index >= documents.size() ) return;
+
+  {
+    lock_guard<mutex> guard( lock );
+    Document& document = documents[index];
+    document.used = ++clock;
+    if ( document.svg || document.failed || document.loading ) return;
+    document.loading = true;
+  }
+
+  if ( pool ) {
+    pool->submit( [this, index] { load( index ); } );
+  } else {
+    load( index );
+  }
+}
+
+bool DocumentCache::failed( size_t index ) {
+  lock_guard<mutex> guard( lock );
+  return index < documents.size() && documents[index].failed;
+}
+
+size_t DocumentCache::resident( void ) {
+
+  lock_guard<mutex> guard( lock );
+
+  size_t bytes = 0;
+  for ( size_t i = 0; i < documents.size(); ++i ) {
+    if ( documents[i].svg ) bytes += footprint( documents[i] );
+  }
+  return bytes;
+}
+
+void DocumentCache::trim( size_t keep ) {
+
+  lock_guard<mutex> guard( lock );
+
+  size_t bytes = 0;
+  for ( size_t i = 0; i < documents.size(); ++i ) {
+    if ( documents[i].svg ) bytes += footprint( documents[i] );
+  }
+
+  while ( bytes > budget ) {
+
+    // least recently used document that can be loaded again
+    Document* victim = NULL;
+    for ( size_t i = 0; i < documents.size(); ++i ) {
+      Document& document = documents[i];
+      if ( i == keep || !document.svg || document.pinned ) continue;
+      if ( !victim || document.used < victim->used ) victim = &document;
+    }
+    if ( !victim ) break;
+
+    bytes -= footprint( *victim );
+    delete victim->svg;
+    victim->svg = NULL;
+    victim->bytes = 0;
+  }
+}
+
+} // namespace CMU462
@@ -0,0 +1,102 @@
+#ifndef CMU462_DOCUMENT_CACHE_H
+#define CMU462_DOCUMENT_CACHE_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include "svg.h"
+#include "task_pool.h"
+
+namespace CMU462 {
+
+// default memory budget of resident documents, in bytes
+static const size_t kDocumentBudget = 512 << 20;
+
+/**
+ * Documents of a list of tabs, loaded on first use. Documents can be
+ * prefetched in the background, and the least recently used ones are
+ * unloaded (and loaded again when needed) once the resident documents
+ * exceed the memory budget.
+ *
+ * acquire, prefetch and trim are meant to be called from a single
+ * thread, background loads only fill in their own document.
+ */
+class DocumentCache {
+ public:
+
+  DocumentCache( TaskPool* pool = NULL, size_t budget = kDocumentBudget )
+    : pool( pool ), budget( budget ), clock( 0 ) { }
+
+  // unloads every document
+  ~DocumentCache();
+
+  void set_pool( TaskPool* pool ) { this->pool = pool; }
+  void set_budget( size_t budget ) { this->budget = budget; }
+
+  // add a document that is loaded from path when first used, or that is
+  // already loaded from path if svg is not NULL
+  size_t add( const std::string& path, SVG* svg = NULL );
+
+  // add a loaded document without a file, it is never unloaded
+  size_t add( SVG* svg );
+
+  // unload and remove a document, later documents move down one index
+  void remove( size_t index );
+
+  size_t size( void ) const { return documents.size(); }
+
+  const std::string& path( size_t index ) const {
+    return documents[index].path;
+  }
+
+  // the document, loaded first if needed (waiting for a background load
+  // in progress). Marks it as most recently used. NULL if it failed to load
+  SVG* acquire( size_t index );
+
+  // start loading a document in the background if it is not resident
+  void prefetch( size_t index );
+
+  // whether the document loaded before or failed to load
+  bool failed( size_t index );
+
+  // unload least recently used documents until the resident ones fit the
+  // budget. The document keep is never unloaded
+  void trim( size_t keep );
+
+  // estimated bytes of the resident documents
+  size_t resident( void );
+
+ private:
+
+  struct Document {
+    std::string path;
+    SVG* svg;
+    bool loading;             // a background load is in progress
+    bool failed;              // the last load failed
+    bool pinned;              // added loaded, cannot be reloaded
+    size_t bytes;             // estimated memory, 0 if not yet known
+    unsigned long used;       // clock at the last acquire or prefetch
+  };
+
+  // estimated bytes of a document, refined once its images are decoded
+  size_t footprint( Document& document );
+
+  void load( size_t index );
+
+  TaskPool* pool;
+  size_t budget;
+  unsigned long clock;
+
+  std::vector<Document> documents;
+
+  // guards the svg, loading and failed fields against background loads
+  std::mutex lock;
+  std::condition_variable loaded;
+
+}; // class DocumentCache
+
+} // namespace CMU462
+
+#endif // CMU462_DOCUMENT_CACHE_H
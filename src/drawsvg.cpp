@@ -1,16 +1,24 @@
 #include "drawsvg.h"
+#include "image_diff.h"
+#include "profiler.h"
 
 #include <sstream>
 #include <iostream>
 #include <cstdlib>
+#include <cstdio>
 
 using namespace std;
 
 namespace CMU462 {
 
+#ifdef DRAWSVG_PROFILE
+// frames recorded by a trace capture, and where it is written
+static const size_t kTraceFrames = 60;
+static const char* kTraceFile = "drawsvg_trace.json";
+#endif
+
 DrawSVG::~DrawSVG() {
 
-  tabs.clear();
   viewport_imp.clear();
   viewport_ref.clear();
 
@@ -41,6 +49,11 @@ string DrawSVG::info() {
     if (sample_rate > 1) {
       osd += "( " + to_string(sample_rate * sample_rate) + "x SSAA)";
     }
+#ifdef DRAWSVG_PROFILE
+    if (profiler.enabled()) {
+      osd += " - " + profiler.breakdown();
+    }
+#endif
   }
 
   return osd;
@@ -64,25 +77,12 @@ void DrawSVG::init() {
   software_renderer_imp->set_tex_sampler(sampler_imp);
   software_renderer_ref->set_tex_sampler(sampler_ref);
 
-  // generate mipmaps & set initial viewports
+  // set tab and transformation if tabs loaded, viewports are set up
+  // when a tab is first viewed and mipmaps are generated by the loader
   for (size_t i = 0; i < tabs.size(); ++i) {
-
-    viewport_imp.push_back(new ViewportImp());
-    viewport_ref.push_back(new ViewportRef());
-
-    // auto adjust
-    auto_adjust(i);
-
-    // set initial svg_2_norm for imp using ref
-    viewport_imp[i]->set_svg_2_norm(viewport_ref[i]->get_svg_2_norm());
-
-    // generate mipmaps
-    regenerate_mipmap(i);
+    if (activate(i)) break;
   }
 
-  // set tab and transformation if tabs loaded
-  current_tab = 0;
-
   // initial osd
   osd = "Software Renderer";
 
@@ -90,6 +90,13 @@ void DrawSVG::init() {
 
 void DrawSVG::render() {
 
+#ifdef DRAWSVG_PROFILE
+  // a capture draws every frame, so the trace shows all stages
+  if (method == Software && !show_diff && profiler.capturing()) {
+    software_renderer->draw_svg(*current_svg);
+  }
+#endif
+
   if (method == Hardware ) {
     redraw();
   }
@@ -102,6 +109,9 @@ void DrawSVG::render() {
     draw_zoom();
   }
 
+#ifdef DRAWSVG_PROFILE
+  profiler.end_frame();
+#endif
 }
 
 void DrawSVG::resize( size_t width, size_t height ) {
@@ -183,6 +193,16 @@ void DrawSVG::char_event( unsigned int key ) {
       show_zoom = !show_zoom;
       break;
 
+#ifdef DRAWSVG_PROFILE
+    // per-stage frame times in the OSD, trace of the next frames
+    case 'p': case 'P':
+      profiler.enable(!profiler.enabled());
+      break;
+    case 't': case 'T':
+      profiler.capture(kTraceFrames, kTraceFile);
+      break;
+#endif
+
     // tab selection
     case '0':
       setTab( 9 );
@@ -215,6 +235,14 @@ void DrawSVG::char_event( unsigned int key ) {
       setTab( 8 );
       break;
 
+    // previous / next tab, for more than ten
+    case '[':
+      stepTab( -1 );
+      break;
+    case ']':
+      stepTab( 1 );
+      break;
+
     default:
       return;
   }
@@ -246,8 +274,8 @@ void DrawSVG::cursor_event( float x, float y ) {
   if (leftDown) {
   
     show_diff = false;
-    float dx = (x - cursor_x) / width  * tabs[current_tab]->width;
-    float dy = (y - cursor_y) / height * tabs[current_tab]->height;
+    float dx = (x - cursor_x) / width  * current_svg->width;
+    float dy = (y - cursor_y) / height * current_svg->height;
     viewport_imp[current_tab]->update_viewbox(dx, dy, 1);
     viewport_ref[current_tab]->update_viewbox(dx, dy, 1);
     redraw();
@@ -283,35 +311,94 @@ void DrawSVG::clear( void ) {
 }
 
 void DrawSVG::newTab( SVG* svg ) {
-  if (tabs.size() < 9) {
-    tabs.push_back(svg);
-  } else {
-    fprintf(stderr, "DrawSVG can only hold up to 9 tabs");
-  }
+  tabs.add(svg);
+  viewport_imp.push_back(new ViewportImp());
+  viewport_ref.push_back(new ViewportRef());
+  viewport_set.push_back(false);
+}
+
+void DrawSVG::newTab( const string& path, SVG* svg ) {
+  tabs.add(path, svg);
+  viewport_imp.push_back(new ViewportImp());
+  viewport_ref.push_back(new ViewportRef());
+  viewport_set.push_back(false);
 }
 
 void DrawSVG::delTab( size_t tab_index ) {
   if (tab_index < tabs.size()) {
-    tabs.erase(tabs.begin() + tab_index);
+
+    bool current = (tab_index == current_tab);
+    if (current) current_svg = NULL;
+    tabs.remove(tab_index);
+
+    // viewports have no virtual destructor, like ~DrawSVG only drop them
+    viewport_imp.erase(viewport_imp.begin() + tab_index);
+    viewport_ref.erase(viewport_ref.begin() + tab_index);
+    viewport_set.erase(viewport_set.begin() + tab_index);
+
+    if (tab_index < current_tab) current_tab--;
+
+    // show the tab that took its place, or the one before
+    if (current) {
+      if (current_tab >= tabs.size() && current_tab > 0) current_tab--;
+      if (!activate(current_tab)) stepTab(-1);
+    }
   }
 }
 
-void DrawSVG::setTab( size_t tab_index ) {
+bool DrawSVG::activate( size_t tab_index ) {
+
+  SVG* svg = tabs.acquire(tab_index);
+  if (!svg) return false;
+
+  current_tab = tab_index;
+  current_svg = svg;
+
+  // set up the viewport on first view
+  if (!viewport_set[tab_index]) {
+
+    // auto adjust
+    auto_adjust(tab_index);
+
+    // set initial svg_2_norm for imp using ref
+    viewport_imp[tab_index]->set_svg_2_norm(
+      viewport_ref[tab_index]->get_svg_2_norm());
+
+    viewport_set[tab_index] = true;
+  }
+
+  // prefetch the neighbours, unload what is over budget
+  if (tab_index > 0) tabs.prefetch(tab_index - 1);
+  tabs.prefetch(tab_index + 1);
+  tabs.trim(tab_index);
 
-  if ( tab_index < tabs.size() ) {
+  return true;
+}
+
+void DrawSVG::setTab( size_t tab_index ) {
 
-    // switch tab and update transformation
-    current_tab = tab_index;
+  if ( tab_index < tabs.size() && activate(tab_index) ) {
 
     // update output
     redraw();
   }
 }
 
+void DrawSVG::stepTab( int step ) {
+
+  for (int i = (int) current_tab + step; 
+       i >= 0 && i < (int) tabs.size(); i += step) {
+    if (activate(i)) {
+      redraw();
+      return;
+    }
+  }
+}
+
 void DrawSVG::draw_diff() {
 
   // get reference output
-  software_renderer_ref->draw_svg(*tabs[current_tab]);
+  software_renderer_ref->draw_svg(*current_svg);
   
   // save reference output
   vector<unsigned char> reference ( 4 * width * height );
@@ -319,27 +406,20 @@ void DrawSVG::draw_diff() {
   memset(&framebuffer[0], 255, 4 * width * height);
 
   // get implementation output
-  software_renderer_imp->draw_svg(*tabs[current_tab]);
-
-  // take difference and count errors
-  int errorCount = 0;
-  for( size_t i = 0; i < width * height; i++ ) {
-
-    framebuffer[i*4 + 0] = abs(reference[i*4 + 0] - framebuffer[i*4 + 0]);
-    framebuffer[i*4 + 1] = abs(reference[i*4 + 1] - framebuffer[i*4 + 1]);
-    framebuffer[i*4 + 2] = abs(reference[i*4 + 2] - framebuffer[i*4 + 2]);
-    framebuffer[i*4 + 3] = 255;
-
-    for( int k = 0; k < 3; k++ ) {
-      if( framebuffer[i*4+k] ) {
-        errorCount++;
-        break;
-      }
-    }
-  
-    osd = to_string(errorCount) + " pixels different";
-  }
-
+  software_renderer_imp->draw_svg(*current_svg);
+
+  // count errors and show them as a heatmap (see image_diff.h). The
+  // heatmap cannot be written over the frames while they are compared
+  DiffStats stats;
+  vector<unsigned char> heatmap ( 4 * width * height );
+  diff_images(&reference[0], &framebuffer[0], width, height, stats,
+              &heatmap[0], pool);
+  memcpy(&framebuffer[0], &heatmap[0], 4 * width * height);
+
+  char quality[64];
+  snprintf(quality, sizeof(quality), " (PSNR %.2f dB, SSIM %.4f)",
+           stats.psnr, stats.ssim);
+  osd = to_string(stats.errors) + " pixels different" + quality;
 }
 
 void DrawSVG::draw_zoom() {
@@ -436,6 +516,9 @@ void DrawSVG::redraw() {
 
   clear();
 
+  // images of the tab may still be decoding
+  current_svg->images.wait();
+
   // set svg_2_screen transformation
   Matrix3x3 m_imp = norm_to_screen * viewport_imp[current_tab]->get_svg_2_norm();
   Matrix3x3 m_ref = norm_to_screen * viewport_ref[current_tab]->get_svg_2_norm();
@@ -446,13 +529,13 @@ void DrawSVG::redraw() {
   switch (method) {
 
     case Hardware:  
-      hardware_renderer->draw_svg(*tabs[current_tab]);
+      hardware_renderer->draw_svg(*current_svg);
       break;
       
     case Software: 
 
       if (show_diff) { draw_diff(); return; }
-      software_renderer->draw_svg(*tabs[current_tab]);
+      software_renderer->draw_svg(*current_svg);
       display_pixels( &framebuffer[0] );
       break;
 
@@ -460,8 +543,9 @@ void DrawSVG::redraw() {
 }
 
 void DrawSVG::regenerate_mipmap(size_t tab_index) {
-  if (tab_index < tabs.size()) {
-    SVG* svg = tabs[tab_index];
+  if (tab_index == current_tab && current_svg) {
+    SVG* svg = current_svg;
+    svg->images.wait();
     for ( size_t i = 0; i < svg->elements.size(); ++i ) {
   
       SVGElement* element = svg->elements[i];
@@ -470,13 +554,23 @@ void DrawSVG::regenerate_mipmap(size_t tab_index) {
           sampler->generate_mips(tex, 0);
       }
     }
+
+    // images only drawn through <use>
+    for ( size_t i = 0; i < svg->defs.size(); ++i ) {
+
+      SVGElement* element = svg->defs[i];
+      if (element->type == IMAGE) {
+          Texture& tex = static_cast<Image*>(element)->tex;
+          sampler->generate_mips(tex, 0);
+      }
+    }
   }
 }
 
 void DrawSVG::auto_adjust(size_t tab_index) {
   
-  float w = tabs[tab_index]->width;
-  float h = tabs[tab_index]->height;
+  float w = current_svg->width;
+  float h = current_svg->height;
   float span = 1.2 * max(w,h) / 2;
   viewport_imp[tab_index]->set_viewbox( w / 2, h / 2, span);
   viewport_ref[tab_index]->set_viewbox( w / 2, h / 2, span);
@@ -485,6 +579,8 @@ void DrawSVG::auto_adjust(size_t tab_index) {
 
 void DrawSVG::display_pixels( const unsigned char* pixels ) const {
 
+  DRAWSVG_PROFILE_SCOPE( PROFILE_UPLOAD );
+
   // copy pixels to the screen
   glPushAttrib( GL_VIEWPORT_BIT );
   glViewport(0, 0, width, height);
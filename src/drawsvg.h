@@ -6,6 +6,7 @@
 #include "CMU462.h"
 #include "renderer.h"
 #include "svg.h"
+#include "document_cache.h"
 #include "hardware_renderer.h"
 #include "software_renderer.h"
 
@@ -39,8 +40,10 @@ class DrawSVG : public Renderer {
     method (Software),
     sample_rate (1),
     current_tab (0),
+    current_svg (NULL),
     show_diff (false),
     show_zoom (false),
+    pool (NULL),
     norm_to_screen ( Matrix3x3::identity() )  { }
 
   /**
@@ -98,10 +101,26 @@ class DrawSVG : public Renderer {
   void drawIllustration( SVG& svg );
 
   /**
-   * Load a svg into a new tab if there is one available.
+   * Load a svg into a new tab.
    */
   void newTab( SVG* svg );
 
+  /**
+   * Add a tab for a svg file that is loaded when the tab is first viewed,
+   * or a tab for a svg already loaded from the file. Tabs that are not
+   * viewed may be unloaded to stay within the memory budget.
+   */
+  void newTab( const std::string& path, SVG* svg = NULL );
+
+  /**
+   * Use a thread pool to prefetch the neighbours of the current tab and
+   * to compare frames in diff mode.
+   */
+  inline void setTaskPool( TaskPool* pool ) {
+    this->pool = pool;
+    tabs.set_pool( pool );
+  }
+
   /**
    * Delete a tab and in the renderer.
    */
@@ -148,9 +167,17 @@ class DrawSVG : public Renderer {
   Sampler2D* sampler_ref;
 
   /* tabs */
-  std::vector<SVG*> tabs; size_t current_tab;
+  DocumentCache tabs; size_t current_tab;
+  SVG* current_svg; // document of the current tab, always loaded
   std::vector<Viewport*> viewport_imp;
   std::vector<Viewport*> viewport_ref;
+  std::vector<bool> viewport_set; // set up on first view
+
+  /* load a tab and make it current, false if it fails to load */
+  bool activate(size_t tab_index);
+
+  /* switch to the closest tab in direction step that loads */
+  void stepTab(int step);
   
   /* diff */
   bool show_diff;
@@ -160,6 +187,9 @@ class DrawSVG : public Renderer {
   bool show_zoom;
   void draw_zoom();
 
+  /* workers, NULL to do everything on the main thread */
+  TaskPool* pool;
+
   /* samples rate (sqrt(s/pix)) */
   size_t sample_rate;
   void inc_sample_rate();
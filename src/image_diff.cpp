@@ -0,0 +1,334 @@
+#include "image_diff.h"
+#include "task_pool.h"
+
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DRAWSVG_DIFF_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CMU462 {
+
+// rows of pixels per band of the pixel pass
+static const size_t kDiffBandRows = 32;
+
+// SSIM window size and the step between windows, in pixels
+static const size_t kSSIMWindow = 8;
+static const size_t kSSIMStep = 4;
+
+// SSIM stabilizing constants, (0.01 * 255)^2 and (0.03 * 255)^2
+static const double kSSIMC1 = 6.5025;
+static const double kSSIMC2 = 58.5225;
+
+struct PixelBand {
+  size_t first, last;       // rows
+  uint64_t errors;
+  int max_error;
+  uint64_t squares;         // sum of squared channel differences
+};
+
+struct WindowBand {
+  size_t first, last;       // rows of windows
+  double ssim;              // sum over the windows of the band
+  size_t windows;
+};
+
+static inline uint8_t luma( const unsigned char* p ) {
+  return (uint8_t) ( ( 77 * p[0] + 150 * p[1] + 29 * p[2] + 128 ) >> 8 );
+}
+
+// blue through red to yellow for errors 1 to 255, the square root makes
+// differences of a few levels stand out
+struct HeatTable {
+
+  unsigned char colors[256][3];
+
+  HeatTable() {
+    for ( int e = 0; e < 256; ++e ) {
+      float t = sqrtf( e / 255.0f );
+      float r = min( 1.0f, 2 * t );
+      float g = max( 0.0f, 2 * t - 1 );
+      float b = max( 0.0f, 1 - 2 * t );
+      colors[e][0] = (unsigned char) ( 255 * r + 0.5f );
+      colors[e][1] = (unsigned char) ( 255 * g + 0.5f );
+      colors[e][2] = (unsigned char) ( 255 * b + 0.5f );
+    }
+  }
+
+};
+
+static const HeatTable kHeat;
+
+// Pixel pass //
+
+// errors, largest error and squared errors of n pixels
+static void diff_row( const unsigned char* a, const unsigned char* b,
+                      size_t n, PixelBand& band ) {
+
+  size_t i = 0;
+
+#ifdef DRAWSVG_DIFF_SSE2
+
+  // 4 pixels at a time. Squares are summed in 32 bit lanes, at most
+  // 4 * 255^2 per lane and step, and moved to 64 bits before overflowing
+  static const size_t kFlush = 4096;
+  static const int kNonZero[16] = { 4, 3, 3, 2, 3, 2, 2, 1,
+                                    3, 2, 2, 1, 2, 1, 1, 0 };
+
+  const __m128i color = _mm_set1_epi32( 0x00ffffff );
+  const __m128i zero = _mm_setzero_si128();
+  __m128i largest = zero;
+
+  while ( i + 4 <= n ) {
+
+    __m128i squares = zero;
+    size_t end = min( n - n % 4, i + 4 * kFlush );
+
+    for ( ; i < end; i += 4 ) {
+      __m128i x = _mm_loadu_si128( (const __m128i*) ( a + 4 * i ) );
+      __m128i y = _mm_loadu_si128( (const __m128i*) ( b + 4 * i ) );
+
+      // absolute differences of the color channels
+      __m128i d = _mm_or_si128( _mm_subs_epu8( x, y ), _mm_subs_epu8( y, x ) );
+      d = _mm_and_si128( d, color );
+
+      largest = _mm_max_epu8( largest, d );
+
+      int equal = _mm_movemask_ps( _mm_castsi128_ps(
+                    _mm_cmpeq_epi32( d, zero ) ) );
+      band.errors += kNonZero[equal];
+
+      __m128i lo = _mm_unpacklo_epi8( d, zero );
+      __m128i hi = _mm_unpackhi_epi8( d, zero );
+      squares = _mm_add_epi32( squares, _mm_madd_epi16( lo, lo ) );
+      squares = _mm_add_epi32( squares, _mm_madd_epi16( hi, hi ) );
+    }
+
+    uint32_t lanes[4];
+    _mm_storeu_si128( (__m128i*) lanes, squares );
+    band.squares += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+
+  unsigned char bytes[16];
+  _mm_storeu_si128( (__m128i*) bytes, largest );
+  for ( int k = 0; k < 16; ++k ) {
+    band.max_error = max( band.max_error, (int) bytes[k] );
+  }
+
+#endif
+
+  for ( ; i < n; ++i ) {
+    bool differs = false;
+    for ( int k = 0; k < 3; ++k ) {
+      int d = abs( a[4 * i + k] - b[4 * i + k] );
+      band.max_error = max( band.max_error, d );
+      band.squares += d * d;
+      differs = differs || d;
+    }
+    if ( differs ) band.errors++;
+  }
+}
+
+static void heat_row( const unsigned char* a, const unsigned char* b,
+                      size_t n, unsigned char* out ) {
+  for ( size_t i = 0; i < n; ++i, a += 4, b += 4, out += 4 ) {
+    int e = max( abs( a[0] - b[0] ),
+                 max( abs( a[1] - b[1] ), abs( a[2] - b[2] ) ) );
+    if ( e ) {
+      out[0] = kHeat.colors[e][0];
+      out[1] = kHeat.colors[e][1];
+      out[2] = kHeat.colors[e][2];
+    } else {
+      out[0] = out[1] = out[2] = 64 + luma( a ) / 4;
+    }
+    out[3] = 255;
+  }
+}
+
+static void diff_band( const unsigned char* a, const unsigned char* b,
+                       size_t width, uint8_t* luma_a, uint8_t* luma_b,
+                       unsigned char* heatmap, PixelBand* band ) {
+
+  for ( size_t y = band->first; y < band->last; ++y ) {
+
+    size_t row = 4 * width * y;
+    diff_row( a + row, b + row, width, *band );
+
+    uint8_t* la = luma_a + width * y;
+    uint8_t* lb = luma_b + width * y;
+    for ( size_t x = 0; x < width; ++x ) {
+      la[x] = luma( a + row + 4 * x );
+      lb[x] = luma( b + row + 4 * x );
+    }
+
+    if ( heatmap ) heat_row( a + row, b + row, width, heatmap + row );
+  }
+}
+
+// SSIM //
+
+static inline double ssim( double n, double sa, double sb, double saa,
+                           double sbb, double sab ) {
+  double ma = sa / n, mb = sb / n;
+  double va = saa / n - ma * ma, vb = sbb / n - mb * mb;
+  double cov = sab / n - ma * mb;
+  return ( ( 2 * ma * mb + kSSIMC1 ) * ( 2 * cov + kSSIMC2 ) ) /
+         ( ( ma * ma + mb * mb + kSSIMC1 ) * ( va + vb + kSSIMC2 ) );
+}
+
+// SSIM of the w x h window at (x, y) of planes with the given stride
+static double window_ssim( const uint8_t* a, const uint8_t* b,
+                           size_t stride, size_t x, size_t y,
+                           size_t w, size_t h ) {
+
+  a += stride * y + x;
+  b += stride * y + x;
+
+#ifdef DRAWSVG_DIFF_SSE2
+  if ( w == 8 ) {
+
+    // sums of 8 rows fit 16 bit lanes, products are summed in 32 bits
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sa = zero, sb = zero, saa = zero, sbb = zero, sab = zero;
+    for ( size_t r = 0; r < h; ++r, a += stride, b += stride ) {
+      __m128i x = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) a ),
+                                     zero );
+      __m128i y = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) b ),
+                                     zero );
+      sa  = _mm_add_epi16( sa, x );
+      sb  = _mm_add_epi16( sb, y );
+      saa = _mm_add_epi32( saa, _mm_madd_epi16( x, x ) );
+      sbb = _mm_add_epi32( sbb, _mm_madd_epi16( y, y ) );
+      sab = _mm_add_epi32( sab, _mm_madd_epi16( x, y ) );
+    }
+
+    // horizontal sums, the 16 bit ones widened by a multiply with 1
+    const __m128i one = _mm_set1_epi16( 1 );
+    sa = _mm_madd_epi16( sa, one );
+    sb = _mm_madd_epi16( sb, one );
+
+    int32_t lanes[5][4];
+    _mm_storeu_si128( (__m128i*) lanes[0], sa );
+    _mm_storeu_si128( (__m128i*) lanes[1], sb );
+    _mm_storeu_si128( (__m128i*) lanes[2], saa );
+    _mm_storeu_si128( (__m128i*) lanes[3], sbb );
+    _mm_storeu_si128( (__m128i*) lanes[4], sab );
+
+    double sums[5];
+    for ( int k = 0; k < 5; ++k ) {
+      sums[k] = (double) lanes[k][0] + lanes[k][1] + lanes[k][2] +
+                lanes[k][3];
+    }
+    return ssim( 8 * h, sums[0], sums[1], sums[2], sums[3], sums[4] );
+  }
+#endif
+
+  uint64_t sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+  for ( size_t r = 0; r < h; ++r, a += stride, b += stride ) {
+    for ( size_t c = 0; c < w; ++c ) {
+      sa += a[c]; sb += b[c];
+      saa += a[c] * a[c]; sbb += b[c] * b[c]; sab += a[c] * b[c];
+    }
+  }
+  return ssim( (double) w * h, sa, sb, saa, sbb, sab );
+}
+
+static void ssim_band( const uint8_t* a, const uint8_t* b,
+                       size_t width, size_t height, WindowBand* band ) {
+
+  // images smaller than a window are one window
+  size_t w = min( width, kSSIMWindow ), h = min( height, kSSIMWindow );
+
+  for ( size_t j = band->first; j < band->last; ++j ) {
+    size_t y = j * kSSIMStep;
+    for ( size_t x = 0; x + w <= width; x += kSSIMStep ) {
+      band->ssim += window_ssim( a, b, width, x, y, w, h );
+      band->windows++;
+    }
+  }
+}
+
+// run count bands on pool, or in order without one
+template <class Band, class Run>
+static void run_bands( vector<Band>& bands, Run run, TaskPool* pool ) {
+  if ( !pool ) {
+    for ( size_t i = 0; i < bands.size(); ++i ) run( &bands[i] );
+    return;
+  }
+  TaskGroup group;
+  for ( size_t i = 0; i < bands.size(); ++i ) {
+    Band* band = &bands[i];
+    pool->submit( [run, band] { run( band ); }, &group );
+  }
+  group.wait();
+}
+
+void diff_images( const unsigned char* a, const unsigned char* b,
+                  size_t width, size_t height, DiffStats& stats,
+                  unsigned char* heatmap, TaskPool* pool ) {
+
+  stats.errors = 0;
+  stats.max_error = 0;
+  stats.mse = 0;
+  stats.psnr = numeric_limits<double>::infinity();
+  stats.ssim = 1;
+  if ( !width || !height ) return;
+
+  // errors and the luma planes
+  vector<uint8_t> luma_a( width * height ), luma_b( width * height );
+  vector<PixelBand> pixels( ( height + kDiffBandRows - 1 ) / kDiffBandRows );
+  for ( size_t i = 0; i < pixels.size(); ++i ) {
+    pixels[i].first = i * kDiffBandRows;
+    pixels[i].last = min( height, pixels[i].first + kDiffBandRows );
+    pixels[i].errors = 0;
+    pixels[i].max_error = 0;
+    pixels[i].squares = 0;
+  }
+
+  uint8_t* la = &luma_a[0]; uint8_t* lb = &luma_b[0];
+  run_bands( pixels, [=]( PixelBand* band ) {
+    diff_band( a, b, width, la, lb, heatmap, band );
+  }, pool );
+
+  uint64_t squares = 0;
+  for ( size_t i = 0; i < pixels.size(); ++i ) {
+    stats.errors += pixels[i].errors;
+    stats.max_error = max( stats.max_error, pixels[i].max_error );
+    squares += pixels[i].squares;
+  }
+
+  stats.mse = (double) squares / ( 3.0 * width * height );
+  if ( squares ) stats.psnr = 10 * log10( 255.0 * 255.0 / stats.mse );
+
+  // structural similarity over the luma planes
+  size_t rows = height < kSSIMWindow ? 1 :
+                ( height - kSSIMWindow ) / kSSIMStep + 1;
+  size_t per_band = max( (size_t) 1, kDiffBandRows / kSSIMStep );
+  vector<WindowBand> windows( ( rows + per_band - 1 ) / per_band );
+  for ( size_t i = 0; i < windows.size(); ++i ) {
+    windows[i].first = i * per_band;
+    windows[i].last = min( rows, windows[i].first + per_band );
+    windows[i].ssim = 0;
+    windows[i].windows = 0;
+  }
+
+  run_bands( windows, [=]( WindowBand* band ) {
+    ssim_band( la, lb, width, height, band );
+  }, pool );
+
+  double sum = 0; size_t count = 0;
+  for ( size_t i = 0; i < windows.size(); ++i ) {
+    sum += windows[i].ssim;
+    count += windows[i].windows;
+  }
+  if ( count ) stats.ssim = sum / count;
+}
+
+} // namespace CMU462
@@ -0,0 +1,37 @@
+#ifndef CMU462_IMAGE_DIFF_H
+#define CMU462_IMAGE_DIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace CMU462 {
+
+class TaskPool;
+
+struct DiffStats {
+  size_t errors;      // pixels whose color differs
+  int max_error;      // largest difference of a color channel, 0 to 255
+  double mse;         // mean squared difference over color channels
+  double psnr;        // peak signal to noise ratio in dB, infinite if equal
+  double ssim;        // mean structural similarity of the luma, 0 to 1
+};
+
+/**
+ * Compares two RGBA8 images of width x height pixels. Alpha is ignored,
+ * as it is in the frames the renderers resolve to.
+ *
+ * Errors and PSNR are per pixel. SSIM is computed on the luma over 8x8
+ * windows, placed every 4 pixels. Both run in bands of rows on pool if
+ * one is given, with SSE2 where available.
+ *
+ * If heatmap is not NULL it receives an RGBA8 image of the differences:
+ * equal pixels show the first image dimmed to gray, differing ones a
+ * color from blue (small) through red to yellow (largest).
+ */
+void diff_images( const unsigned char* a, const unsigned char* b,
+                  size_t width, size_t height, DiffStats& stats,
+                  unsigned char* heatmap = NULL, TaskPool* pool = NULL );
+
+} // namespace CMU462
+
+#endif // CMU462_IMAGE_DIFF_H
@@ -0,0 +1,618 @@
+#include "inflate.h"
+
+#include <stdint.h>
+#include <cstring>
+
+using namespace std;
+
+namespace CMU462 {
+
+// length and distance codes (RFC 1951, 3.2.5)
+static const uint16_t kLengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+  67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t kLengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+  4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t kDistanceBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+  769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t kDistanceExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8,
+  9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// order of the code length code lengths
+static const uint8_t kCodeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static const int kMaxCodeLength = 15;
+
+// bits resolved by the first table lookup, longer codes take a second one
+static const int kLiteralBits  = 10;
+static const int kDistanceBits = 8;
+static const int kCodeLengthBits = 7;
+
+// longest match, output keeps this much room (plus a word of slack for
+// copies that overshoot) ahead of the write position
+static const size_t kMaxMatch = 258;
+static const size_t kSlack = kMaxMatch + 16;
+
+// Huffman tables //
+
+// what a table entry decodes to
+enum {
+  kLiteral = 0,     // value is a byte (or a code length)
+  kBase    = 16,    // value is a length or distance base, low bits extra
+  kEnd     = 32,    // end of block
+  kLink    = 64,    // value is a subtable offset, low bits its index bits
+  kInvalid = 128    // no code
+};
+
+struct Entry {
+  uint16_t value;
+  uint8_t  bits;    // code bits consumed by this lookup
+  uint8_t  op;
+};
+
+struct Table {
+  std::vector<Entry> entries;
+  int bits;         // index bits of the first lookup
+};
+
+enum Alphabet { kLiteralLength, kDistance, kCodeLength };
+
+static Entry symbol_entry( int symbol, Alphabet alphabet ) {
+
+  Entry entry = { 0, 0, kInvalid };
+  switch ( alphabet ) {
+    case kLiteralLength:
+      if ( symbol < 256 ) {
+        entry.value = symbol; entry.op = kLiteral;
+      } else if ( symbol == 256 ) {
+        entry.op = kEnd;
+      } else if ( symbol < 286 ) {
+        entry.value = kLengthBase[symbol - 257];
+        entry.op = kBase | kLengthExtra[symbol - 257];
+      }
+      break;
+    case kDistance:
+      if ( symbol < 30 ) {
+        entry.value = kDistanceBase[symbol];
+        entry.op = kBase | kDistanceExtra[symbol];
+      }
+      break;
+    case kCodeLength:
+      entry.value = symbol; entry.op = kLiteral;
+      break;
+  }
+  return entry;
+}
+
+static inline unsigned reverse_bits( unsigned code, int length ) {
+  unsigned reversed = 0;
+  for ( int i = 0; i < length; ++i ) {
+    reversed = ( reversed << 1 ) | ( code & 1 );
+    code >>= 1;
+  }
+  return reversed;
+}
+
+// build the lookup table of a canonical code from its code lengths.
+// Deflate streams store codes least significant bit first, so entries are
+// indexed by the reversed code. Incomplete codes are allowed, unused
+// entries decode as invalid
+static int build_table( Table& table, const uint8_t* lengths, int n,
+                        int bits, Alphabet alphabet ) {
+
+  int count[kMaxCodeLength + 1] = { 0 };
+  for ( int i = 0; i < n; ++i ) count[lengths[i]]++;
+  count[0] = 0;
+
+  int left = 1;
+  for ( int length = 1; length <= kMaxCodeLength; ++length ) {
+    left = ( left << 1 ) - count[length];
+    if ( left < 0 ) return 55;  // over-subscribed code
+  }
+
+  unsigned next[kMaxCodeLength + 2] = { 0 };
+  for ( int length = 1; length <= kMaxCodeLength; ++length ) {
+    next[length + 1] = ( next[length] + count[length] ) << 1;
+  }
+
+  // first pass: codes and the size of the subtable under each prefix
+  unsigned codes[288];
+  int sub_bits[1 << kLiteralBits] = { 0 };
+  unsigned mask = ( 1u << bits ) - 1;
+  for ( int i = 0; i < n; ++i ) {
+    int length = lengths[i];
+    if ( !length ) continue;
+    codes[i] = reverse_bits( next[length]++, length );
+    if ( length > bits ) {
+      int& sub = sub_bits[codes[i] & mask];
+      if ( length - bits > sub ) sub = length - bits;
+    }
+  }
+
+  Entry invalid = { 0, 0, kInvalid };
+  table.bits = bits;
+  table.entries.assign( (size_t) 1 << bits, invalid );
+
+  for ( unsigned prefix = 0; prefix <= mask; ++prefix ) {
+    if ( !sub_bits[prefix] ) continue;
+    Entry link = { (uint16_t) table.entries.size(), (uint8_t) bits,
+                   (uint8_t) ( kLink | sub_bits[prefix] ) };
+    table.entries[prefix] = link;
+    table.entries.resize( table.entries.size() + ( 1 << sub_bits[prefix] ),
+                          invalid );
+  }
+
+  // second pass: replicate each code over the entries it is a prefix of
+  for ( int i = 0; i < n; ++i ) {
+    int length = lengths[i];
+    if ( !length ) continue;
+
+    Entry entry = symbol_entry( i, alphabet );
+    if ( length <= bits ) {
+      entry.bits = length;
+      for ( unsigned k = codes[i]; k <= mask; k += 1u << length ) {
+        table.entries[k] = entry;
+      }
+    } else {
+      const Entry& link = table.entries[codes[i] & mask];
+      unsigned size = 1u << ( link.op & 15 );
+      entry.bits = length - bits;
+      for ( unsigned k = codes[i] >> bits; k < size; k += 1u << entry.bits ) {
+        table.entries[link.value + k] = entry;
+      }
+    }
+  }
+
+  return 0;
+}
+
+// tables of the fixed code, built once
+struct FixedTables {
+
+  Table literals, distances;
+
+  FixedTables() {
+    uint8_t lengths[288];
+    for ( int i = 0;   i < 144; ++i ) lengths[i] = 8;
+    for ( int i = 144; i < 256; ++i ) lengths[i] = 9;
+    for ( int i = 256; i < 280; ++i ) lengths[i] = 7;
+    for ( int i = 280; i < 288; ++i ) lengths[i] = 8;
+    build_table( literals, lengths, 288, kLiteralBits, kLiteralLength );
+
+    for ( int i = 0; i < 32; ++i ) lengths[i] = 5;
+    build_table( distances, lengths, 32, kDistanceBits, kDistance );
+  }
+
+};
+
+// Decoder //
+
+static inline uint64_t load64_le( const unsigned char* p ) {
+  uint64_t word;
+  memcpy( &word, p, sizeof( word ) );
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64( word );
+#endif
+  return word;
+}
+
+class Inflater {
+ public:
+
+  Inflater( const unsigned char* in, size_t size, vector<unsigned char>& out )
+    : p( in ), end( in + size ), buffer( 0 ), count( 0 ), overrun( 0 ),
+      error( 0 ), out( out ), pos( out.size() ), state( kHeader ),
+      final( false ), fixed( false ), stored_left( 0 ) { }
+
+  // decode until at least limit bytes of output are written (the last
+  // match may go past it) or the stream ends. Returns the error code
+  int run( size_t limit );
+
+  // end of output, out is oversized while decoding
+  size_t size( void ) const { return pos; }
+
+  bool done( void ) const { return state == kDone || error; }
+
+  // drop all output but the last keep bytes, returns the bytes dropped
+  size_t discard( size_t keep ) {
+    if ( pos <= keep ) return 0;
+    size_t drop = pos - keep;
+    memmove( &out[0], &out[drop], keep );
+    pos = keep;
+    return drop;
+  }
+
+ private:
+
+  // top up the bit buffer to at least 56 bits. Past the end of the input
+  // zero bytes are shifted in, reading too many of those is an error
+  inline void refill( void ) {
+    if ( end - p >= 8 ) {
+      buffer |= load64_le( p ) << count;
+      p += ( 63 - count ) >> 3;
+      count |= 56;
+    } else {
+      while ( count <= 56 ) {
+        if ( p < end ) buffer |= (uint64_t) *p++ << count;
+        else overrun++;
+        count += 8;
+      }
+      if ( overrun > 16 ) error = 10;  // end reached without end code
+    }
+  }
+
+  inline unsigned peek( int bits ) const {
+    return (unsigned) ( buffer & ( ( (uint64_t) 1 << bits ) - 1 ) );
+  }
+
+  inline void consume( int bits ) {
+    buffer >>= bits;
+    count -= bits;
+  }
+
+  // bits must be available (at most 32)
+  inline unsigned take( int bits ) {
+    unsigned value = peek( bits );
+    consume( bits );
+    return value;
+  }
+
+  // decode one symbol, at most 15 bits must be available
+  inline Entry decode( const Table& table ) {
+    Entry entry = table.entries[peek( table.bits )];
+    if ( entry.op & kLink ) {
+      consume( entry.bits );
+      entry = table.entries[entry.value + peek( entry.op & 15 )];
+    }
+    consume( entry.bits );
+    return entry;
+  }
+
+  // grow to the reserved capacity first, then by doubling
+  inline void reserve( size_t bytes ) {
+    if ( pos + bytes > out.size() ) {
+      size_t size = out.capacity() > out.size() ? out.capacity()
+                                                : out.size() * 2;
+      out.resize( size > pos + bytes ? size : pos + bytes );
+    }
+  }
+
+  void stored_header( void );
+  void stored( size_t limit );
+  void dynamic_tables( void );
+  void codes( const Table& literals, const Table& distances, size_t limit );
+
+  // the block is done, the stream too if it was the last one
+  void end_block( void ) { state = final ? kDone : kHeader; }
+
+  const unsigned char* p;
+  const unsigned char* end;
+
+  uint64_t buffer;    // bits not yet consumed, least significant first
+  unsigned count;     // number of valid bits in buffer
+  size_t overrun;     // zero bytes read past the end
+
+  int error;
+
+  vector<unsigned char>& out;
+  size_t pos;         // write position, out is oversized while decoding
+
+  // where decoding stopped: before a block header, in a block or after
+  // the last one
+  enum State { kHeader, kStored, kCodes, kDone } state;
+  bool final;         // the current block is the last one
+  bool fixed;         // the current block uses the fixed code
+  size_t stored_left; // bytes left in the current stored block
+
+  Table literals, distances, lengths;
+
+}; // class Inflater
+
+int Inflater::run( size_t limit ) {
+
+  static const FixedTables fixed_tables;
+
+  while ( pos < limit && state != kDone && !error ) {
+
+    if ( state == kStored ) {
+      stored( limit );
+      continue;
+    }
+    if ( state == kCodes ) {
+      const Table& l = fixed ? fixed_tables.literals : literals;
+      const Table& d = fixed ? fixed_tables.distances : distances;
+      codes( l, d, limit );
+      continue;
+    }
+
+    refill();
+    if ( p == end && count <= overrun * 8 ) { error = 52; break; }
+
+    final = take( 1 );
+    unsigned type = take( 2 );
+
+    if ( type == 0 ) {
+      stored_header();
+    } else if ( type == 1 ) {
+      fixed = true;
+      state = kCodes;
+    } else if ( type == 2 ) {
+      dynamic_tables();
+      fixed = false;
+      state = kCodes;
+    } else {
+      error = 20;  // invalid block type
+    }
+  }
+
+  // trailing zero bytes that were consumed mean a truncated stream
+  if ( state == kDone && !error && overrun * 8 > count ) error = 10;
+
+  return error;
+}
+
+void Inflater::stored_header( void ) {
+
+  // back to the first unconsumed byte
+  consume( count & 7 );
+  size_t buffered = count >> 3;
+  if ( buffered < overrun ) { error = 52; return; }
+  p -= buffered - overrun;
+  buffer = 0; count = 0; overrun = 0;
+
+  if ( end - p < 4 ) { error = 52; return; }
+  unsigned length  = p[0] | ( p[1] << 8 );
+  unsigned nlength = p[2] | ( p[3] << 8 );
+  p += 4;
+  if ( length + nlength != 65535 ) { error = 21; return; }
+  if ( (size_t) ( end - p ) < length ) { error = 23; return; }
+
+  stored_left = length;
+  state = kStored;
+}
+
+void Inflater::stored( size_t limit ) {
+
+  // the bit buffer is empty, p is at the data
+  size_t length = limit - pos < stored_left ? limit - pos : stored_left;
+  reserve( length + kSlack );
+  if ( length ) memcpy( &out[pos], p, length );
+  pos += length;
+  p += length;
+
+  stored_left -= length;
+  if ( !stored_left ) end_block();
+}
+
+void Inflater::dynamic_tables( void ) {
+
+  refill();
+  unsigned nliterals  = take( 5 ) + 257;
+  unsigned ndistances = take( 5 ) + 1;
+  unsigned ncodes     = take( 4 ) + 4;
+  if ( nliterals > 286 || ndistances > 30 ) { error = 13; return; }
+
+  // the code lengths are themselves Huffman coded
+  uint8_t code_lengths[19] = { 0 };
+  for ( unsigned i = 0; i < ncodes; ++i ) {
+    refill();
+    code_lengths[kCodeLengthOrder[i]] = take( 3 );
+  }
+  error = build_table( lengths, code_lengths, 19, kCodeLengthBits,
+                       kCodeLength );
+  if ( error ) return;
+
+  uint8_t bitlengths[286 + 30] = { 0 };
+  unsigned n = nliterals + ndistances;
+  for ( unsigned i = 0; i < n; ) {
+
+    refill();
+    if ( error ) return;
+
+    Entry entry = decode( lengths );
+    if ( entry.op == kInvalid ) { error = 16; return; }
+
+    unsigned code = entry.value;
+    if ( code <= 15 ) {
+      bitlengths[i++] = code;
+      continue;
+    }
+
+    // runs of the previous length or of zeros
+    uint8_t value = 0;
+    unsigned repeat;
+    if ( code == 16 ) {
+      if ( i == 0 ) { error = 54; return; }  // nothing to repeat
+      value = bitlengths[i - 1];
+      repeat = 3 + take( 2 );
+    } else if ( code == 17 ) {
+      repeat = 3 + take( 3 );
+    } else {
+      repeat = 11 + take( 7 );
+    }
+    if ( i + repeat > n ) { error = 13; return; }
+    memset( bitlengths + i, value, repeat );
+    i += repeat;
+  }
+
+  if ( bitlengths[256] == 0 ) { error = 64; return; }
+
+  error = build_table( literals, bitlengths, nliterals, kLiteralBits,
+                       kLiteralLength );
+  if ( error ) return;
+  error = build_table( distances, bitlengths + nliterals, ndistances,
+                       kDistanceBits, kDistance );
+}
+
+void Inflater::codes( const Table& literals, const Table& distances,
+                      size_t limit ) {
+
+  while ( pos < limit ) {
+
+    // 56 bits cover the longest length and distance with extra bits
+    refill();
+    if ( error ) return;
+
+    Entry entry = decode( literals );
+
+    if ( entry.op == kLiteral ) {
+      reserve( kSlack );
+      out[pos++] = (unsigned char) entry.value;
+      continue;
+    }
+    if ( entry.op == kEnd ) { end_block(); return; }
+    if ( !( entry.op & kBase ) ) { error = 16; return; }
+
+    size_t length = entry.value + take( entry.op & 15 );
+
+    entry = decode( distances );
+    if ( !( entry.op & kBase ) ) { error = 18; return; }
+    size_t distance = entry.value + take( entry.op & 15 );
+    if ( distance > pos ) { error = 52; return; }  // before the start
+
+    reserve( kSlack );
+    unsigned char* dst = &out[pos];
+    const unsigned char* src = dst - distance;
+    pos += length;
+
+    if ( distance >= 8 ) {
+      // word copies may write past the match, into the slack
+      for ( size_t i = 0; i < length; i += 8 ) {
+        memcpy( dst + i, src + i, 8 );
+      }
+    } else if ( distance == 1 ) {
+      memset( dst, *src, length );
+    } else {
+      for ( size_t i = 0; i < length; ++i ) dst[i] = src[i];
+    }
+  }
+}
+
+int inflate( const unsigned char* in, size_t size,
+             vector<unsigned char>& out ) {
+  Inflater inflater( in, size, out );
+  int error = inflater.run( (size_t) -1 );
+  out.resize( inflater.size() );
+  return error;
+}
+
+// check a zlib header, 0 if the deflate stream follows it
+static int zlib_header( const unsigned char* in, size_t size ) {
+
+  if ( size < 2 ) return 53;  // too small for a zlib header
+
+  // 256 * in[0] + in[1] must be a multiple of 31
+  if ( ( in[0] * 256 + in[1] ) % 31 != 0 ) return 24;
+
+  // only deflate with a window of up to 32k, without a preset dictionary
+  unsigned method = in[0] & 15, info = ( in[0] >> 4 ) & 15;
+  if ( method != 8 || info > 7 ) return 25;
+  if ( ( in[1] >> 5 ) & 1 ) return 26;
+
+  return 0;
+}
+
+// check a gzip header (RFC 1952) and find its end, 0 if the deflate
+// stream follows it
+static int gzip_header( const unsigned char* in, size_t size,
+                        size_t& header ) {
+
+  enum { kText = 1, kHeaderCRC = 2, kExtra = 4, kName = 8, kComment = 16 };
+
+  if ( !is_gzip( in, size ) || size < 10 ) return 27;
+  if ( in[2] != 8 ) return 25;  // not deflate
+  unsigned flags = in[3];
+
+  size_t pos = 10;  // magic, method, flags, time, extra flags, system
+  if ( flags & kExtra ) {
+    if ( size - pos < 2 ) return 27;
+    pos += 2 + ( in[pos] | ( in[pos + 1] << 8 ) );
+  }
+  if ( flags & kName ) {
+    while ( pos < size && in[pos] ) pos++;
+    pos++;
+  }
+  if ( flags & kComment ) {
+    while ( pos < size && in[pos] ) pos++;
+    pos++;
+  }
+  if ( flags & kHeaderCRC ) pos += 2;
+  if ( pos > size ) return 27;
+
+  header = pos;
+  return 0;
+}
+
+int zlib_decompress( const unsigned char* in, size_t size,
+                     vector<unsigned char>& out ) {
+
+  int error = zlib_header( in, size );
+  if ( error ) return error;
+
+  return inflate( in + 2, size - 2, out );
+}
+
+// Stream //
+
+// output decoded per step, on top of the window
+static const size_t kStreamStep = 1 << 16;
+static const size_t kStreamWindow = 32768;
+
+InflateStream::~InflateStream() {
+  delete inflater;
+}
+
+int InflateStream::open( const unsigned char* in, size_t size,
+                         InflateFormat format ) {
+
+  delete inflater;
+  inflater = NULL;
+  window.clear();
+  start = 0;
+  status = 0;
+
+  size_t header = 0;
+  if ( format == kInflateZlib ) {
+    status = zlib_header( in, size );
+    header = 2;
+  } else if ( format == kInflateGzip ) {
+    status = gzip_header( in, size, header );
+  }
+  if ( status ) return status;
+
+  inflater = new Inflater( in + header, size - header, window );
+  return 0;
+}
+
+size_t InflateStream::read( unsigned char* data, size_t size ) {
+
+  if ( !inflater ) return 0;
+
+  // decode a step once everything decoded has been read, keeping the
+  // window before it
+  if ( start == inflater->size() && !inflater->done() ) {
+    start -= inflater->discard( kStreamWindow );
+    status = inflater->run( start + kStreamStep );
+  }
+
+  size_t available = inflater->size() - start;
+  size_t n = size < available ? size : available;
+  if ( n ) memcpy( data, &window[start], n );
+  start += n;
+  return n;
+}
+
+bool is_gzip( const unsigned char* in, size_t size ) {
+  return size >= 2 && in[0] == 0x1f && in[1] == 0x8b;
+}
+
+} // namespace CMU462
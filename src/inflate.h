@@ -0,0 +1,77 @@
+#ifndef CMU462_INFLATE_H
+#define CMU462_INFLATE_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace CMU462 {
+
+/**
+ * Decompress a raw deflate stream (RFC 1951), appending the data to out.
+ * Huffman codes are decoded with lookup tables, several bits at a time
+ * from a 64 bit buffer refilled a word at a time.
+ *
+ * Returns 0 on success or a LodePNG error code.
+ */
+int inflate( const unsigned char* in, size_t size,
+             std::vector<unsigned char>& out );
+
+/**
+ * Decompress a zlib stream (RFC 1950), appending the data to out. The
+ * adler32 checksum is not verified.
+ *
+ * Returns 0 on success or a LodePNG error code.
+ */
+int zlib_decompress( const unsigned char* in, size_t size,
+                     std::vector<unsigned char>& out );
+
+// whether in starts like a gzip file
+bool is_gzip( const unsigned char* in, size_t size );
+
+typedef enum e_InflateFormat {
+  kInflateRaw = 0,    // deflate stream without a wrapper
+  kInflateZlib,       // RFC 1950
+  kInflateGzip        // RFC 1952, only the first member
+} InflateFormat;
+
+class Inflater;
+
+/**
+ * Decompresses a stream held in memory a piece at a time. Besides the
+ * piece being read only the last 32k of output are kept, which is what
+ * later matches may refer to, so memory stays bounded however large the
+ * decompressed data is. Checksums are not verified.
+ */
+class InflateStream {
+ public:
+
+  InflateStream() : inflater( NULL ), start( 0 ), status( 0 ) { }
+  ~InflateStream();
+
+  // start decompressing in, which must stay valid while reading. Returns
+  // 0 or a LodePNG error code for a bad header
+  int open( const unsigned char* in, size_t size,
+            InflateFormat format = kInflateRaw );
+
+  // copy up to size decompressed bytes to data, returns the count. 0 at
+  // the end of the stream or on an error
+  size_t read( unsigned char* data, size_t size );
+
+  // 0 or the LodePNG error code that stopped decompression
+  int error( void ) const { return status; }
+
+ private:
+
+  Inflater* inflater;
+  std::vector<unsigned char> window;   // output, oversized
+  size_t start;                        // first byte not read yet
+  int status;
+
+  InflateStream( const InflateStream& );
+  InflateStream& operator=( const InflateStream& );
+
+}; // class InflateStream
+
+} // namespace CMU462
+
+#endif // CMU462_INFLATE_H
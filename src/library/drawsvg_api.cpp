@@ -0,0 +1,143 @@
+#include "drawsvg_api.h"
+
+#include "svg.h"
+#include "texture.h"
+#include "viewport.h"
+#include "software_renderer.h"
+
+#include <stdint.h>
+
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+using namespace CMU462;
+
+// a renderer with its sampler
+struct DocumentRenderer {
+  DocumentRenderer() : sample_rate( 0 ) {
+    renderer.set_tex_sampler( &sampler );
+  }
+  SoftwareRendererImp renderer;
+  Sampler2DImp sampler;
+  size_t sample_rate;   // of the renderer, 0 before the first render
+};
+
+// a document with the renderers that drew it, kept between renders so
+// their sample buffers and sprite caches are reused. Drawing only reads
+// the document, each render takes a renderer of its own
+struct drawsvg_document {
+  ~drawsvg_document() {
+    for ( size_t i = 0; i < idle.size(); ++i ) delete idle[i];
+  }
+  SVG svg;
+  std::vector<DocumentRenderer*> idle;  // renderers not drawing
+  std::mutex lock;                      // guards idle
+};
+
+/* NOTE:
+ * Exceptions must not cross the C interface, every entry point that can
+ * allocate catches them and returns its error value.
+ */
+
+drawsvg_document* drawsvg_load( const void* data, size_t size ) {
+
+  if ( !data ) return NULL;
+
+  try {
+    // without a pool, images are decoded before loading returns
+    unique_ptr<drawsvg_document> document( new drawsvg_document() );
+    if ( SVGParser::loadMemory( (const char*) data, size,
+                                &document->svg ) ) {
+      return NULL;
+    }
+    return document.release();
+  } catch ( ... ) {
+    return NULL;
+  }
+}
+
+void drawsvg_size( const drawsvg_document* document,
+                   float* width, float* height ) {
+  if ( width  ) *width  = document ? document->svg.width  : 0;
+  if ( height ) *height = document ? document->svg.height : 0;
+}
+
+// draws with a renderer of the document, which is only returned to the
+// idle ones if drawing completes
+static void render( drawsvg_document* document, unsigned char* pixels,
+                    size_t width, size_t height,
+                    size_t sample_rate, const float* view ) {
+
+  SVG& svg = document->svg;
+
+  ViewportImp viewport;
+  if ( view ) {
+    viewport.set_viewbox( view[0], view[1], view[2] );
+  } else {
+    float span = 1.2 * max( svg.width, svg.height ) / 2;
+    viewport.set_viewbox( svg.width / 2, svg.height / 2, span );
+  }
+
+  // the largest centered square of the buffer shows the view
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = ( width  - scale ) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = ( height - scale ) / 2;
+
+  // an idle renderer, or a new one if every renderer is drawing
+  unique_ptr<DocumentRenderer> idle;
+  {
+    lock_guard<std::mutex> guard( document->lock );
+    if ( !document->idle.empty() ) {
+      idle.reset( document->idle.back() );
+      document->idle.pop_back();
+    }
+  }
+  if ( !idle ) idle.reset( new DocumentRenderer() );
+
+  SoftwareRendererImp& renderer = idle->renderer;
+  renderer.set_render_target( pixels, width, height );
+
+  // changing the rate drops the cached sprites, keep them when it is not
+  if ( idle->sample_rate != sample_rate ) {
+    renderer.set_sample_rate( sample_rate );
+    idle->sample_rate = sample_rate;
+  }
+  renderer.set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+  renderer.draw_svg( svg );
+
+  lock_guard<std::mutex> guard( document->lock );
+  document->idle.push_back( idle.get() );
+  idle.release();
+}
+
+int drawsvg_render( drawsvg_document* document, unsigned char* pixels,
+                    size_t width, size_t height,
+                    size_t sample_rate, const float* view ) {
+
+  if ( !document || !pixels || !width || !height ) return DRAWSVG_INVALID;
+  if ( sample_rate < 1 || sample_rate > 4 ) return DRAWSVG_INVALID;
+  // 4 bytes per sample, the sample buffer size must not wrap around
+  if ( width > SIZE_MAX / 4 / sample_rate / sample_rate / height ) {
+    return DRAWSVG_INVALID;
+  }
+  if ( view && !( isfinite( view[0] ) && isfinite( view[1] ) &&
+                  isfinite( view[2] ) && view[2] > 0 ) ) {
+    return DRAWSVG_INVALID;
+  }
+
+  try {
+    render( document, pixels, width, height, sample_rate, view );
+  } catch ( ... ) {
+    return DRAWSVG_FAILED;
+  }
+  return DRAWSVG_OK;
+}
+
+void drawsvg_free( drawsvg_document* document ) {
+  delete document;
+}
@@ -0,0 +1,83 @@
+#ifndef CMU462_DRAWSVG_API_H
+#define CMU462_DRAWSVG_API_H
+
+/*
+ * C interface of libdrawsvg.
+ *
+ * Documents are loaded once from memory and stay resident, each render
+ * draws one into a buffer owned by the caller with the software renderer.
+ * No window system, GL context or file is involved.
+ *
+ * Documents can be rendered from different threads at the same time, the
+ * same document included: drawing only reads it. A document must not be
+ * freed while it is being rendered.
+ *
+ * No C++ exception leaves the library. Failures are reported by the
+ * return values below, running out of memory included.
+ */
+
+#include <stddef.h>
+
+#if defined(_WIN32) && defined(DRAWSVG_SHARED)
+#  ifdef DRAWSVG_EXPORTS
+#    define DRAWSVG_API __declspec(dllexport)
+#  else
+#    define DRAWSVG_API __declspec(dllimport)
+#  endif
+#elif defined(__GNUC__)
+#  define DRAWSVG_API __attribute__((visibility("default")))
+#else
+#  define DRAWSVG_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct drawsvg_document drawsvg_document;
+
+/* results of drawsvg_render */
+#define DRAWSVG_OK        0
+#define DRAWSVG_INVALID (-1)
+#define DRAWSVG_FAILED  (-2)
+
+/**
+ * Loads a document from size bytes at data, plain or gzip compressed
+ * (.svgz). data is not referenced after the call returns.
+ * \return the document, NULL if it cannot be parsed or there is not
+ *         enough memory to hold it.
+ */
+DRAWSVG_API drawsvg_document* drawsvg_load( const void* data, size_t size );
+
+/**
+ * Canvas size of a document, in svg units.
+ */
+DRAWSVG_API void drawsvg_size( const drawsvg_document* document,
+                               float* width, float* height );
+
+/**
+ * Renders a document into pixels, width * height RGBA pixels of 4 bytes
+ * in rows from the top, as the viewer would show it in a window of that
+ * size: the largest centered square of the buffer shows the view.
+ * \param sample_rate samples per pixel side, 1 to 4
+ * \param view center x, center y and half the visible size in svg units,
+ *        finite and the size above 0, NULL for the whole canvas
+ * \return DRAWSVG_OK on success, DRAWSVG_INVALID for invalid arguments
+ *         (pixels untouched), DRAWSVG_FAILED if rendering failed, out of
+ *         memory for the samples say (pixels undefined).
+ */
+DRAWSVG_API int drawsvg_render( drawsvg_document* document,
+                                unsigned char* pixels,
+                                size_t width, size_t height,
+                                size_t sample_rate, const float* view );
+
+/**
+ * Releases a document and its renderer. NULL is ignored.
+ */
+DRAWSVG_API void drawsvg_free( drawsvg_document* document );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CMU462_DRAWSVG_API_H
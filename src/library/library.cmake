@@ -0,0 +1,49 @@
+option(DRAWSVG_BUILD_LIBRARY  "Build the libdrawsvg render library"  ON)
+option(DRAWSVG_BUILD_SHARED_LIBRARY  "Build libdrawsvg as a shared library"  OFF)
+
+if(DRAWSVG_BUILD_LIBRARY)
+
+  include_directories(${CMAKE_CURRENT_SOURCE_DIR})
+
+  # the parts of libCMU462 the scene and rendering code use, compiled in
+  # so the library needs neither the windowing nor the GL part of it
+  set(CMU462_LIBRARY_SOURCE_DIR ${PROJECT_SOURCE_DIR}/CMU462/src)
+  set(CMU462_DrawSVGLIB_SOURCE
+      library/drawsvg_api.cpp
+      ${CMU462_DRAWSVG_CORE_SOURCE}
+      ${CMU462_LIBRARY_SOURCE_DIR}/vector2D.cpp
+      ${CMU462_LIBRARY_SOURCE_DIR}/vector3D.cpp
+      ${CMU462_LIBRARY_SOURCE_DIR}/vector4D.cpp
+      ${CMU462_LIBRARY_SOURCE_DIR}/matrix3x3.cpp
+      ${CMU462_LIBRARY_SOURCE_DIR}/color.cpp
+      ${CMU462_LIBRARY_SOURCE_DIR}/base64.cpp
+      ${CMU462_LIBRARY_SOURCE_DIR}/lodepng.cpp
+      ${CMU462_LIBRARY_SOURCE_DIR}/tinyxml2.cpp
+  )
+
+  if(DRAWSVG_BUILD_SHARED_LIBRARY)
+    add_library( drawsvg_lib SHARED ${CMU462_DrawSVGLIB_SOURCE} )
+    set_target_properties( drawsvg_lib PROPERTIES
+        COMPILE_DEFINITIONS "DRAWSVG_SHARED;DRAWSVG_EXPORTS" )
+  else(DRAWSVG_BUILD_SHARED_LIBRARY)
+    add_library( drawsvg_lib STATIC ${CMU462_DrawSVGLIB_SOURCE} )
+  endif(DRAWSVG_BUILD_SHARED_LIBRARY)
+
+  target_include_directories( drawsvg_lib PRIVATE
+      ${PROJECT_SOURCE_DIR}/CMU462/include/CMU462 )
+
+  if(UNIX)
+    target_link_libraries( drawsvg_lib -lpthread )
+  endif(UNIX)
+
+  # libdrawsvg, next to the drawsvg executable
+  set_target_properties( drawsvg_lib PROPERTIES
+      OUTPUT_NAME drawsvg
+      POSITION_INDEPENDENT_CODE ON
+      ARCHIVE_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}
+      LIBRARY_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR} )
+
+  install(TARGETS drawsvg_lib DESTINATION ${drawsvg_SOURCE_DIR}/lib)
+  install(FILES library/drawsvg_api.h DESTINATION ${drawsvg_SOURCE_DIR}/include)
+
+endif(DRAWSVG_BUILD_LIBRARY)
@@ -0,0 +1,157 @@
+#include "lod.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+// squared distance from p to the segment ab
+static double dist2_to_segment( const Vector2D& p,
+                                const Vector2D& a, const Vector2D& b ) {
+
+  Vector2D ab = b - a;
+  Vector2D ap = p - a;
+
+  double len2 = ab.norm2();
+  if ( len2 == 0.0 ) return ap.norm2();
+
+  double t = dot( ap, ab ) / len2;
+  t = t < 0.0 ? 0.0 : ( t > 1.0 ? 1.0 : t );
+  return ( ap - t * ab ).norm2();
+}
+
+// marks the points of the open run [first, last] that survive simplification.
+// Uses an explicit stack so long runs cannot overflow the call stack.
+static void mark_run( const vector<Vector2D>& points,
+                      size_t first, size_t last, double tol2,
+                      vector<bool>& keep ) {
+
+  vector< pair<size_t, size_t> > stack;
+  stack.push_back( make_pair( first, last ) );
+
+  while ( !stack.empty() ) {
+
+    size_t a = stack.back().first;
+    size_t b = stack.back().second;
+    stack.pop_back();
+    if ( b <= a + 1 ) continue;
+
+    // find the point furthest from the chord
+    size_t split = a; double max_d2 = 0.0;
+    for ( size_t i = a + 1; i < b; ++i ) {
+      double d2 = dist2_to_segment( points[i], points[a], points[b] );
+      if ( d2 > max_d2 ) { max_d2 = d2; split = i; }
+    }
+
+    if ( max_d2 > tol2 ) {
+      keep[split] = true;
+      stack.push_back( make_pair( a, split ) );
+      stack.push_back( make_pair( split, b ) );
+    }
+  }
+}
+
+void simplify( const vector<Vector2D>& points, float tolerance,
+               bool closed, vector<Vector2D>& simplified ) {
+
+  simplified.clear();
+
+  size_t n = points.size();
+  if ( n < 3 ) {
+    simplified = points;
+    return;
+  }
+
+  double tol2 = (double) tolerance * tolerance;
+  vector<bool> keep( n, false );
+  keep[0] = true;
+
+  if ( closed ) {
+
+    // split the ring at the point furthest from the first one, then
+    // simplify both halves as open runs
+    size_t far = 0; double max_d2 = 0.0;
+    for ( size_t i = 1; i < n; ++i ) {
+      double d2 = ( points[i] - points[0] ).norm2();
+      if ( d2 > max_d2 ) { max_d2 = d2; far = i; }
+    }
+    if ( far == 0 ) {
+      simplified.push_back( points[0] );
+      return;
+    }
+
+    keep[far] = true;
+    mark_run( points, 0, far, tol2, keep );
+
+    // the closing half wraps around to the first point
+    vector<Vector2D> tail( points.begin() + far, points.end() );
+    tail.push_back( points[0] );
+    vector<bool> tail_keep( tail.size(), false );
+    mark_run( tail, 0, tail.size() - 1, tol2, tail_keep );
+    for ( size_t i = 1; i + 1 < tail.size(); ++i ) {
+      if ( tail_keep[i] ) keep[far + i] = true;
+    }
+
+  } else {
+    keep[n - 1] = true;
+    mark_run( points, 0, n - 1, tol2, keep );
+  }
+
+  for ( size_t i = 0; i < n; ++i ) {
+    if ( keep[i] ) simplified.push_back( points[i] );
+  }
+}
+
+void LODChain::build( const vector<Vector2D>& points, bool closed ) {
+
+  levels.clear();
+  if ( points.empty() ) return;
+
+  // bounds
+  bounds_min = bounds_max = points[0];
+  for ( size_t i = 1; i < points.size(); ++i ) {
+    bounds_min.x = min( bounds_min.x, points[i].x );
+    bounds_min.y = min( bounds_min.y, points[i].y );
+    bounds_max.x = max( bounds_max.x, points[i].x );
+    bounds_max.y = max( bounds_max.y, points[i].y );
+  }
+
+  if ( points.size() < kLODMinPoints ) return;
+
+  double diag = ( bounds_max - bounds_min ).norm();
+  if ( diag == 0.0 ) return;
+
+  // tolerances double from 1/4096 of the diagonal up to 1/8 of it. Only
+  // keep a level if it removes a meaningful share of the previous one
+  size_t min_points = closed ? 3 : 2;
+  size_t prev_count = points.size();
+  for ( float tol = diag / 4096.0f; tol <= diag / 8.0f; tol *= 2.0f ) {
+
+    LODLevel level;
+    level.tolerance = tol;
+    simplify( points, tol, closed, level.points );
+
+    if ( level.points.size() < min_points ) break;
+    if ( level.points.size() * 4 > prev_count * 3 ) continue;
+
+    prev_count = level.points.size();
+    levels.push_back( level );
+    if ( prev_count <= min_points ) break;
+  }
+}
+
+const vector<Vector2D>& LODChain::select( const vector<Vector2D>& points,
+                                          float scale ) const {
+
+  const vector<Vector2D>* best = &points;
+  for ( size_t i = 0; i < levels.size(); ++i ) {
+    if ( levels[i].tolerance * scale > kLODPixelError ) break;
+    best = &levels[i].points;
+  }
+
+  return *best;
+}
+
+} // namespace CMU462
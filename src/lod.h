@@ -0,0 +1,51 @@
+#ifndef CMU462_LOD_H
+#define CMU462_LOD_H
+
+#include <vector>
+
+#include "vector2D.h"
+
+namespace CMU462 {
+
+// geometry with fewer points than this is always drawn at full resolution
+static const size_t kLODMinPoints = 32;
+
+// maximum deviation (in screen pixels) allowed when picking a coarser level
+static const float kLODPixelError = 0.5f;
+
+// simplifies a point list with the Douglas-Peucker algorithm. Points that
+// lie within tolerance of the simplified outline are dropped. Closed point
+// lists are treated as polygons (the last point connects back to the first)
+void simplify( const std::vector<Vector2D>& points, float tolerance,
+               bool closed, std::vector<Vector2D>& simplified );
+
+struct LODLevel {
+  float tolerance;                // max deviation from the source, svg units
+  std::vector<Vector2D> points;   // simplified points
+};
+
+struct LODChain {
+
+  LODChain() : bounds_min( 0, 0 ), bounds_max( 0, 0 ) { }
+
+  // bounding box of the full resolution points
+  Vector2D bounds_min;
+  Vector2D bounds_max;
+
+  // progressively coarser versions of the source points
+  std::vector<LODLevel> levels;
+
+  // precompute bounds and simplified levels for a point list
+  void build( const std::vector<Vector2D>& points, bool closed );
+
+  // pick the coarsest level whose error stays below kLODPixelError when
+  // drawn at the given scale (screen pixels per svg unit). Falls back to
+  // the full resolution points when no level is coarse enough
+  const std::vector<Vector2D>& select( const std::vector<Vector2D>& points,
+                                       float scale ) const;
+
+}; // struct LODChain
+
+} // namespace CMU462
+
+#endif // CMU462_LOD_H
@@ -1,26 +1,31 @@
 #include "CMU462.h"
 #include "viewer.h"
 #include "drawsvg.h"
+#include "task_pool.h"
 
 #include <sys/stat.h>
 #include <dirent.h>
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 using namespace CMU462;
 
 #define msg(s) cerr << "[DrawSVG] " << s << endl;
 
+// prefetches files and decodes their images in the background
+static TaskPool* pool = NULL;
+
 int loadFile( DrawSVG* drawsvg, const char* path ) {
 
   SVG* svg = new SVG();
 
-  if( SVGParser::load( path, svg ) < 0) {
+  if( SVGParser::loadCached( path, svg, pool ) < 0) {
     delete svg;
     return -1;
   }
   
-  drawsvg->newTab( svg );
+  drawsvg->newTab( path, svg );
   return 0;
 }
 
@@ -29,30 +34,47 @@ int loadDirectory( DrawSVG* drawsvg, const char* path ) {
   DIR *dir = opendir (path);
   if(dir) {
     
-    struct dirent *ent; size_t n = 0;
+    struct dirent *ent;
     
-    // load files
+    // list files
     string pathname = path; 
     if (pathname[pathname.back()] != '/') pathname.push_back('/');
-    while (((ent = readdir (dir)) != NULL) && (n < 9)) {
+    vector<string> filenames;
+    while ((ent = readdir (dir)) != NULL) {
 
       string filename = ent->d_name;
       string filesufx = filename.substr(filename.find_last_of(".") + 1);
-      if (filesufx == "svg" ) {
-        cerr << "[DrawSVG] Loading " << filename << "... "; 
-        if (loadFile(drawsvg, (pathname + filename).c_str()) < 0) {
-          cerr << "Failed (Invalid SVG file)" << endl;
-        } else {
-          cerr << "Succeeded" << endl;
-          n++;
-        }
+      if (filesufx == "svg" || filesufx == "svgz") {
+        filenames.push_back(filename);
       }
     }
 
     closedir (dir);
+    sort(filenames.begin(), filenames.end());
+
+    // load the first valid file for the first tab, the others are only
+    // loaded when their tab is viewed (or is next to the viewed one)
+    size_t n = 0;
+    for (size_t i = 0; i < filenames.size(); i++) {
+
+      string filename = pathname + filenames[i];
+      if (n) {
+        drawsvg->newTab(filename);
+        n++;
+        continue;
+      }
+
+      cerr << "[DrawSVG] Loading " << filenames[i] << "... "; 
+      if (loadFile(drawsvg, filename.c_str()) < 0) {
+        cerr << "Failed (Invalid SVG file)" << endl;
+      } else {
+        cerr << "Succeeded" << endl;
+        n++;
+      }
+    }
 
     if (n) {
-      msg("Successfully Loaded " << n << " files from " << path);
+      msg("Found " << n << " files in " << path);
       return 0;
     }
 
@@ -99,6 +121,10 @@ int main( int argc, char** argv ) {
   // set drawsvg as renderer
   viewer.set_renderer(drawsvg);
 
+  // worker threads for loading
+  pool = new TaskPool();
+  drawsvg->setTaskPool(pool);
+
   // load tests
   if( argc == 2 ) {
     if (loadPath(drawsvg, argv[1]) < 0) exit(0);
@@ -0,0 +1,294 @@
+#include "number.h"
+
+#include <stdint.h>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+namespace CMU462 {
+
+// powers of ten that are exact in a double / float
+static const double kPow10[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+static const float kPow10f[] = {
+  1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+// digits kept in the mantissa, more would overflow 64 bits
+static const int kMaxDigits = 19;
+
+// a number split into mantissa * 10^exponent
+struct Decimal {
+  uint64_t mantissa;
+  int exponent;
+  bool negative;
+  bool exact;      // no significant digits were dropped
+};
+
+static inline bool is_digit( char c ) {
+  return (unsigned) ( c - '0' ) < 10;
+}
+
+static bool scan( const char*& p, const char* end, Decimal& d ) {
+
+  const char* s = p;
+  d.mantissa = 0; d.exponent = 0; d.negative = false; d.exact = true;
+
+  if ( s < end && ( *s == '+' || *s == '-' ) ) {
+    d.negative = ( *s == '-' );
+    s++;
+  }
+
+  int digits = 0; bool any = false;
+
+  // integer part
+  for ( ; s < end && is_digit( *s ); ++s ) {
+    any = true;
+    if ( digits < kMaxDigits ) {
+      d.mantissa = d.mantissa * 10 + ( *s - '0' );
+      if ( d.mantissa ) digits++;
+    } else {
+      d.exponent++;
+      if ( *s != '0' ) d.exact = false;
+    }
+  }
+
+  // fraction
+  if ( s < end && *s == '.' ) {
+    for ( ++s; s < end && is_digit( *s ); ++s ) {
+      any = true;
+      if ( digits < kMaxDigits ) {
+        d.mantissa = d.mantissa * 10 + ( *s - '0' );
+        if ( d.mantissa ) digits++;
+        d.exponent--;
+      } else if ( *s != '0' ) {
+        d.exact = false;
+      }
+    }
+  }
+
+  if ( !any ) return false;
+
+  // exponent, only if digits follow ("1e" is the number 1)
+  if ( s < end && ( *s == 'e' || *s == 'E' ) ) {
+    const char* t = s + 1;
+    bool negative = false;
+    if ( t < end && ( *t == '+' || *t == '-' ) ) {
+      negative = ( *t == '-' );
+      t++;
+    }
+    if ( t < end && is_digit( *t ) ) {
+      int e = 0;
+      for ( ; t < end && is_digit( *t ); ++t ) {
+        if ( e < 100000 ) e = e * 10 + ( *t - '0' );
+      }
+      d.exponent += negative ? -e : e;
+      s = t;
+    }
+  }
+
+  p = s;
+  return true;
+}
+
+// slow path for long mantissas and large exponents
+template <class T>
+static T convert( const char* first, const char* last ) {
+
+  char buffer[64];
+  size_t n = last - first;
+  if ( n < sizeof( buffer ) ) {
+    memcpy( buffer, first, n );
+    buffer[n] = '\0';
+    return (T) ( sizeof( T ) == sizeof( float ) ? strtof( buffer, NULL )
+                                                : strtod( buffer, NULL ) );
+  }
+
+  string copy( first, last );
+  return (T) ( sizeof( T ) == sizeof( float ) ? strtof( copy.c_str(), NULL )
+                                              : strtod( copy.c_str(), NULL ) );
+}
+
+bool parse_number( const char*& p, const char* end, double& value ) {
+
+  const char* first = p;
+  Decimal d;
+  if ( !scan( p, end, d ) ) return false;
+
+  // exact operands give a correctly rounded result (Clinger's fast path)
+  if ( d.mantissa == 0 ) {
+    value = 0;
+  } else if ( d.exact && d.mantissa <= ( (uint64_t) 1 << 53 ) &&
+              d.exponent >= -22 && d.exponent <= 22 ) {
+    value = d.exponent < 0 ? (double) d.mantissa / kPow10[-d.exponent]
+                           : (double) d.mantissa * kPow10[ d.exponent];
+  } else {
+    value = convert<double>( first, p );
+    return true;
+  }
+
+  if ( d.negative ) value = -value;
+  return true;
+}
+
+// whether rounding x, within a few double ulps of the decimal value, to a
+// float gives the correctly rounded float of the decimal value. That is
+// the case unless x is close to halfway between two floats
+static inline bool rounds_to_float( double x ) {
+
+  if ( !( x >= FLT_MIN && x <= FLT_MAX ) ) return false;
+
+  // the 29 low mantissa bits are what a float drops
+  uint64_t bits;
+  memcpy( &bits, &x, sizeof( bits ) );
+  int64_t dropped = (int64_t) ( bits & ( ( 1 << 29 ) - 1 ) ) - ( 1 << 28 );
+  return dropped < -8 || dropped > 8;
+}
+
+bool parse_number( const char*& p, const char* end, float& value ) {
+
+  const char* first = p;
+  Decimal d;
+  if ( !scan( p, end, d ) ) return false;
+
+  if ( d.mantissa == 0 ) {
+    value = 0;
+  } else if ( d.exact && d.mantissa <= ( (uint64_t) 1 << 24 ) &&
+              d.exponent >= -10 && d.exponent <= 10 ) {
+    value = d.exponent < 0 ? (float) d.mantissa / kPow10f[-d.exponent]
+                           : (float) d.mantissa * kPow10f[ d.exponent];
+  } else if ( d.exponent >= -22 && d.exponent <= 22 ) {
+    // long mantissas ("76.57053795390641"), two roundings in double
+    // stay far below float precision
+    double x = d.exponent < 0 ? (double) d.mantissa / kPow10[-d.exponent]
+                              : (double) d.mantissa * kPow10[ d.exponent];
+    if ( !rounds_to_float( x ) ) {
+      value = convert<float>( first, p );
+      return true;
+    }
+    value = (float) x;
+  } else {
+    value = convert<float>( first, p );
+    return true;
+  }
+
+  if ( d.negative ) value = -value;
+  return true;
+}
+
+size_t parse_numbers( const char*& p, const char* end,
+                      float* values, size_t n ) {
+
+  size_t count = 0;
+  while ( count < n ) {
+    const char* s = p;
+    skip_separators( s, end );
+    if ( !parse_number( s, end, values[count] ) ) break;
+    p = s;
+    count++;
+  }
+  return count;
+}
+
+bool parse_points( const char* begin, const char* end,
+                   vector<Vector2D>& points ) {
+
+  const char* p = begin;
+  while ( true ) {
+
+    // leading and trailing separators are allowed
+    skip_separators( p, end );
+    if ( p == end ) return true;
+
+    float xy[2];
+    if ( parse_numbers( p, end, xy, 2 ) != 2 ) return false;
+    points.push_back( Vector2D( xy[0], xy[1] ) );
+  }
+}
+
+// Transforms //
+
+// whether [name, end) spells keyword
+static inline bool is_keyword( const char* name, const char* end,
+                               const char* keyword, size_t length ) {
+  return (size_t) ( end - name ) == length && !memcmp( name, keyword, length );
+}
+
+// m composed with a rotation by degrees about (x, y)
+static inline Affine2D rotated( const Affine2D& m, float degrees,
+                                float x, float y ) {
+
+  double cosine = cos( degrees * PI / 180.0f );
+  double sine   = sin( degrees * PI / 180.0f );
+
+  Affine2D r( cosine, sine, -sine, cosine, 0, 0 );
+  if ( x != 0 || y != 0 ) {
+    r.e = -x * cosine + y * sine + x;
+    r.f = -x * sine - y * cosine + y;
+  }
+  return m * r;
+}
+
+bool parse_transform( const char* begin, const char* end, Affine2D& m ) {
+
+  const char* p = begin;
+  while ( true ) {
+
+    // transforms are separated by whitespace, a comma or both
+    skip_separators( p, end );
+    if ( p == end ) return true;
+
+    const char* name = p;
+    while ( p < end && ( ( *p >= 'a' && *p <= 'z' ) ||
+                         ( *p >= 'A' && *p <= 'Z' ) ) ) p++;
+    const char* name_end = p;
+
+    while ( p < end && is_separator_space( *p ) ) p++;
+    if ( p == end || *p != '(' ) return false;
+    p++;
+
+    // optional arguments take the defaults below
+    float v[6] = { 0, 0, 0, 0, 0, 0 };
+    size_t count = parse_numbers( p, end, v, 6 );
+
+    while ( p < end && is_separator_space( *p ) ) p++;
+    if ( p == end || *p != ')' ) return false;
+    p++;
+
+    // argument counts other than the ones SVG allows are malformed.
+    // translate and scale touch only some coefficients, folded in place
+    if ( is_keyword( name, name_end, "translate", 9 ) ) {
+      if ( count != 1 && count != 2 ) return false;
+      double x = v[0], y = v[1];
+      m.e = m.a * x + m.c * y + m.e;
+      m.f = m.b * x + m.d * y + m.f;
+    } else if ( is_keyword( name, name_end, "scale", 5 ) ) {
+      if ( count != 1 && count != 2 ) return false;
+      double x = v[0], y = count > 1 ? v[1] : x;
+      m.a *= x; m.b *= x;
+      m.c *= y; m.d *= y;
+    } else if ( is_keyword( name, name_end, "rotate", 6 ) ) {
+      if ( count != 1 && count != 3 ) return false;
+      m = rotated( m, v[0], v[1], v[2] );
+    } else if ( is_keyword( name, name_end, "matrix", 6 ) ) {
+      if ( count != 6 ) return false;
+      m = m * Affine2D( v[0], v[1], v[2], v[3], v[4], v[5] );
+    } else if ( is_keyword( name, name_end, "skewX", 5 ) ) {
+      if ( count != 1 ) return false;
+      m = m * Affine2D( 1, 0, tan( v[0] * PI / 180.0f ), 1, 0, 0 );
+    } else if ( is_keyword( name, name_end, "skewY", 5 ) ) {
+      if ( count != 1 ) return false;
+      m = m * Affine2D( 1, tan( v[0] * PI / 180.0f ), 0, 1, 0, 0 );
+    } else {
+      return false;
+    }
+  }
+}
+
+} // namespace CMU462
@@ -0,0 +1,58 @@
+#ifndef CMU462_NUMBER_H
+#define CMU462_NUMBER_H
+
+#include <vector>
+
+#include "vector2D.h"
+#include "affine.h"
+
+namespace CMU462 {
+
+/**
+ * Number parsing for SVG attribute values. Input is a range that need
+ * not be NUL terminated, nothing is allocated and the C locale is
+ * assumed, unlike strtod and stream extraction.
+ *
+ * Numbers follow the SVG grammar: an optional sign, digits with an
+ * optional fraction and an optional exponent ("-1.5e-3", ".5", "+2.").
+ * Lists separate numbers by whitespace, a comma or both ("1,2 3 , 4"),
+ * and a sign or a second dot starts a new number ("1-2.5.5" is 1 -2.5 .5).
+ */
+
+static inline bool is_separator_space( char c ) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+// skip whitespace around at most one comma
+static inline void skip_separators( const char*& p, const char* end ) {
+  while ( p < end && is_separator_space( *p ) ) p++;
+  if ( p < end && *p == ',' ) {
+    p++;
+    while ( p < end && is_separator_space( *p ) ) p++;
+  }
+}
+
+// parse the number at p and advance past it. Returns false, leaving p
+// unchanged, if p does not start a number. Results are correctly rounded
+bool parse_number( const char*& p, const char* end, double& value );
+bool parse_number( const char*& p, const char* end, float&  value );
+
+// parse up to n numbers separated as in a list, starting with optional
+// separators. Returns the count read
+size_t parse_numbers( const char*& p, const char* end,
+                      float* values, size_t n );
+
+// parse a points attribute ("x,y x,y ...") and append the points.
+// Returns false on malformed input, points up to the error are kept
+bool parse_points( const char* begin, const char* end,
+                   std::vector<Vector2D>& points );
+
+// parse a transform attribute ("translate(10) rotate(45 5 5) ...") and
+// compose each transform into m, in the order listed, as it is read.
+// Returns false on malformed input, an unknown transform or an argument
+// count SVG does not allow for it, the transforms before it are kept
+bool parse_transform( const char* begin, const char* end, Affine2D& m );
+
+} // namespace CMU462
+
+#endif // CMU462_NUMBER_H
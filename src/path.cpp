@@ -0,0 +1,424 @@
+#include "path.h"
+#include "number.h"
+
+#include "CMU462.h"
+
+#include <cmath>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+// Path data tokenizer //
+
+static inline bool read_number( const char*& p, const char* end,
+                                double& value ) {
+  skip_separators( p, end );
+  return parse_number( p, end, value );
+}
+
+static inline bool read_point( const char*& p, const char* end,
+                               Vector2D& point ) {
+  return read_number( p, end, point.x ) && read_number( p, end, point.y );
+}
+
+// arc flags may be written without separators ("a1 1 0 01 5 5")
+static inline bool read_flag( const char*& p, const char* end, bool& flag ) {
+  skip_separators( p, end );
+  if ( p == end || ( *p != '0' && *p != '1' ) ) return false;
+  flag = ( *p == '1' );
+  p++;
+  return true;
+}
+
+// point on an ellipse (center c, radii r, rotation cos/sin) at angle a
+static inline Vector2D ellipse_point( const Vector2D& c, const Vector2D& r,
+                                      double cs, double sn, double a ) {
+  double x = r.x * cos( a ), y = r.y * sin( a );
+  return Vector2D( c.x + cs * x - sn * y, c.y + sn * x + cs * y );
+}
+
+// derivative of ellipse_point with respect to a
+static inline Vector2D ellipse_tangent( const Vector2D& r,
+                                        double cs, double sn, double a ) {
+  double x = -r.x * sin( a ), y = r.y * cos( a );
+  return Vector2D( cs * x - sn * y, sn * x + cs * y );
+}
+
+// signed angle from u to v
+static inline double angle_between( const Vector2D& u, const Vector2D& v ) {
+  return atan2( u.x * v.y - u.y * v.x, u.x * v.x + u.y * v.y );
+}
+
+// appends an elliptical arc from p0 to p1 as cubic Bezier segments. This
+// follows the endpoint to center parameterization conversion in the SVG
+// specification (implementation notes, section F.6.5)
+static void arc_to( PathData& path, const Vector2D& p0,
+                    double rx, double ry, double rotation,
+                    bool large_arc, bool sweep, const Vector2D& p1 ) {
+
+  if ( p0.x == p1.x && p0.y == p1.y ) return;
+
+  // degenerate radii draw a straight line
+  rx = fabs( rx ); ry = fabs( ry );
+  if ( rx == 0 || ry == 0 ) {
+    path.ops.push_back( PATH_LINE );
+    path.coords.push_back( p1 );
+    return;
+  }
+
+  double phi = rotation * PI / 180.0;
+  double cs = cos( phi ), sn = sin( phi );
+
+  // step 1: compute (x1', y1')
+  double dx2 = ( p0.x - p1.x ) / 2, dy2 = ( p0.y - p1.y ) / 2;
+  double x1p =  cs * dx2 + sn * dy2;
+  double y1p = -sn * dx2 + cs * dy2;
+
+  // scale up radii that are too small to span the endpoints
+  double lambda = ( x1p * x1p ) / ( rx * rx ) + ( y1p * y1p ) / ( ry * ry );
+  if ( lambda > 1 ) {
+    rx *= sqrt( lambda );
+    ry *= sqrt( lambda );
+  }
+
+  // step 2: compute (cx', cy')
+  double rx2 = rx * rx, ry2 = ry * ry;
+  double num = rx2 * ry2 - rx2 * y1p * y1p - ry2 * x1p * x1p;
+  double den = rx2 * y1p * y1p + ry2 * x1p * x1p;
+  double coef = den > 0 ? sqrt( max( 0.0, num / den ) ) : 0;
+  if ( large_arc == sweep ) coef = -coef;
+  double cxp =  coef * rx * y1p / ry;
+  double cyp = -coef * ry * x1p / rx;
+
+  // step 3: compute (cx, cy)
+  Vector2D center( cs * cxp - sn * cyp + ( p0.x + p1.x ) / 2,
+                   sn * cxp + cs * cyp + ( p0.y + p1.y ) / 2 );
+
+  // step 4: start angle and sweep
+  Vector2D u( ( x1p - cxp ) / rx, ( y1p - cyp ) / ry );
+  Vector2D v( ( -x1p - cxp ) / rx, ( -y1p - cyp ) / ry );
+  double theta = angle_between( Vector2D( 1, 0 ), u );
+  double delta = angle_between( u, v );
+  if ( !sweep && delta > 0 ) delta -= 2 * PI;
+  if (  sweep && delta < 0 ) delta += 2 * PI;
+
+  // split into segments of at most 90 degrees
+  int segments = (int) ceil( fabs( delta ) / ( PI / 2 ) - 1e-9 );
+  segments = max( segments, 1 );
+  double step = delta / segments;
+  double k = 4.0 / 3.0 * tan( step / 4 );
+
+  Vector2D radius( rx, ry );
+  for ( int i = 0; i < segments; ++i ) {
+    double a0 = theta + i * step, a1 = a0 + step;
+    Vector2D e0 = ellipse_point( center, radius, cs, sn, a0 );
+    Vector2D e1 = ellipse_point( center, radius, cs, sn, a1 );
+    path.ops.push_back( PATH_CUBIC );
+    path.coords.push_back( e0 + k * ellipse_tangent( radius, cs, sn, a0 ) );
+    path.coords.push_back( e1 - k * ellipse_tangent( radius, cs, sn, a1 ) );
+    path.coords.push_back( i == segments - 1 ? p1 : e1 );
+  }
+}
+
+// Parser //
+
+bool PathData::parse( const char* d ) {
+
+  if ( !d ) {
+    ops.clear(); coords.clear();
+    return false;
+  }
+  return parse( d, d + strlen( d ) );
+}
+
+bool PathData::parse( const char* begin, const char* end ) {
+
+  ops.clear(); coords.clear();
+
+  const char* p = begin;
+  char cmd = 0;
+
+  Vector2D cur, start;   // current point, start of the current subpath
+  Vector2D ctrl;         // last control point, for smooth curves
+  char last = 0;         // last command, for smooth curves
+  bool ok = true;
+
+  while ( ok ) {
+
+    skip_separators( p, end );
+    if ( p == end ) break;
+
+    // new command letter, or an implicit repeat of the last command
+    if ( isalpha( (unsigned char) *p ) ) {
+      cmd = *p++;
+    } else if ( !cmd || cmd == 'z' || cmd == 'Z' ) {
+      ok = false; break;
+    }
+
+    // the first command has to be a move
+    if ( ops.empty() && cmd != 'M' && cmd != 'm' ) {
+      ok = false; break;
+    }
+
+    // drawing after a close starts a new subpath at the old start point
+    if ( !ops.empty() && ops.back() == PATH_CLOSE &&
+         cmd != 'M' && cmd != 'm' && cmd != 'Z' && cmd != 'z' ) {
+      ops.push_back( PATH_MOVE );
+      coords.push_back( start );
+    }
+
+    bool rel = islower( cmd ) != 0;
+    Vector2D base = rel ? cur : Vector2D( 0, 0 );
+    char type = toupper( cmd );
+
+    switch ( type ) {
+
+      case 'M': {
+        Vector2D pt;
+        if ( !read_point( p, end, pt ) ) { ok = false; break; }
+        cur = start = base + pt;
+        ops.push_back( PATH_MOVE );
+        coords.push_back( cur );
+        // following coordinate pairs are implicit line commands
+        cmd = rel ? 'l' : 'L';
+        break;
+      }
+
+      case 'L': {
+        Vector2D pt;
+        if ( !read_point( p, end, pt ) ) { ok = false; break; }
+        cur = base + pt;
+        ops.push_back( PATH_LINE );
+        coords.push_back( cur );
+        break;
+      }
+
+      case 'H': {
+        double x;
+        if ( !read_number( p, end, x ) ) { ok = false; break; }
+        cur.x = base.x + x;
+        ops.push_back( PATH_LINE );
+        coords.push_back( cur );
+        break;
+      }
+
+      case 'V': {
+        double y;
+        if ( !read_number( p, end, y ) ) { ok = false; break; }
+        cur.y = base.y + y;
+        ops.push_back( PATH_LINE );
+        coords.push_back( cur );
+        break;
+      }
+
+      case 'C': case 'S': {
+        Vector2D c1, c2, pt;
+        if ( type == 'C' ) {
+          if ( !read_point( p, end, c1 ) ) { ok = false; break; }
+          c1 = base + c1;
+        } else {
+          // reflect the previous control point if it was a cubic
+          char prev = toupper( last );
+          c1 = ( prev == 'C' || prev == 'S' ) ? 2 * cur - ctrl : cur;
+        }
+        if ( !read_point( p, end, c2 ) || !read_point( p, end, pt ) ) {
+          ok = false; break;
+        }
+        c2 = base + c2; pt = base + pt;
+        ops.push_back( PATH_CUBIC );
+        coords.push_back( c1 );
+        coords.push_back( c2 );
+        coords.push_back( pt );
+        ctrl = c2; cur = pt;
+        break;
+      }
+
+      case 'Q': case 'T': {
+        Vector2D c, pt;
+        if ( type == 'Q' ) {
+          if ( !read_point( p, end, c ) ) { ok = false; break; }
+          c = base + c;
+        } else {
+          // reflect the previous control point if it was a quadratic
+          char prev = toupper( last );
+          c = ( prev == 'Q' || prev == 'T' ) ? 2 * cur - ctrl : cur;
+        }
+        if ( !read_point( p, end, pt ) ) { ok = false; break; }
+        pt = base + pt;
+        ops.push_back( PATH_QUAD );
+        coords.push_back( c );
+        coords.push_back( pt );
+        ctrl = c; cur = pt;
+        break;
+      }
+
+      case 'A': {
+        double rx, ry, rotation; bool large_arc, sweep; Vector2D pt;
+        if ( !read_number( p, end, rx ) || !read_number( p, end, ry ) ||
+             !read_number( p, end, rotation ) ||
+             !read_flag( p, end, large_arc ) || !read_flag( p, end, sweep ) ||
+             !read_point( p, end, pt ) ) {
+          ok = false; break;
+        }
+        pt = base + pt;
+        arc_to( *this, cur, rx, ry, rotation, large_arc, sweep, pt );
+        cur = pt;
+        break;
+      }
+
+      case 'Z': {
+        ops.push_back( PATH_CLOSE );
+        cur = start;
+        break;
+      }
+
+      default:
+        ok = false;
+        break;
+    }
+
+    last = cmd;
+  }
+
+  // bounds (control points included, so this is conservative)
+  if ( !coords.empty() ) {
+    bounds_min = bounds_max = coords[0];
+    for ( size_t i = 1; i < coords.size(); ++i ) {
+      bounds_min.x = min( bounds_min.x, coords[i].x );
+      bounds_min.y = min( bounds_min.y, coords[i].y );
+      bounds_max.x = max( bounds_max.x, coords[i].x );
+      bounds_max.y = max( bounds_max.y, coords[i].y );
+    }
+  }
+
+  return ok;
+}
+
+// Flattening //
+
+// number of uniform segments that keeps a Bezier curve of the given
+// degree within tolerance (Wang's formula). dd is the largest norm of
+// the second differences of the control points
+static inline int segment_count( int degree, double dd, float tolerance ) {
+  double n = sqrt( degree * ( degree - 1 ) / 8.0 * dd / tolerance );
+  return (int) min( max( ceil( n ), 1.0 ), 1024.0 );
+}
+
+void PathData::flatten( float tolerance, vector<Subpath>& subpaths ) const {
+
+  subpaths.clear();
+
+  Subpath* sp = NULL;
+  Vector2D cur, start;
+  size_t k = 0;
+
+  for ( size_t i = 0; i < ops.size(); ++i ) {
+
+    // every drawing command extends the current subpath
+    if ( ops[i] != PATH_MOVE && ops[i] != PATH_CLOSE && !sp ) {
+      subpaths.push_back( Subpath() );
+      sp = &subpaths.back();
+      sp->closed = false;
+      sp->points.push_back( cur );
+    }
+
+    switch ( ops[i] ) {
+
+      case PATH_MOVE:
+        cur = start = coords[k++];
+        subpaths.push_back( Subpath() );
+        sp = &subpaths.back();
+        sp->closed = false;
+        sp->points.push_back( cur );
+        break;
+
+      case PATH_LINE:
+        cur = coords[k++];
+        sp->points.push_back( cur );
+        break;
+
+      case PATH_QUAD: {
+        const Vector2D& p0 = cur;
+        const Vector2D& p1 = coords[k];
+        const Vector2D& p2 = coords[k + 1];
+        int n = segment_count( 2, ( p0 - 2 * p1 + p2 ).norm(), tolerance );
+        for ( int j = 1; j <= n; ++j ) {
+          double t = (double) j / n, s = 1 - t;
+          sp->points.push_back( s * s * p0 + 2 * s * t * p1 + t * t * p2 );
+        }
+        cur = p2; k += 2;
+        break;
+      }
+
+      case PATH_CUBIC: {
+        const Vector2D& p0 = cur;
+        const Vector2D& p1 = coords[k];
+        const Vector2D& p2 = coords[k + 1];
+        const Vector2D& p3 = coords[k + 2];
+        double dd = max( ( p0 - 2 * p1 + p2 ).norm(),
+                         ( p1 - 2 * p2 + p3 ).norm() );
+        int n = segment_count( 3, dd, tolerance );
+        for ( int j = 1; j <= n; ++j ) {
+          double t = (double) j / n, s = 1 - t;
+          sp->points.push_back( s * s * s * p0 + 3 * s * s * t * p1 +
+                                3 * s * t * t * p2 + t * t * t * p3 );
+        }
+        cur = p3; k += 3;
+        break;
+      }
+
+      case PATH_CLOSE:
+        if ( sp ) sp->closed = true;
+        cur = start;
+        sp = NULL;
+        break;
+    }
+  }
+
+  // drop lone move commands
+  size_t n = 0;
+  for ( size_t i = 0; i < subpaths.size(); ++i ) {
+    if ( subpaths[i].points.size() < 2 ) continue;
+    if ( n != i ) subpaths[n].points.swap( subpaths[i].points );
+    subpaths[n].closed = subpaths[i].closed;
+    n++;
+  }
+  subpaths.resize( n );
+}
+
+// Path cache //
+
+const vector<Subpath>& PathCache::flattened( const PathData& path,
+                                            float scale ) {
+
+  // bucket b covers scales in (2^(b-1), 2^b]. Flattening for the top of
+  // the bucket keeps the error below tolerance for the whole bucket
+  int bucket = 0;
+  if ( scale > 0 && scale < INF_F ) {
+    bucket = (int) ceil( log2( scale ) );
+    bucket = max( -32, min( 32, bucket ) );
+  }
+
+  map< int, vector<Subpath> >& cache = paths[&path];
+  map< int, vector<Subpath> >::iterator it = cache.find( bucket );
+  if ( it != cache.end() ) return it->second;
+
+  // evict the bucket furthest from the current zoom level
+  if ( cache.size() >= kPathMaxCachedBuckets ) {
+    map< int, vector<Subpath> >::iterator far = cache.begin();
+    if ( abs( cache.rbegin()->first - bucket ) > abs( far->first - bucket ) ) {
+      far = --cache.end();
+    }
+    cache.erase( far );
+  }
+
+  vector<Subpath>& subpaths = cache[bucket];
+  path.flatten( kPathPixelTolerance / ldexp( 1.0f, bucket ), subpaths );
+  return subpaths;
+}
+
+} // namespace CMU462
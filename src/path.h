@@ -0,0 +1,91 @@
+#ifndef CMU462_PATH_H
+#define CMU462_PATH_H
+
+#include <map>
+#include <vector>
+#include <unordered_map>
+
+#include "vector2D.h"
+
+namespace CMU462 {
+
+// maximum distance (in screen pixels) between a curve and its flattening
+static const float kPathPixelTolerance = 0.25f;
+
+// maximum number of zoom buckets a PathCache keeps a path flattened for
+static const size_t kPathMaxCachedBuckets = 8;
+
+/**
+ * Path commands after normalization. All coordinates are absolute,
+ * shorthand commands (H, V, S, T) are expanded and elliptical arcs
+ * are converted to cubic Bezier curves.
+ */
+typedef enum e_PathOp {
+  PATH_MOVE = 0,   // 1 point
+  PATH_LINE,       // 1 point
+  PATH_QUAD,       // 2 points: control, end
+  PATH_CUBIC,      // 3 points: control, control, end
+  PATH_CLOSE       // no points
+} PathOp;
+
+// a run of connected points produced by flattening a path
+struct Subpath {
+  std::vector<Vector2D> points;
+  bool closed;
+};
+
+class PathData {
+ public:
+
+  PathData() : bounds_min( 0, 0 ), bounds_max( 0, 0 ) { }
+
+  // parse SVG path data (the d attribute), returns false on malformed
+  // input. Commands parsed up to the error are kept, as the spec asks
+  bool parse( const char* d );
+
+  // parse path data in [begin, end), which need not be NUL terminated
+  bool parse( const char* begin, const char* end );
+
+  // flatten curves so that no point of the outline deviates more than
+  // tolerance (in path units) from the true curve
+  void flatten( float tolerance, std::vector<Subpath>& subpaths ) const;
+
+  inline bool empty() const { return ops.empty(); }
+
+  // bounds of all points including control points
+  Vector2D bounds_min;
+  Vector2D bounds_max;
+
+  // normalized commands and their points
+  std::vector<PathOp> ops;
+  std::vector<Vector2D> coords;
+
+}; // class PathData
+
+/**
+ * Flattened outlines of paths, kept by whoever draws them rather than by
+ * the paths, so that a document is only read while it is drawn and can
+ * be drawn by several renderers at once.
+ */
+class PathCache {
+ public:
+
+  // get the flattening of path for a given scale (screen pixels per path
+  // unit). Results are cached per power-of-two zoom bucket, so panning
+  // and small zoom steps reuse the same flattened outline
+  const std::vector<Subpath>& flattened( const PathData& path, float scale );
+
+  // drop every outline, before the paths they were made from are freed
+  void clear( void ) { paths.clear(); }
+
+ private:
+
+  // flattened subpaths by zoom bucket, by path
+  std::unordered_map< const PathData*,
+                      std::map< int, std::vector<Subpath> > > paths;
+
+}; // class PathCache
+
+} // namespace CMU462
+
+#endif // CMU462_PATH_H
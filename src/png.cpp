@@ -1,15 +1,246 @@
 #include "png.h"
+#include "inflate.h"
+#include "deflate.h"
+#include "task_pool.h"
 
+#include <cstring>
 #include <fstream>
+#include <algorithm>
 #include <sstream>
 #include <iostream>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DRAWSVG_PNG_SSE2
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
 namespace CMU462 {
 
+// Scanline filters //
+
+/* NOTE:
+ * Undoing the Sub, Avg and Paeth filters of a scanline is sequential from
+ * pixel to pixel, but the bytes within a pixel are independent. The SSE2
+ * paths handle a whole 3 or 4 byte pixel per step (RGB and RGBA, which is
+ * what embedded images are), and Up 16 bytes per step. Everything else
+ * goes byte by byte. recon may be the scanline itself.
+ */
+
+static inline unsigned char paeth_predictor( short a, short b, short c ) {
+  short p = a + b - c;
+  short pa = p > a ? p - a : a - p;
+  short pb = p > b ? p - b : b - p;
+  short pc = p > c ? p - c : c - p;
+  return (unsigned char) ( ( pa <= pb && pa <= pc ) ? a : pb <= pc ? b : c );
+}
+
+static void unfilter_sub( unsigned char* recon, const unsigned char* scanline,
+                          size_t bytewidth, size_t length ) {
+  for ( size_t i = 0; i < bytewidth && i < length; ++i ) recon[i] = scanline[i];
+  for ( size_t i = bytewidth; i < length; ++i ) {
+    recon[i] = scanline[i] + recon[i - bytewidth];
+  }
+}
+
+static void unfilter_up( unsigned char* recon, const unsigned char* scanline,
+                         const unsigned char* precon, size_t length ) {
+  for ( size_t i = 0; i < length; ++i ) recon[i] = scanline[i] + precon[i];
+}
+
+static void unfilter_avg( unsigned char* recon, const unsigned char* scanline,
+                          const unsigned char* precon, size_t bytewidth,
+                          size_t length ) {
+  for ( size_t i = 0; i < bytewidth && i < length; ++i ) {
+    recon[i] = scanline[i] + ( precon ? precon[i] / 2 : 0 );
+  }
+  for ( size_t i = bytewidth; i < length; ++i ) {
+    recon[i] = scanline[i] +
+               ( ( recon[i - bytewidth] + ( precon ? precon[i] : 0 ) ) / 2 );
+  }
+}
+
+static void unfilter_paeth( unsigned char* recon, const unsigned char* scanline,
+                            const unsigned char* precon, size_t bytewidth,
+                            size_t length ) {
+  for ( size_t i = 0; i < bytewidth && i < length; ++i ) {
+    recon[i] = scanline[i] + paeth_predictor( 0, precon[i], 0 );
+  }
+  for ( size_t i = bytewidth; i < length; ++i ) {
+    recon[i] = scanline[i] + paeth_predictor( recon[i - bytewidth], precon[i],
+                                              precon[i - bytewidth] );
+  }
+}
+
+#ifdef DRAWSVG_PNG_SSE2
+
+// whole pixels in the low bytes of a register
+template <int bpp>
+static inline __m128i load_pixel( const unsigned char* p ) {
+  int v = 0;
+  memcpy( &v, p, bpp );
+  return _mm_cvtsi32_si128( v );
+}
+
+template <int bpp>
+static inline void store_pixel( unsigned char* p, __m128i x ) {
+  int v = _mm_cvtsi128_si32( x );
+  memcpy( p, &v, bpp );
+}
+
+template <int bpp>
+static void unfilter_sub_sse2( unsigned char* recon,
+                               const unsigned char* scanline, size_t length ) {
+  __m128i a = _mm_setzero_si128();
+  for ( size_t i = 0; i + bpp <= length; i += bpp ) {
+    a = _mm_add_epi8( a, load_pixel<bpp>( scanline + i ) );
+    store_pixel<bpp>( recon + i, a );
+  }
+}
+
+static void unfilter_up_sse2( unsigned char* recon,
+                              const unsigned char* scanline,
+                              const unsigned char* precon, size_t length ) {
+  size_t i = 0;
+  for ( ; i + 16 <= length; i += 16 ) {
+    __m128i x = _mm_loadu_si128( (const __m128i*) ( scanline + i ) );
+    __m128i b = _mm_loadu_si128( (const __m128i*) ( precon + i ) );
+    _mm_storeu_si128( (__m128i*) ( recon + i ), _mm_add_epi8( x, b ) );
+  }
+  unfilter_up( recon + i, scanline + i, precon + i, length - i );
+}
+
+template <int bpp>
+static void unfilter_avg_sse2( unsigned char* recon,
+                               const unsigned char* scanline,
+                               const unsigned char* precon, size_t length ) {
+  // (a + b) / 2 is the rounding up average less the low bit of a ^ b
+  const __m128i one = _mm_set1_epi8( 1 );
+  __m128i a = _mm_setzero_si128();
+  for ( size_t i = 0; i + bpp <= length; i += bpp ) {
+    __m128i b = load_pixel<bpp>( precon + i );
+    __m128i avg = _mm_sub_epi8( _mm_avg_epu8( a, b ),
+                                _mm_and_si128( _mm_xor_si128( a, b ), one ) );
+    a = _mm_add_epi8( load_pixel<bpp>( scanline + i ), avg );
+    store_pixel<bpp>( recon + i, a );
+  }
+}
+
+static inline __m128i select_epi16( __m128i mask, __m128i x, __m128i y ) {
+  return _mm_or_si128( _mm_and_si128( mask, x ), _mm_andnot_si128( mask, y ) );
+}
+
+static inline __m128i abs_epi16( __m128i x ) {
+  return _mm_max_epi16( x, _mm_sub_epi16( _mm_setzero_si128(), x ) );
+}
+
+template <int bpp>
+static void unfilter_paeth_sse2( unsigned char* recon,
+                                 const unsigned char* scanline,
+                                 const unsigned char* precon, size_t length ) {
+  // a: left, b: above, c: above left, in 16 bit lanes
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  for ( size_t i = 0; i + bpp <= length; i += bpp ) {
+    __m128i b = _mm_unpacklo_epi8( load_pixel<bpp>( precon + i ), zero );
+
+    // distances of a + b - c to a, b and c
+    __m128i pa = _mm_sub_epi16( b, c );
+    __m128i pb = _mm_sub_epi16( a, c );
+    __m128i pc = abs_epi16( _mm_add_epi16( pa, pb ) );
+    pa = abs_epi16( pa );
+    pb = abs_epi16( pb );
+
+    // ties go to a, then b
+    __m128i smallest = _mm_min_epi16( pc, _mm_min_epi16( pa, pb ) );
+    __m128i nearest = select_epi16( _mm_cmpeq_epi16( smallest, pa ), a,
+                      select_epi16( _mm_cmpeq_epi16( smallest, pb ), b, c ) );
+
+    __m128i d = _mm_add_epi8( load_pixel<bpp>( scanline + i ),
+                              _mm_packus_epi16( nearest, nearest ) );
+    store_pixel<bpp>( recon + i, d );
+
+    a = _mm_unpacklo_epi8( d, zero );
+    c = b;
+  }
+}
+
+#endif
+
+// undo the filter of one scanline, precon is the previous reconstructed
+// scanline (NULL for the first). False for an invalid filter type
+static bool unfilter_scanline( unsigned char* recon,
+                               const unsigned char* scanline,
+                               const unsigned char* precon, size_t bytewidth,
+                               unsigned long filter, size_t length ) {
+
+  // above the first scanline is zero: Up is None, Paeth is Sub
+  if ( !precon && filter == 2 ) filter = 0;
+  if ( !precon && filter == 4 ) filter = 1;
+
+#ifdef DRAWSVG_PNG_SSE2
+  bool simd = ( bytewidth == 3 || bytewidth == 4 ) && length % bytewidth == 0;
+#else
+  bool simd = false;
+#endif
+
+  switch ( filter ) {
+    case 0:
+      if ( recon != scanline ) memmove( recon, scanline, length );
+      return true;
+    case 1:
+#ifdef DRAWSVG_PNG_SSE2
+      if ( simd ) {
+        if ( bytewidth == 3 ) unfilter_sub_sse2<3>( recon, scanline, length );
+        else                  unfilter_sub_sse2<4>( recon, scanline, length );
+        return true;
+      }
+#endif
+      unfilter_sub( recon, scanline, bytewidth, length );
+      return true;
+    case 2:
+#ifdef DRAWSVG_PNG_SSE2
+      unfilter_up_sse2( recon, scanline, precon, length );
+#else
+      unfilter_up( recon, scanline, precon, length );
+#endif
+      return true;
+    case 3:
+#ifdef DRAWSVG_PNG_SSE2
+      if ( simd && precon ) {
+        if ( bytewidth == 3 ) unfilter_avg_sse2<3>( recon, scanline, precon, length );
+        else                  unfilter_avg_sse2<4>( recon, scanline, precon, length );
+        return true;
+      }
+#endif
+      unfilter_avg( recon, scanline, precon, bytewidth, length );
+      return true;
+    case 4:
+#ifdef DRAWSVG_PNG_SSE2
+      if ( simd ) {
+        if ( bytewidth == 3 ) unfilter_paeth_sse2<3>( recon, scanline, precon, length );
+        else                  unfilter_paeth_sse2<4>( recon, scanline, precon, length );
+        return true;
+      }
+#endif
+      unfilter_paeth( recon, scanline, precon, bytewidth, length );
+      return true;
+    default:
+      return false;
+  }
+}
+
 // Parser routines //
 
+// largest image decoded, in pixels (1 GB of RGBA8). Headers are checked
+// before anything is allocated for the image
+static const unsigned long long kPNGMaxPixels = 1ull << 28;
+
+// most bytes deflate can expand one compressed byte to
+static const size_t kInflateMaxRatio = 1032;
+
 /* picoPNG version 20101224
  * Copyright (c) 2005-2010 Lode Vandevenne
  *
@@ -31,201 +262,6 @@ namespace CMU462 {
  */
 int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
     
-  static const unsigned long LENBASE[29] =  {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
-  static const unsigned long LENEXTRA[29] = {0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0};
-  static const unsigned long DISTBASE[30] =  {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
-  static const unsigned long DISTEXTRA[30] = {0,0,0,0,1,1,2, 2, 3, 3, 4, 4, 5, 5,  6,  6,  7,  7,  8,  8,   9,   9,  10,  10,  11,  11,  12,   12,   13,   13};
-  static const unsigned long CLCL[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15}; //code length code lengths
-  struct Zlib //nested functions for zlib decompression
-  {
-    static unsigned long readBitFromStream(size_t& bitp, const unsigned char* bits) { unsigned long result = (bits[bitp >> 3] >> (bitp & 0x7)) & 1; bitp++; return result;}
-    static unsigned long readBitsFromStream(size_t& bitp, const unsigned char* bits, size_t nbits)
-    {
-      unsigned long result = 0;
-      for(size_t i = 0; i < nbits; i++) result += (readBitFromStream(bitp, bits)) << i;
-      return result;
-    }
-    struct HuffmanTree
-    {
-      int makeFromLengths(const std::vector<unsigned long>& bitlen, unsigned long maxbitlen)
-      { //make tree given the lengths
-        unsigned long numcodes = (unsigned long)(bitlen.size()), treepos = 0, nodefilled = 0;
-        std::vector<unsigned long> tree1d(numcodes), blcount(maxbitlen + 1, 0), nextcode(maxbitlen + 1, 0);
-        for(unsigned long bits = 0; bits < numcodes; bits++) blcount[bitlen[bits]]++; //count number of instances of each code length
-        for(unsigned long bits = 1; bits <= maxbitlen; bits++) nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
-        for(unsigned long n = 0; n < numcodes; n++) if(bitlen[n] != 0) tree1d[n] = nextcode[bitlen[n]]++; //generate all the codes
-        tree2d.clear(); tree2d.resize(numcodes * 2, 32767); //32767 here means the tree2d isn't filled there yet
-        for(unsigned long n = 0; n < numcodes; n++) //the codes
-        for(unsigned long i = 0; i < bitlen[n]; i++) //the bits for this code
-        {
-          unsigned long bit = (tree1d[n] >> (bitlen[n] - i - 1)) & 1;
-          if(treepos > numcodes - 2) return 55;
-          if(tree2d[2 * treepos + bit] == 32767) //not yet filled in
-          {
-            if(i + 1 == bitlen[n]) { tree2d[2 * treepos + bit] = n; treepos = 0; } //last bit
-            else { tree2d[2 * treepos + bit] = ++nodefilled + numcodes; treepos = nodefilled; } //addresses are encoded as values > numcodes
-          }
-          else treepos = tree2d[2 * treepos + bit] - numcodes; //subtract numcodes from address to get address value
-        }
-        return 0;
-      }
-      int decode(bool& decoded, unsigned long& result, size_t& treepos, unsigned long bit) const
-      { //Decodes a symbol from the tree
-        unsigned long numcodes = (unsigned long)tree2d.size() / 2;
-        if(treepos >= numcodes) return 11; //error: you appeared outside the codetree
-        result = tree2d[2 * treepos + bit];
-        decoded = (result < numcodes);
-        treepos = decoded ? 0 : result - numcodes;
-        return 0;
-      }
-      std::vector<unsigned long> tree2d; //2D representation of a huffman tree: The one dimension is "0" or "1", the other contains all nodes and leaves of the tree.
-    };
-    struct Inflator
-    {
-      int error;
-      void inflate(std::vector<unsigned char>& out, const std::vector<unsigned char>& in, size_t inpos = 0)
-      {
-        size_t bp = 0, pos = 0; //bit pointer and byte pointer
-        error = 0;
-        unsigned long BFINAL = 0;
-        while(!BFINAL && !error)
-        {
-          if(bp >> 3 >= in.size()) { error = 52; return; } //error, bit pointer will jump past memory
-          BFINAL = readBitFromStream(bp, &in[inpos]);
-          unsigned long BTYPE = readBitFromStream(bp, &in[inpos]); BTYPE += 2 * readBitFromStream(bp, &in[inpos]);
-          if(BTYPE == 3) { error = 20; return; } //error: invalid BTYPE
-          else if(BTYPE == 0) inflateNoCompression(out, &in[inpos], bp, pos, in.size());
-          else inflateHuffmanBlock(out, &in[inpos], bp, pos, in.size(), BTYPE);
-        }
-        if(!error) out.resize(pos); //Only now we know the true size of out, resize it to that
-      }
-      void generateFixedTrees(HuffmanTree& tree, HuffmanTree& treeD) //get the tree of a deflated block with fixed tree
-      {
-        std::vector<unsigned long> bitlen(288, 8), bitlenD(32, 5);;
-        for(size_t i = 144; i <= 255; i++) bitlen[i] = 9;
-        for(size_t i = 256; i <= 279; i++) bitlen[i] = 7;
-        tree.makeFromLengths(bitlen, 15);
-        treeD.makeFromLengths(bitlenD, 15);
-      }
-      HuffmanTree codetree, codetreeD, codelengthcodetree; //the code tree for Huffman codes, dist codes, and code length codes
-      unsigned long huffmanDecodeSymbol(const unsigned char* in, size_t& bp, const HuffmanTree& codetree, size_t inlength)
-      { //decode a single symbol from given list of bits with given code tree. return value is the symbol
-        bool decoded; unsigned long ct;
-        for(size_t treepos = 0;;)
-        {
-          if((bp & 0x07) == 0 && (bp >> 3) > inlength) { error = 10; return 0; } //error: end reached without endcode
-          error = codetree.decode(decoded, ct, treepos, readBitFromStream(bp, in)); if(error) return 0; //stop, an error happened
-          if(decoded) return ct;
-        }
-      }
-      void getTreeInflateDynamic(HuffmanTree& tree, HuffmanTree& treeD, const unsigned char* in, size_t& bp, size_t inlength)
-      { //get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree
-        std::vector<unsigned long> bitlen(288, 0), bitlenD(32, 0);
-        if(bp >> 3 >= inlength - 2) { error = 49; return; } //the bit pointer is or will go past the memory
-        size_t HLIT =  readBitsFromStream(bp, in, 5) + 257; //number of literal/length codes + 257
-        size_t HDIST = readBitsFromStream(bp, in, 5) + 1; //number of dist codes + 1
-        size_t HCLEN = readBitsFromStream(bp, in, 4) + 4; //number of code length codes + 4
-        std::vector<unsigned long> codelengthcode(19); //lengths of tree to decode the lengths of the dynamic tree
-        for(size_t i = 0; i < 19; i++) codelengthcode[CLCL[i]] = (i < HCLEN) ? readBitsFromStream(bp, in, 3) : 0;
-        error = codelengthcodetree.makeFromLengths(codelengthcode, 7); if(error) return;
-        size_t i = 0, replength;
-        while(i < HLIT + HDIST)
-        {
-          unsigned long code = huffmanDecodeSymbol(in, bp, codelengthcodetree, inlength); if(error) return;
-          if(code <= 15)  { if(i < HLIT) bitlen[i++] = code; else bitlenD[i++ - HLIT] = code; } //a length code
-          else if(code == 16) //repeat previous
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 3 + readBitsFromStream(bp, in, 2);
-            unsigned long value; //set value to the previous code
-            if((i - 1) < HLIT) value = bitlen[i - 1];
-            else value = bitlenD[i - HLIT - 1];
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 13; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = value; else bitlenD[i++ - HLIT] = value;
-            }
-          }
-          else if(code == 17) //repeat "0" 3-10 times
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 3 + readBitsFromStream(bp, in, 3);
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 14; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-            }
-          }
-          else if(code == 18) //repeat "0" 11-138 times
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 11 + readBitsFromStream(bp, in, 7);
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 15; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-            }
-          }
-          else { error = 16; return; } //error: somehow an unexisting code appeared. This can never happen.
-        }
-        if(bitlen[256] == 0) { error = 64; return; } //the length of the end code 256 must be larger than 0
-        error = tree.makeFromLengths(bitlen, 15); if(error) return; //now we've finally got HLIT and HDIST, so generate the code trees, and the function is done
-        error = treeD.makeFromLengths(bitlenD, 15); if(error) return;
-      }
-      void inflateHuffmanBlock(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength, unsigned long btype) 
-      {
-        if(btype == 1) { generateFixedTrees(codetree, codetreeD); }
-        else if(btype == 2) { getTreeInflateDynamic(codetree, codetreeD, in, bp, inlength); if(error) return; }
-        for(;;)
-        {
-          unsigned long code = huffmanDecodeSymbol(in, bp, codetree, inlength); if(error) return;
-          if(code == 256) return; //end code
-          else if(code <= 255) //literal symbol
-          {
-            if(pos >= out.size()) out.resize((pos + 1) * 2); //reserve more room
-            out[pos++] = (unsigned char)(code);
-          }
-          else if(code >= 257 && code <= 285) //length code
-          {
-            size_t length = LENBASE[code - 257], numextrabits = LENEXTRA[code - 257];
-            if((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-            length += readBitsFromStream(bp, in, numextrabits);
-            unsigned long codeD = huffmanDecodeSymbol(in, bp, codetreeD, inlength); if(error) return;
-            if(codeD > 29) { error = 18; return; } //error: invalid dist code (30-31 are never used)
-            unsigned long dist = DISTBASE[codeD], numextrabitsD = DISTEXTRA[codeD];
-            if((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-            dist += readBitsFromStream(bp, in, numextrabitsD);
-            size_t start = pos, back = start - dist; //backwards
-            if(pos + length >= out.size()) out.resize((pos + length) * 2); //reserve more room
-            for(size_t i = 0; i < length; i++) { out[pos++] = out[back++]; if(back >= start) back = start - dist; }
-          }
-        }
-      }
-      void inflateNoCompression(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength)
-      {
-        while((bp & 0x7) != 0) bp++; //go to first boundary of byte
-        size_t p = bp / 8;
-        if(p >= inlength - 4) { error = 52; return; } //error, bit pointer will jump past memory
-        unsigned long LEN = in[p] + 256 * in[p + 1], NLEN = in[p + 2] + 256 * in[p + 3]; p += 4;
-        if(LEN + NLEN != 65535) { error = 21; return; } //error: NLEN is not one's complement of LEN
-        if(pos + LEN >= out.size()) out.resize(pos + LEN);
-        if(p + LEN > inlength) { error = 23; return; } //error: reading outside of in buffer
-        for(unsigned long n = 0; n < LEN; n++) out[pos++] = in[p++]; //read LEN bytes of literal data
-        bp = p * 8;
-      }
-    };
-    int decompress(std::vector<unsigned char>& out, const std::vector<unsigned char>& in) //returns error value
-    {
-      Inflator inflator;
-      if(in.size() < 2) { return 53; } //error, size of zlib data too small
-      if((in[0] * 256 + in[1]) % 31 != 0) { return 24; } //error: 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way
-      unsigned long CM = in[0] & 15, CINFO = (in[0] >> 4) & 15, FDICT = (in[1] >> 5) & 1;
-      if(CM != 8 || CINFO > 7) { return 25; } //error: only compression method 8: inflate with sliding window of 32k is supported by the PNG spec
-      if(FDICT != 0) { return 26; } //error: the specification of PNG says about the zlib stream: "The additional flags shall not specify a preset dictionary."
-      inflator.inflate(out, in, 2);
-      return inflator.error; //note: adler32 checksum was skipped and ignored
-    }
-  };
   struct PNGDecoder //nested functions for PNG decoding
   {
     struct Info
@@ -299,10 +335,27 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
         pos += 4; //step over CRC (which is ignored)
       }
       unsigned long bpp = getBpp(info);
-      std::vector<unsigned char> scanlines(((info.width * (info.height * bpp + 7)) / 8) + info.height); //now the out buffer will be filled
-      Zlib zlib; //decompress with the Zlib decompressor
-      error = zlib.decompress(scanlines, idat); if(error) return; //stop if the zlib decompressor returned an error
+      size_t linelength = (info.width * bpp + 7) / 8; //length in bytes of a scanline, excluding the filtertype byte
+      std::vector<unsigned char> scanlines; scanlines.reserve(std::min(info.height * (1 + linelength), idat.size() * kInflateMaxRatio)); //the decompressed size, bounded by what the data can expand to
+      error = zlib_decompress(idat.empty() ? 0 : &idat[0], idat.size(), scanlines); if(error) return; //stop if the zlib decompressor returned an error
+      std::vector<unsigned char>().swap(idat); //the compressed data is not needed any more
       size_t bytewidth = (bpp + 7) / 8, outlength = (info.height * info.width * bpp + 7) / 8;
+      if(info.interlaceMethod == 0 && scanlines.size() < info.height * (1 + linelength)) { error = 91; return; } //error: less data than the scanlines of the image
+      if(info.interlaceMethod == 0 && convert_to_rgba32) //no interlace: unfilter each scanline in place and convert it straight to RGBA8
+      {
+        out.resize(info.width * info.height * 4);
+        if(out.empty()) return;
+        const bool rgba8 = (info.colorType == 6 && info.bitDepth == 8); //nothing to convert, unfilter into out directly
+        for(unsigned long y = 0; y < info.height; y++)
+        {
+          unsigned char* line = &scanlines[y * (1 + linelength)];
+          unsigned char* recon = rgba8 ? &out[y * linelength] : line + 1;
+          const unsigned char* prevline = (y == 0) ? 0 : recon - (rgba8 ? linelength : 1 + linelength);
+          unFilterScanline(recon, line + 1, prevline, bytewidth, line[0], linelength); if(error) return;
+          if(!rgba8) { error = convertRow(&out[y * info.width * 4], recon, info, info.width); if(error) return; }
+        }
+        return;
+      }
       out.resize(outlength); //time to fill the out buffer
       unsigned char* out_ = outlength ? &out[0] : 0; //use a regular pointer to the std::vector for faster code if compiled without optimization
       if(info.interlaceMethod == 0) //no interlace, just filter
@@ -352,6 +405,7 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       if(in[0] != 137 || in[1] != 80 || in[2] != 78 || in[3] != 71 || in[4] != 13 || in[5] != 10 || in[6] != 26 || in[7] != 10) { error = 28; return; } //no PNG signature
       if(in[12] != 'I' || in[13] != 'H' || in[14] != 'D' || in[15] != 'R') { error = 29; return; } //error: it doesn't start with a IHDR chunk!
       info.width = read32bitInt(&in[16]); info.height = read32bitInt(&in[20]);
+      if((unsigned long long) info.width * info.height > kPNGMaxPixels) { error = 92; return; } //error: image too large to decode
       info.bitDepth = in[24]; info.colorType = in[25];
       info.compressionMethod = in[26]; if(in[26] != 0) { error = 32; return; } //error: only compression method 0 is allowed in the specification
       info.filterMethod = in[27]; if(in[27] != 0) { error = 33; return; } //error: only filter method 0 is allowed in the specification
@@ -360,43 +414,7 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
     }
     void unFilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned long filterType, size_t length)
     {
-      switch(filterType)
-      {
-        case 0: for(size_t i = 0; i < length; i++) recon[i] = scanline[i]; break;
-        case 1:
-          for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
-          for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
-          break;
-        case 2:
-          if(precon) for(size_t i = 0; i < length; i++) recon[i] = scanline[i] + precon[i];
-          else       for(size_t i = 0; i < length; i++) recon[i] = scanline[i];
-          break;
-        case 3:
-          if(precon)
-          {
-            for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i] + precon[i] / 2;
-            for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
-          }
-          else
-          {
-            for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
-            for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + recon[i - bytewidth] / 2;
-          }
-          break;
-        case 4:
-          if(precon)
-          {
-            for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i] + paethPredictor(0, precon[i], 0);
-            for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + paethPredictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]);
-          }
-          else
-          {
-            for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
-            for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + paethPredictor(recon[i - bytewidth], 0, 0);
-          }
-          break;
-        default: error = 36; return; //error: unexisting filter type given
-      }
+      if(!unfilter_scanline(recon, scanline, precon, bytewidth, filterType, length)) error = 36; //error: unexisting filter type given
     }
     void adam7Pass(unsigned char* out, unsigned char* linen, unsigned char* lineo, const unsigned char* in, unsigned long w, size_t passleft, size_t passtop, size_t spacex, size_t spacey, size_t passw, size_t passh, unsigned long bpp)
     { //filter and reposition the pixels into the output when the image is Adam7 interlaced. This function can only do it after the full image is already decoded. The out buffer must have the correct allocated memory size already.
@@ -440,9 +458,12 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
     }
     int convert(std::vector<unsigned char>& out, const unsigned char* in, Info& infoIn, unsigned long w, unsigned long h)
     { //converts from any color type to 32-bit. return value = LodePNG error code
-      size_t numpixels = w * h, bp = 0;
-      out.resize(numpixels * 4);
-      unsigned char* out_ = out.empty() ? 0 : &out[0]; //faster if compiled without optimization
+      out.resize(w * h * 4);
+      return out.empty() ? 0 : convertRow(&out[0], in, infoIn, w * h);
+    }
+    int convertRow(unsigned char* out_, const unsigned char* in, const Info& infoIn, size_t numpixels)
+    { //converts pixels starting on a byte boundary (a scanline, or a whole image without padding) to 32-bit
+      size_t bp = 0;
       if(infoIn.bitDepth == 8 && infoIn.colorType == 0) //greyscale
       for(size_t i = 0; i < numpixels; i++)
       {
@@ -472,7 +493,7 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       for(size_t i = 0; i < numpixels; i++)
       {
         out_[4 * i + 0] = out_[4 * i + 1] = out_[4 * i + 2] = in[2 * i];
-        out_[4 * i + 3] = (infoIn.key_defined && 256U * in[i] + in[i + 1] == infoIn.key_r) ? 0 : 255;
+        out_[4 * i + 3] = (infoIn.key_defined && 256U * in[2 * i] + in[2 * i + 1] == infoIn.key_r) ? 0 : 255;
       }
       else if(infoIn.bitDepth == 16 && infoIn.colorType == 2) //RGB color
       for(size_t i = 0; i < numpixels; i++)
@@ -503,11 +524,6 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       }
       return 0;
     }
-    unsigned char paethPredictor(short a, short b, short c) //Paeth predicter, used by PNG filter type 4
-    {
-      short p = a + b - c, pa = p > a ? (p - a) : (a - p), pb = p > b ? (p - b) : (b - p), pc = p > c ? (p - c) : (c - p);
-      return (unsigned char)((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c);
-    }
   };
   
   // always convert to 32 bit
@@ -516,11 +532,23 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
   // decode PNG
   PNGDecoder decoder; 
   decoder.decode(png.pixels, buffer, size, convert_to_rgba32);
-  png.width = decoder.info.width; 
-  png.height = decoder.info.height;
+  png.width  = decoder.error ? 0 : decoder.info.width;
+  png.height = decoder.error ? 0 : decoder.info.height;
+  if (decoder.error) png.pixels.clear();
   
   // premultiply by alpha
-  for (size_t i = 0; i < png.pixels.size(); i+= 4) {
+  size_t i = 0;
+#ifdef DRAWSVG_PNG_SSE2
+  // clear 4 pixels at a time, each a little endian word with alpha on top
+  for (; i + 16 <= png.pixels.size(); i += 16) {
+    __m128i* p = (__m128i*) &png.pixels[i];
+    __m128i x = _mm_loadu_si128(p);
+    __m128i alpha = _mm_srli_epi32(x, 24);
+    __m128i transparent = _mm_cmpeq_epi32(alpha, _mm_setzero_si128());
+    _mm_storeu_si128(p, _mm_andnot_si128(transparent, x));
+  }
+#endif
+  for (; i < png.pixels.size(); i+= 4) {
     if( ! png.pixels[i + 3] ) {
       png.pixels[  i  ] = 0; 
       png.pixels[i + 1] = 0; 
@@ -554,7 +582,281 @@ int PNGParser::load(const char* filename, PNG& png) {
 
 }
 
-int PNGParser::save(const char *filename, const PNG& png) {
+// Encoder //
+
+// rows per band are chosen for about this many bytes of filtered data
+static const size_t kBandBytes = 1 << 20;
+
+static const unsigned char kSignature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+// rows of the image filtered and compressed as one piece of the stream
+struct PNGBand {
+  size_t first, last;               // rows
+  std::vector<unsigned char> chunk; // the IDAT chunk of the band
+  uint32_t adler;                   // of the filtered rows
+  size_t bytes;                     // filtered bytes
+};
+
+static void put32( vector<unsigned char>& out, uint32_t value ) {
+  out.push_back( value >> 24 ); out.push_back( value >> 16 );
+  out.push_back( value >> 8 );  out.push_back( value );
+}
+
+// start a chunk at the end of out, returning its offset
+static size_t begin_chunk( vector<unsigned char>& out, const char* type ) {
+  size_t offset = out.size();
+  put32( out, 0 );
+  out.insert( out.end(), type, type + 4 );
+  return offset;
+}
+
+// fill in the length and append the crc of the chunk at offset
+static void end_chunk( vector<unsigned char>& out, size_t offset ) {
+  uint32_t length = (uint32_t) ( out.size() - offset - 8 );
+  out[offset]     = length >> 24; out[offset + 1] = length >> 16;
+  out[offset + 2] = length >> 8;  out[offset + 3] = length;
+  put32( out, crc32( 0, &out[offset + 4], length + 4 ) );
+}
+
+// sum of the filtered bytes taken as signed, small sums compress better
+static inline size_t filter_cost( const unsigned char* line, size_t length ) {
+  size_t sum = 0, i = 0;
+#ifdef DRAWSVG_PNG_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  __m128i total = zero;
+  for ( ; i + 16 <= length; i += 16 ) {
+    __m128i x = _mm_loadu_si128( (const __m128i*) ( line + i ) );
+    x = _mm_min_epu8( x, _mm_sub_epi8( zero, x ) );
+    total = _mm_add_epi64( total, _mm_sad_epu8( x, zero ) );
+  }
+  sum = _mm_cvtsi128_si32( total ) +
+        _mm_cvtsi128_si32( _mm_unpackhi_epi64( total, total ) );
+#endif
+  for ( ; i < length; ++i ) {
+    sum += line[i] < 128 ? line[i] : 256 - line[i];
+  }
+  return sum;
+}
+
+#ifdef DRAWSVG_PNG_SSE2
+// low or high 8 bytes of x in 16 bit lanes
+static inline __m128i widen_epu8( __m128i x, int high ) {
+  const __m128i zero = _mm_setzero_si128();
+  return high ? _mm_unpackhi_epi8( x, zero ) : _mm_unpacklo_epi8( x, zero );
+}
+#endif
+
+// filter one row of 4 byte pixels into out (filter type byte first),
+// picking the filter with the lowest cost. scratch holds 4 rows
+static void filter_row( const unsigned char* row, const unsigned char* prev,
+                        size_t length, int level, unsigned char* out,
+                        unsigned char* scratch ) {
+
+  static const size_t bpp = 4;
+
+  // not worth choosing when nothing is compressed
+  if ( level <= kDeflateStore ) {
+    out[0] = 0;
+    memcpy( out + 1, row, length );
+    return;
+  }
+
+  unsigned char* sub   = scratch;
+  unsigned char* up    = scratch + length;
+  unsigned char* avg   = scratch + 2 * length;
+  unsigned char* paeth = scratch + 3 * length;
+
+  for ( size_t i = 0; i < bpp && i < length; ++i ) {
+    sub[i]   = row[i];
+    up[i]    = row[i] - prev[i];
+    avg[i]   = row[i] - prev[i] / 2;
+    paeth[i] = row[i] - prev[i];
+  }
+  size_t i = bpp;
+#ifdef DRAWSVG_PNG_SSE2
+  // unlike unfiltering, every byte is independent: 4 pixels per step
+  const __m128i one = _mm_set1_epi8( 1 );
+  for ( ; i + 16 <= length; i += 16 ) {
+    __m128i x = _mm_loadu_si128( (const __m128i*) ( row + i ) );
+    __m128i a = _mm_loadu_si128( (const __m128i*) ( row + i - bpp ) );
+    __m128i b = _mm_loadu_si128( (const __m128i*) ( prev + i ) );
+    __m128i c = _mm_loadu_si128( (const __m128i*) ( prev + i - bpp ) );
+
+    __m128i mean = _mm_sub_epi8( _mm_avg_epu8( a, b ),
+                                 _mm_and_si128( _mm_xor_si128( a, b ), one ) );
+    _mm_storeu_si128( (__m128i*) ( sub + i ), _mm_sub_epi8( x, a ) );
+    _mm_storeu_si128( (__m128i*) ( up + i ),  _mm_sub_epi8( x, b ) );
+    _mm_storeu_si128( (__m128i*) ( avg + i ), _mm_sub_epi8( x, mean ) );
+
+    // the predictor in 16 bit lanes, low and high halves
+    __m128i nearest[2];
+    for ( int half = 0; half < 2; ++half ) {
+      __m128i a16 = widen_epu8( a, half );
+      __m128i b16 = widen_epu8( b, half );
+      __m128i c16 = widen_epu8( c, half );
+      __m128i pa = _mm_sub_epi16( b16, c16 );
+      __m128i pb = _mm_sub_epi16( a16, c16 );
+      __m128i pc = abs_epi16( _mm_add_epi16( pa, pb ) );
+      pa = abs_epi16( pa );
+      pb = abs_epi16( pb );
+      __m128i smallest = _mm_min_epi16( pc, _mm_min_epi16( pa, pb ) );
+      nearest[half] = select_epi16( _mm_cmpeq_epi16( smallest, pa ), a16,
+                      select_epi16( _mm_cmpeq_epi16( smallest, pb ), b16, c16 ) );
+    }
+    __m128i predicted = _mm_packus_epi16( nearest[0], nearest[1] );
+    _mm_storeu_si128( (__m128i*) ( paeth + i ), _mm_sub_epi8( x, predicted ) );
+  }
+#endif
+  for ( ; i < length; ++i ) {
+    unsigned char a = row[i - bpp], b = prev[i], c = prev[i - bpp];
+    sub[i]   = row[i] - a;
+    up[i]    = row[i] - b;
+    avg[i]   = row[i] - ( ( a + b ) >> 1 );
+    paeth[i] = row[i] - paeth_predictor( a, b, c );
+  }
+
+  const unsigned char* candidates[5] = { row, sub, up, avg, paeth };
+  int best = 0;
+  size_t best_cost = filter_cost( row, length );
+  for ( int f = 1; f < 5; ++f ) {
+    size_t cost = filter_cost( candidates[f], length );
+    if ( cost < best_cost ) { best = f; best_cost = cost; }
+  }
+
+  out[0] = best;
+  memcpy( out + 1, candidates[best], length );
+}
+
+static void encode_band( const PNG& png, int level, PNGBand* band ) {
+
+  size_t length = (size_t) png.width * 4, stride = length + 1;
+
+  // rows before the band are filtered again, they are the window the
+  // band's matches can refer to
+  size_t context = 0;
+  if ( level > kDeflateStore ) {
+    context = min( band->first, ( 32768 + stride - 1 ) / stride );
+  }
+  size_t first = band->first - context;
+
+  vector<unsigned char> filtered( ( band->last - first ) * stride );
+  vector<unsigned char> zero( length, 0 ), scratch( 4 * length );
+  for ( size_t y = first; y < band->last; ++y ) {
+    const unsigned char* row = &png.pixels[y * length];
+    filter_row( row, y ? row - length : &zero[0], length, level,
+                &filtered[( y - first ) * stride], &scratch[0] );
+  }
+
+  const unsigned char* data = &filtered[context * stride];
+  band->bytes = ( band->last - band->first ) * stride;
+  band->adler = adler32( 1, data, band->bytes );
+
+  size_t offset = begin_chunk( band->chunk, "IDAT" );
+  if ( band->first == 0 ) {
+    // zlib header: deflate with a 32k window
+    band->chunk.push_back( 0x78 );
+    band->chunk.push_back( level <= kDeflateFast ? 0x01 : 0x9c );
+  }
+  deflate( data, band->bytes, context * stride, level, false, band->chunk );
+  end_chunk( band->chunk, offset );
+}
+
+// write signature, chunks and compressed bands of a valid image to file
+static void write_png(ostream& file, const PNG& png, int level,
+                      TaskPool* pool) {
+
+  // signature and header, 8 bit RGBA
+  vector<unsigned char> header(kSignature, kSignature + 8);
+  size_t offset = begin_chunk(header, "IHDR");
+  put32(header, png.width);
+  put32(header, png.height);
+  unsigned char format[5] = { 8, 6, 0, 0, 0 };
+  header.insert(header.end(), format, format + 5);
+  end_chunk(header, offset);
+  file.write((const char*) &header[0], header.size());
+
+  // bands are compressed independently, each ends with a sync flush and
+  // becomes an IDAT chunk of its own
+  size_t stride = (size_t) png.width * 4 + 1;
+  size_t rows = max((size_t) 1, kBandBytes / stride);
+  size_t count = (png.height + rows - 1) / rows;
+
+  vector<PNGBand> bands(count);
+  vector<TaskGroup> done(count);
+  for (size_t i = 0; i < count; ++i) {
+    PNGBand* band = &bands[i];
+    band->first = i * rows;
+    band->last  = min(band->first + rows, (size_t) png.height);
+    if (pool) {
+      pool->submit([&png, level, band] { encode_band(png, level, band); },
+                   &done[i]);
+    }
+  }
+
+  // written in order as they complete
+  uint32_t adler = 1;
+  for (size_t i = 0; i < count; ++i) {
+    if (pool) done[i].wait(); else encode_band(png, level, &bands[i]);
+    file.write((const char*) &bands[i].chunk[0], bands[i].chunk.size());
+    adler = adler32_combine(adler, bands[i].adler, bands[i].bytes);
+    vector<unsigned char>().swap(bands[i].chunk);
+  }
+
+  // an empty final block ends the stream, then its checksum
+  vector<unsigned char> trailer;
+  offset = begin_chunk(trailer, "IDAT");
+  unsigned char last[5] = { 1, 0, 0, 0xff, 0xff };
+  trailer.insert(trailer.end(), last, last + 5);
+  put32(trailer, adler);
+  end_chunk(trailer, offset);
+  end_chunk(trailer, begin_chunk(trailer, "IEND"));
+  file.write((const char*) &trailer[0], trailer.size());
+
+  // wait for every band before returning, even if writing failed
+  for (size_t i = 0; i < count; ++i) done[i].wait();
+}
+
+static bool writable(const PNG& png) {
+  return png.width > 0 && png.height > 0 &&
+         png.pixels.size() >= (size_t) png.width * png.height * 4;
+}
+
+int PNGParser::save(const char *filename, const PNG& png, int level,
+                    TaskPool* pool) {
+
+  if (!writable(png)) {
+    cerr << "PNG: no RGBA8 image to write to " << filename << endl;
+    return -1;
+  }
+
+  ofstream file(filename, ios::out | ios::binary);
+  if (!file) {
+    cerr << "PNG: cannot open " << filename << " for writing" << endl;
+    return -1;
+  }
+
+  write_png(file, png, level, pool);
+
+  if (!file.good()) {
+    cerr << "PNG: failed writing " << filename << endl;
+    return -1;
+  }
+  return 0;
+}
+
+int PNGParser::save(vector<unsigned char>& out, const PNG& png, int level,
+                    TaskPool* pool) {
+
+  if (!writable(png)) {
+    cerr << "PNG: no RGBA8 image to encode" << endl;
+    return -1;
+  }
+
+  ostringstream file(ios::out | ios::binary);
+  write_png(file, png, level, pool);
+
+  const string& bytes = file.str();
+  out.insert(out.end(), bytes.begin(), bytes.end());
   return 0;
 }
 
@@ -8,8 +8,12 @@
 #include "vector2D.h"
 #include "tinyxml2.h"
 
+#include "deflate.h"
+
 namespace CMU462 {
 
+class TaskPool;
+
 struct PNG {
   int width;
   int height;
@@ -20,7 +24,16 @@ class PNGParser {
  public:
   static int load( const unsigned char* buffer, size_t size, PNG& png );
   static int load( const char* filename, PNG& png );
-  static int save( const char* filename, const PNG& png );
+
+  // write RGBA8 pixels. level is kDeflateStore, kDeflateFast or
+  // kDeflateDefault, bands of rows are filtered and compressed in parallel
+  // on pool if one is given
+  static int save( const char* filename, const PNG& png,
+                   int level = kDeflateDefault, TaskPool* pool = NULL );
+
+  // encode the same way into memory, appending the file to out
+  static int save( std::vector<unsigned char>& out, const PNG& png,
+                   int level = kDeflateDefault, TaskPool* pool = NULL );
 }; // class PNGParser
 
 } // namespace CMU462
@@ -0,0 +1,182 @@
+#include "profiler.h"
+
+#ifdef DRAWSVG_PROFILE
+
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+namespace CMU462 {
+
+// deepest nesting of timed scopes
+static const size_t kProfileDepth = 32;
+
+// events kept by a capture, a few million is what trace viewers still load
+static const size_t kProfileEvents = 1 << 21;
+
+static const char* kStageNames[PROFILE_STAGES] = {
+  "traversal", "triangulation", "rasterization", "resolve", "upload"
+};
+
+static const char* kStageLabels[PROFILE_STAGES] = {
+  "trav", "tri", "rast", "resolve", "upload"
+};
+
+Profiler profiler;
+
+Profiler::Profiler()
+  : active( false ), untracked( 0 ), frame_start( 0 ),
+    capture_frames( 0 ), capture_enabled( false ), dropped( 0 ) {
+  clock.start();
+  scopes.reserve( kProfileDepth );
+  for ( int i = 0; i < PROFILE_STAGES; i++ ) totals[i] = shown[i] = 0;
+}
+
+double Profiler::now( void ) {
+  clock.stop();
+  return clock.duration();
+}
+
+void Profiler::enable( bool on ) {
+  if ( on && !active ) {
+    for ( int i = 0; i < PROFILE_STAGES; i++ ) totals[i] = shown[i] = 0;
+    frame_start = now();
+  }
+  active = on;
+}
+
+void Profiler::begin( ProfileStage stage ) {
+
+  if ( untracked || scopes.size() == kProfileDepth ) {
+    untracked++;
+    return;
+  }
+
+  // a stage inside itself (an image drawn as points, say) is timed once
+  if ( !scopes.empty() && scopes.back().stage == stage ) {
+    scopes.back().repeats++;
+    return;
+  }
+
+  Scope scope = { stage, now(), 0, 0 };
+  scopes.push_back( scope );
+}
+
+void Profiler::end( void ) {
+
+  if ( untracked ) {
+    untracked--;
+    return;
+  }
+  if ( scopes.empty() ) return;
+
+  Scope& scope = scopes.back();
+  if ( scope.repeats ) {
+    scope.repeats--;
+    return;
+  }
+
+  double duration = now() - scope.start;
+  totals[scope.stage] += duration - scope.children;
+
+  if ( capture_frames ) {
+    if ( events.size() < kProfileEvents ) {
+      Event event = { scope.stage, scope.start, duration };
+      events.push_back( event );
+    } else {
+      dropped++;
+    }
+  }
+
+  scopes.pop_back();
+  if ( !scopes.empty() ) scopes.back().children += duration;
+}
+
+void Profiler::end_frame( void ) {
+
+  if ( !active ) return;
+
+  double t = now();
+  for ( int i = 0; i < PROFILE_STAGES; i++ ) {
+    if ( totals[i] > 0 ) shown[i] = totals[i];
+    totals[i] = 0;
+  }
+
+  if ( capture_frames ) {
+    Event event = { -1, frame_start, t - frame_start };
+    events.push_back( event );
+
+    if ( --capture_frames == 0 ) {
+      write_trace();
+      vector<Event>().swap( events );
+      active = capture_enabled;
+    }
+  }
+
+  frame_start = t;
+}
+
+string Profiler::breakdown( void ) const {
+
+  string line;
+  char text[32];
+  for ( int i = 0; i < PROFILE_STAGES; i++ ) {
+    snprintf( text, sizeof( text ), "%s%s %.2f", i ? " | " : "",
+              kStageLabels[i], shown[i] * 1e3 );
+    line += text;
+  }
+  return line + " ms";
+}
+
+void Profiler::capture( size_t frames, const string& filename ) {
+
+  if ( !frames || capturing() ) return;
+
+  capture_enabled = active;
+  enable( true );
+
+  capture_frames = frames;
+  capture_file = filename;
+  events.clear();
+  events.reserve( 1 << 16 );
+  dropped = 0;
+}
+
+int Profiler::write_trace( void ) {
+
+  FILE* file = fopen( capture_file.c_str(), "w" );
+  if ( !file ) {
+    cerr << "[DrawSVG] Cannot write trace " << capture_file << endl;
+    return -1;
+  }
+
+  // complete events ("X") with timestamps and durations in microseconds
+  size_t frames = 0;
+  fprintf( file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+  for ( size_t i = 0; i < events.size(); i++ ) {
+    const Event& event = events[i];
+    if ( event.stage < 0 ) frames++;
+    fprintf( file, "{\"name\":\"%s\",\"cat\":\"drawsvg\",\"ph\":\"X\","
+                   "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}%s\n",
+             event.stage < 0 ? "frame" : kStageNames[event.stage],
+             event.start * 1e6, event.duration * 1e6,
+             i + 1 < events.size() ? "," : "" );
+  }
+  fprintf( file, "]}\n" );
+
+  if ( fclose( file ) ) {
+    cerr << "[DrawSVG] Failed writing trace " << capture_file << endl;
+    return -1;
+  }
+
+  cerr << "[DrawSVG] Wrote trace of " << frames << " frames to "
+       << capture_file;
+  if ( dropped ) cerr << " (" << dropped << " scopes dropped)";
+  cerr << endl;
+  return 0;
+}
+
+} // namespace CMU462
+
+#endif // DRAWSVG_PROFILE
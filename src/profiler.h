@@ -0,0 +1,146 @@
+#ifndef CMU462_PROFILER_H
+#define CMU462_PROFILER_H
+
+/**
+ * Per-stage frame profiler.
+ *
+ * Scopes placed around the stages of a frame measure where its time goes.
+ * Time spent in a nested scope of another stage is only counted for the
+ * inner stage, so the stages of a frame add up to its drawing time.
+ *
+ * The profiler is only built with DRAWSVG_PROFILE defined (the CMake option
+ * DRAWSVG_BUILD_PROFILER, or debug builds). Without it DRAWSVG_PROFILE_SCOPE
+ * expands to nothing. With it, a scope costs a test of a flag until the
+ * profiler is enabled at runtime.
+ *
+ * The profiler is not thread safe: scopes are meant for the thread that
+ * draws and displays the frames.
+ */
+
+namespace CMU462 {
+
+enum ProfileStage {
+  PROFILE_TRAVERSAL,      // walking the document, transforms and setup
+  PROFILE_TRIANGULATION,  // polygons and subpaths to triangles
+  PROFILE_RASTERIZATION,  // shapes and sprite stamps, timed per element
+  PROFILE_RESOLVE,        // supersamples to the render target
+  PROFILE_UPLOAD,         // frame to the screen (glDrawPixels)
+  PROFILE_STAGES
+};
+
+} // namespace CMU462
+
+#ifdef DRAWSVG_PROFILE
+
+#include "timer.h"
+
+#include <string>
+#include <vector>
+
+namespace CMU462 {
+
+class Profiler {
+ public:
+
+  Profiler();
+
+  bool enabled( void ) const { return active; }
+
+  /**
+   * Turns measuring on or off. Only toggle between frames.
+   */
+  void enable( bool on );
+
+  /**
+   * Opens and closes the scope of a stage, see ProfileScope.
+   */
+  void begin( ProfileStage stage );
+  void end( void );
+
+  /**
+   * Ends the current frame. Stages measured in it replace the ones shown
+   * by breakdown(), and a running capture records the frame.
+   */
+  void end_frame( void );
+
+  /**
+   * Milliseconds of the most recent measurement of every stage, as one
+   * line for the OSD.
+   */
+  std::string breakdown( void ) const;
+
+  /**
+   * Records the next frames, enabling the profiler while it does, and
+   * writes them to filename as Chrome trace JSON (chrome://tracing or
+   * Perfetto) once the last one ends.
+   */
+  void capture( size_t frames, const std::string& filename );
+  bool capturing( void ) const { return capture_frames > 0; }
+
+ private:
+
+  // seconds since the profiler was created
+  double now( void );
+
+  // writes the captured events, returns 0 on success
+  int write_trace( void );
+
+  struct Scope {
+    ProfileStage stage;
+    double start;       // seconds
+    double children;    // seconds spent in nested scopes of other stages
+    size_t repeats;     // nested scopes of the same stage, not timed
+  };
+
+  struct Event {
+    int stage;          // a ProfileStage, or -1 for a whole frame
+    double start;       // seconds
+    double duration;    // seconds
+  };
+
+  Timer clock;
+  bool active;
+
+  std::vector<Scope> scopes;
+  size_t untracked;     // scopes opened while scopes was full
+
+  double frame_start;
+  double totals[PROFILE_STAGES];  // exclusive seconds in the current frame
+  double shown[PROFILE_STAGES];   // latest measured frame of each stage
+
+  size_t capture_frames;          // frames left to capture
+  bool capture_enabled;           // whether the profiler was on before
+  std::string capture_file;
+  std::vector<Event> events;
+  size_t dropped;                 // events past the capture limit
+
+};
+
+// the profiler of the viewer
+extern Profiler profiler;
+
+/**
+ * Measures a stage from construction to the end of the enclosing block.
+ */
+class ProfileScope {
+ public:
+  ProfileScope( ProfileStage stage ) : on( profiler.enabled() ) {
+    if ( on ) profiler.begin( stage );
+  }
+  ~ProfileScope() { if ( on ) profiler.end(); }
+ private:
+  bool on;
+};
+
+} // namespace CMU462
+
+#define DRAWSVG_PROFILE_SCOPE( stage ) \
+  CMU462::ProfileScope drawsvg_profile_scope( CMU462::stage )
+
+#else
+
+#define DRAWSVG_PROFILE_SCOPE( stage )
+
+#endif // DRAWSVG_PROFILE
+
+#endif // CMU462_PROFILER_H
@@ -0,0 +1,288 @@
+/*
+ * Headless batch renderer.
+ *
+ * Renders SVG files (or every .svg/.svgz under a directory) with the
+ * software renderer into memory and writes the frames as PNG, PPM or raw
+ * RGBA, without a window or GL context. Files are rendered concurrently,
+ * one per worker, and the load, draw and write time of each is reported
+ * once all are done.
+ *
+ * usage: drawsvg_render [options] <file or directory>...
+ *   -o <dir>            output directory (default: current directory)
+ *   -f png|ppm|raw      output format (default: png)
+ *   -s <width> <height> frame size in pixels (default: 800 600)
+ *   -r <rate>           sample rate, samples per pixel side (default: 1)
+ *   -v <x> <y> <span>   view centered on (x, y) in svg units, span being
+ *                       half the visible size (default: whole canvas)
+ *   -j <threads>        workers (default: hardware threads)
+ *   -c                  load through precompiled scenes (see loadCached),
+ *                       writing the missing or stale ones
+ *
+ * Frames are named after their files with the extension of the format.
+ * Files that would write the same frame (x.svg of two directories, say)
+ * are rejected before anything is rendered.
+ */
+
+#include "svg.h"
+#include "png.h"
+#include "texture.h"
+#include "viewport.h"
+#include "task_pool.h"
+#include "software_renderer.h"
+#include "bench/bench_util.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <map>
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[DrawSVG] " << s << endl;
+
+enum Format { FORMAT_PNG, FORMAT_PPM, FORMAT_RAW };
+
+static const char* kExtensions[] = { ".png", ".ppm", ".rgba" };
+
+struct Options {
+  string output;
+  Format format;
+  size_t width, height;
+  size_t sample_rate;
+  bool view;
+  float view_x, view_y, view_span;
+  size_t threads;
+  bool cached;
+  TaskPool* encoder;  // compresses the bands of PNG frames
+};
+
+struct Job {
+  string input, output;
+  int status;
+  double load_ms, draw_ms, write_ms;
+};
+
+// writes frame, which is left empty when written as PNG
+static int write_frame( const string& filename, const Options& options,
+                        vector<unsigned char>& frame ) {
+
+  size_t width = options.width, height = options.height;
+
+  if ( options.format == FORMAT_PNG ) {
+    PNG png;
+    png.width = width;
+    png.height = height;
+    png.pixels.swap( frame );
+    return PNGParser::save( filename.c_str(), png, kDeflateDefault,
+                            options.encoder );
+  }
+
+  FILE* file = fopen( filename.c_str(), "wb" );
+  if ( !file ) return -1;
+
+  bool written = true;
+  if ( options.format == FORMAT_PPM ) {
+    fprintf( file, "P6\n%zu %zu\n255\n", width, height );
+    vector<unsigned char> row( 3 * width );
+    for ( size_t y = 0; y < height && written; y++ ) {
+      const unsigned char* src = &frame[4 * width * y];
+      for ( size_t x = 0; x < width; x++ ) {
+        row[3 * x + 0] = src[4 * x + 0];
+        row[3 * x + 1] = src[4 * x + 1];
+        row[3 * x + 2] = src[4 * x + 2];
+      }
+      written = fwrite( &row[0], 1, row.size(), file ) == row.size();
+    }
+  } else {
+    written = fwrite( &frame[0], 1, frame.size(), file ) == frame.size();
+  }
+
+  written = !fclose( file ) && written;
+  return written ? 0 : -1;
+}
+
+// load, draw and write one file. Runs on a worker, everything it uses is
+// its own: document, renderer, sampler and frame
+static void render( Job* job, const Options* options ) {
+
+  double t0 = now();
+
+  // images are decoded before loading returns, waiting on other tasks
+  // from a worker could leave every worker waiting
+  SVG svg;
+  int status = options->cached ?
+    SVGParser::loadCached( job->input.c_str(), &svg, NULL, true ) :
+    SVGParser::load( job->input.c_str(), &svg );
+  if ( status < 0 ) {
+    job->status = -1;
+    return;
+  }
+
+  double t1 = now();
+
+  size_t width = options->width, height = options->height;
+  vector<unsigned char> frame( 4 * width * height );
+
+  SoftwareRendererImp renderer;
+  Sampler2DImp sampler;
+  renderer.set_tex_sampler( &sampler );
+  renderer.set_render_target( &frame[0], width, height );
+  renderer.set_sample_rate( options->sample_rate );
+
+  ViewportImp viewport;
+  if ( options->view ) {
+    viewport.set_viewbox( options->view_x, options->view_y,
+                          options->view_span );
+  } else {
+    float span = 1.2 * max( svg.width, svg.height ) / 2;
+    viewport.set_viewbox( svg.width / 2, svg.height / 2, span );
+  }
+
+  // the largest centered square of the frame shows the view
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = ( width  - scale ) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = ( height - scale ) / 2;
+  renderer.set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+
+  renderer.draw_svg( svg );
+
+  double t2 = now();
+
+  job->status = write_frame( job->output, *options, frame );
+
+  double t3 = now();
+
+  job->load_ms  = ( t1 - t0 ) * 1e3;
+  job->draw_ms  = ( t2 - t1 ) * 1e3;
+  job->write_ms = ( t3 - t2 ) * 1e3;
+}
+
+static void usage( const char* program ) {
+  msg( "Usage: " << program << " [-o dir] [-f png|ppm|raw] "
+       << "[-s width height] [-r rate] [-v x y span] [-j threads] [-c] "
+       << "<file or directory>..." );
+}
+
+int main( int argc, char** argv ) {
+
+  Options options;
+  options.output = ".";
+  options.format = FORMAT_PNG;
+  options.width = 800; options.height = 600;
+  options.sample_rate = 1;
+  options.view = false;
+  options.threads = 0;
+  options.cached = false;
+  options.encoder = NULL;
+
+  vector<string> files;
+  for ( int i = 1; i < argc; i++ ) {
+    string arg = argv[i];
+    if ( arg == "-o" && i + 1 < argc ) {
+      options.output = argv[++i];
+    } else if ( arg == "-f" && i + 1 < argc ) {
+      string format = argv[++i];
+      if ( format == "png" ) options.format = FORMAT_PNG;
+      else if ( format == "ppm" ) options.format = FORMAT_PPM;
+      else if ( format == "raw" ) options.format = FORMAT_RAW;
+      else { usage( argv[0] ); return 1; }
+    } else if ( arg == "-s" && i + 2 < argc ) {
+      options.width  = max( 1, atoi( argv[++i] ) );
+      options.height = max( 1, atoi( argv[++i] ) );
+    } else if ( arg == "-r" && i + 1 < argc ) {
+      options.sample_rate = max( 1, atoi( argv[++i] ) );
+    } else if ( arg == "-v" && i + 3 < argc ) {
+      options.view = true;
+      options.view_x = atof( argv[++i] );
+      options.view_y = atof( argv[++i] );
+      options.view_span = atof( argv[++i] );
+    } else if ( arg == "-j" && i + 1 < argc ) {
+      options.threads = max( 1, atoi( argv[++i] ) );
+    } else if ( arg == "-c" ) {
+      options.cached = true;
+    } else if ( !arg.empty() && arg[0] == '-' ) {
+      usage( argv[0] );
+      return 1;
+    } else if ( !collect( arg, files ) ) {
+      msg( "Cannot read " << arg );
+      return 1;
+    }
+  }
+
+  if ( files.empty() ) {
+    usage( argv[0] );
+    return 1;
+  }
+
+  string directory = options.output;
+  if ( directory[directory.size() - 1] != '/' ) directory.push_back( '/' );
+
+  map<string, string> outputs;  // input of each output
+  vector<Job> jobs( files.size() );
+  for ( size_t i = 0; i < files.size(); i++ ) {
+    string name = files[i].substr( files[i].find_last_of( "/" ) + 1 );
+    name = name.substr( 0, name.find_last_of( "." ) );
+    jobs[i].input  = files[i];
+    jobs[i].output = directory + name + kExtensions[options.format];
+    jobs[i].status = 0;
+    jobs[i].load_ms = jobs[i].draw_ms = jobs[i].write_ms = 0;
+
+    pair<map<string, string>::iterator, bool> added =
+      outputs.insert( make_pair( jobs[i].output, files[i] ) );
+    if ( !added.second ) {
+      msg( files[i] << " and " << added.first->second
+           << " would both be written to " << jobs[i].output );
+      return 1;
+    }
+  }
+
+  // workers wait for the bands of their frames, so the bands go to a pool
+  // of their own: waiting on the pool a task runs on could leave every
+  // worker waiting
+  TaskPool encoder( options.threads );
+  options.encoder = &encoder;
+
+  double start = now();
+  {
+    TaskPool pool( options.threads );
+    TaskGroup group;
+    for ( size_t i = 0; i < jobs.size(); i++ ) {
+      Job* job = &jobs[i];
+      const Options* shared = &options;
+      pool.submit( [job, shared] { render( job, shared ); }, &group );
+    }
+    group.wait();
+  }
+  double wall = now() - start;
+
+  printf( "%-32s %10s %10s %10s %10s\n", "file", "load(ms)", "draw(ms)",
+          "write(ms)", "total(ms)" );
+
+  int failed = 0;
+  double total[3] = { 0, 0, 0 };
+  for ( size_t i = 0; i < jobs.size(); i++ ) {
+    const Job& job = jobs[i];
+    string name = job.input.substr( job.input.find_last_of( "/" ) + 1 );
+    if ( job.status < 0 ) {
+      printf( "%-32s failed\n", name.c_str() );
+      failed++;
+      continue;
+    }
+    printf( "%-32s %10.2f %10.2f %10.2f %10.2f\n", name.c_str(),
+            job.load_ms, job.draw_ms, job.write_ms,
+            job.load_ms + job.draw_ms + job.write_ms );
+    total[0] += job.load_ms; total[1] += job.draw_ms;
+    total[2] += job.write_ms;
+  }
+
+  printf( "%-32s %10.2f %10.2f %10.2f %10.2f\n", "total", total[0],
+          total[1], total[2], total[0] + total[1] + total[2] );
+  printf( "%zu files (%d failed) in %.2f s\n", jobs.size(), failed, wall );
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,500 @@
+/*
+ * Render service.
+ *
+ * Serves render requests over stdin/stdout, or over connections to a Unix
+ * domain socket. Parsed documents, with their decoded textures, stay
+ * resident between requests, keyed by path and invalidated when the
+ * file's modification time or size changes, along with the renderers
+ * that drew them so their outline and sprite caches are reused. Requests
+ * are rendered on a pool of workers, each with a renderer of its own, and
+ * answered as soon as they are done, so answers can come out of order.
+ *
+ * usage: drawsvg_server [-s socket] [-j threads] [-n documents]
+ *                       [-b samples]
+ *   -s <path>       listen on a Unix domain socket instead of stdin/stdout
+ *   -j <threads>    workers (default: hardware threads)
+ *   -n <documents>  resident documents (default: 64), least recently used
+ *                   ones are dropped beyond that
+ *   -b <samples>    most samples of a request, width * height * rate^2
+ *                   (default: 2^28, a 16384 x 16384 frame at rate 1)
+ *
+ * Requests are single lines:
+ *
+ *   <id> render <raw|png> <width> <height> <rate> fit <path>
+ *   <id> render <raw|png> <width> <height> <rate> <x> <y> <span> <path>
+ *
+ * rendering the document at path into a frame of width x height pixels at
+ * rate samples per pixel side, showing the whole canvas or the view
+ * centered on (x, y) with half its size being span, as the viewer does.
+ * id is any token without spaces, echoed in the answer. Answers are
+ *
+ *   <id> ok <raw|png> <width> <height> <bytes>\n<bytes of pixels>
+ *   <id> error <message>\n
+ *
+ * raw pixels are width * height RGBA pixels of 4 bytes, in rows from the
+ * top. A request that fails, running out of memory say, is answered with
+ * an error and the service goes on.
+ */
+
+#include "svg.h"
+#include "png.h"
+#include "texture.h"
+#include "viewport.h"
+#include "task_pool.h"
+#include "software_renderer.h"
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[DrawSVG] " << s << endl;
+
+// default for the most samples of a request, 1 GB of sample buffer
+static const size_t kSampleBudget = (size_t) 1 << 28;
+
+// most samples of a renderer kept for the next request, larger sample
+// buffers are released with their renderer
+static const size_t kKeepSamples = (size_t) 1 << 24;
+
+// a renderer with its sampler
+struct DocumentRenderer {
+  DocumentRenderer() : sample_rate( 0 ) {
+    renderer.set_tex_sampler( &sampler );
+  }
+  SoftwareRendererImp renderer;
+  Sampler2DImp sampler;
+  size_t sample_rate;   // of the renderer, 0 before the first render
+};
+
+/**
+ * A resident document. It is loaded by the first request for it, the
+ * others wait for that load. Drawing only reads the document, so once it
+ * is loaded any number of requests render it at once, each taking a
+ * renderer of its own from the idle ones.
+ */
+struct Document {
+  Document( time_t mtime, off_t size )
+    : mtime( mtime ), size( size ), loaded( false ), failed( false ) { }
+  ~Document() {
+    for ( size_t i = 0; i < idle.size(); ++i ) delete idle[i];
+  }
+
+  time_t mtime; off_t size;   // of the file it was loaded from
+  std::mutex lock;            // held while loading
+  bool loaded, failed;
+  SVG svg;
+
+  std::vector<DocumentRenderer*> idle;  // renderers not drawing
+  std::mutex renderers;                 // guards idle
+};
+
+/**
+ * Resident documents by path. Documents dropped from the cache (replaced
+ * by a newer version or least recently used) are released once the
+ * requests rendering them are done.
+ */
+class Documents {
+ public:
+
+  Documents( size_t capacity ) : capacity( capacity ), clock( 0 ) { }
+
+  // the document for the file at path as it is now, NULL if there is no
+  // such file
+  shared_ptr<Document> get( const string& path ) {
+
+    struct stat st;
+    if ( stat( path.c_str(), &st ) || !S_ISREG( st.st_mode ) ) return NULL;
+
+    lock_guard<std::mutex> guard( lock );
+
+    Entry& entry = entries[path];
+    if ( !entry.document || entry.document->mtime != st.st_mtime ||
+         entry.document->size != st.st_size ) {
+      entry.document.reset( new Document( st.st_mtime, st.st_size ) );
+    }
+    entry.used = ++clock;
+
+    shared_ptr<Document> document = entry.document;
+
+    // drop the least recently used documents beyond capacity
+    while ( entries.size() > capacity ) {
+      map<string, Entry>::iterator oldest = entries.begin();
+      for ( map<string, Entry>::iterator i = entries.begin();
+            i != entries.end(); ++i ) {
+        if ( i->second.used < oldest->second.used ) oldest = i;
+      }
+      entries.erase( oldest );
+    }
+
+    return document;
+  }
+
+ private:
+
+  struct Entry {
+    shared_ptr<Document> document;
+    unsigned long used;   // clock at the last request
+  };
+
+  std::mutex lock;
+  map<string, Entry> entries;
+  size_t capacity;
+  unsigned long clock;
+};
+
+struct Request {
+  string id;
+  bool png;
+  size_t width, height, sample_rate;
+  bool fit;
+  float x, y, span;
+  string path;
+};
+
+// parse a request line, false with a message in error if it is malformed
+// or would take more than budget samples
+static bool parse_request( const string& line, size_t budget,
+                           Request& request, string& error ) {
+
+  istringstream in( line );
+  string command, format, view;
+  if ( !( in >> request.id >> command ) ) {
+    error = "empty request";
+    return false;
+  }
+  if ( command != "render" ) {
+    error = "unknown command " + command;
+    return false;
+  }
+
+  long width, height, rate;
+  if ( !( in >> format >> width >> height >> rate >> view ) ) {
+    error = "malformed request";
+    return false;
+  }
+  if ( format != "raw" && format != "png" ) {
+    error = "unknown format " + format;
+    return false;
+  }
+  if ( width < 1 || height < 1 || width > 16384 || height > 16384 ) {
+    error = "invalid size";
+    return false;
+  }
+  if ( rate < 1 || rate > 4 ) {
+    error = "invalid sample rate";
+    return false;
+  }
+  if ( (unsigned long long) width * height * rate * rate > budget ) {
+    error = "frame exceeds the sample budget";
+    return false;
+  }
+
+  request.png = format == "png";
+  request.width = width;
+  request.height = height;
+  request.sample_rate = rate;
+
+  request.fit = view == "fit";
+  if ( !request.fit ) {
+    request.x = atof( view.c_str() );
+    if ( !( in >> request.y >> request.span ) ) {
+      error = "malformed view";
+      return false;
+    }
+  }
+
+  // the path is the rest of the line, spaces included
+  in >> ws;
+  getline( in, request.path );
+  if ( request.path.empty() ) {
+    error = "missing path";
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Answers to one client. Answers are written whole, in the order their
+ * requests finish.
+ */
+class Client {
+ public:
+
+  Client( int fd ) : fd( fd ), broken( false ) { }
+
+  void answer( const string& header, const vector<unsigned char>& data ) {
+    lock_guard<std::mutex> guard( lock );
+    if ( broken ) return;
+    broken = !write_all( header.data(), header.size() ) ||
+             ( !data.empty() && !write_all( &data[0], data.size() ) );
+  }
+
+  void error( const string& id, const string& message ) {
+    answer( id + " error " + message + "\n", vector<unsigned char>() );
+  }
+
+ private:
+
+  bool write_all( const void* data, size_t size ) {
+    const char* p = (const char*) data;
+    while ( size ) {
+      ssize_t n = ::write( fd, p, size );
+      if ( n < 0 && errno == EINTR ) continue;
+      if ( n <= 0 ) return false;
+      p += n; size -= n;
+    }
+    return true;
+  }
+
+  int fd;
+  std::mutex lock;
+  bool broken;   // the client went away, answers are dropped
+};
+
+// render a request and answer it
+static void render( const Request& request, Documents* documents,
+                    Client* client ) {
+
+  shared_ptr<Document> document = documents->get( request.path );
+  if ( !document ) {
+    client->error( request.id, "no such file " + request.path );
+    return;
+  }
+
+  size_t width = request.width, height = request.height;
+  vector<unsigned char> frame( 4 * width * height );
+
+  {
+    lock_guard<std::mutex> guard( document->lock );
+
+    // images are decoded before loading returns, waiting on other tasks
+    // from a worker could leave every worker waiting
+    if ( !document->loaded ) {
+      document->failed =
+        SVGParser::load( request.path.c_str(), &document->svg ) < 0;
+      document->loaded = true;
+    }
+  }
+  if ( document->failed ) {
+    client->error( request.id, "cannot load " + request.path );
+    return;
+  }
+
+  SVG& svg = document->svg;
+
+  ViewportImp viewport;
+  if ( request.fit ) {
+    float span = 1.2 * max( svg.width, svg.height ) / 2;
+    viewport.set_viewbox( svg.width / 2, svg.height / 2, span );
+  } else {
+    viewport.set_viewbox( request.x, request.y, request.span );
+  }
+
+  // the largest centered square of the frame shows the view
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = ( width - scale ) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = ( height - scale ) / 2;
+
+  // an idle renderer, or a new one if every renderer is drawing. One that
+  // throws while drawing is not returned
+  unique_ptr<DocumentRenderer> idle;
+  {
+    lock_guard<std::mutex> guard( document->renderers );
+    if ( !document->idle.empty() ) {
+      idle.reset( document->idle.back() );
+      document->idle.pop_back();
+    }
+  }
+  if ( !idle ) idle.reset( new DocumentRenderer() );
+
+  SoftwareRendererImp& renderer = idle->renderer;
+  renderer.set_render_target( &frame[0], width, height );
+
+  // changing the rate drops the cached sprites, keep them when it is not
+  if ( idle->sample_rate != request.sample_rate ) {
+    renderer.set_sample_rate( request.sample_rate );
+    idle->sample_rate = request.sample_rate;
+  }
+  renderer.set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+  renderer.draw_svg( svg );
+
+  size_t rate = request.sample_rate;
+  if ( width * height * rate * rate <= kKeepSamples ) {
+    lock_guard<std::mutex> guard( document->renderers );
+    document->idle.push_back( idle.get() );
+    idle.release();
+  }
+  idle.reset();
+
+  // encoding does not need the document
+  if ( request.png ) {
+    PNG png;
+    png.width = width;
+    png.height = height;
+    png.pixels.swap( frame );
+    if ( PNGParser::save( frame, png ) ) {
+      client->error( request.id, "cannot encode the frame" );
+      return;
+    }
+  }
+
+  ostringstream header;
+  header << request.id << " ok " << ( request.png ? "png " : "raw " )
+         << width << " " << height << " " << frame.size() << "\n";
+  client->answer( header.str(), frame );
+}
+
+// render a request and answer it, with an error if rendering fails.
+// Runs on a worker
+static void serve( const Request& request, Documents* documents,
+                   Client* client ) {
+  try {
+    render( request, documents, client );
+  } catch ( const bad_alloc& ) {
+    client->error( request.id, "out of memory" );
+  } catch ( const exception& e ) {
+    client->error( request.id, string( "failed: " ) + e.what() );
+  } catch ( ... ) {
+    client->error( request.id, "failed" );
+  }
+}
+
+// read requests from in until it ends, answering on out. Returns once
+// every request is answered
+static void session( int in, int out, TaskPool* pool,
+                     Documents* documents, size_t budget ) {
+
+  FILE* input = fdopen( in, "r" );
+  if ( !input ) return;
+
+  Client client( out );
+  TaskGroup group;
+
+  char* line = NULL; size_t capacity = 0; ssize_t length;
+  while ( ( length = getline( &line, &capacity, input ) ) > 0 ) {
+
+    string text( line, length );
+    while ( !text.empty() && ( text[text.size() - 1] == '\n' ||
+                               text[text.size() - 1] == '\r' ) ) {
+      text.erase( text.size() - 1 );
+    }
+    if ( text.empty() ) continue;
+
+    shared_ptr<Request> request( new Request() );
+    string error;
+    if ( !parse_request( text, budget, *request, error ) ) {
+      client.error( request->id.empty() ? "-" : request->id, error );
+      continue;
+    }
+
+    Client* answer = &client;
+    pool->submit( [request, documents, answer] {
+      serve( *request, documents, answer );
+    }, &group );
+  }
+  free( line );
+
+  group.wait();
+  fclose( input );
+}
+
+static int listen_on( const string& path ) {
+
+  struct sockaddr_un address;
+  if ( path.size() >= sizeof( address.sun_path ) ) {
+    msg( "Socket path too long: " << path );
+    return -1;
+  }
+
+  int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+  if ( fd < 0 ) return -1;
+
+  memset( &address, 0, sizeof( address ) );
+  address.sun_family = AF_UNIX;
+  strcpy( address.sun_path, path.c_str() );
+
+  // a socket left by a previous run
+  unlink( path.c_str() );
+
+  if ( bind( fd, (struct sockaddr*) &address, sizeof( address ) ) ||
+       listen( fd, 16 ) ) {
+    msg( "Cannot listen on " << path << ": " << strerror( errno ) );
+    close( fd );
+    return -1;
+  }
+
+  return fd;
+}
+
+int main( int argc, char** argv ) {
+
+  string socket_path;
+  size_t threads = 0, capacity = 64, budget = kSampleBudget;
+  for ( int i = 1; i < argc; i++ ) {
+    string arg = argv[i];
+    if ( arg == "-s" && i + 1 < argc ) {
+      socket_path = argv[++i];
+    } else if ( arg == "-j" && i + 1 < argc ) {
+      threads = max( 1, atoi( argv[++i] ) );
+    } else if ( arg == "-n" && i + 1 < argc ) {
+      capacity = max( 1, atoi( argv[++i] ) );
+    } else if ( arg == "-b" && i + 1 < argc ) {
+      budget = max( 1ull, strtoull( argv[++i], NULL, 10 ) );
+    } else {
+      msg( "Usage: " << argv[0]
+           << " [-s socket] [-j threads] [-n documents] [-b samples]" );
+      return 1;
+    }
+  }
+
+  // a client closing its connection early must not end the service
+  signal( SIGPIPE, SIG_IGN );
+
+  TaskPool pool( threads );
+  Documents documents( capacity );
+
+  if ( socket_path.empty() ) {
+    session( STDIN_FILENO, STDOUT_FILENO, &pool, &documents, budget );
+    return 0;
+  }
+
+  int server = listen_on( socket_path );
+  if ( server < 0 ) return 1;
+
+  // one reader thread per connection, rendering is left to the pool
+  while ( true ) {
+    int connection = accept( server, NULL, NULL );
+    if ( connection < 0 ) {
+      if ( errno == EINTR ) continue;
+      msg( "Cannot accept connections: " << strerror( errno ) );
+      break;
+    }
+    thread( [connection, &pool, &documents, budget] {
+      session( connection, connection, &pool, &documents, budget );
+    } ).detach();
+  }
+
+  close( server );
+  unlink( socket_path.c_str() );
+  return 1;
+}
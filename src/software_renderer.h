@@ -2,9 +2,11 @@
 #define CMU462_SOFTWARE_RENDERER_H
 
 #include <stdio.h>
+#include <map>
 #include <vector>
 
 #include "CMU462.h"
+#include "affine.h"
 #include "texture.h"
 #include "svg_renderer.h"
 
@@ -66,7 +68,12 @@ class SoftwareRenderer : public SVGRenderer {
 class SoftwareRendererImp : public SoftwareRenderer {
  public:
 
-  SoftwareRendererImp( ) : SoftwareRenderer( ) { }
+  SoftwareRendererImp( ) : SoftwareRenderer( ), is_affine( true ),
+    cached_svg( NULL ), cached_generation( 0 ), cached_indexed( 0 ),
+    instance_depth( 0 ),
+    fill_override( NULL ), stroke_override( NULL ),
+    sprite_bytes( 0 ), sprite_frame( 0 ),
+    paint( 0, 0, 0, 0 ), paint_sample( 0 ) { }
 
   // draw an svg input to render target
   void draw_svg( SVG& svg );
@@ -80,6 +87,9 @@ class SoftwareRendererImp : public SoftwareRenderer {
 
  private:
 
+  // drives the rasterization kernels directly (bench/kernel_bench.cpp)
+  friend struct RendererKernels;
+
   // Primitive Drawing //
 
   // Draws an SVG element
@@ -109,6 +119,122 @@ class SoftwareRendererImp : public SoftwareRenderer {
   // Draw a group
   void draw_group( Group& group );
 
+  // Draw a path
+  void draw_path( Path& path );
+
+  // Draw an instance of shared content
+  void draw_use( Use& use );
+
+  // Transformation //
+
+  // affine form of the current transformation, if it has one
+  Affine2D affine; bool is_affine;
+
+  // refresh the affine form after the transformation changed
+  void update_affine( void );
+
+  // transform a point, using the affine form when possible
+  inline Vector2D transform( Vector2D p ) {
+    return is_affine ? affine * p : SVGRenderer::transform( p );
+  }
+
+  // transform a point list to interleaved screen space x,y floats.
+  // The result lives in a scratch buffer valid until the next call
+  const float* transform_points( const std::vector<Vector2D>& points );
+  std::vector<float> screen_points;
+
+  // Scene Transforms //
+
+  // screen space transform of an indexed element
+  struct NodeTransform {
+    Matrix3x3 matrix;
+    Affine2D affine; bool is_affine;
+  };
+
+  // cached screen space transforms, indexed by SVGElement::id
+  std::vector<NodeTransform> node_transforms;
+
+  // scene state the cached transforms were computed for
+  const SVG* cached_svg; unsigned long cached_generation, cached_indexed;
+  Matrix3x3 cached_svg_2_screen;
+
+  // recompute the transforms of elements whose world transform changed,
+  // or all of them if svg_2_screen or the document changed
+  void update_node_transforms( SVG& svg );
+
+  // flattened outlines of the paths of the cached document
+  PathCache path_cache;
+
+  // Level of Detail //
+
+  // screen pixels per svg unit under the current transformation
+  float transform_scale( void );
+
+  // draws geometry whose screen footprint is smaller than a pixel as a
+  // single sample, returns false if the geometry is larger than that
+  bool draw_subpixel( const Vector2D& bounds_min, const Vector2D& bounds_max,
+                      const Color& color );
+
+  // Instancing //
+
+  // nesting depth of <use> content being drawn. Instanced content is
+  // outside the scene tables, so its transforms are composed on the fly
+  int instance_depth;
+
+  // colors of the innermost <use> that overrides fill or stroke
+  const Color* fill_override; const Color* stroke_override;
+
+  // fill and stroke colors of an element after <use> overrides
+  inline const Color& fill_color( const SVGElement& element ) const {
+    return fill_override ? *fill_override : element.style.fillColor;
+  }
+  inline const Color& stroke_color( const SVGElement& element ) const {
+    return stroke_override ? *stroke_override : element.style.strokeColor;
+  }
+
+  // Sprites //
+
+  /* NOTE:
+   * Content instanced many times is rasterized once per distinct linear
+   * transform into a transparent sample buffer, premultiplied the same
+   * way fill_sample composites onto the background. Instances that only
+   * differ by translation stamp that buffer at a whole pixel offset.
+   * The fractional part of the translation is quantized and is part of
+   * the key, so sprites line up with the sample grid exactly.
+   */
+
+  struct SpriteKey {
+    SVGElement* source;
+    double a, b, c, d;          // linear part of the screen transform
+    int dx, dy;                 // subpixel offset in 1/kSpriteSubpixel
+    float fill[4], stroke[4];   // color overrides, alpha -1 if none
+    bool operator<( const SpriteKey& rhs ) const;
+  };
+
+  struct Sprite {
+    int x, y;                   // position relative to the instance origin
+    size_t width, height;       // size in pixels
+    bool direct;                // too large to cache, drawn directly
+    std::vector<unsigned char> samples;
+    unsigned long used;         // last frame the sprite was stamped in
+  };
+
+  std::map<SpriteKey, Sprite> sprites;
+  size_t sprite_bytes; unsigned long sprite_frame;
+
+  // draw the instance by stamping its sprite, returns false if the
+  // instance has to be drawn directly
+  bool draw_sprite( Use& use );
+
+  // rasterize the content described by key into sprite
+  void render_sprite( const SpriteKey& key, Sprite& sprite );
+
+  // composite a sprite onto the sample buffer at pixel (x, y)
+  void stamp_sprite( const Sprite& sprite, int x, int y );
+
+  // drop cached sprites
+  void clear_sprites( void );
+
   // Rasterization //
 
   // rasterize a point
@@ -136,6 +262,11 @@ class SoftwareRendererImp : public SoftwareRenderer {
   void fill_sample( int sx, int sy, const Color& c );
   void fill_pixel( int x, int y, const Color& c );
 
+  // last opaque color filled and its packed sample (see pack_color). It
+  // is only packed again when the color changes, so runs of elements with
+  // the same style store samples without converting colors
+  Color paint; uint32_t paint_sample;
+
 }; // class SoftwareRendererImp
 
 
@@ -0,0 +1,53 @@
+#ifndef CMU462_STRING_VIEW_H
+#define CMU462_STRING_VIEW_H
+
+#include <string.h>
+#include <string>
+
+namespace CMU462 {
+
+/**
+ * Non-owning reference to a run of characters, standing in for the C++17
+ * std::string_view. The characters are not NUL terminated. A default
+ * constructed view refers to nothing, which tells absent attributes apart
+ * from empty ones.
+ */
+class StringView {
+ public:
+
+  StringView() : first( NULL ), last( NULL ) { }
+
+  StringView( const char* s )
+    : first( s ), last( s ? s + strlen( s ) : NULL ) { }
+
+  StringView( const char* first, const char* last )
+    : first( first ), last( last ) { }
+
+  inline const char* begin() const { return first; }
+  inline const char* end() const { return last; }
+  inline size_t size() const { return last - first; }
+  inline bool empty() const { return first == last; }
+
+  // whether the view refers to anything
+  inline bool valid() const { return first != NULL; }
+
+  inline bool operator==( const char* s ) const {
+    size_t n = strlen( s );
+    return size() == n && !memcmp( first, s, n );
+  }
+  inline bool operator!=( const char* s ) const { return !( *this == s ); }
+
+  inline std::string str() const {
+    return first ? std::string( first, last ) : std::string();
+  }
+
+ private:
+
+  const char* first;
+  const char* last;
+
+}; // class StringView
+
+} // namespace CMU462
+
+#endif // CMU462_STRING_VIEW_H
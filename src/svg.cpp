@@ -1,17 +1,43 @@
 #include "svg.h"
 #include "png.h"
-#include "base64.h"
+#include "xml_stream.h"
+#include "number.h"
+#include "base64_decoder.h"
 
 #include <string>
+#include <cstring>
 #include <fstream>
-#include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
 
 using namespace std;
 
 namespace CMU462 {
 
+// generations are unique across documents, so (document, generation)
+// identifies one state of a scene even if a document is reallocated
+static atomic<unsigned long> svg_generation( 0 );
+
+// longest chain of nested <use> references that is followed, deeper
+// chains are treated like reference cycles
+static const int kMaxUseDepth = 16;
+
+uint32_t pack_color( const Color& c ) {
+
+  float a = min( max( c.a, 0.f ), 1.f );
+  unsigned char rgba[4] = {
+    (unsigned char) ( min( max( c.r * c.a, 0.f ), 1.f ) * 255 ),
+    (unsigned char) ( min( max( c.g * c.a, 0.f ), 1.f ) * 255 ),
+    (unsigned char) ( min( max( c.b * c.a, 0.f ), 1.f ) * 255 ),
+    (unsigned char) ( a * 255 )
+  };
+
+  uint32_t packed;
+  memcpy( &packed, rgba, 4 );
+  return packed;
+}
+
 Group::~Group() {
   for (size_t i = 0; i < elements.size(); i++) {
     delete elements[i];
@@ -19,20 +45,154 @@ Group::~Group() {
 }
 
 SVG::~SVG() {
+  images.wait();
   for (size_t i = 0; i < elements.size(); i++) {
     delete elements[i];
   } elements.clear();
+  for (size_t i = 0; i < defs.size(); i++) {
+    delete defs[i];
+  } defs.clear();
+}
+
+void SVG::index() {
+
+  generation = indexed = ++svg_generation;
+
+  nodes.clear(); parents.clear(); world.clear(); stamps.clear();
+  for (size_t i = 0; i < elements.size(); i++) {
+    index( elements[i], -1 );
+  }
+
+  dirty.assign( nodes.size(), false );
+  transforms_dirty = false;
+
+  // loading is over
+  style_sources.clear();
+}
+
+void SVG::index( SVGElement* element, int parent ) {
+
+  int id = nodes.size();
+  element->id = id;
+
+  nodes.push_back( element );
+  parents.push_back( parent );
+  world.push_back( parent < 0 ? element->transform
+                              : world[parent] * element->transform );
+  stamps.push_back( generation );
+
+  if ( element->type == GROUP ) {
+    Group* group = static_cast<Group*>( element );
+    for (size_t i = 0; i < group->elements.size(); i++) {
+      index( group->elements[i], id );
+    }
+  }
+}
+
+void SVG::set_transform( SVGElement* element, const Matrix3x3& transform ) {
+
+  element->transform = transform;
+
+  int id = element->id;
+  if ( id >= 0 && id < (int) nodes.size() && nodes[id] == element ) {
+    dirty[id] = true;
+    transforms_dirty = true;
+  }
+}
+
+void SVG::update_transforms() {
+
+  if ( !transforms_dirty ) return;
+  generation = ++svg_generation;
+
+  // parents come first, so a single pass pushes changes down the tree
+  for (size_t i = 0; i < nodes.size(); i++) {
+    int parent = parents[i];
+    if ( !dirty[i] && ( parent < 0 || !dirty[parent] ) ) continue;
+
+    dirty[i] = true;
+    world[i] = parent < 0 ? nodes[i]->transform
+                          : world[parent] * nodes[i]->transform;
+    stamps[i] = generation;
+  }
+
+  dirty.assign( nodes.size(), false );
+  transforms_dirty = false;
+}
+
+// Attribute access //
+
+/* NOTE:
+ * Attribute values are read as views, either into the tinyxml2 DOM or into
+ * the input of an XMLStream, and converted without allocating.
+ */
+
+static inline StringView attribute( XMLElement* xml, const char* name ) {
+  return StringView( xml->Attribute( name ) );
+}
+
+static inline StringView attribute( XMLStream* xml, const char* name ) {
+  return xml->attribute( name );
+}
+
+// copy a short value to a NUL terminated buffer, false if it does not fit
+static inline bool terminate( StringView value, char* buffer, size_t size ) {
+  if ( !value.valid() || value.size() >= size ) return false;
+  memcpy( buffer, value.begin(), value.size() );
+  buffer[value.size()] = '\0';
+  return true;
+}
+
+// numeric value, fallback if absent or not a number
+static float to_float( StringView value, float fallback = 0 ) {
+
+  const char* p = value.begin();
+  while ( p < value.end() && is_separator_space( *p ) ) p++;
+
+  float f;
+  return parse_number( p, value.end(), f ) ? f : fallback;
+}
+
+static Color to_color( StringView value ) {
+
+  char buffer[64];
+  if ( !terminate( value, buffer, sizeof( buffer ) ) ) {
+    return Color::fromHex( value.str().c_str() );
+  }
+  return Color::fromHex( buffer );
+}
+
+template <class Tag>
+static inline float float_attribute( Tag* xml, const char* name,
+                                     float fallback = 0 ) {
+  return to_float( attribute( xml, name ), fallback );
 }
 
 // Parser //
 
-int SVGParser::load( const char* filename, SVG* svg ) {
+int SVGParser::load( const char* filename, SVG* svg, TaskPool* pool ) {
+
+  // tokenize the file where it is mapped, without copying it
+  XMLStream xml;
+  if( !xml.map( filename ) && !xml.open( filename ) ) {
+    return -1;
+  }
+
+  return parseStream( xml, filename, svg, pool );
+}
+
+int SVGParser::loadMemory( const char* data, size_t size, SVG* svg,
+                           TaskPool* pool ) {
 
-  ifstream in( filename );
-  if( !in.is_open() ) {
-     return -1;
+  XMLStream xml;
+  if( !xml.attach( data, size ) ) {
+    return -1;
   }
-  in.close();
+
+  return parseStream( xml, "<memory>", svg, pool );
+}
+
+int SVGParser::loadDOM( const char* filename, SVG* svg, TaskPool* pool ) {
 
   XMLDocument doc;
   doc.LoadFile( filename );
@@ -47,11 +207,110 @@ int SVGParser::load( const char* filename, SVG* svg ) {
      exit( 1 );
   }
 
-  root->QueryFloatAttribute( "width",  &svg->width  );
-  root->QueryFloatAttribute( "height", &svg->height );
+  svg->width  = float_attribute( root, "width",  svg->width  );
+  svg->height = float_attribute( root, "height", svg->height );
 
   parseSVG( root, svg );
 
+  // resolve instanced content
+  linkUses( svg );
+
+  // build scene tables
+  svg->index();
+
+  decodeImages( svg, pool );
+
+  return 0;
+}
+
+int SVGParser::loadStream( const char* filename, SVG* svg,
+                           TaskPool* pool ) {
+
+  XMLStream xml;
+  if( !xml.open( filename ) ) {
+    return -1;
+  }
+
+  return parseStream( xml, filename, svg, pool );
+}
+
+int SVGParser::parseStream( XMLStream& xml, const char* filename,
+                            SVG* svg, TaskPool* pool ) {
+
+  XMLToken token = xml.next();
+  if( token != XML_START || xml.name() != "svg" ) {
+    cerr << "Error: not an SVG file!" << endl;
+    return -1;
+  }
+
+  svg->width  = float_attribute( &xml, "width",  svg->width  );
+  svg->height = float_attribute( &xml, "height", svg->height );
+
+  // element lists of the open tags, innermost last. Tags whose children
+  // are ignored (unknown elements, shapes) open a NULL list
+  vector< vector<SVGElement*>* > open;
+  open.push_back( &svg->elements );
+
+  while( !open.empty() ) {
+
+    token = xml.next();
+    if( token == XML_END ) {
+      open.pop_back();
+      continue;
+    }
+    if( token != XML_START ) break;
+
+    vector<SVGElement*>* elements = open.back();
+    vector<SVGElement*>* children = NULL;
+
+    if( elements ) {
+
+      StringView elementType = xml.name();
+      if( elementType == "g" ) {
+
+        Group* group = new Group();
+        parseElement( &xml, group, svg );
+        elements->push_back( group );
+        children = &group->elements;
+
+      } else if( elementType == "defs" ) {
+
+        children = &svg->defs;
+
+      } else if( elementType == "symbol" ) {
+
+        Group* symbol = new Group();
+        parseElement( &xml, symbol, svg );
+        svg->defs.push_back( symbol );
+        children = &symbol->elements;
+
+      } else {
+        SVGElement* element = parseLeaf( &xml, elementType, svg );
+        if ( element ) elements->push_back( element );
+      }
+    }
+
+    open.push_back( children );
+  }
+
+  if( token == XML_ERROR ) {
+    cerr << "Error: " << xml.error() << " near byte " << xml.bytes()
+         << " of " << filename << endl;
+    return -1;
+  }
+  if( !open.empty() ) {
+    cerr << "Error: unexpected end of " << filename << endl;
+    return -1;
+  }
+
+  // resolve instanced content
+  linkUses( svg );
+
+  // build scene tables
+  svg->index();
+
+  decodeImages( svg, pool );
+
   return 0;
 }
 
@@ -65,316 +324,455 @@ void SVGParser::parseSVG( XMLElement* xml, SVG* svg ) {
    * order when drawing elements.
    */
 
+  parseElements( xml, svg->elements, svg );
+}
+
+void SVGParser::parseElements( XMLElement* xml,
+                               vector<SVGElement*>& elements, SVG* svg ) {
+
   XMLElement* elem = xml->FirstChildElement();
   while( elem ) {
 
-    string elementType ( elem->Value() );
-    if( elementType == "line" ) {
+    StringView elementType ( elem->Value() );
+    if( elementType == "g" ) {
 
-      Line* line = new Line();
-      parseElement(elem, line );
-      parseLine( elem, line );
-      svg->elements.push_back( line );
+      Group* group = new Group();
+      parseElement( elem, group, svg );
+      parseGroup( elem, group, svg );
+      elements.push_back( group );
 
-    } else if( elementType == "polyline" ) {
+    } else if( elementType == "defs" ) {
 
-      Polyline* polyline = new Polyline();
-      parseElement(elem, polyline );
-      parsePolyline( elem, polyline );
-      svg->elements.push_back( polyline );
+      // definitions are only drawn through <use>
+      parseElements( elem, svg->defs, svg );
 
-    } else if( elementType == "rect" ) {
+    } else if( elementType == "symbol" ) {
 
-      float w = elem->FloatAttribute("width" );
-      float h = elem->FloatAttribute("height");
+      // a symbol is a group that is only drawn through <use>
+      Group* symbol = new Group();
+      parseElement( elem, symbol, svg );
+      parseGroup( elem, symbol, svg );
+      svg->defs.push_back( symbol );
 
-      // treat zero-size rectangles as points
-      if (w == 0 && h == 0) {
-        Point* point = new Point();
-        parseElement(elem, point );
-        parsePoint( elem, point );
-        svg->elements.push_back( point );
-      } else {
-        Rect* rect = new Rect();
-        parseElement( elem, rect );
-        parseRect( elem, rect );
-        svg->elements.push_back( rect );
-      }
+    } else {
+      SVGElement* element = parseLeaf( elem, elementType, svg );
+      if ( element ) elements.push_back( element );
+    }
 
-    } else if( elementType == "polygon" ) {
+    elem = elem->NextSiblingElement();
+  }
+}
 
-      Polygon* polygon = new Polygon();
-      parseElement( elem, polygon);
-      parsePolygon( elem, polygon );
-      svg->elements.push_back( polygon );
+template <class Tag>
+SVGElement* SVGParser::parseLeaf( Tag* elem, StringView elementType,
+                                  SVG* svg ) {
 
-    } else if( elementType == "ellipse" ) {
+  if( elementType == "line" ) {
 
-      Ellipse* ellipse = new Ellipse();
-      parseElement( elem, ellipse);
-      parseEllipse( elem, ellipse );
-      svg->elements.push_back( ellipse );
+    Line* line = new Line();
+    parseElement( elem, line, svg );
+    parseLine( elem, line );
+    return line;
 
-    } else if ( elementType == "image" ) {
+  } else if( elementType == "polyline" ) {
 
-      Image* image = new Image();
-      parseElement( elem, image);
-      parseImage( elem, image);
-      svg->elements.push_back( image ); 
+    Polyline* polyline = new Polyline();
+    parseElement( elem, polyline, svg );
+    parsePolyline( elem, polyline );
+    return polyline;
 
-    } else if( elementType == "g" ) {
+  } else if( elementType == "rect" ) {
 
-       Group* group = new Group();
-       parseElement( elem, group);
-       parseGroup( elem, group );
-       svg->elements.push_back( group );
+    float w = float_attribute( elem, "width"  );
+    float h = float_attribute( elem, "height" );
 
+    // treat zero-size rectangles as points
+    if (w == 0 && h == 0) {
+      Point* point = new Point();
+      parseElement( elem, point, svg );
+      parsePoint( elem, point );
+      return point;
     } else {
-       // unknown element type --- include default handler here if desired
+      Rect* rect = new Rect();
+      parseElement( elem, rect, svg );
+      parseRect( elem, rect );
+      return rect;
     }
 
-    elem = elem->NextSiblingElement();
-  }
-}
+  } else if( elementType == "polygon" ) {
 
-void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
+    Polygon* polygon = new Polygon();
+    parseElement( elem, polygon, svg );
+    parsePolygon( elem, polygon );
+    return polygon;
 
-  // parse style
-  Style* style = &element->style;
-  const char* fill = xml->Attribute( "fill" );
-  if( fill ) style->fillColor = Color::fromHex( fill );
+  } else if( elementType == "ellipse" ) {
 
-  const char* fill_opacity = xml->Attribute( "fill-opacity" );
-  if( fill_opacity ) style->fillColor.a = atof( fill_opacity );
-
-  const char* stroke = xml->Attribute( "stroke" );
-  const char* stroke_opacity = xml->Attribute( "stroke-opacity" );
-  if( stroke ) {
-    style->strokeColor = Color::fromHex( stroke );
-    if( stroke_opacity ) style->strokeColor.a = atof( stroke_opacity );
-  } else {
-    style->strokeColor = Color::Black;
-    style->strokeColor.a = 0;
-  }
+    Ellipse* ellipse = new Ellipse();
+    parseElement( elem, ellipse, svg );
+    parseEllipse( elem, ellipse );
+    return ellipse;
 
+  } else if ( elementType == "image" ) {
 
-  xml->QueryFloatAttribute( "stroke-width",      &style->strokeWidth );
-  xml->QueryFloatAttribute( "stroke-miterlimit", &style->miterLimit  );
+    Image* image = new Image();
+    parseElement( elem, image, svg );
+    if ( !parseImage( elem, image ) ) {
+      delete image;
+      return NULL;
+    }
+    return image;
 
-  // parse transformation
-  const char* trans = xml->Attribute( "transform" );
-  if ( trans ) {
-    
-    // NOTE (sky):
-    // This implements the SVG transformation specification. All the SVG 
-    // transformations are supported as documented in the link below:
-    // https://developer.mozilla.org/en-US/docs/Web/SVG/Attribute/transform
+  } else if( elementType == "path" ) {
 
-    // consolidate transformation
-    Matrix3x3 transform = Matrix3x3::identity();
+    Path* path = new Path();
+    parseElement( elem, path, svg );
+    parsePath( elem, path );
+    return path;
 
-    string trans_str = trans; size_t paren_l, paren_r;
-    while ( trans_str.find_first_of('(') != string::npos ) {
+  } else if( elementType == "use" ) {
 
-      paren_l = trans_str.find_first_of('(');
-      paren_r = trans_str.find_first_of(')');
+    Use* use = new Use();
+    parseElement( elem, use, svg );
+    parseUse( elem, use );
+    return use;
 
-      string type = trans_str.substr(0, paren_l);
-      string data = trans_str.substr(paren_l + 1, paren_r - paren_l - 1);
+  }
 
-      if ( type == "matrix" ) {
-        
-        string matrix_str = data;
-        replace( matrix_str.begin(), matrix_str.end(), ',', ' ');
+  // unknown element type --- include default handler here if desired
+  return NULL;
+}
 
-        stringstream ss (matrix_str);
-        float a; float b; float c; float d; float e; float f;
-        ss >> a; ss >> b; ss >> c; ss >> d; ss >> e; ss >> f;
+template <class Tag>
+void SVGParser::parseElement( Tag* xml, SVGElement* element, SVG* svg ) {
+
+  // register for <use> references, the first element with an id wins
+  StringView id = attribute( xml, "id" );
+  if( id.valid() ) svg->ids.insert( make_pair( id.str(), element ) );
+
+  // parse style, unless an element with the same style attributes was
+  // parsed before
+  static const char* const kStyleAttributes[] = {
+    "fill", "fill-opacity", "stroke", "stroke-opacity",
+    "stroke-width", "stroke-miterlimit"
+  };
+  StringView values[6];
+  string source;
+  for ( int i = 0; i < 6; i++ ) {
+    values[i] = attribute( xml, kStyleAttributes[i] );
+    if ( values[i].valid() ) {
+      source.append( values[i].begin(), values[i].end() );
+    }
+    source.push_back( values[i].valid() ? '\0' : '\1' );
+  }
 
-        Matrix3x3 m;
-        m(0,0) = a; m(0,1) = c; m(0,2) = e;
-        m(1,0) = b; m(1,1) = d; m(1,2) = f;
-        m(2,0) = 0; m(2,1) = 0; m(2,2) = 1;        
-        transform = transform * m;
-      
-      } else if ( type == "translate" ) {
-        
-        stringstream ss (data);
-        float x; if (!(ss >> x)) x = 0;
-        float y; if (!(ss >> y)) y = 0;
+  unordered_map<string, Style>::iterator known =
+    svg->style_sources.find( source );
+  if ( known != svg->style_sources.end() ) {
+    element->style = known->second;
+  } else {
+    Style* style = &element->style;
+    const StringView& fill = values[0];
+    if( fill.valid() ) style->fillColor = to_color( fill );
+
+    const StringView& fill_opacity = values[1];
+    if( fill_opacity.valid() ) style->fillColor.a = to_float( fill_opacity );
+
+    const StringView& stroke = values[2];
+    const StringView& stroke_opacity = values[3];
+    if( stroke.valid() ) {
+      style->strokeColor = to_color( stroke );
+      if( stroke_opacity.valid() ) {
+        style->strokeColor.a = to_float( stroke_opacity );
+      }
+    } else {
+      style->strokeColor = Color::Black;
+      style->strokeColor.a = 0;
+    }
 
-        Matrix3x3 m = Matrix3x3::identity();
-        
-        m(0,2) = x;
-        m(1,2) = y;
-        
-        transform = transform * m;
+    // initial values of the spec when absent
+    style->strokeWidth = to_float( values[4], 1 );
+    style->miterLimit  = to_float( values[5], 4 );
 
-      } else if (type == "scale" ) {
+    svg->style_sources.insert( make_pair( source, *style ) );
+  }
 
-        stringstream ss (data);
-        float x; if (!(ss >> x)) x = 1;
-        float y; if (!(ss >> y)) y = 1;
+  // parse transformation
+  StringView trans = attribute( xml, "transform" );
+  if ( trans.valid() ) {
 
-        Matrix3x3 m = Matrix3x3::identity();
-        
-        m(0,0) = x;
-        m(1,1) = y;
+    // NOTE (sky):
+    // This implements the SVG transformation specification. All the SVG 
+    // transformations are supported as documented in the link below:
+    // https://developer.mozilla.org/en-US/docs/Web/SVG/Attribute/transform
 
-        transform = transform * m;
+    // consolidate transformation, folded into one affine transform as
+    // the list is read
+    Affine2D transform;
+    if ( !parse_transform( trans.begin(), trans.end(), transform ) ) {
+      cerr << "Warning: malformed transform, using transforms up to the error"
+           << endl;
+    }
 
-      } else if (type == "rotate") {
+    element->transform = transform.toMatrix();
+  }
+}
 
-        stringstream ss (data);
-        float a; if (!(ss >> a)) a = 0;
-        float x; if (!(ss >> x)) x = 0;
-        float y; if (!(ss >> y)) y = 0;
 
-        if ( x != 0 || y != 0 ) {
+template <class Tag>
+void SVGParser::parsePoint( Tag* xml, Point* point ) {
+  point->position = Vector2D(float_attribute( xml, "x" ),
+                             float_attribute( xml, "y" ));
+}
 
-          Matrix3x3 m = Matrix3x3::identity();
+template <class Tag>
+void SVGParser::parseLine( Tag* xml, Line* line ) {
+  line->from = Vector2D(float_attribute( xml, "x1" ),
+                        float_attribute( xml, "y1" ));
+  line->to   = Vector2D(float_attribute( xml, "x2" ),
+                        float_attribute( xml, "y2" ));
+}
 
-          m(0,0) = cos(a*PI/180.0f); m(0,1) = -sin(a*PI/180.0f);
-          m(1,0) = sin(a*PI/180.0f); m(1,1) =  cos(a*PI/180.0f);
+template <class Tag>
+void SVGParser::parsePolyline( Tag* xml, Polyline* polyline ) {
 
-          m(0,2) = -x * cos(a*PI/180.0f) + y * sin(a*PI/180.0f) + x;
-          m(1,2) = -x * sin(a*PI/180.0f) - y * cos(a*PI/180.0f) + y;
+  StringView points = attribute( xml, "points" );
+  if( !parse_points( points.begin(), points.end(), polyline->points ) ) {
+    cerr << "Warning: malformed polyline points, using points up to the error"
+         << endl;
+  }
 
-          transform = transform * m;
+  polyline->lod.build( polyline->points, false );
+}
 
-        } else {
-          
-          Matrix3x3 m = Matrix3x3::identity();
-          
-          m(0,0) = cos(a*PI/180.0f); m(0,1) = -sin(a*PI/180.0f);
-          m(1,0) = sin(a*PI/180.0f); m(1,1) =  cos(a*PI/180.0f);
-          
-          transform = transform * m;
-        }
-        
-      } else if (type == "skewX" ) {
+template <class Tag>
+void SVGParser::parseRect( Tag* xml, Rect* rect ) {
+  rect->position  = Vector2D(float_attribute( xml, "x" ),
+                             float_attribute( xml, "y" ));
+  rect->dimension = Vector2D(float_attribute( xml, "width" ),
+                             float_attribute( xml, "height" ));
+}
 
-        stringstream ss (data);
-        float a; ss >> a;
+template <class Tag>
+void SVGParser::parsePolygon( Tag* xml, Polygon* polygon ) {
 
-        Matrix3x3 m = Matrix3x3::identity();
-        
-        m(0,1) = tan(a*PI/180.0f);
+  StringView points = attribute( xml, "points" );
+  if( !parse_points( points.begin(), points.end(), polygon->points ) ) {
+    cerr << "Warning: malformed polygon points, using points up to the error"
+         << endl;
+  }
 
-        transform = transform * m;
+  polygon->lod.build( polygon->points, true );
+}
 
-      } else if (type == "skewY" ) {
+template <class Tag>
+void SVGParser::parseEllipse( Tag* xml, Ellipse* ellipse ) {
+  ellipse->center = Vector2D(float_attribute( xml, "cx" ),
+                             float_attribute( xml, "cy" ));
 
-        stringstream ss (data);
-        float a; ss >> a;
+  ellipse->radius = Vector2D(float_attribute( xml, "rx" ),
+                             float_attribute( xml, "ry" ));
+}
 
-        Matrix3x3 m = Matrix3x3::identity();
-        
-        m(1,0) = tan(a*PI/180.0f);
+template <class Tag>
+bool SVGParser::parseImage( Tag* xml, Image* image ) {
+  image->position  = Vector2D ( float_attribute( xml, "x" ),
+                                float_attribute( xml, "y" ));
+  image->dimension = Vector2D ( float_attribute( xml, "width" ),
+                                float_attribute( xml, "height" )); 
 
-        transform = transform * m;
+  // read png data
+  StringView href = attribute( xml, "xlink:href" );
+  const char* data = href.valid() ?
+    find( href.begin(), href.end(), ',' ) : href.end();
+  if ( data == href.end() ) {
+    cerr << "Warning: skipping image without embedded data" << endl;
+    return false;
+  }
 
-      } else {
-        cerr << "unknown transformation type: " << type << endl;
-      }
+  // base64 is decoded right away, in one pass straight from the attribute
+  // (at 3/4 of its size). The PNG is decoded later, possibly in the
+  // background
+  if ( !base64_decode( data + 1, href.end(), image->data ) ) {
+    cerr << "Warning: malformed base64 image data" << endl;
+  }
+  return true;
+}
 
-      size_t end = paren_r + 2;
-      trans_str.erase(0, end);
-    }
+template <class Tag>
+void SVGParser::parsePath( Tag* xml, Path* path ) {
 
-    element->transform = transform;
+  /* NOTE:
+   * Path data is normalized at load time (absolute coordinates, arcs as
+   * cubic curves) but curves are only flattened at draw time, for the
+   * tolerance that matches the current zoom level.
+   */
+  StringView d = attribute( xml, "d" );
+  if ( d.valid() && !path->data.parse( d.begin(), d.end() ) ) {
+    cerr << "Warning: malformed path data, rendering up to the error" << endl;
   }
-}   
+}
+
+template <class Tag>
+void SVGParser::parseUse( Tag* xml, Use* use ) {
 
+  StringView href = attribute( xml, "href" );
+  if ( !href.valid() ) href = attribute( xml, "xlink:href" );
+  if ( !href.empty() && *href.begin() == '#' ) {
+    use->href = string( href.begin() + 1, href.end() );
+  }
 
-void SVGParser::parsePoint( XMLElement* xml, Point* point ) {
-  point->position = Vector2D(xml->FloatAttribute( "x" ),
-                             xml->FloatAttribute( "y" ));
+  // x and y are an additional translation after the use transform
+  Matrix3x3 m = Matrix3x3::identity();
+  m(0,2) = float_attribute( xml, "x" );
+  m(1,2) = float_attribute( xml, "y" );
+  use->transform = use->transform * m;
+
+  /* NOTE:
+   * The spec lets referenced content inherit style from the <use> only
+   * where it does not set the property itself. Styles are resolved at
+   * load time here, so a fill or stroke given on the <use> replaces the
+   * one of the referenced content instead.
+   */
+  use->fill   = attribute( xml, "fill"   ).valid();
+  use->stroke = attribute( xml, "stroke" ).valid();
 }
 
-void SVGParser::parseLine( XMLElement* xml, Line* line ) {
-  line->from = Vector2D(xml->FloatAttribute( "x1" ),
-                        xml->FloatAttribute( "y1" ));
-  line->to   = Vector2D(xml->FloatAttribute( "x2" ),
-                        xml->FloatAttribute( "y2" ));
+// collect the <use> elements of a subtree
+static void collect_uses( SVGElement* element, vector<Use*>& uses ) {
+
+  if ( element->type == USE ) {
+    uses.push_back( static_cast<Use*>( element ) );
+  } else if ( element->type == GROUP ) {
+    Group* group = static_cast<Group*>( element );
+    for (size_t i = 0; i < group->elements.size(); i++) {
+      collect_uses( group->elements[i], uses );
+    }
+  }
 }
 
-void SVGParser::parsePolyline( XMLElement* xml, Polyline* polyline ) {
+// whether drawing element would end up drawing use again
+static bool reaches( const SVGElement* element, const Use* use, int depth ) {
 
-  stringstream points (xml->Attribute( "points" ));
+  if ( element == use || depth > kMaxUseDepth ) return true;
 
-  float x, y;
-  char c;
+  if ( element->type == USE ) {
+    const SVGElement* source = static_cast<const Use*>( element )->source;
+    return source && reaches( source, use, depth + 1 );
+  }
 
-  while( points >> x >> c >> y ) {
-     polyline->points.push_back( Vector2D( x, y ) );
+  if ( element->type == GROUP ) {
+    const Group* group = static_cast<const Group*>( element );
+    for (size_t i = 0; i < group->elements.size(); i++) {
+      if ( reaches( group->elements[i], use, depth ) ) return true;
+    }
   }
-}
 
-void SVGParser::parseRect( XMLElement* xml, Rect* rect ) {
-  rect->position  = Vector2D(xml->FloatAttribute( "x" ),
-                             xml->FloatAttribute( "y" ));
-  rect->dimension = Vector2D(xml->FloatAttribute( "width"  ),
-                             xml->FloatAttribute( "height" ));
+  return false;
 }
 
-void SVGParser::parsePolygon( XMLElement* xml, Polygon* polygon ) {
+void SVGParser::linkUses( SVG* svg ) {
 
-  stringstream points (xml->Attribute( "points" ));
+  vector<Use*> uses;
+  for (size_t i = 0; i < svg->elements.size(); i++) {
+    collect_uses( svg->elements[i], uses );
+  }
+  for (size_t i = 0; i < svg->defs.size(); i++) {
+    collect_uses( svg->defs[i], uses );
+  }
+  if ( uses.empty() ) return;
+
+  // references may point forward, so resolve only once all ids are known
+  for (size_t i = 0; i < uses.size(); i++) {
+    map<string, SVGElement*>::iterator it = svg->ids.find( uses[i]->href );
+    if ( it == svg->ids.end() ) {
+      cerr << "Warning: <use> references unknown id '"
+           << uses[i]->href << "'" << endl;
+      continue;
+    }
+    uses[i]->source = it->second;
+  }
 
-  float x, y;
-  char c;
+  // break reference cycles
+  for (size_t i = 0; i < uses.size(); i++) {
+    Use* use = uses[i];
+    if ( use->source && reaches( use->source, use, 0 ) ) {
+      cerr << "Warning: <use> reference cycle through '"
+           << use->href << "'" << endl;
+      use->source = NULL;
+    }
+  }
 
-  while( points >> x >> c >> y ) {
-     polygon->points.push_back( Vector2D( x, y ) );
+  // count instances per source
+  map<const SVGElement*, size_t> instances;
+  for (size_t i = 0; i < uses.size(); i++) {
+    if ( uses[i]->source ) instances[ uses[i]->source ]++;
+  }
+  for (size_t i = 0; i < uses.size(); i++) {
+    if ( uses[i]->source ) uses[i]->instances = instances[ uses[i]->source ];
   }
 }
 
-void SVGParser::parseEllipse( XMLElement* xml, Ellipse* ellipse ) {
-  ellipse->center = Vector2D(xml->FloatAttribute( "cx" ),
-                             xml->FloatAttribute( "cy" ));
+// collect the images of a subtree
+static void collect_images( SVGElement* element, vector<Image*>& images ) {
 
-  ellipse->radius = Vector2D(xml->FloatAttribute( "rx" ),
-                             xml->FloatAttribute( "ry" ));
+  if ( element->type == IMAGE ) {
+    images.push_back( static_cast<Image*>( element ) );
+  } else if ( element->type == GROUP ) {
+    Group* group = static_cast<Group*>( element );
+    for (size_t i = 0; i < group->elements.size(); i++) {
+      collect_images( group->elements[i], images );
+    }
+  }
 }
 
-void SVGParser::parseImage( XMLElement* xml, Image* image ) {
-  image->position  = Vector2D ( xml->FloatAttribute( "x" ),
-                                xml->FloatAttribute( "y" ));
-  image->dimension = Vector2D ( xml->FloatAttribute( "width"  ),
-                                xml->FloatAttribute( "height" )); 
+static void decode_image( Image* image ) {
 
-  // read png data
-  const char* data = xml->Attribute( "xlink:href" );
-  while (*data != ',') data++; data++;
-  
-  // decode base64 encoded data
-  string encoded = data;
-  encoded.erase(remove(encoded.begin(), encoded.end(), ' ' ), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\t'), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\n'), encoded.end());
-  string decoded = base64_decode(encoded);
-
-  // load decoded data into buffer
-  const unsigned char* buffer = (unsigned char*) decoded.c_str(); 
-  size_t size = decoded.size();
-
-  // load into png
-  PNG png; PNGParser::load(buffer, size, png);
-  
-  // create bitmap texture from png (mip level 0)
-  MipLevel mip_start;
+  // load into png, the file is not needed afterwards
+  PNG png; png.width = png.height = 0;
+  vector<unsigned char> file;
+  file.swap( image->data );
+  if ( !file.empty() ) PNGParser::load( &file[0], file.size(), png );
+  vector<unsigned char>().swap( file );
+
+  // add to svg as mip level 0, the pixels are moved rather than copied
+  image->tex.width  = png.width;
+  image->tex.height = png.height;
+  image->tex.mipmap.push_back( MipLevel() );
+  MipLevel& mip_start = image->tex.mipmap.back();
   mip_start.width  = png.width;
   mip_start.height = png.height;
-  mip_start.texels = png.pixels;
+  mip_start.texels.swap( png.pixels );
 
-  // add to svg
-  image->tex.width  = mip_start.width;
-  image->tex.height = mip_start.height;
-  image->tex.mipmap.push_back(mip_start);
+  // mip levels for the default sampler, so nothing is left for drawing
+  if ( image->tex.width && image->tex.height ) {
+    Sampler2DImp sampler;
+    sampler.generate_mips( image->tex, 0 );
+  }
+}
+
+void SVGParser::decodeImages( SVG* svg, TaskPool* pool ) {
+
+  vector<Image*> images;
+  for (size_t i = 0; i < svg->elements.size(); i++) {
+    collect_images( svg->elements[i], images );
+  }
+  for (size_t i = 0; i < svg->defs.size(); i++) {
+    collect_images( svg->defs[i], images );
+  }
+
+  // one task per image, they are independent
+  for (size_t i = 0; i < images.size(); i++) {
+    if ( pool ) {
+      Image* image = images[i];
+      pool->submit( [image] { decode_image( image ); }, &svg->images );
+    } else {
+      decode_image( images[i] );
+    }
+  }
 }
 
-void SVGParser::parseGroup( XMLElement* xml, Group* group ) {
+void SVGParser::parseGroup( XMLElement* xml, Group* group, SVG* svg ) {
 
   /* NOTE (sky):
    * A group contains a list of elements, and optionally a transformation
@@ -386,76 +784,118 @@ void SVGParser::parseGroup( XMLElement* xml, Group* group ) {
    * transformation, and keep in mind that transformation is accumulative.
    * Groups can also be nested.  
    */
-  XMLElement* elem = xml->FirstChildElement();
-  while( elem ) {
+  parseElements( xml, group->elements, svg );
+}
 
-    string elementType ( elem->Value() );
-    if( elementType == "line" ) {
+// Bounds //
 
-      Line* line = new Line();
-      parseElement( elem, line );
-      parseLine( elem, line );
-      group->elements.push_back( line );
-    
-    } else if( elementType == "polyline" ) {
+static void expand( const Vector2D& p, bool& empty,
+                    Vector2D& bounds_min, Vector2D& bounds_max ) {
 
-      Polyline* polyline = new Polyline();
-      parseElement( elem, polyline );
-      parsePolyline( elem, polyline );
-      group->elements.push_back( polyline );
+  if ( empty ) {
+    bounds_min = bounds_max = p;
+    empty = false;
+    return;
+  }
 
-    } else if( elementType == "rect" ) {
+  bounds_min.x = min( bounds_min.x, p.x ); bounds_min.y = min( bounds_min.y, p.y );
+  bounds_max.x = max( bounds_max.x, p.x ); bounds_max.y = max( bounds_max.y, p.y );
+}
 
-      float w = elem->FloatAttribute("width" );
-      float h = elem->FloatAttribute("height");
+static void expand( const Affine2D& m, const vector<Vector2D>& points,
+                    bool& empty, Vector2D& bounds_min, Vector2D& bounds_max ) {
 
-      // treat zero-size rectangles as points
-      if (w == 0 && h == 0) {
-        Point* point = new Point();
-        parseElement( elem, point );
-        parsePoint( elem, point );
-        group->elements.push_back( point );
-      } else {
-        Rect* rect = new Rect();
-        parseElement( elem, rect );
-        parseRect( elem, rect );
-        group->elements.push_back( rect );
-      }
+  for (size_t i = 0; i < points.size(); i++) {
+    expand( m * points[i], empty, bounds_min, bounds_max );
+  }
+}
 
-    } else if( elementType == "polygon" ) {
-    
-      Polygon* polygon = new Polygon();
-      parseElement( elem, polygon );
-      parsePolygon( elem, polygon );
-      group->elements.push_back( polygon );
-    
-    } else if( elementType == "ellipse" ) {
-    
-      Ellipse* ellipse = new Ellipse();
-      parseElement( elem, ellipse );
-      parseEllipse( elem, ellipse );
-      group->elements.push_back( ellipse );
-
-    } else if ( elementType == "image" ) {
-    
-      Image* image = new Image();
-      parseElement( elem, image );
-      parseImage( elem, image);
-      group->elements.push_back( image ); 
-    
-    } else if( elementType == "g" ) {
-    
-       Group* sub_group = new Group();
-       parseElement( elem, sub_group );
-       parseGroup( elem, sub_group );
-       group->elements.push_back( sub_group );
-    
-    } else {
-       // unknown element type --- include default handler here if desired
-    }    
-    elem = elem->NextSiblingElement();
+static void expand( const Affine2D& m, const Vector2D& a, const Vector2D& b,
+                    bool& empty, Vector2D& bounds_min, Vector2D& bounds_max ) {
+
+  expand( m * a, empty, bounds_min, bounds_max );
+  expand( m * Vector2D( b.x, a.y ), empty, bounds_min, bounds_max );
+  expand( m * Vector2D( a.x, b.y ), empty, bounds_min, bounds_max );
+  expand( m * b, empty, bounds_min, bounds_max );
+}
+
+static void bounds( const SVGElement* element, const Affine2D& parent,
+                    bool& empty, Vector2D& bounds_min, Vector2D& bounds_max ) {
+
+  Affine2D local;
+  if ( !Affine2D::fromMatrix( element->transform, local ) ) return;
+  Affine2D m = parent * local;
+
+  switch ( element->type ) {
+    case POINT:
+      expand( m * static_cast<const Point*>( element )->position,
+              empty, bounds_min, bounds_max );
+      break;
+    case LINE: {
+      const Line* line = static_cast<const Line*>( element );
+      expand( m * line->from, empty, bounds_min, bounds_max );
+      expand( m * line->to,   empty, bounds_min, bounds_max );
+      break;
+    }
+    case POLYLINE:
+      expand( m, static_cast<const Polyline*>( element )->points,
+              empty, bounds_min, bounds_max );
+      break;
+    case RECT: {
+      const Rect* rect = static_cast<const Rect*>( element );
+      expand( m, rect->position, rect->position + rect->dimension,
+              empty, bounds_min, bounds_max );
+      break;
+    }
+    case POLYGON:
+      expand( m, static_cast<const Polygon*>( element )->points,
+              empty, bounds_min, bounds_max );
+      break;
+    case ELLIPSE: {
+      // extent of the transformed ellipse along each axis
+      const Ellipse* ellipse = static_cast<const Ellipse*>( element );
+      Vector2D c = m * ellipse->center;
+      Vector2D r = ellipse->radius;
+      Vector2D e( sqrt( m.a * m.a * r.x * r.x + m.c * m.c * r.y * r.y ),
+                  sqrt( m.b * m.b * r.x * r.x + m.d * m.d * r.y * r.y ) );
+      expand( c - e, empty, bounds_min, bounds_max );
+      expand( c + e, empty, bounds_min, bounds_max );
+      break;
+    }
+    case IMAGE: {
+      const Image* image = static_cast<const Image*>( element );
+      expand( m, image->position, image->position + image->dimension,
+              empty, bounds_min, bounds_max );
+      break;
+    }
+    case GROUP: {
+      const Group* group = static_cast<const Group*>( element );
+      for (size_t i = 0; i < group->elements.size(); i++) {
+        bounds( group->elements[i], m, empty, bounds_min, bounds_max );
+      }
+      break;
+    }
+    case PATH:
+      expand( m, static_cast<const Path*>( element )->data.coords,
+              empty, bounds_min, bounds_max );
+      break;
+    case USE: {
+      const SVGElement* source = static_cast<const Use*>( element )->source;
+      if ( source ) bounds( source, m, empty, bounds_min, bounds_max );
+      break;
+    }
+    default:
+      break;
   }
 }
 
+bool bounds( const SVGElement* element, const Affine2D& m,
+             Vector2D& bounds_min, Vector2D& bounds_max ) {
+
+  bool empty = true;
+  bounds( element, m, empty, bounds_min, bounds_max );
+  return !empty;
+}
+
 } // namespace CMU462
 
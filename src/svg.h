@@ -2,18 +2,32 @@
 #define CMU462_SVG_H
 
 #include <map>
+#include <string>
 #include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include <string.h>
 
 #include "color.h"
+#include "affine.h"
+#include "lod.h"
+#include "path.h"
 #include "texture.h"
 #include "vector2D.h"
 #include "matrix3x3.h"
+#include "string_view.h"
+#include "task_pool.h"
 
 #include "tinyxml2.h"
 using namespace tinyxml2;
 
 namespace CMU462 {
 
+class XMLStream;
+
+// appended to the name of a source file for its precompiled scene
+static const char* const kSceneExtension = ".bin";
+
 typedef enum e_SVGElementType {
   NONE = 0,
   POINT,
@@ -23,7 +37,9 @@ typedef enum e_SVGElementType {
   POLYGON,
   ELLIPSE,
   IMAGE,
-  GROUP
+  GROUP,
+  PATH,
+  USE
 } SVGElementType;
 
 struct Style {
@@ -33,10 +49,21 @@ struct Style {
   float miterLimit;
 };
 
+// orders styles by their bytes, Style has no padding
+struct StyleLess {
+  bool operator()( const Style& a, const Style& b ) const {
+    return memcmp( &a, &b, sizeof( Style ) ) < 0;
+  }
+};
+
+// a color as premultiplied RGBA8. Channels are truncated, not rounded,
+// as the blend in fill_sample truncates them (0.5 packs to 127)
+uint32_t pack_color( const Color& c );
+
 struct SVGElement {
 
   SVGElement( SVGElementType _type ) 
-    : type( _type ), transform( Matrix3x3::identity() ) { }
+    : type( _type ), id( -1 ), transform( Matrix3x3::identity() ) { }
 
   virtual ~SVGElement() { }
 
@@ -46,6 +73,11 @@ struct SVGElement {
   // styling
   Style style;
 
+  // index into the scene tables of the owning SVG, -1 if not indexed
+  // NOTE: this fills the padding ahead of transform, so the layout stays
+  // the same as the one the reference renderer library was built with
+  int id;
+
   // transformation list
   Matrix3x3 transform;
   
@@ -80,6 +112,9 @@ struct Polyline : SVGElement {
   Polyline() : SVGElement  ( POLYLINE ) { }
   std::vector<Vector2D> points;
 
+  // bounds and simplified versions of points
+  LODChain lod;
+
 };
 
 struct Rect : SVGElement {
@@ -95,6 +130,9 @@ struct Polygon : SVGElement {
   Polygon() : SVGElement  ( POLYGON ) { }
   std::vector<Vector2D> points;
 
+  // bounds and simplified versions of points
+  LODChain lod;
+
 };
 
 struct Ellipse : SVGElement {
@@ -111,44 +149,254 @@ struct Image : SVGElement {
   Vector2D position;
   Vector2D dimension;
   Texture tex;
+
+  // PNG file, released once decoded into tex
+  std::vector<unsigned char> data;
   
 };
 
+struct Path : SVGElement {
+
+  Path() : SVGElement ( PATH ) { }
+  PathData data;
+
+};
+
+struct Use : SVGElement {
+
+  Use() : SVGElement ( USE ), source( NULL ), instances( 0 ),
+          fill( false ), stroke( false ) { }
+
+  // id of the referenced element (without the leading '#')
+  std::string href;
+
+  // referenced element, owned by the document and shared by every
+  // instance. NULL if the reference could not be resolved
+  SVGElement* source;
+
+  // number of <use> elements sharing the same source
+  size_t instances;
+
+  // whether style.fillColor / style.strokeColor replace the colors of
+  // the referenced content
+  bool fill, stroke;
+
+};
+
 struct SVG {
 
+  SVG() : generation( 0 ), indexed( 0 ), transforms_dirty( false ) { }
+
   ~SVG();
   float width, height;
   std::vector<SVGElement*> elements;
 
+  // Scene tables //
+
+  /* NOTE:
+   * After loading, every element in the tree is assigned an id which
+   * indexes the tables below. Ids follow draw order, so a parent always
+   * comes before its children. world[id] is the element's transform
+   * composed with the transforms of all its ancestors and is kept up
+   * to date incrementally: changing a local transform with set_transform
+   * marks the element dirty, and update_transforms recomputes only the
+   * dirty subtrees. Call it before drawing again: renderers only read the
+   * document, so several of them can draw it at once.
+   */
+
+  std::vector<SVGElement*> nodes;     // all elements in draw order
+  std::vector<int> parents;           // parent id, -1 for top level
+  std::vector<Matrix3x3> world;       // element to svg space
+  std::vector<unsigned long> stamps;  // generation of the last world change
+
+  // bumped whenever update_transforms changes a world transform
+  unsigned long generation;
+
+  // generation of the last index(), identifies the element tree even if
+  // a document is freed and another one allocated at the same address
+  unsigned long indexed;
+
+  // (re)build the scene tables from the element tree
+  void index( void );
+
+  // set the local transform of an indexed element
+  void set_transform( SVGElement* element, const Matrix3x3& transform );
+
+  // recompute world transforms of dirty subtrees
+  void update_transforms( void );
+
+  // Instancing //
+
+  /* NOTE:
+   * Content of <defs> and <symbol> is parsed like any other element but
+   * kept out of the draw list. It is only drawn through <use> elements,
+   * which store nothing but a transform, a style override and a pointer
+   * to the shared geometry.
+   */
+
+  std::vector<SVGElement*> defs;               // not drawn, owned
+  std::map<std::string, SVGElement*> ids;      // elements by id attribute
+
+  // Styles //
+
+  // styles of the style attribute text already parsed, only kept while
+  // loading so that repeated styles are not parsed again
+  std::unordered_map<std::string, Style> style_sources;
+
+  // Images //
+
+  /* NOTE:
+   * Embedded images may still be decoding in the background after the
+   * loader returns, the geometry is complete before any texture is.
+   * Wait on images before touching a texture, drawing included.
+   */
+
+  TaskGroup images;
+
+ private:
+
+  void index( SVGElement* element, int parent );
+
+  std::vector<bool> dirty; bool transforms_dirty;
+
 };
 
 class SVGParser {
  public:
 
-  static int load( const char* filename, SVG* svg );
+  /* NOTE:
+   * Loaders decode embedded images and generate their mipmaps on pool if
+   * one is given, and return as soon as the geometry is parsed (see
+   * SVG::images). Without a pool images are decoded before returning.
+   */
+
+  // load from the file mapped into memory, attribute values are read
+  // in place without copying the document. Compressed (.svgz) files are
+  // inflated in chunks as they are parsed, here and in loadStream
+  static int load( const char* filename, SVG* svg, TaskPool* pool = NULL );
+
+  // load from a document already in memory, plain or gzip compressed.
+  // data is only read while loading
+  static int loadMemory( const char* data, size_t size, SVG* svg,
+                         TaskPool* pool = NULL );
+
+  // write a loaded document as SVG, streamed from the element tree (see
+  // svg_writer.cpp). Decoded images are encoded again, so wait on
+  // SVG::images first
   static int save( const char* filename, const SVG* svg );
+
+  // write a document that draws the same canvas with less work, with
+  // transforms folded, groups and polygons merged, elements that draw
+  // nothing dropped and coordinates rounded to steps of at most the
+  // canvas size / 10^digits
+  static int saveOptimized( const char* filename, const SVG* svg,
+                            int digits = 5 );
+
+  // load through a tinyxml2 DOM of the whole document
+  static int loadDOM( const char* filename, SVG* svg,
+                      TaskPool* pool = NULL );
+
+  // load without building an XML DOM or mapping the file. Elements are
+  // created as their tags are read, so peak memory is the scene plus one
+  // chunk of input
+  static int loadStream( const char* filename, SVG* svg,
+                         TaskPool* pool = NULL );
+
+  // Precompiled scenes //
+
+  /* NOTE:
+   * A precompiled scene is the loaded document in a versioned binary
+   * format (see svg_binary.cpp): the element tree with normalized paths,
+   * point lists with their LOD levels, and decoded textures with their
+   * mip chains. Loading one maps the file and copies arrays out of it,
+   * nothing is parsed or decoded.
+   */
+
+  // write a loaded document, its images must be decoded (wait on
+  // SVG::images first)
+  static int saveBinary( const char* filename, const SVG* svg );
+
+  // load a document written by saveBinary. Fails for files of another
+  // version or written for another architecture
+  static int loadBinary( const char* filename, SVG* svg );
+
+  // load through the precompiled scene next to the source (filename with
+  // kSceneExtension appended). It is used if it was written from the
+  // source as it is now, otherwise the source is parsed as load() does,
+  // decoding images on pool if one is given. With update, a missing or
+  // stale scene is written again after parsing; its images are then
+  // decoded before returning and pool is not used
+  static int loadCached( const char* filename, SVG* svg,
+                         TaskPool* pool = NULL, bool update = false );
  
  private:
+
+  // create elements from the tags of a stream positioned at the start
+  static int parseStream     ( XMLStream& xml, const char* filename,
+                               SVG* svg, TaskPool* pool );
   
   // parse a svg file
   static void parseSVG       ( XMLElement* xml, SVG* svg );
 
+  // parse the children of xml into elements, in document order
+  static void parseElements  ( XMLElement* xml,
+                               std::vector<SVGElement*>& elements,
+                               SVG* svg );
+
+  static void parseGroup     ( XMLElement* xml, Group* group, SVG* svg );
+
+  /* NOTE:
+   * Everything below only reads the attributes of a single tag, and is
+   * shared by the DOM (XMLElement) and the streaming (XMLStream) loader.
+   */
+
+  // create and parse an element without children, NULL if type is not
+  // a known element of that kind
+  template <class Tag>
+  static SVGElement* parseLeaf ( Tag* xml, StringView type,
+                                 SVG* svg );
+
   // parse shared properties of svg elements
-  static void parseElement   ( XMLElement* xml, SVGElement* element );
+  template <class Tag>
+  static void parseElement   ( Tag* xml, SVGElement* element, SVG* svg );
   
   // parse type specific properties
-  static void parsePoint     ( XMLElement* xml, Point*    point       );
-  static void parseLine      ( XMLElement* xml, Line*     line        );
-  static void parsePolyline  ( XMLElement* xml, Polyline* polyline    );
-  static void parseRect      ( XMLElement* xml, Rect*     rect        );
-  static void parsePolygon   ( XMLElement* xml, Polygon*  polygon     );
-  static void parseEllipse   ( XMLElement* xml, Ellipse*  ellipse     );
-  static void parseImage     ( XMLElement* xml, Image*    image       );
-  static void parseGroup     ( XMLElement* xml, Group*    group       );
-
+  template <class Tag>
+  static void parsePoint     ( Tag* xml, Point*    point       );
+  template <class Tag>
+  static void parseLine      ( Tag* xml, Line*     line        );
+  template <class Tag>
+  static void parsePolyline  ( Tag* xml, Polyline* polyline    );
+  template <class Tag>
+  static void parseRect      ( Tag* xml, Rect*     rect        );
+  template <class Tag>
+  static void parsePolygon   ( Tag* xml, Polygon*  polygon     );
+  template <class Tag>
+  static void parseEllipse   ( Tag* xml, Ellipse*  ellipse     );
+  template <class Tag>
+  static bool parseImage     ( Tag* xml, Image*    image       );
+  template <class Tag>
+  static void parsePath      ( Tag* xml, Path*     path        );
+  template <class Tag>
+  static void parseUse       ( Tag* xml, Use*      use         );
+
+  // resolve <use> references once the whole document is loaded
+  static void linkUses       ( SVG* svg );
+
+  // decode embedded images, on pool if not NULL
+  static void decodeImages   ( SVG* svg, TaskPool* pool );
 
 }; // class SVGParser
 
+/**
+ * Computes the bounds of an element and everything it draws (children,
+ * instanced content) under m composed with the element's own transform.
+ * Bounds cover control points and are not padded for strokes.
+ * \return false if the element has no geometry.
+ */
+bool bounds( const SVGElement* element, const Affine2D& m,
+             Vector2D& bounds_min, Vector2D& bounds_max );
+
 } // namespace CMU462
 
 #endif // CMU462_SVG_H
@@ -0,0 +1,679 @@
+#include "svg.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+
+namespace CMU462 {
+
+/* NOTE:
+ * Layout of a precompiled scene:
+ *
+ *   header      SceneHeader
+ *   styles      the distinct styles of all elements
+ *   elements    top level elements, then the content of <defs>, each
+ *               element followed by its children (pre-order)
+ *   ids         (name, element) pairs of the id attributes
+ *
+ * Every element starts with an ElementRecord, which refers to its style
+ * by index, followed by data that depends on its type. Elements are
+ * numbered in the order they are written, which is how a <use> refers to
+ * its source. Arrays are aligned to 8 bytes and stored as they are laid
+ * out in memory, so they are read with a single copy out of the mapping.
+ *
+ * Values are in the byte order and layout of the machine that wrote the
+ * file. The header records both, and files of another version or layout
+ * are treated like missing ones and written again from the source.
+ */
+
+static const char kSceneMagic[4] = { 'D', 'S', 'V', 'B' };
+
+// bumped on any change to the layout
+static const uint32_t kSceneVersion = 3;
+
+static const uint32_t kSceneByteOrder = 0x01020304;
+
+struct SceneHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t layout;            // sizes of the in-memory types, see layout()
+  uint64_t source_size;       // of the source file written from
+  int64_t  source_time;       // its modification time, nanoseconds
+  uint64_t size;              // of the whole file
+  float width, height;
+  uint32_t elements;          // top level elements
+  uint32_t defs;              // top level elements of <defs>
+  uint32_t ids;
+  uint32_t reserved;
+};
+
+struct ElementRecord {
+  uint32_t type;
+  uint32_t children;          // groups only
+  uint32_t style;             // index into the styles
+  uint32_t reserved;
+  double transform[9];        // row major
+};
+
+// catches files written with a different Vector2D or PathOp
+static uint32_t layout() {
+  return (uint32_t) ( sizeof( Vector2D ) | sizeof( PathOp ) << 8 |
+                      sizeof( size_t ) << 16 );
+}
+
+// source size and modification time in nanoseconds, false if it cannot be
+// read. Seconds alone miss an edit made in the second the scene was written
+static bool source_stamp( const char* filename, uint64_t& size,
+                          int64_t& time ) {
+  struct stat st;
+  if ( stat( filename, &st ) ) return false;
+  size = st.st_size;
+  time = (int64_t) st.st_mtime * 1000000000;
+#if defined(__APPLE__)
+  time += st.st_mtimespec.tv_nsec;
+#elif !defined(_WIN32)
+  time += st.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
+// Writer //
+
+class SceneWriter {
+ public:
+
+  SceneWriter() : count( 0 ) { }
+
+  template <class T>
+  void put( const T& value ) {
+    const unsigned char* p = (const unsigned char*) &value;
+    bytes.insert( bytes.end(), p, p + sizeof( T ) );
+  }
+
+  // a count followed by the elements, aligned
+  template <class T>
+  void put_array( const T* values, size_t n ) {
+    put( (uint64_t) n );
+    align();
+    const unsigned char* p = (const unsigned char*) values;
+    bytes.insert( bytes.end(), p, p + n * sizeof( T ) );
+    align();
+  }
+
+  template <class T>
+  void put_array( const vector<T>& values ) {
+    put_array( values.empty() ? NULL : &values[0], values.size() );
+  }
+
+  void put_string( const string& s ) {
+    put_array( s.data(), s.size() );
+  }
+
+  void put_points( const vector<Vector2D>& points, const LODChain& lod ) {
+    put_array( points );
+    put( lod.bounds_min ); put( lod.bounds_max );
+    put( (uint32_t) lod.levels.size() );
+    for ( size_t i = 0; i < lod.levels.size(); ++i ) {
+      put( lod.levels[i].tolerance );
+      put_array( lod.levels[i].points );
+    }
+  }
+
+  // number the distinct styles of an element and its children
+  void put_style( const SVGElement* element );
+
+  void put_element( const SVGElement* element );
+
+  // element numbers, assigned in the order elements are written
+  map<const SVGElement*, uint32_t> numbers;
+  uint32_t count;
+
+  // distinct styles by number
+  map<Style, uint32_t, StyleLess> style_numbers;
+  vector<Style> styles;
+
+  // <use> elements in the order they are written
+  vector<const Use*> uses;
+
+  vector<unsigned char> bytes;
+
+ private:
+
+  void align( void ) {
+    while ( bytes.size() % 8 ) bytes.push_back( 0 );
+  }
+
+};
+
+void SceneWriter::put_style( const SVGElement* element ) {
+
+  if ( !style_numbers.count( element->style ) ) {
+    style_numbers[element->style] = styles.size();
+    styles.push_back( element->style );
+  }
+
+  if ( element->type == GROUP ) {
+    const Group* group = static_cast<const Group*>( element );
+    for ( size_t i = 0; i < group->elements.size(); ++i ) {
+      put_style( group->elements[i] );
+    }
+  }
+}
+
+void SceneWriter::put_element( const SVGElement* element ) {
+
+  numbers[element] = count++;
+
+  ElementRecord record;
+  memset( &record, 0, sizeof( record ) );
+  record.type = element->type;
+  record.style = style_numbers[element->style];
+  for ( int i = 0; i < 9; ++i ) {
+    record.transform[i] = element->transform( i / 3, i % 3 );
+  }
+
+  const Group* group = element->type == GROUP ?
+    static_cast<const Group*>( element ) : NULL;
+  if ( group ) record.children = group->elements.size();
+  put( record );
+
+  switch ( element->type ) {
+    case POINT:
+      put( static_cast<const Point*>( element )->position );
+      break;
+    case LINE: {
+      const Line* line = static_cast<const Line*>( element );
+      put( line->from ); put( line->to );
+      break;
+    }
+    case POLYLINE: {
+      const Polyline* polyline = static_cast<const Polyline*>( element );
+      put_points( polyline->points, polyline->lod );
+      break;
+    }
+    case RECT: {
+      const Rect* rect = static_cast<const Rect*>( element );
+      put( rect->position ); put( rect->dimension );
+      break;
+    }
+    case POLYGON: {
+      const Polygon* polygon = static_cast<const Polygon*>( element );
+      put_points( polygon->points, polygon->lod );
+      break;
+    }
+    case ELLIPSE: {
+      const Ellipse* ellipse = static_cast<const Ellipse*>( element );
+      put( ellipse->center ); put( ellipse->radius );
+      break;
+    }
+    case IMAGE: {
+      const Image* image = static_cast<const Image*>( element );
+      put( image->position ); put( image->dimension );
+      put( (uint64_t) image->tex.width ); put( (uint64_t) image->tex.height );
+      put( (uint32_t) image->tex.mipmap.size() );
+      for ( size_t i = 0; i < image->tex.mipmap.size(); ++i ) {
+        const MipLevel& level = image->tex.mipmap[i];
+        put( (uint64_t) level.width ); put( (uint64_t) level.height );
+        put_array( level.texels );
+      }
+      break;
+    }
+    case PATH: {
+      const PathData& data = static_cast<const Path*>( element )->data;
+      put( data.bounds_min ); put( data.bounds_max );
+      put_array( data.ops );
+      put_array( data.coords );
+      break;
+    }
+    case USE:
+      // the source may come later, uses are written after all elements
+      uses.push_back( static_cast<const Use*>( element ) );
+      break;
+    default:
+      break;
+  }
+
+  if ( group ) {
+    for ( size_t i = 0; i < group->elements.size(); ++i ) {
+      put_element( group->elements[i] );
+    }
+  }
+}
+
+// Reader //
+
+class SceneReader {
+ public:
+
+  SceneReader( const unsigned char* data, size_t size )
+    : data( data ), size( size ), pos( 0 ), failed( false ) { }
+
+  // styles the element records refer to
+  vector<Style> styles;
+
+  template <class T>
+  bool get( T& value ) {
+    if ( failed || size - pos < sizeof( T ) ) return fail();
+    memcpy( (void*) &value, data + pos, sizeof( T ) );
+    pos += sizeof( T );
+    return true;
+  }
+
+  template <class T>
+  bool get_array( vector<T>& values ) {
+    uint64_t n;
+    if ( !get( n ) || !align() ) return false;
+    if ( n > ( size - pos ) / sizeof( T ) ) return fail();
+    values.resize( n );
+    if ( n ) memcpy( (void*) &values[0], data + pos, n * sizeof( T ) );
+    pos += n * sizeof( T );
+    return align();
+  }
+
+  bool get_string( string& s ) {
+    vector<char> chars;
+    if ( !get_array( chars ) ) return false;
+    s.assign( chars.begin(), chars.end() );
+    return true;
+  }
+
+  bool get_points( vector<Vector2D>& points, LODChain& lod ) {
+    uint32_t levels;
+    if ( !get_array( points ) || !get( lod.bounds_min ) ||
+         !get( lod.bounds_max ) || !get( levels ) ) return false;
+    if ( levels > size - pos ) return fail();
+    lod.levels.resize( levels );
+    for ( size_t i = 0; i < levels; ++i ) {
+      if ( !get( lod.levels[i].tolerance ) ||
+           !get_array( lod.levels[i].points ) ) return false;
+    }
+    return true;
+  }
+
+  // read an element and its children, NULL on malformed input
+  SVGElement* get_element( void );
+
+  // elements by number, and the <use> elements with their source numbers
+  vector<SVGElement*> numbered;
+  vector< pair<Use*, uint32_t> > uses;
+
+  bool ok( void ) const { return !failed; }
+
+ private:
+
+  bool fail( void ) { failed = true; return false; }
+
+  bool align( void ) {
+    size_t aligned = ( pos + 7 ) & ~(size_t) 7;
+    if ( aligned > size ) return fail();
+    pos = aligned;
+    return true;
+  }
+
+  const unsigned char* data;
+  size_t size, pos;
+  bool failed;
+
+};
+
+SVGElement* SceneReader::get_element() {
+
+  ElementRecord record;
+  if ( !get( record ) ) return NULL;
+
+  SVGElement* element = NULL;
+  switch ( record.type ) {
+    case POINT: {
+      Point* point = new Point(); element = point;
+      get( point->position );
+      break;
+    }
+    case LINE: {
+      Line* line = new Line(); element = line;
+      get( line->from ); get( line->to );
+      break;
+    }
+    case POLYLINE: {
+      Polyline* polyline = new Polyline(); element = polyline;
+      get_points( polyline->points, polyline->lod );
+      break;
+    }
+    case RECT: {
+      Rect* rect = new Rect(); element = rect;
+      get( rect->position ); get( rect->dimension );
+      break;
+    }
+    case POLYGON: {
+      Polygon* polygon = new Polygon(); element = polygon;
+      get_points( polygon->points, polygon->lod );
+      break;
+    }
+    case ELLIPSE: {
+      Ellipse* ellipse = new Ellipse(); element = ellipse;
+      get( ellipse->center ); get( ellipse->radius );
+      break;
+    }
+    case IMAGE: {
+      Image* image = new Image(); element = image;
+      uint64_t width = 0, height = 0;
+      uint32_t levels = 0;
+      get( image->position ); get( image->dimension );
+      get( width ); get( height ); get( levels );
+      if ( levels > (uint32_t) kMaxMipLevels + 1 ) fail();
+      image->tex.width = width; image->tex.height = height;
+      image->tex.mipmap.resize( ok() ? levels : 0 );
+      for ( size_t i = 0; i < image->tex.mipmap.size() && ok(); ++i ) {
+        MipLevel& level = image->tex.mipmap[i];
+        get( width ); get( height );
+        level.width = width; level.height = height;
+        get_array( level.texels );
+      }
+      break;
+    }
+    case PATH: {
+      Path* path = new Path(); element = path;
+      PathData& data = path->data;
+      get( data.bounds_min ); get( data.bounds_max );
+      get_array( data.ops ); get_array( data.coords );
+      break;
+    }
+    case USE: {
+      Use* use = new Use(); element = use;
+      break;
+    }
+    case GROUP:
+      element = new Group();
+      break;
+    default:
+      fail();
+      return NULL;
+  }
+
+  if ( record.style < styles.size() ) {
+    element->style = styles[record.style];
+  } else {
+    fail();
+  }
+  for ( int i = 0; i < 9; ++i ) {
+    element->transform( i / 3, i % 3 ) = record.transform[i];
+  }
+
+  numbered.push_back( element );
+
+  if ( element->type == GROUP ) {
+    Group* group = static_cast<Group*>( element );
+    // every child takes at least a record
+    if ( record.children > ( size - pos ) / sizeof( ElementRecord ) ) fail();
+    for ( uint32_t i = 0; i < record.children && ok(); ++i ) {
+      SVGElement* child = get_element();
+      if ( child ) group->elements.push_back( child );
+    }
+  }
+
+  if ( !ok() ) {
+    delete element;
+    return NULL;
+  }
+  return element;
+}
+
+// Saving //
+
+// write the scene, stamped with the source it was loaded from
+static int save_scene( const char* filename, const SVG* svg,
+                       uint64_t source_size, int64_t source_time ) {
+
+  SceneWriter writer;
+
+  SceneHeader header;
+  memset( &header, 0, sizeof( header ) );
+  writer.put( header );
+
+  for ( size_t i = 0; i < svg->elements.size(); ++i ) {
+    writer.put_style( svg->elements[i] );
+  }
+  for ( size_t i = 0; i < svg->defs.size(); ++i ) {
+    writer.put_style( svg->defs[i] );
+  }
+  writer.put_array( writer.styles );
+
+  for ( size_t i = 0; i < svg->elements.size(); ++i ) {
+    writer.put_element( svg->elements[i] );
+  }
+  for ( size_t i = 0; i < svg->defs.size(); ++i ) {
+    writer.put_element( svg->defs[i] );
+  }
+
+  // <use> sources, by element number
+  const vector<const Use*>& uses = writer.uses;
+  writer.put( (uint32_t) uses.size() );
+  for ( size_t i = 0; i < uses.size(); ++i ) {
+    const Use* use = uses[i];
+    map<const SVGElement*, uint32_t>::const_iterator source =
+      writer.numbers.find( use->source );
+    writer.put( writer.numbers[use] );
+    writer.put( source == writer.numbers.end() ? ~(uint32_t) 0
+                                               : source->second );
+    writer.put( (uint64_t) use->instances );
+    writer.put( (uint8_t) use->fill ); writer.put( (uint8_t) use->stroke );
+    writer.put_string( use->href );
+  }
+
+  size_t ids = 0;
+  for ( map<string, SVGElement*>::const_iterator it = svg->ids.begin();
+        it != svg->ids.end(); ++it ) {
+    map<const SVGElement*, uint32_t>::const_iterator number =
+      writer.numbers.find( it->second );
+    if ( number == writer.numbers.end() ) continue;
+    writer.put_string( it->first );
+    writer.put( number->second );
+    ids++;
+  }
+
+  // the header goes in last, it holds the sizes
+  memcpy( header.magic, kSceneMagic, 4 );
+  header.version    = kSceneVersion;
+  header.byte_order = kSceneByteOrder;
+  header.layout     = layout();
+  header.source_size = source_size;
+  header.source_time = source_time;
+  header.size       = writer.bytes.size();
+  header.width      = svg->width;
+  header.height     = svg->height;
+  header.elements   = svg->elements.size();
+  header.defs       = svg->defs.size();
+  header.ids        = ids;
+  memcpy( &writer.bytes[0], &header, sizeof( header ) );
+
+  // written aside and renamed, readers never see a partial file
+  string temporary = string( filename ) + ".tmp";
+  FILE* file = fopen( temporary.c_str(), "wb" );
+  if ( !file ) return -1;
+  bool written = fwrite( &writer.bytes[0], 1, writer.bytes.size(), file )
+                 == writer.bytes.size();
+  written = !fclose( file ) && written;
+  if ( !written || rename( temporary.c_str(), filename ) ) {
+    remove( temporary.c_str() );
+    return -1;
+  }
+  return 0;
+}
+
+int SVGParser::saveBinary( const char* filename, const SVG* svg ) {
+  return save_scene( filename, svg, 0, 0 );
+}
+
+// Loading //
+
+// scene read from mapped bytes, stamp is the expected source stamp if
+// checked
+static int load_scene( const unsigned char* data, size_t size, SVG* svg,
+                       const uint64_t* source_size,
+                       const int64_t* source_time ) {
+
+  SceneHeader header;
+  if ( size < sizeof( header ) ) return -1;
+  memcpy( &header, data, sizeof( header ) );
+  if ( memcmp( header.magic, kSceneMagic, 4 ) ||
+       header.version != kSceneVersion ||
+       header.byte_order != kSceneByteOrder ||
+       header.layout != layout() || header.size != size ) {
+    return -1;
+  }
+  if ( source_size && ( header.source_size != *source_size ||
+                        header.source_time != *source_time ) ) {
+    return -1;
+  }
+
+  SceneReader reader( data, size );
+  reader.get( header );
+
+  svg->width  = header.width;
+  svg->height = header.height;
+
+  reader.get_array( reader.styles );
+
+  for ( uint32_t i = 0; i < header.elements && reader.ok(); ++i ) {
+    SVGElement* element = reader.get_element();
+    if ( element ) svg->elements.push_back( element );
+  }
+  for ( uint32_t i = 0; i < header.defs && reader.ok(); ++i ) {
+    SVGElement* element = reader.get_element();
+    if ( element ) svg->defs.push_back( element );
+  }
+
+  uint32_t uses = 0;
+  reader.get( uses );
+  for ( uint32_t i = 0; i < uses && reader.ok(); ++i ) {
+    uint32_t number = 0, source = 0;
+    uint64_t instances = 0;
+    uint8_t fill = 0, stroke = 0;
+    string href;
+    reader.get( number ); reader.get( source ); reader.get( instances );
+    reader.get( fill ); reader.get( stroke ); reader.get_string( href );
+    if ( !reader.ok() || number >= reader.numbered.size() ||
+         reader.numbered[number]->type != USE ) break;
+    Use* use = static_cast<Use*>( reader.numbered[number] );
+    use->source = source < reader.numbered.size() ?
+                  reader.numbered[source] : NULL;
+    use->instances = instances;
+    use->fill = fill; use->stroke = stroke;
+    use->href.swap( href );
+  }
+
+  for ( uint32_t i = 0; i < header.ids && reader.ok(); ++i ) {
+    string id;
+    uint32_t number = 0;
+    reader.get_string( id ); reader.get( number );
+    if ( reader.ok() && number < reader.numbered.size() ) {
+      svg->ids[id] = reader.numbered[number];
+    }
+  }
+
+  if ( !reader.ok() ) {
+    cerr << "Warning: malformed precompiled scene" << endl;
+    return -1;
+  }
+
+  // build scene tables
+  svg->index();
+
+  return 0;
+}
+
+// map the scene file and load it
+static int load_scene( const char* filename, SVG* svg,
+                       const uint64_t* source_size,
+                       const int64_t* source_time ) {
+
+#ifndef _WIN32
+
+  int fd = open( filename, O_RDONLY );
+  if ( fd < 0 ) return -1;
+
+  struct stat st;
+  if ( fstat( fd, &st ) || !S_ISREG( st.st_mode ) || st.st_size <= 0 ) {
+    close( fd );
+    return -1;
+  }
+
+  void* mapping = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if ( mapping == MAP_FAILED ) return -1;
+  madvise( mapping, st.st_size, MADV_SEQUENTIAL );
+
+  int result = load_scene( (const unsigned char*) mapping, st.st_size, svg,
+                           source_size, source_time );
+  munmap( mapping, st.st_size );
+
+#else
+
+  // no mmap, read the whole file with a single copy
+  FILE* file = fopen( filename, "rb" );
+  if ( !file ) return -1;
+  fseek( file, 0, SEEK_END );
+  long size = ftell( file );
+  fseek( file, 0, SEEK_SET );
+  vector<unsigned char> buffer( size > 0 ? size : 1 );
+  size_t read = size > 0 ? fread( &buffer[0], 1, size, file ) : 0;
+  fclose( file );
+
+  int result = load_scene( &buffer[0], read, svg, source_size, source_time );
+
+#endif
+
+  // a failed load leaves nothing behind
+  if ( result < 0 ) {
+    for ( size_t i = 0; i < svg->elements.size(); ++i ) delete svg->elements[i];
+    for ( size_t i = 0; i < svg->defs.size(); ++i ) delete svg->defs[i];
+    svg->elements.clear(); svg->defs.clear(); svg->ids.clear();
+  }
+  return result;
+}
+
+int SVGParser::loadBinary( const char* filename, SVG* svg ) {
+  return load_scene( filename, svg, NULL, NULL );
+}
+
+int SVGParser::loadCached( const char* filename, SVG* svg,
+                           TaskPool* pool, bool update ) {
+
+  uint64_t size;
+  int64_t time;
+  if ( !source_stamp( filename, size, time ) ) return -1;
+
+  string scene = string( filename ) + kSceneExtension;
+  if ( !load_scene( scene.c_str(), svg, &size, &time ) ) return 0;
+
+  if ( !update ) return load( filename, svg, pool );
+
+  /* NOTE:
+   * Writing the scene needs the decoded images, so they are decoded right
+   * away and not on a pool: this may itself run on a pool, and waiting
+   * for tasks queued behind it could never return.
+   */
+  if ( load( filename, svg ) < 0 ) return -1;
+
+  // stamped with the source as it was before parsing, a change while
+  // parsing makes the scene stale rather than wrong. A directory that
+  // cannot be written to only costs the parse next time
+  save_scene( scene.c_str(), svg, size, time );
+
+  return 0;
+}
+
+} // namespace CMU462
@@ -0,0 +1,690 @@
+#include "svg.h"
+#include "png.h"
+#include "base64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <set>
+#include <string>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+
+namespace CMU462 {
+
+/* NOTE:
+ * Documents are written straight from the element tree through a small
+ * output buffer, tag by tag, without building a DOM or the whole text.
+ *
+ * A plain save writes every element as loaded, with numbers in the
+ * shortest form that reads back as the same float. An optimized save
+ * writes a document that draws the same canvas with less work:
+ *
+ *   - transforms are folded into the coordinates of shapes, and left out
+ *     where they are the identity
+ *   - groups with a single child are replaced by the child, with the
+ *     group transform folded into it, and empty groups are dropped
+ *   - runs of small polygons with the same style become one path
+ *   - shapes that draw nothing (transparent, no geometry, entirely off
+ *     the canvas) are dropped
+ *   - coordinates are rounded to a fraction of the canvas size
+ *
+ * Elements referenced by a <use> are written with their own transform,
+ * which their instances draw them with. Nothing is dropped from them or
+ * from <defs>: instances draw their content elsewhere, and may override
+ * its colors.
+ */
+
+// largest polygon merged into a path. Larger ones are kept, they draw
+// through their simplified levels of detail when zoomed out
+static const size_t kMergeMaxPoints = 16;
+
+// points of a path made from merged polygons
+static const size_t kMergeMaxPathPoints = 4096;
+
+// output buffered before a write
+static const size_t kWriteBuffer = 1 << 16;
+
+static bool identity( const Affine2D& m ) {
+  return m.a == 1 && m.b == 0 && m.c == 0 && m.d == 1 &&
+         m.e == 0 && m.f == 0;
+}
+
+static bool same_style( const Style& a, const Style& b ) {
+  return !memcmp( &a, &b, sizeof( Style ) );
+}
+
+// Output //
+
+class SVGWriter {
+ public:
+
+  SVGWriter( FILE* file, int precision )
+    : file( file ), precision( precision ), failed( false ) {
+    buffer.reserve( kWriteBuffer );
+  }
+
+  void put( const char* s, size_t n ) {
+    if ( buffer.size() + n > kWriteBuffer ) flush();
+    if ( n > kWriteBuffer ) {
+      failed = fwrite( s, 1, n, file ) != n || failed;
+      return;
+    }
+    buffer.insert( buffer.end(), s, s + n );
+  }
+
+  void put( const char* s ) { put( s, strlen( s ) ); }
+  void put( const string& s ) { put( s.data(), s.size() ); }
+
+  // text with XML special characters escaped
+  void escaped( const string& s ) {
+    for ( size_t i = 0; i < s.size(); ++i ) {
+      switch ( s[i] ) {
+        case '&':  put( "&amp;" );  break;
+        case '<':  put( "&lt;" );   break;
+        case '>':  put( "&gt;" );   break;
+        case '"':  put( "&quot;" ); break;
+        default:   put( &s[i], 1 ); break;
+      }
+    }
+  }
+
+  // a number in a list, after separator unless the number starts with
+  // its own sign
+  void number( double v, char separator = ' ', bool exact = false ) {
+    char text[64];
+    size_t n = format( v, exact ? -1 : precision, text );
+    if ( separator && text[0] != '-' ) put( &separator, 1 );
+    put( text, n );
+  }
+
+  void attribute( const char* name, double v, bool exact = false ) {
+    put( " " ); put( name ); put( "=\"" );
+    number( v, 0, exact );
+    put( "\"" );
+  }
+
+  void attribute( const char* name, const string& value ) {
+    put( " " ); put( name ); put( "=\"" );
+    escaped( value );
+    put( "\"" );
+  }
+
+  void color( const char* name, const Color& c ) {
+    char text[8];
+    snprintf( text, sizeof( text ), "#%02x%02x%02x", channel( c.r ),
+              channel( c.g ), channel( c.b ) );
+    attribute( name, text );
+  }
+
+  void transform( const Affine2D& m ) {
+    put( " transform=\"matrix(" );
+    number( m.a, 0, true ); number( m.b, ' ', true );
+    number( m.c, ' ', true ); number( m.d, ' ', true );
+    number( m.e, ' ', true ); number( m.f, ' ', true );
+    put( ")\"" );
+  }
+
+  void indent( int depth ) {
+    if ( precision >= 0 ) return;
+    for ( int i = 0; i < depth; ++i ) put( "  " );
+  }
+
+  // write out the buffer, false if anything failed to write
+  bool flush( void ) {
+    if ( !buffer.empty() ) {
+      failed = fwrite( &buffer[0], 1, buffer.size(), file ) !=
+               buffer.size() || failed;
+      buffer.clear();
+    }
+    return !failed;
+  }
+
+ private:
+
+  static int channel( float v ) {
+    return (int) ( min( max( v, 0.f ), 1.f ) * 255 + 0.5f );
+  }
+
+  // decimal text of v into text, rounded to precision decimal places, or
+  // with the fewest digits that read back as the same float if negative
+  static size_t format( double v, int precision, char* text ) {
+
+    int n;
+    if ( precision < 0 || fabs( v ) >= 1e15 ) {
+      float f = (float) v;
+      for ( int digits = 6; ; ++digits ) {
+        n = snprintf( text, 64, "%.*g", digits, f );
+        if ( digits == 9 || strtof( text, NULL ) == f ) break;
+      }
+      return n;
+    }
+
+    n = snprintf( text, 64, "%.*f", precision, v );
+
+    // drop trailing zeros, the point if nothing follows it, a leading
+    // zero and the sign of zero
+    if ( strchr( text, '.' ) ) {
+      while ( text[n - 1] == '0' ) n--;
+      if ( text[n - 1] == '.' ) n--;
+      text[n] = '\0';
+    }
+    if ( !strcmp( text, "-0" ) ) { strcpy( text, "0" ); return 1; }
+    char* digits = text[0] == '-' ? text + 1 : text;
+    if ( digits[0] == '0' && digits[1] == '.' ) {
+      memmove( digits, digits + 1, strlen( digits ) );
+      n--;
+    }
+    return n;
+  }
+
+  FILE* file;
+  int precision;
+  vector<char> buffer;
+  bool failed;
+
+};
+
+// Document //
+
+class DocumentWriter {
+ public:
+
+  DocumentWriter( const SVG* svg, SVGWriter& out, bool optimize );
+
+  void write( void );
+
+ private:
+
+  // write elements of one parent, world is the parent to svg transform
+  void write_list( const vector<SVGElement*>& elements,
+                   const Affine2D& world, int depth );
+
+  // write an element whose transform is composed after pending
+  void write_element( const SVGElement* element, const Affine2D& pending,
+                      const Affine2D& world, int depth );
+
+  // whether an element draws anything on the canvas
+  bool visible( const SVGElement* element, const Affine2D& world );
+
+  // whether a polygon can be merged into a path with its neighbours
+  bool mergeable( const SVGElement* element );
+
+  // write polygons as one path
+  void write_merged( const vector<const Polygon*>& polygons );
+
+  void write_style( const SVGElement* element );
+  void write_points( const vector<Vector2D>& points, const Affine2D* m );
+  void write_path( const PathData& data, const Affine2D* m );
+  void write_image( const Image* image );
+
+  const SVG* svg;
+  SVGWriter& out;
+  bool optimize;
+
+  // nesting depth of content drawn by instances (<defs> and <use>
+  // sources) being written
+  int shared;
+
+  // <use> sources, written as they are
+  set<const SVGElement*> sources;
+
+  // id attributes by element
+  map<const SVGElement*, string> names;
+
+};
+
+static void collect_sources( const SVGElement* element,
+                             set<const SVGElement*>& sources ) {
+
+  if ( element->type == USE ) {
+    const Use* use = static_cast<const Use*>( element );
+    if ( use->source ) sources.insert( use->source );
+  } else if ( element->type == GROUP ) {
+    const Group* group = static_cast<const Group*>( element );
+    for ( size_t i = 0; i < group->elements.size(); ++i ) {
+      collect_sources( group->elements[i], sources );
+    }
+  }
+}
+
+DocumentWriter::DocumentWriter( const SVG* svg, SVGWriter& out,
+                                bool optimize )
+  : svg( svg ), out( out ), optimize( optimize ), shared( 0 ) {
+
+  for ( size_t i = 0; i < svg->elements.size(); ++i ) {
+    collect_sources( svg->elements[i], sources );
+  }
+  for ( size_t i = 0; i < svg->defs.size(); ++i ) {
+    collect_sources( svg->defs[i], sources );
+  }
+
+  // optimized documents only keep the ids that are referenced
+  for ( map<string, SVGElement*>::const_iterator it = svg->ids.begin();
+        it != svg->ids.end(); ++it ) {
+    if ( !optimize || sources.count( it->second ) ) {
+      names.insert( make_pair( it->second, it->first ) );
+    }
+  }
+}
+
+void DocumentWriter::write() {
+
+  out.put( "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" );
+  out.put( "<svg xmlns=\"http://www.w3.org/2000/svg\""
+           " xmlns:xlink=\"http://www.w3.org/1999/xlink\"" );
+  out.attribute( "width", svg->width, true );
+  out.attribute( "height", svg->height, true );
+  out.put( ">\n" );
+
+  if ( !svg->defs.empty() ) {
+    shared++;
+    out.indent( 1 ); out.put( "<defs>\n" );
+    write_list( svg->defs, Affine2D(), 2 );
+    out.indent( 1 ); out.put( "</defs>\n" );
+    shared--;
+  }
+
+  write_list( svg->elements, Affine2D(), 1 );
+
+  out.put( "</svg>\n" );
+}
+
+bool DocumentWriter::visible( const SVGElement* element,
+                              const Affine2D& world ) {
+
+  if ( !optimize || shared || sources.count( element ) ) return true;
+
+  const Color& fill = element->style.fillColor;
+  const Color& stroke = element->style.strokeColor;
+  switch ( element->type ) {
+    case POINT:
+      if ( fill.a == 0 ) return false;
+      break;
+    case LINE:
+    case POLYLINE:
+      if ( stroke.a == 0 ) return false;
+      break;
+    case RECT:
+    case POLYGON:
+    case ELLIPSE:
+    case PATH:
+      if ( fill.a == 0 && stroke.a == 0 ) return false;
+      break;
+    case USE:
+      if ( !static_cast<const Use*>( element )->source ) return false;
+      break;
+    case GROUP: {
+      const Group* group = static_cast<const Group*>( element );
+      Affine2D inner;
+      if ( !Affine2D::fromMatrix( element->transform, inner ) ) return true;
+      inner = world * inner;
+      for ( size_t i = 0; i < group->elements.size(); ++i ) {
+        if ( visible( group->elements[i], inner ) ) return true;
+      }
+      return false;
+    }
+    default:
+      break;
+  }
+
+  // geometry entirely off the canvas
+  Vector2D bounds_min, bounds_max;
+  if ( !bounds( element, world, bounds_min, bounds_max ) ) return false;
+  return bounds_max.x >= 0 && bounds_max.y >= 0 &&
+         bounds_min.x <= svg->width && bounds_min.y <= svg->height;
+}
+
+bool DocumentWriter::mergeable( const SVGElement* element ) {
+
+  if ( !optimize || element->type != POLYGON ) return false;
+  if ( sources.count( element ) || names.count( element ) ) return false;
+
+  Affine2D m;
+  return Affine2D::fromMatrix( element->transform, m ) &&
+         static_cast<const Polygon*>( element )->points.size() <=
+         kMergeMaxPoints;
+}
+
+void DocumentWriter::write_list( const vector<SVGElement*>& elements,
+                                 const Affine2D& world, int depth ) {
+
+  for ( size_t i = 0; i < elements.size(); ++i ) {
+
+    const SVGElement* element = elements[i];
+    if ( !visible( element, world ) ) continue;
+
+    // gather the run of same style polygons starting here, skipping
+    // the ones that draw nothing
+    vector<const Polygon*> run;
+    if ( mergeable( element ) ) {
+      size_t points = 0, j = i;
+      for ( ; j < elements.size(); ++j ) {
+        const SVGElement* next = elements[j];
+        if ( !visible( next, world ) ) continue;
+        if ( !mergeable( next ) ||
+             !same_style( next->style, element->style ) ) break;
+        const Polygon* polygon = static_cast<const Polygon*>( next );
+        if ( points + polygon->points.size() > kMergeMaxPathPoints ) break;
+        points += polygon->points.size();
+        run.push_back( polygon );
+      }
+      if ( run.size() > 1 ) {
+        out.indent( depth );
+        write_merged( run );
+        i = j - 1;
+        continue;
+      }
+    }
+
+    write_element( element, Affine2D(), world, depth );
+  }
+}
+
+void DocumentWriter::write_element( const SVGElement* element,
+                                    const Affine2D& pending,
+                                    const Affine2D& world, int depth ) {
+
+  Affine2D own;
+  bool affine = Affine2D::fromMatrix( element->transform, own );
+  Affine2D local = pending * own;
+  bool source = sources.count( element ) > 0;
+
+  // a group with a single visible child is replaced by the child
+  if ( optimize && affine && !source && element->type == GROUP ) {
+    const Group* group = static_cast<const Group*>( element );
+    const SVGElement* child = NULL;
+    size_t count = 0;
+    for ( size_t i = 0; i < group->elements.size(); ++i ) {
+      if ( visible( group->elements[i], world * own ) ) {
+        child = group->elements[i];
+        count++;
+      }
+    }
+    if ( count == 0 ) return;
+    if ( count == 1 && !sources.count( child ) ) {
+      write_element( child, local, world * own, depth );
+      return;
+    }
+  }
+
+  // shapes defined by points take the transform into their coordinates
+  const Affine2D* fold = NULL;
+  if ( optimize && affine && !source && !identity( local ) ) {
+    switch ( element->type ) {
+      case POINT: case LINE: case POLYLINE: case POLYGON: case PATH:
+        fold = &local;
+        break;
+      case RECT:
+        if ( local.b == 0 && local.c == 0 ) fold = &local;
+        break;
+      default:
+        break;
+    }
+  }
+
+  static const char* const kTags[] = {
+    NULL, "rect", "line", "polyline", "rect", "polygon", "ellipse",
+    "image", "g", "path", "use"
+  };
+  if ( element->type <= NONE || element->type > USE ) return;
+
+  out.indent( depth );
+  out.put( "<" );
+  out.put( kTags[element->type] );
+
+  map<const SVGElement*, string>::const_iterator name =
+    names.find( element );
+  if ( name != names.end() ) out.attribute( "id", name->second );
+
+  if ( !optimize || element->type != GROUP ) write_style( element );
+
+  if ( !affine ) {
+    // projective transforms are not part of SVG, keep the affine part
+    const Matrix3x3& m = element->transform;
+    out.transform( Affine2D( m(0,0), m(1,0), m(0,1), m(1,1),
+                             m(0,2), m(1,2) ) );
+  } else if ( !fold && !identity( local ) ) {
+    out.transform( local );
+  }
+
+  Affine2D none;
+  const Affine2D& m = fold ? *fold : none;
+  switch ( element->type ) {
+    case POINT: {
+      Vector2D p = m * static_cast<const Point*>( element )->position;
+      out.attribute( "x", p.x ); out.attribute( "y", p.y );
+      out.put( " width=\"0\" height=\"0\"" );
+      break;
+    }
+    case LINE: {
+      const Line* line = static_cast<const Line*>( element );
+      Vector2D from = m * line->from, to = m * line->to;
+      out.attribute( "x1", from.x ); out.attribute( "y1", from.y );
+      out.attribute( "x2", to.x ); out.attribute( "y2", to.y );
+      break;
+    }
+    case POLYLINE:
+      write_points( static_cast<const Polyline*>( element )->points, fold );
+      break;
+    case POLYGON:
+      write_points( static_cast<const Polygon*>( element )->points, fold );
+      break;
+    case RECT: {
+      const Rect* rect = static_cast<const Rect*>( element );
+      Vector2D a = m * rect->position;
+      Vector2D b = m * ( rect->position + rect->dimension );
+      out.attribute( "x", min( a.x, b.x ) );
+      out.attribute( "y", min( a.y, b.y ) );
+      out.attribute( "width", fabs( b.x - a.x ) );
+      out.attribute( "height", fabs( b.y - a.y ) );
+      break;
+    }
+    case ELLIPSE: {
+      const Ellipse* ellipse = static_cast<const Ellipse*>( element );
+      out.attribute( "cx", ellipse->center.x );
+      out.attribute( "cy", ellipse->center.y );
+      out.attribute( "rx", ellipse->radius.x );
+      out.attribute( "ry", ellipse->radius.y );
+      break;
+    }
+    case IMAGE:
+      write_image( static_cast<const Image*>( element ) );
+      break;
+    case PATH:
+      write_path( static_cast<const Path*>( element )->data, fold );
+      break;
+    case USE:
+      out.attribute( "xlink:href", "#" +
+                     static_cast<const Use*>( element )->href );
+      break;
+    default:
+      break;
+  }
+
+  if ( element->type != GROUP ) {
+    out.put( "/>\n" );
+    return;
+  }
+
+  const Group* group = static_cast<const Group*>( element );
+  if ( group->elements.empty() ) {
+    out.put( "/>\n" );
+    return;
+  }
+  out.put( ">\n" );
+  if ( source ) shared++;
+  write_list( group->elements, affine ? world * own : world, depth + 1 );
+  if ( source ) shared--;
+  out.indent( depth );
+  out.put( "</g>\n" );
+}
+
+void DocumentWriter::write_style( const SVGElement* element ) {
+
+  const Style& style = element->style;
+
+  // a <use> only overrides the colors it was given
+  bool use = element->type == USE;
+  bool fill = use ? static_cast<const Use*>( element )->fill : true;
+  bool stroke = use ? static_cast<const Use*>( element )->stroke
+                    : style.strokeColor.a != 0;
+
+  // fill defaults to opaque black, stroke to none
+  const Color& f = style.fillColor;
+  if ( fill && f.a == 0 ) {
+    out.put( " fill=\"none\"" );
+  } else if ( fill ) {
+    if ( use || f.r != 0 || f.g != 0 || f.b != 0 ) out.color( "fill", f );
+    if ( f.a != 1 ) out.attribute( "fill-opacity", f.a, true );
+  }
+
+  const Color& s = style.strokeColor;
+  if ( stroke && s.a == 0 ) {
+    out.put( " stroke=\"none\"" );
+  } else if ( stroke ) {
+    out.color( "stroke", s );
+    if ( s.a != 1 ) out.attribute( "stroke-opacity", s.a, true );
+  }
+
+  if ( use ) return;
+  if ( style.strokeWidth != 1 ) {
+    out.attribute( "stroke-width", style.strokeWidth, true );
+  }
+  if ( style.miterLimit != 4 ) {
+    out.attribute( "stroke-miterlimit", style.miterLimit, true );
+  }
+}
+
+void DocumentWriter::write_points( const vector<Vector2D>& points,
+                                   const Affine2D* m ) {
+
+  out.put( " points=\"" );
+  for ( size_t i = 0; i < points.size(); ++i ) {
+    Vector2D p = m ? *m * points[i] : points[i];
+    out.number( p.x, i ? ' ' : 0 );
+    out.number( p.y );
+  }
+  out.put( "\"" );
+}
+
+void DocumentWriter::write_path( const PathData& data, const Affine2D* m ) {
+
+  static const char kCommands[] = { 'M', 'L', 'Q', 'C', 'Z' };
+  static const int kPoints[] = { 1, 1, 2, 3, 0 };
+
+  out.put( " d=\"" );
+  size_t coord = 0;
+  int last = -1;
+  for ( size_t i = 0; i < data.ops.size(); ++i ) {
+    int op = data.ops[i];
+    if ( op < PATH_MOVE || op > PATH_CLOSE ) break;
+
+    // repeated commands are implicit, and so are lines after a move
+    bool implicit = op != PATH_MOVE && op != PATH_CLOSE &&
+                    ( op == last || ( op == PATH_LINE && last == PATH_MOVE ) );
+    if ( !implicit ) out.put( &kCommands[op], 1 );
+
+    for ( int k = 0; k < kPoints[op] && coord < data.coords.size(); ++k ) {
+      Vector2D p = m ? *m * data.coords[coord] : data.coords[coord];
+      coord++;
+      out.number( p.x, implicit || k ? ' ' : 0 );
+      out.number( p.y );
+    }
+    last = op;
+  }
+  out.put( "\"" );
+}
+
+void DocumentWriter::write_merged( const vector<const Polygon*>& polygons ) {
+
+  out.put( "<path" );
+  write_style( polygons[0] );
+  out.put( " d=\"" );
+  for ( size_t i = 0; i < polygons.size(); ++i ) {
+    Affine2D m;
+    Affine2D::fromMatrix( polygons[i]->transform, m );
+    const vector<Vector2D>& points = polygons[i]->points;
+    out.put( "M" );
+    for ( size_t j = 0; j < points.size(); ++j ) {
+      Vector2D p = m * points[j];
+      out.number( p.x, j ? ' ' : 0 );
+      out.number( p.y );
+    }
+    out.put( "Z" );
+  }
+  out.put( "\"/>\n" );
+}
+
+void DocumentWriter::write_image( const Image* image ) {
+
+  out.attribute( "x", image->position.x );
+  out.attribute( "y", image->position.y );
+  out.attribute( "width", image->dimension.x );
+  out.attribute( "height", image->dimension.y );
+
+  // the PNG file if it was not decoded yet, otherwise the texture again
+  vector<unsigned char> file;
+  if ( !image->data.empty() ) {
+    file = image->data;
+  } else if ( !image->tex.mipmap.empty() ) {
+    const MipLevel& level = image->tex.mipmap[0];
+    PNG png;
+    png.width = level.width;
+    png.height = level.height;
+    png.pixels = level.texels;
+    PNGParser::save( file, png );
+  }
+
+  out.put( " xlink:href=\"data:image/png;base64," );
+  if ( !file.empty() ) out.put( base64_encode( &file[0], file.size() ) );
+  out.put( "\"" );
+}
+
+// Saving //
+
+static int save_document( const char* filename, const SVG* svg,
+                          bool optimize, int digits ) {
+
+  // written aside and renamed, readers never see a partial file
+  string temporary = string( filename ) + ".tmp";
+  FILE* file = fopen( temporary.c_str(), "wb" );
+  if ( !file ) {
+    cerr << "Error: cannot open " << filename << " for writing" << endl;
+    return -1;
+  }
+
+  // decimal places of a step of at most the canvas size / 10^digits
+  int precision = -1;
+  if ( optimize ) {
+    double size = max( max( svg->width, svg->height ), 1e-6f );
+    precision = max( 0, (int) ceil( digits - log10( size ) ) );
+  }
+
+  SVGWriter out( file, precision );
+  DocumentWriter( svg, out, optimize ).write();
+
+  bool written = out.flush();
+  written = !fclose( file ) && written;
+  if ( !written || rename( temporary.c_str(), filename ) ) {
+    cerr << "Error: failed writing " << filename << endl;
+    remove( temporary.c_str() );
+    return -1;
+  }
+  return 0;
+}
+
+int SVGParser::save( const char* filename, const SVG* svg ) {
+  return save_document( filename, svg, false, 0 );
+}
+
+int SVGParser::saveOptimized( const char* filename, const SVG* svg,
+                              int digits ) {
+  return save_document( filename, svg, true, digits );
+}
+
+} // namespace CMU462
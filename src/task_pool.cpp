@@ -0,0 +1,87 @@
+#include "task_pool.h"
+
+using namespace std;
+
+namespace CMU462 {
+
+// Task group //
+
+void TaskGroup::add( void ) {
+  lock_guard<mutex> guard( lock );
+  pending++;
+}
+
+void TaskGroup::done( void ) {
+  lock_guard<mutex> guard( lock );
+  if ( --pending == 0 ) idle.notify_all();
+}
+
+void TaskGroup::wait( void ) {
+  unique_lock<mutex> guard( lock );
+  while ( pending ) idle.wait( guard );
+}
+
+bool TaskGroup::busy( void ) {
+  lock_guard<mutex> guard( lock );
+  return pending != 0;
+}
+
+// Task pool //
+
+TaskPool::TaskPool( size_t threads ) : stopping( false ) {
+
+  if ( threads == 0 ) threads = thread::hardware_concurrency();
+  if ( threads == 0 ) threads = 1;
+
+  for ( size_t i = 0; i < threads; ++i ) {
+    workers.push_back( thread( &TaskPool::work, this ) );
+  }
+}
+
+TaskPool::~TaskPool() {
+
+  {
+    lock_guard<mutex> guard( lock );
+    stopping = true;
+  }
+  ready.notify_all();
+
+  for ( size_t i = 0; i < workers.size(); ++i ) {
+    workers[i].join();
+  }
+}
+
+void TaskPool::submit( const function<void()>& task, TaskGroup* group ) {
+
+  if ( group ) group->add();
+
+  Task t = { task, group };
+  {
+    lock_guard<mutex> guard( lock );
+    queue.push_back( t );
+  }
+  ready.notify_one();
+}
+
+void TaskPool::work( void ) {
+
+  while ( true ) {
+
+    Task task;
+    {
+      unique_lock<mutex> guard( lock );
+      while ( queue.empty() && !stopping ) ready.wait( guard );
+
+      // the queue is drained before the workers exit
+      if ( queue.empty() ) return;
+
+      task = queue.front();
+      queue.pop_front();
+    }
+
+    task.run();
+    if ( task.group ) task.group->done();
+  }
+}
+
+} // namespace CMU462
@@ -0,0 +1,86 @@
+#ifndef CMU462_TASK_POOL_H
+#define CMU462_TASK_POOL_H
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace CMU462 {
+
+/**
+ * Counts the outstanding tasks of one owner (a document, a batch of
+ * files), so the owner can wait for its own work without waiting for
+ * everything else queued on the pool.
+ */
+class TaskGroup {
+ public:
+
+  TaskGroup() : pending( 0 ) { }
+
+  // destroying a group with outstanding tasks waits for them
+  ~TaskGroup() { wait(); }
+
+  void add( void );
+  void done( void );
+
+  // block until every task added so far is done
+  void wait( void );
+
+  // whether tasks are outstanding
+  bool busy( void );
+
+ private:
+
+  std::mutex lock;
+  std::condition_variable idle;
+  size_t pending;
+
+  TaskGroup( const TaskGroup& );
+  TaskGroup& operator=( const TaskGroup& );
+
+}; // class TaskGroup
+
+/**
+ * Fixed set of worker threads running queued tasks in submission order.
+ * Tasks may submit further tasks. Destroying the pool finishes every
+ * queued task first.
+ */
+class TaskPool {
+ public:
+
+  // threads defaults to the number of hardware threads
+  TaskPool( size_t threads = 0 );
+  ~TaskPool();
+
+  // queue a task, counted in group (if any) until it has run
+  void submit( const std::function<void()>& task, TaskGroup* group = NULL );
+
+  size_t size( void ) const { return workers.size(); }
+
+ private:
+
+  struct Task {
+    std::function<void()> run;
+    TaskGroup* group;
+  };
+
+  void work( void );
+
+  std::vector<std::thread> workers;
+
+  std::mutex lock;
+  std::condition_variable ready;
+  std::deque<Task> queue;
+  bool stopping;
+
+  TaskPool( const TaskPool& );
+  TaskPool& operator=( const TaskPool& );
+
+}; // class TaskPool
+
+} // namespace CMU462
+
+#endif // CMU462_TASK_POOL_H
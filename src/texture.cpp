@@ -34,6 +34,8 @@ namespace CMU462 {
       return c;
     }
 
+    Sampler2D::~Sampler2D() { }
+
     void Sampler2DImp::generate_mips(Texture &tex, int startLevel) {
 
       // NOTE:
@@ -70,8 +70,20 @@ bool snip(const vector<Vector2D>& contour,int u,int v,int w,int n,int *V ) {
 }
 
 void triangulate(const Polygon& polygon, vector<Vector2D>& triangles) {
-  
-  const vector<Vector2D>& contour = polygon.points;
+  triangulate(polygon.points, triangles);
+}
+
+void triangulate(const vector<Vector2D>& contour, vector<Vector2D>& triangles) {
+
+  vector<int> indices;
+  triangulate(contour, indices);
+
+  for (size_t i = 0; i < indices.size(); i++) {
+    triangles.push_back( contour[indices[i]] );
+  }
+}
+
+void triangulate(const vector<Vector2D>& contour, vector<int>& indices) {
 
   // allocate and initialize list of vertices in polygon
   int n = contour.size();
@@ -112,9 +124,9 @@ void triangulate(const Polygon& polygon, vector<Vector2D>& triangles) {
       a = V[u]; b = V[v]; c = V[w];
 
       // output Triangle
-      triangles.push_back( contour[a] );
-      triangles.push_back( contour[b] );
-      triangles.push_back( contour[c] );
+      indices.push_back( a );
+      indices.push_back( b );
+      indices.push_back( c );
 
       m++;
 
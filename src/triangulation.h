@@ -8,6 +8,15 @@ namespace CMU462 {
 // triangulates a polygon and save the result as a triangle list
 void triangulate(const Polygon& polygon, std::vector<Vector2D>& triangles );
 
+// triangulates a contour given as a point list
+void triangulate(const std::vector<Vector2D>& contour,
+                 std::vector<Vector2D>& triangles );
+
+// triangulates a contour and save the result as a list of indices into
+// the contour, three per triangle
+void triangulate(const std::vector<Vector2D>& contour,
+                 std::vector<int>& indices );
+
 } // namespace CMU462
 
 #endif // CMU462_TRIANGULATION_H
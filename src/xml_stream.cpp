@@ -0,0 +1,477 @@
+#include "xml_stream.h"
+#include "inflate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+namespace CMU462 {
+
+static inline bool is_space( char c ) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// write code point c as UTF-8 to out, returns the number of bytes
+static size_t encode_utf8( unsigned long c, char* out ) {
+
+  if ( c < 0x80 ) {
+    out[0] = (char) c;
+    return 1;
+  }
+  if ( c < 0x800 ) {
+    out[0] = (char) ( 0xC0 | ( c >> 6 ) );
+    out[1] = (char) ( 0x80 | ( c & 0x3F ) );
+    return 2;
+  }
+  if ( c < 0x10000 ) {
+    out[0] = (char) ( 0xE0 | ( c >> 12 ) );
+    out[1] = (char) ( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+    out[2] = (char) ( 0x80 | ( c & 0x3F ) );
+    return 3;
+  }
+  out[0] = (char) ( 0xF0 | ( c >> 18 ) );
+  out[1] = (char) ( 0x80 | ( ( c >> 12 ) & 0x3F ) );
+  out[2] = (char) ( 0x80 | ( ( c >> 6 ) & 0x3F ) );
+  out[3] = (char) ( 0x80 | ( c & 0x3F ) );
+  return 4;
+}
+
+// copy [s, e) to out, replacing entity and character references. Returns
+// the end of the output, which is never longer than the input
+static char* decode_entities( const char* s, const char* e, char* out ) {
+
+  static const struct { const char* name; size_t len; char c; } entities[] = {
+    { "&lt;",   4, '<'  }, { "&gt;",   4, '>'  }, { "&amp;", 5, '&' },
+    { "&quot;", 6, '"'  }, { "&apos;", 6, '\'' }
+  };
+
+  const char* in = s;
+  while ( in < e ) {
+
+    if ( *in != '&' ) {
+      *out++ = *in++;
+      continue;
+    }
+
+    // character reference
+    if ( in + 2 < e && in[1] == '#' ) {
+      const char* digits = in + 2;
+      int base = 10;
+      if ( *digits == 'x' ) { base = 16; digits++; }
+      unsigned long c = 0;
+      const char* stop = digits;
+      for ( ; stop < e; ++stop ) {
+        int d;
+        if ( *stop >= '0' && *stop <= '9' ) d = *stop - '0';
+        else if ( base == 16 && *stop >= 'a' && *stop <= 'f' ) d = *stop - 'a' + 10;
+        else if ( base == 16 && *stop >= 'A' && *stop <= 'F' ) d = *stop - 'A' + 10;
+        else break;
+        c = c * base + d;
+        if ( c > 0x10FFFF ) break;
+      }
+      if ( stop > digits && stop < e && *stop == ';' ) {
+        out += encode_utf8( c, out );
+        in = stop + 1;
+        continue;
+      }
+    }
+
+    // predefined entity
+    bool found = false;
+    for ( size_t i = 0; i < sizeof( entities ) / sizeof( entities[0] ); ++i ) {
+      size_t len = entities[i].len;
+      if ( (size_t) ( e - in ) >= len && !strncmp( in, entities[i].name, len ) ) {
+        *out++ = entities[i].c;
+        in += len;
+        found = true;
+        break;
+      }
+    }
+
+    // keep unknown references as they are
+    if ( !found ) *out++ = *in++;
+  }
+
+  return out;
+}
+
+bool XMLStream::open( const char* filename ) {
+
+  close();
+
+  file = fopen( filename, "rb" );
+  if ( !file ) return false;
+
+  // compressed input is mapped and inflated a chunk at a time
+  unsigned char magic[2];
+  size_t n = fread( magic, 1, 2, file );
+  if ( is_gzip( magic, n ) ) {
+    fclose( file );
+    file = NULL;
+    return map( filename );
+  }
+  rewind( file );
+
+  buffer.resize( kXMLChunkSize );
+  input = &buffer[0];
+  return true;
+}
+
+bool XMLStream::map( const char* filename ) {
+
+  close();
+
+#ifndef _WIN32
+
+  int fd = ::open( filename, O_RDONLY );
+  if ( fd < 0 ) return false;
+
+  struct stat st;
+  if ( fstat( fd, &st ) || !S_ISREG( st.st_mode ) ) {
+    ::close( fd );
+    return false;
+  }
+
+  // the mapping stays valid after the descriptor is closed
+  if ( st.st_size > 0 ) {
+    mapping = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if ( mapping == MAP_FAILED ) {
+      mapping = NULL;
+      ::close( fd );
+      return false;
+    }
+    mapping_size = st.st_size;
+    madvise( mapping, mapping_size, MADV_SEQUENTIAL );
+  }
+  ::close( fd );
+
+  input = (const char*) mapping;
+  end = mapping_size;
+
+  if ( is_gzip( (const unsigned char*) mapping, mapping_size ) ) {
+    return inflate_input( (const unsigned char*) mapping, mapping_size );
+  }
+
+#else
+
+  // no mmap, read the whole file with a single copy
+  FILE* f = fopen( filename, "rb" );
+  if ( !f ) return false;
+  fseek( f, 0, SEEK_END );
+  long size = ftell( f );
+  fseek( f, 0, SEEK_SET );
+  buffer.resize( size > 0 ? size : 1 );
+  end = size > 0 ? fread( &buffer[0], 1, size, f ) : 0;
+  fclose( f );
+  input = &buffer[0];
+
+  if ( is_gzip( (const unsigned char*) &buffer[0], end ) ) {
+    compressed.swap( buffer );
+    return inflate_input( (const unsigned char*) &compressed[0], end );
+  }
+
+#endif
+
+  eof = true;
+  return true;
+}
+
+bool XMLStream::attach( const char* data, size_t size ) {
+
+  close();
+
+  input = data;
+  end = size;
+
+  if ( is_gzip( (const unsigned char*) data, size ) ) {
+    return inflate_input( (const unsigned char*) data, size );
+  }
+
+  eof = true;
+  return true;
+}
+
+void XMLStream::close( void ) {
+
+  if ( file ) fclose( file );
+  file = NULL;
+
+  delete inflater;
+  inflater = NULL;
+  vector<char>().swap( compressed );
+
+#ifndef _WIN32
+  if ( mapping ) munmap( mapping, mapping_size );
+#endif
+  mapping = NULL; mapping_size = 0;
+
+  vector<char>().swap( buffer );
+  input = NULL;
+  pos = end = scan = consumed = 0;
+  quote = 0; depth = 0;
+  eof = closing = false;
+  tag = StringView();
+  attributes.clear();
+  decoded.clear();
+  message = NULL;
+}
+
+bool XMLStream::inflate_input( const unsigned char* data, size_t size ) {
+
+  inflater = new InflateStream();
+  if ( inflater->open( data, size, kInflateGzip ) ) {
+    close();
+    return false;
+  }
+
+  buffer.resize( kXMLChunkSize );
+  input = &buffer[0];
+  end = 0;
+  return true;
+}
+
+bool XMLStream::fill( void ) {
+
+  if ( ( !file && !inflater ) || eof ) return false;
+
+  // drop what has been tokenized already
+  if ( pos > 0 ) {
+    memmove( &buffer[0], &buffer[pos], end - pos );
+    consumed += pos;
+    end -= pos;
+    pos = 0;
+  }
+
+  // make room for a full chunk, the buffer only grows past the chunk
+  // size for markup that does not fit in one
+  if ( buffer.size() < end + kXMLChunkSize ) {
+    buffer.resize( end + kXMLChunkSize );
+  }
+
+  input = &buffer[0];
+
+  size_t n = 0;
+  if ( inflater ) {
+    // several reads to fill the chunk, each returns at most a step
+    size_t room = buffer.size() - end, read;
+    while ( n < room && ( read = inflater->read(
+              (unsigned char*) &buffer[end + n], room - n ) ) ) {
+      n += read;
+    }
+    if ( inflater->error() ) message = "corrupt compressed data";
+  } else {
+    n = fread( &buffer[end], 1, buffer.size() - end, file );
+  }
+  if ( n == 0 ) {
+    eof = true;
+    return false;
+  }
+
+  end += n;
+  return true;
+}
+
+bool XMLStream::find_markup_end( size_t& markup_end ) {
+
+  const char* p = input + pos;
+  size_t avail = end - pos;
+
+  // comments, CDATA sections and processing instructions end with a fixed
+  // terminator, everything else at the first '>' outside quotes/brackets
+  const char* terminator = NULL; size_t skip = 1;
+  if ( avail < 2 ) return false;
+  if ( p[1] == '?' ) {
+    terminator = "?>"; skip = 2;
+  } else if ( p[1] == '!' ) {
+    if ( avail < 4 ) return false;
+    if ( p[2] == '-' && p[3] == '-' ) {
+      terminator = "-->"; skip = 4;
+    } else if ( p[2] == '[' ) {
+      if ( avail < 9 ) return false;
+      if ( !strncmp( p, "<![CDATA[", 9 ) ) {
+        terminator = "]]>"; skip = 9;
+      }
+    }
+  }
+
+  size_t i = scan > skip ? scan : skip;
+
+  if ( terminator ) {
+    size_t len = strlen( terminator );
+    for ( ; i + len <= avail; ++i ) {
+      if ( p[i] == terminator[0] && !strncmp( p + i, terminator, len ) ) {
+        markup_end = pos + i + len;
+        return true;
+      }
+    }
+    scan = i;
+    return false;
+  }
+
+  for ( ; i < avail; ++i ) {
+    char c = p[i];
+    if ( quote ) {
+      if ( c == quote ) quote = 0;
+    } else if ( c == '"' || c == '\'' ) {
+      quote = c;
+    } else if ( c == '[' ) {
+      depth++;
+    } else if ( c == ']' ) {
+      depth--;
+    } else if ( c == '>' && depth <= 0 ) {
+      markup_end = pos + i + 1;
+      return true;
+    }
+  }
+
+  scan = i;
+  return false;
+}
+
+XMLToken XMLStream::parse_tag( size_t first, size_t last ) {
+
+  const char* s = input + first + 1;
+  const char* e = input + last - 1;   // '>'
+
+  // end tag
+  if ( *s == '/' ) {
+    const char* n = ++s;
+    while ( s < e && !is_space( *s ) ) s++;
+    tag = StringView( n, s );
+    return XML_END;
+  }
+
+  // self-closing tag
+  const char* t = e;
+  while ( t > s && is_space( t[-1] ) ) t--;
+  if ( t > s && t[-1] == '/' ) {
+    closing = true;
+    e = t - 1;
+  }
+
+  const char* n = s;
+  while ( s < e && !is_space( *s ) ) s++;
+  if ( s == n ) {
+    message = "missing tag name";
+    return XML_ERROR;
+  }
+  tag = StringView( n, s );
+
+  // attributes
+  size_t references = 0;
+  while ( true ) {
+
+    while ( s < e && is_space( *s ) ) s++;
+    if ( s >= e ) break;
+
+    const char* attribute = s;
+    while ( s < e && *s != '=' && !is_space( *s ) ) s++;
+    const char* attribute_end = s;
+
+    while ( s < e && is_space( *s ) ) s++;
+    if ( s >= e || *s != '=' ) {
+      message = "attribute without value";
+      return XML_ERROR;
+    }
+    s++;
+
+    while ( s < e && is_space( *s ) ) s++;
+    if ( s >= e || ( *s != '"' && *s != '\'' ) ) {
+      message = "unquoted attribute value";
+      return XML_ERROR;
+    }
+
+    char q = *s++;
+    const char* value = s;
+    const char* value_end = (const char*) memchr( s, q, e - s );
+    if ( !value_end ) {
+      message = "unterminated attribute value";
+      return XML_ERROR;
+    }
+
+    if ( memchr( value, '&', value_end - value ) ) {
+      references += value_end - value;
+    }
+
+    attributes.push_back( StringView( attribute, attribute_end ) );
+    attributes.push_back( StringView( value, value_end ) );
+
+    s = value_end + 1;
+  }
+
+  // decode values with references, sized up front so views stay valid
+  if ( references ) {
+    decoded.resize( references );
+    char* out = &decoded[0];
+    for ( size_t i = 1; i < attributes.size(); i += 2 ) {
+      StringView& v = attributes[i];
+      if ( !memchr( v.begin(), '&', v.size() ) ) continue;
+      char* start = out;
+      out = decode_entities( v.begin(), v.end(), out );
+      v = StringView( start, out );
+    }
+  }
+
+  return XML_START;
+}
+
+XMLToken XMLStream::next( void ) {
+
+  // close a self-closing tag, name still points at it
+  if ( closing ) {
+    closing = false;
+    attributes.clear();
+    return XML_END;
+  }
+
+  attributes.clear();
+
+  while ( true ) {
+
+    // skip text up to the next markup
+    const char* lt = pos < end ?
+      (const char*) memchr( input + pos, '<', end - pos ) : NULL;
+    if ( !lt ) {
+      pos = end;
+      if ( !fill() ) return message ? XML_ERROR : XML_DONE;
+      continue;
+    }
+    pos = lt - input;
+
+    size_t markup_end;
+    while ( !find_markup_end( markup_end ) ) {
+      if ( !fill() ) {
+        if ( !message ) message = "unexpected end of file";
+        return XML_ERROR;
+      }
+    }
+
+    size_t first = pos;
+    pos = markup_end;
+    scan = 0; quote = 0; depth = 0;
+
+    // comments, CDATA, doctype and processing instructions
+    char c = input[first + 1];
+    if ( c == '!' || c == '?' ) continue;
+
+    return parse_tag( first, markup_end );
+  }
+}
+
+StringView XMLStream::attribute( const char* attribute ) const {
+
+  for ( size_t i = 0; i < attributes.size(); i += 2 ) {
+    if ( attributes[i] == attribute ) return attributes[i + 1];
+  }
+  return StringView();
+}
+
+} // namespace CMU462
@@ -0,0 +1,128 @@
+#ifndef CMU462_XML_STREAM_H
+#define CMU462_XML_STREAM_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "string_view.h"
+
+namespace CMU462 {
+
+// bytes read from the file at a time
+static const size_t kXMLChunkSize = 1 << 20;
+
+typedef enum e_XMLToken {
+  XML_START = 0,   // start tag, self-closing tags are followed by XML_END
+  XML_END,         // end tag
+  XML_DONE,        // end of input
+  XML_ERROR        // malformed input
+} XMLToken;
+
+/**
+ * Pull tokenizer for XML documents. Only element tags are reported; text,
+ * comments, processing instructions and doctype declarations are skipped.
+ *
+ * Input is either a file mapped into memory as a whole, which tokenizes
+ * the mapped bytes without copying them, or a file read in chunks, which
+ * bounds memory use by the chunk size and the largest single tag, or a
+ * document already in memory, tokenized in place like a mapping.
+ *
+ * gzip compressed files (.svgz) are recognized by their header whichever
+ * way they are opened. The compressed file is mapped and inflated into
+ * the chunk buffer as tokenizing goes, the decompressed document is
+ * never held in memory as a whole.
+ *
+ * Names and attribute values are views into the input, so they are only
+ * valid until the next call to next(). Attribute values that contain
+ * entity or character references are decoded into a scratch buffer.
+ */
+class InflateStream;
+
+class XMLStream {
+ public:
+
+  XMLStream() : file( NULL ), inflater( NULL ), input( NULL ),
+                mapping( NULL ), mapping_size( 0 ), pos( 0 ), end( 0 ),
+                scan( 0 ), quote( 0 ), depth( 0 ), consumed( 0 ), eof( false ),
+                closing( false ), message( NULL ) { }
+
+  ~XMLStream() { close(); }
+
+  // read a file in chunks, returns false if it cannot be opened
+  bool open( const char* filename );
+
+  // map a whole file into memory, returns false if it cannot be mapped
+  bool map( const char* filename );
+
+  // tokenize size bytes at data, which must stay valid until close
+  bool attach( const char* data, size_t size );
+
+  // release the file, mapping and buffers
+  void close( void );
+
+  // advance to the next start or end tag
+  XMLToken next( void );
+
+  // name of the current tag
+  StringView name( void ) const { return tag; }
+
+  // value of an attribute of the current start tag, invalid if absent
+  StringView attribute( const char* attribute ) const;
+
+  // bytes of input tokenized so far
+  size_t bytes( void ) const { return consumed + pos; }
+
+  // description of the last XML_ERROR
+  const char* error( void ) const { return message; }
+
+ private:
+
+  // read more input, moving unread bytes to the front of the buffer.
+  // Returns false at the end of the input
+  bool fill( void );
+
+  // read chunks by inflating gzip data
+  bool inflate_input( const unsigned char* data, size_t size );
+
+  // find the end of the markup starting at pos (pointing at '<'). On
+  // success stores the offset one past it in markup_end
+  bool find_markup_end( size_t& markup_end );
+
+  // tokenize the tag in [first, last)
+  XMLToken parse_tag( size_t first, size_t last );
+
+  // chunked input, from the file or inflated from compressed data
+  FILE* file;
+  InflateStream* inflater;
+  std::vector<char> buffer;
+  std::vector<char> compressed;   // without a mapping
+
+  // bytes being tokenized, the chunk buffer or the mapping
+  const char* input;
+  void* mapping; size_t mapping_size;
+
+  // unread input is [pos, end). scan, quote and depth keep the progress
+  // of an unfinished markup search across reads
+  size_t pos, end, scan; char quote; int depth;
+
+  // bytes dropped from the front of the buffer
+  size_t consumed;
+
+  bool eof;
+
+  // the last start tag was self-closing and still owes an XML_END
+  bool closing;
+
+  // current tag
+  StringView tag;
+  std::vector<StringView> attributes;   // name, value pairs
+  std::string decoded;                  // values with references replaced
+
+  const char* message;
+
+}; // class XMLStream
+
+} // namespace CMU462
+
+#endif // CMU462_XML_STREAM_H